@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "rkadk_common.h"
+#include "rkadk_media_comm.h"
+#include "rkadk_log.h"
+#include "rkadk_param.h"
+#include "rkadk_record.h"
+#include "isp/sample_isp.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern int optind;
+extern char *optarg;
+
+static RKADK_CHAR optstr[] = "a:I:p:t:r:h";
+
+#define IQ_FILE_PATH "/etc/iqfiles"
+
+static RKADK_CHAR g_fileName[RKADK_MAX_FILE_PATH_LEN];
+static RKADK_U32 g_u32EndDuration = 0; // ms
+
+static void print_usage(const RKADK_CHAR *name) {
+  printf("usage example:\n");
+  printf("\t%s [-a /etc/iqfiles] [-I 0] [-t 5] [-r 10]\n", name);
+  printf("\t-a: enable aiq with dirpath provided, eg:-a "
+         "/oem/etc/iqfiles/, Default /etc/iqfiles,"
+         "without this option aiq should run in other application\n");
+  printf("\t-I: Camera id, Default:0\n");
+  printf("\t-p: param ini directory path, Default:/data/rkadk\n");
+  printf("\t-t: pre record time(s), Default:5\n");
+  printf("\t-r: record time(s) after start, Default:10\n");
+}
+
+static RKADK_S32
+GetRecordFileName(RKADK_MW_PTR pRecorder, RKADK_U32 u32FileCnt,
+                  RKADK_CHAR (*paszFilename)[RKADK_MAX_FILE_PATH_LEN]) {
+  static RKADK_U32 u32FileIdx = 0;
+
+  for (RKADK_U32 i = 0; i < u32FileCnt; i++) {
+    sprintf(paszFilename[i], "/mnt/sdcard/PreRecTest_%u.mp4", u32FileIdx);
+    u32FileIdx++;
+  }
+
+  // the first file of the main stream carries the pre-record frames
+  if (!g_fileName[0])
+    snprintf(g_fileName, RKADK_MAX_FILE_PATH_LEN, "%s", paszFilename[0]);
+
+  return 0;
+}
+
+static RKADK_VOID
+RecordEventCallback(RKADK_MW_PTR pRecorder,
+                    const RKADK_MUXER_EVENT_INFO_S *pstEventInfo) {
+  if (pstEventInfo->enEvent != RKADK_MUXER_EVENT_FILE_END)
+    return;
+
+  printf("file end: %s, u32Duration: %d\n",
+         pstEventInfo->unEventInfo.stFileInfo.asFileName,
+         pstEventInfo->unEventInfo.stFileInfo.u32Duration);
+  if (!strcmp(pstEventInfo->unEventInfo.stFileInfo.asFileName, g_fileName))
+    g_u32EndDuration = pstEventInfo->unEventInfo.stFileInfo.u32Duration;
+}
+
+static uint64_t read_be(const unsigned char *p, int len) {
+  uint64_t value = 0;
+
+  for (int i = 0; i < len; i++)
+    value = (value << 8) | p[i];
+
+  return value;
+}
+
+/* movie duration in ms from moov/mvhd, -1 if the file has none */
+static int64_t mp4_duration_ms(const RKADK_CHAR *path) {
+  FILE *fp;
+  unsigned char head[16], mvhd[32];
+  uint64_t size, timescale, duration;
+  int64_t s64Ret = -1;
+  long pos = 0;
+
+  fp = fopen(path, "rb");
+  if (!fp) {
+    RKADK_LOGE("open %s failed", path);
+    return -1;
+  }
+
+  while (fseek(fp, pos, SEEK_SET) == 0 && fread(head, 1, 8, fp) == 8) {
+    size = read_be(head, 4);
+    if (size == 1) {
+      if (fread(head + 8, 1, 8, fp) != 8)
+        break;
+      size = read_be(head + 8, 8);
+    }
+
+    if (!memcmp(head + 4, "moov", 4)) {
+      // mvhd is the first box of moov
+      if (fread(mvhd, 1, 8, fp) != 8 || memcmp(mvhd + 4, "mvhd", 4) ||
+          fread(mvhd, 1, 32, fp) != 32)
+        break;
+
+      if (mvhd[0] == 1) {
+        timescale = read_be(mvhd + 20, 4);
+        duration = read_be(mvhd + 24, 8);
+      } else {
+        timescale = read_be(mvhd + 12, 4);
+        duration = read_be(mvhd + 16, 4);
+      }
+
+      if (timescale)
+        s64Ret = (int64_t)(duration * 1000 / timescale);
+      break;
+    }
+
+    if (size < 8)
+      break;
+    pos += (long)size;
+  }
+
+  fclose(fp);
+  return s64Ret;
+}
+
+static int check(const RKADK_CHAR *name, bool bPass) {
+  printf("%-40s %s\n", name, bPass ? "PASS" : "FAIL");
+  return bPass ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  int c, fail = 0;
+  int64_t s64Duration;
+  RKADK_U32 u32PreRecTime = 5, u32RecordTime = 10;
+  RKADK_U32 u32ExpectMs;
+  RKADK_RECORD_ATTR_S stRecAttr;
+  RKADK_MW_PTR pRecorder = NULL;
+  RKADK_MUXER_PRE_RECORD_MODE_E enPreRecMode = RKADK_MUXER_PRE_RECORD_SINGLE;
+  RKADK_PARAM_REC_TIME_S stRecTime;
+  const char *iniPath = NULL;
+  char path[RKADK_PATH_LEN];
+  char sensorPath[RKADK_MAX_SENSOR_CNT][RKADK_PATH_LEN];
+  RKADK_S32 s32CamId = 0;
+
+#ifdef RKAIQ
+  RKADK_PARAM_FPS_S stFps;
+  RKADK_CHAR *pIqfilesPath = IQ_FILE_PATH;
+  rk_aiq_working_mode_t hdr_mode = RK_AIQ_WORKING_MODE_NORMAL;
+  const char *tmp_optarg = optarg;
+#endif
+
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+#ifdef RKAIQ
+    case 'a':
+      if (!optarg && NULL != argv[optind] && '-' != argv[optind][0]) {
+        tmp_optarg = argv[optind++];
+      }
+
+      if (tmp_optarg)
+        pIqfilesPath = (char *)tmp_optarg;
+      break;
+#endif
+    case 'I':
+      s32CamId = atoi(optarg);
+      break;
+    case 'p':
+      iniPath = optarg;
+      RKADK_LOGD("iniPath: %s", iniPath);
+      break;
+    case 't':
+      u32PreRecTime = atoi(optarg);
+      break;
+    case 'r':
+      u32RecordTime = atoi(optarg);
+      break;
+    case 'h':
+    default:
+      print_usage(argv[0]);
+      optind = 0;
+      return -1;
+    }
+  }
+  optind = 0;
+
+  if (!u32PreRecTime || !u32RecordTime) {
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  RKADK_MPI_SYS_Init();
+
+  if (iniPath) {
+    memset(path, 0, RKADK_PATH_LEN);
+    memset(sensorPath, 0, RKADK_MAX_SENSOR_CNT * RKADK_PATH_LEN);
+    sprintf(path, "%s/rkadk_setting.ini", iniPath);
+    for (int i = 0; i < RKADK_MAX_SENSOR_CNT; i++)
+      sprintf(sensorPath[i], "%s/rkadk_setting_sensor_%d.ini", iniPath, i);
+
+    char *sPath[] = {sensorPath[0], sensorPath[1], NULL};
+
+    RKADK_PARAM_Init(path, sPath);
+  } else {
+    RKADK_PARAM_Init(NULL, NULL);
+  }
+
+  // one file for the whole run, pre-recorded at its start
+  RKADK_PARAM_SetCamParam(s32CamId, RKADK_PARAM_TYPE_PRE_RECORD_TIME, &u32PreRecTime);
+  RKADK_PARAM_SetCamParam(s32CamId, RKADK_PARAM_TYPE_PRE_RECORD_MODE, &enPreRecMode);
+  stRecTime.enStreamType = RKADK_STREAM_TYPE_VIDEO_MAIN;
+  stRecTime.time = u32PreRecTime + u32RecordTime + 60;
+  RKADK_PARAM_SetCamParam(s32CamId, RKADK_PARAM_TYPE_RECORD_TIME, &stRecTime);
+
+#ifdef RKAIQ
+  stFps.enStreamType = RKADK_STREAM_TYPE_SENSOR;
+  if (RKADK_PARAM_GetCamParam(s32CamId, RKADK_PARAM_TYPE_FPS, &stFps)) {
+    RKADK_LOGE("RKADK_PARAM_GetCamParam u32CamId[%d] fps failed", s32CamId);
+    return -1;
+  }
+
+  SAMPLE_ISP_Start(s32CamId, hdr_mode, RK_FALSE, pIqfilesPath, stFps.u32Framerate);
+#endif
+
+  memset(&stRecAttr, 0, sizeof(RKADK_RECORD_ATTR_S));
+  stRecAttr.s32CamID = s32CamId;
+  stRecAttr.pfnRequestFileNames = GetRecordFileName;
+  stRecAttr.pfnEventCallback = RecordEventCallback;
+
+  if (RKADK_RECORD_Create(&stRecAttr, &pRecorder)) {
+    RKADK_LOGE("s32CamId[%d] Create recorder failed", s32CamId);
+#ifdef RKAIQ
+    SAMPLE_ISP_Stop(s32CamId);
+#endif
+    return -1;
+  }
+
+  // the encoder runs from create on, fill the pre-record cache first
+  sleep(u32PreRecTime + 2);
+  RKADK_RECORD_Start(pRecorder);
+  sleep(u32RecordTime);
+  RKADK_RECORD_Stop(pRecorder);
+  RKADK_RECORD_Destroy(pRecorder);
+
+#ifdef RKAIQ
+  SAMPLE_ISP_Stop(s32CamId);
+#endif
+  RKADK_MPI_SYS_Exit();
+
+  // the cache is cut at a key frame, allow one second short of the full time
+  u32ExpectMs = (u32PreRecTime + u32RecordTime - 1) * 1000;
+  s64Duration = mp4_duration_ms(g_fileName);
+  printf("%s: %lld ms, expect >= %u ms\n", g_fileName, (long long)s64Duration,
+         u32ExpectMs);
+
+  fail += check("file is written", s64Duration >= 0);
+  fail += check("file holds the pre-record frames", s64Duration >= u32ExpectMs);
+  fail += check("file end reports the pre-record frames",
+                g_u32EndDuration >= u32ExpectMs);
+
+  printf("%s: %d failed\n", g_fileName, fail);
+  return fail ? -1 : 0;
+}
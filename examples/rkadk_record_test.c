@@ -102,6 +102,11 @@ RecordEventCallback(RKADK_MW_PTR pRecorder,
   case RKADK_MUXER_EVENT_ERR_WRITE_FILE_FAIL:
     printf("+++++ RKADK_MUXER_EVENT_ERR_WRITE_FILE_FAIL +++++\n");
     break;
+  case RKADK_MUXER_EVENT_FMP4_FALLBACK:
+    printf("+++++ RKADK_MUXER_EVENT_FMP4_FALLBACK +++++\n");
+    printf("\tstFileInfo: %s\n",
+           pstEventInfo->unEventInfo.stFileInfo.asFileName);
+    break;
   default:
     printf("+++++ Unknown event(%d) +++++\n", pstEventInfo->enEvent);
     break;
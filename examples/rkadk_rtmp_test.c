@@ -34,7 +34,7 @@ extern char *optarg;
 #define IQ_FILE_PATH "/etc/iqfiles"
 
 static bool is_quit = false;
-static RKADK_CHAR optstr[] = "a:I:p:h";
+static RKADK_CHAR optstr[] = "a:I:p:u:h";
 
 static void print_usage(const RKADK_CHAR *name) {
   printf("usage example:\n");
@@ -44,6 +44,7 @@ static void print_usage(const RKADK_CHAR *name) {
          "without this option aiq should run in other application\n");
   printf("\t-I: Camera id, Default:0\n");
   printf("\t-p: param ini directory path, Default:/data/rkadk\n");
+  printf("\t-u: rtmp url, Default:rtmp://127.0.0.1:1935/live/substream\n");
 }
 
 static void sigterm_handler(int sig) {
@@ -56,6 +57,8 @@ int main(int argc, char *argv[]) {
   RKADK_U32 u32CamId = 0;
   RKADK_MW_PTR pHandle = NULL;
   const char *iniPath = NULL;
+  const char *url = "rtmp://127.0.0.1:1935/live/substream";
+  RKADK_RTMP_STATS_S stStats;
   char path[RKADK_PATH_LEN];
   char sensorPath[RKADK_MAX_SENSOR_CNT][RKADK_PATH_LEN];
 
@@ -84,6 +87,9 @@ int main(int argc, char *argv[]) {
       iniPath = optarg;
       RKADK_LOGD("iniPath: %s", iniPath);
       break;
+    case 'u':
+      url = optarg;
+      break;
     case 'h':
     default:
       print_usage(argv[0]);
@@ -129,8 +135,7 @@ int main(int argc, char *argv[]) {
   SAMPLE_ISP_Start(u32CamId, hdr_mode, fec_enable, pIqfilesPath, stFps.u32Framerate);
 #endif
 
-  ret = RKADK_RTMP_Init(u32CamId, "rtmp://127.0.0.1:1935/live/substream",
-                        &pHandle);
+  ret = RKADK_RTMP_Init(u32CamId, url, &pHandle);
   if (ret) {
     RKADK_LOGE("RKADK_RTMP_Init failed(%d)", ret);
 #ifdef RKAIQ
@@ -142,12 +147,28 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, sigterm_handler);
   char cmd[64];
   printf("\n#Usage: input 'quit' to exit programe!\n"
+         "input 'stats' to print the rtmp sender stats\n"
          "peress any other key to quit\n");
   while (!is_quit) {
     fgets(cmd, sizeof(cmd), stdin);
     if (strstr(cmd, "quit") || is_quit) {
       RKADK_LOGD("#Get 'quit' cmd!");
       break;
+    } else if (strstr(cmd, "stats")) {
+      memset(&stStats, 0, sizeof(stStats));
+      RKADK_RTMP_GetStats(pHandle, &stStats);
+      printf("connected: %d, connect: %d, connect failed: %d\n",
+             stStats.bConnected, stStats.u32ConnectCnt, stStats.u32ConnectFailCnt);
+      printf("queue: %d/%d bytes, hwm: %d, max send: %d us, sent: %lld bytes\n",
+             stStats.u32QueueBytes, stStats.u32QueueSize, stStats.u32QueueHwm,
+             stStats.u32MaxSendUs, stStats.u64SendBytes);
+      printf("drop video: %d, drop audio: %d\n", stStats.u32VideoDropCnt,
+             stStats.u32AudioDropCnt);
+      printf("bitrate: %d, fps: %d, abr down: %d, abr up: %d\n",
+             stStats.u32Bitrate, stStats.u32Framerate, stStats.u32AbrDownCnt,
+             stStats.u32AbrUpCnt);
+      printf("latency: %d us, max latency: %d us\n", stStats.u32LatencyUs,
+             stStats.u32MaxLatencyUs);
     }
 
     usleep(500000);
@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "rkadk_common.h"
+#include "rkadk_log.h"
+#include "rkadk_storage_catalog.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern int optind;
+extern char *optarg;
+
+#define FILE_SIZE (64 * 1024 * 1024)
+
+static RKADK_CHAR optstr[] = "n:m:lh";
+
+/* the sorted singly linked list the storage folders used before the catalog */
+typedef struct LIST_FILE {
+  struct LIST_FILE *next;
+  RKADK_CHAR filename[RKADK_MAX_FILE_PATH_LEN];
+  time_t stTime;
+  off_t stSize;
+  off_t stSpace;
+} LIST_FILE_S;
+
+typedef struct {
+  LIST_FILE_S *first;
+  LIST_FILE_S *last;
+  RKADK_S32 s32FileNum;
+  off_t totalSize;
+  off_t totalSpace;
+} LIST_S;
+
+typedef struct {
+  RKADK_U64 u64FillUs;
+  RKADK_U64 u64NewUs;
+  RKADK_U64 u64LookupUs;
+  RKADK_U64 u64DelOldestUs;
+  RKADK_U64 u64DelRandomUs;
+} BENCH_RESULT_S;
+
+static void print_usage(const RKADK_CHAR *name) {
+  printf("usage example:\n");
+  printf("\t%s [-n 10000] [-m 1000] [-l]\n", name);
+  printf("\t-n: files in the folder, Default: 1000, 10000 and 100000\n");
+  printf("\t-m: operations timed per test, Default:1000\n");
+  printf("\t-l: also run the sorted linked list, to compare\n");
+}
+
+static RKADK_U64 get_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (RKADK_U64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void file_name(RKADK_CHAR *name, RKADK_U32 i) {
+  snprintf(name, RKADK_MAX_FILE_PATH_LEN, "%08d_%06d_A.mp4", 20221016 + i / 86400,
+           i % 86400);
+}
+
+static bool list_check(LIST_S *list, const RKADK_CHAR *filename) {
+  LIST_FILE_S *tmp;
+
+  for (tmp = list->first; tmp; tmp = tmp->next)
+    if (!strcmp(tmp->filename, filename))
+      return true;
+
+  return false;
+}
+
+static int list_add(LIST_S *list, const RKADK_CHAR *filename, time_t stTime) {
+  LIST_FILE_S *tmp, *file;
+
+  file = (LIST_FILE_S *)malloc(sizeof(LIST_FILE_S));
+  if (!file)
+    return -1;
+
+  snprintf(file->filename, RKADK_MAX_FILE_PATH_LEN, "%s", filename);
+  file->stTime = stTime;
+  file->stSize = FILE_SIZE;
+  file->stSpace = FILE_SIZE;
+  file->next = NULL;
+
+  if (!list->first) {
+    list->first = list->last = file;
+  } else if (file->stTime >= list->first->stTime) {
+    file->next = list->first;
+    list->first = file;
+  } else {
+    for (tmp = list->first; tmp->next; tmp = tmp->next) {
+      if (file->stTime >= tmp->next->stTime)
+        break;
+    }
+    file->next = tmp->next;
+    tmp->next = file;
+    if (!file->next)
+      list->last = file;
+  }
+
+  list->totalSize += file->stSize;
+  list->totalSpace += file->stSpace;
+  list->s32FileNum++;
+  return 0;
+}
+
+// unlink and recount the totals in one pass, like the old FileListDel
+static void list_del(LIST_S *list, const RKADK_CHAR *filename) {
+  LIST_FILE_S **link = &list->first, *tmp;
+
+  list->s32FileNum = 0;
+  list->totalSize = 0;
+  list->totalSpace = 0;
+  list->last = NULL;
+  while ((tmp = *link)) {
+    if (!strcmp(tmp->filename, filename)) {
+      *link = tmp->next;
+      free(tmp);
+      continue;
+    }
+
+    list->s32FileNum++;
+    list->totalSize += tmp->stSize;
+    list->totalSpace += tmp->stSpace;
+    list->last = tmp;
+    link = &tmp->next;
+  }
+}
+
+static void list_free(LIST_S *list) {
+  LIST_FILE_S *tmp;
+
+  while ((tmp = list->first)) {
+    list->first = tmp->next;
+    free(tmp);
+  }
+  memset(list, 0, sizeof(LIST_S));
+}
+
+static int catalog_verify(RKADK_CATALOG_S *pstCatalog) {
+  RKADK_S32 s32FileNum = 0;
+  off_t totalSize = 0;
+  RKADK_CATALOG_FILE_S *pstFile, *pstPrev = NULL;
+
+  for (pstFile = RKADK_CATALOG_First(pstCatalog); pstFile;
+       pstFile = RKADK_CATALOG_Next(pstFile)) {
+    if (pstPrev && pstPrev->stTime < pstFile->stTime) {
+      RKADK_LOGE("%s is listed before the newer %s", pstPrev->filename,
+                 pstFile->filename);
+      return -1;
+    }
+
+    if (RKADK_CATALOG_Prev(pstFile) != pstPrev ||
+        RKADK_CATALOG_Find(pstCatalog, pstFile->filename) != pstFile) {
+      RKADK_LOGE("%s is not linked correctly", pstFile->filename);
+      return -1;
+    }
+
+    s32FileNum++;
+    totalSize += pstFile->stSize;
+    pstPrev = pstFile;
+  }
+
+  if (pstPrev != RKADK_CATALOG_Last(pstCatalog) ||
+      s32FileNum != pstCatalog->s32FileNum ||
+      totalSize != pstCatalog->totalSize) {
+    RKADK_LOGE("count %d/%d, total size %lld/%lld mismatch", s32FileNum,
+               pstCatalog->s32FileNum, (long long)totalSize,
+               (long long)pstCatalog->totalSize);
+    return -1;
+  }
+
+  return 0;
+}
+
+static RKADK_U32 *shuffle(RKADK_U32 u32Cnt) {
+  RKADK_U32 i, j, tmp;
+  RKADK_U32 *order = (RKADK_U32 *)malloc(u32Cnt * sizeof(RKADK_U32));
+
+  if (!order)
+    return NULL;
+
+  for (i = 0; i < u32Cnt; i++)
+    order[i] = i;
+  for (i = u32Cnt - 1; i > 0; i--) {
+    j = rand() % (i + 1);
+    tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  return order;
+}
+
+/*
+ * Fill a folder with u32FileNum files, then time u32OpCnt of each operation
+ * the storage manager does at steady state: a new recording is closed (check
+ * and add), a lookup, the oldest file is auto-deleted, a random file is deleted
+ * by the user (and put back so that the folder size stays the same).
+ */
+static int bench_catalog(RKADK_U32 u32FileNum, RKADK_U32 u32OpCnt,
+                         BENCH_RESULT_S *pstResult) {
+  int ret = -1;
+  RKADK_U32 i, u32Next = u32FileNum;
+  RKADK_U64 u64Start;
+  RKADK_U32 *order;
+  RKADK_CHAR name[RKADK_MAX_FILE_PATH_LEN];
+  RKADK_CATALOG_S stCatalog;
+
+  order = shuffle(u32FileNum);
+  if (!order || RKADK_CATALOG_Init(&stCatalog)) {
+    free(order);
+    return -1;
+  }
+
+  // mount time scan: the directory order is not the time order
+  u64Start = get_us();
+  for (i = 0; i < u32FileNum; i++) {
+    file_name(name, order[i]);
+    if (RKADK_CATALOG_Add(&stCatalog, name, order[i], FILE_SIZE, FILE_SIZE))
+      goto exit;
+  }
+  pstResult->u64FillUs = get_us() - u64Start;
+
+  if (catalog_verify(&stCatalog))
+    goto exit;
+
+  u64Start = get_us();
+  for (i = 0; i < u32OpCnt; i++) {
+    file_name(name, u32Next);
+    if (!RKADK_CATALOG_Find(&stCatalog, name))
+      RKADK_CATALOG_Add(&stCatalog, name, u32Next, FILE_SIZE, FILE_SIZE);
+    u32Next++;
+  }
+  pstResult->u64NewUs = get_us() - u64Start;
+
+  u64Start = get_us();
+  for (i = 0; i < u32OpCnt; i++) {
+    file_name(name, u32Next - 1 - order[i % u32FileNum]);
+    if (!RKADK_CATALOG_Find(&stCatalog, name)) {
+      RKADK_LOGE("%s not found", name);
+      goto exit;
+    }
+  }
+  pstResult->u64LookupUs = get_us() - u64Start;
+
+  u64Start = get_us();
+  for (i = 0; i < u32OpCnt; i++) {
+    snprintf(name, RKADK_MAX_FILE_PATH_LEN, "%s",
+             RKADK_CATALOG_Last(&stCatalog)->filename);
+    RKADK_CATALOG_Del(&stCatalog, name);
+  }
+  pstResult->u64DelOldestUs = get_us() - u64Start;
+
+  u64Start = get_us();
+  for (i = 0; i < u32OpCnt; i++) {
+    RKADK_U32 u32Index = u32Next - 1 - order[i % u32FileNum];
+
+    file_name(name, u32Index);
+    RKADK_CATALOG_Del(&stCatalog, name);
+    RKADK_CATALOG_Add(&stCatalog, name, u32Index, FILE_SIZE, FILE_SIZE);
+  }
+  pstResult->u64DelRandomUs = get_us() - u64Start;
+
+  if (catalog_verify(&stCatalog) ||
+      stCatalog.s32FileNum != (RKADK_S32)u32FileNum)
+    goto exit;
+
+  ret = 0;
+exit:
+  RKADK_CATALOG_Deinit(&stCatalog);
+  free(order);
+  return ret;
+}
+
+static int bench_list(RKADK_U32 u32FileNum, RKADK_U32 u32OpCnt,
+                      BENCH_RESULT_S *pstResult) {
+  RKADK_U32 i, u32Next = u32FileNum;
+  RKADK_U64 u64Start;
+  RKADK_U32 *order;
+  RKADK_CHAR name[RKADK_MAX_FILE_PATH_LEN];
+  LIST_S stList;
+
+  order = shuffle(u32FileNum);
+  if (!order)
+    return -1;
+
+  // the old mount time scan did not check for duplicates
+  memset(&stList, 0, sizeof(stList));
+  u64Start = get_us();
+  for (i = 0; i < u32FileNum; i++) {
+    file_name(name, order[i]);
+    if (list_add(&stList, name, order[i]))
+      break;
+  }
+  pstResult->u64FillUs = get_us() - u64Start;
+
+  u64Start = get_us();
+  for (i = 0; i < u32OpCnt; i++) {
+    file_name(name, u32Next);
+    if (!list_check(&stList, name))
+      list_add(&stList, name, u32Next);
+    u32Next++;
+  }
+  pstResult->u64NewUs = get_us() - u64Start;
+
+  u64Start = get_us();
+  for (i = 0; i < u32OpCnt; i++) {
+    file_name(name, u32Next - 1 - order[i % u32FileNum]);
+    list_check(&stList, name);
+  }
+  pstResult->u64LookupUs = get_us() - u64Start;
+
+  u64Start = get_us();
+  for (i = 0; i < u32OpCnt && stList.last; i++) {
+    snprintf(name, RKADK_MAX_FILE_PATH_LEN, "%s", stList.last->filename);
+    list_del(&stList, name);
+  }
+  pstResult->u64DelOldestUs = get_us() - u64Start;
+
+  u64Start = get_us();
+  for (i = 0; i < u32OpCnt; i++) {
+    RKADK_U32 u32Index = u32Next - 1 - order[i % u32FileNum];
+
+    file_name(name, u32Index);
+    list_del(&stList, name);
+    list_add(&stList, name, u32Index);
+  }
+  pstResult->u64DelRandomUs = get_us() - u64Start;
+
+  list_free(&stList);
+  free(order);
+  return 0;
+}
+
+static void print_result(const RKADK_CHAR *mode, RKADK_U32 u32FileNum,
+                         RKADK_U32 u32OpCnt, BENCH_RESULT_S *pstResult) {
+  printf("%-8s %7d files: scan %8.3f ms, new %7.3f us, lookup %7.3f us, "
+         "del oldest %7.3f us, del random %7.3f us\n",
+         mode, u32FileNum, (double)pstResult->u64FillUs / 1000,
+         (double)pstResult->u64NewUs / u32OpCnt,
+         (double)pstResult->u64LookupUs / u32OpCnt,
+         (double)pstResult->u64DelOldestUs / u32OpCnt,
+         (double)pstResult->u64DelRandomUs / u32OpCnt);
+}
+
+int main(int argc, char *argv[]) {
+  int c, i, s32CntNum = 3;
+  bool bList = false;
+  RKADK_U32 u32FileCnt[3] = {1000, 10000, 100000};
+  RKADK_U32 u32OpCnt = 1000;
+  BENCH_RESULT_S stResult;
+
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'n':
+      u32FileCnt[0] = atoi(optarg);
+      s32CntNum = 1;
+      break;
+    case 'm':
+      u32OpCnt = atoi(optarg);
+      break;
+    case 'l':
+      bList = true;
+      break;
+    case 'h':
+    default:
+      print_usage(argv[0]);
+      optind = 0;
+      return 0;
+    }
+  }
+  optind = 0;
+
+  if (!u32OpCnt || u32OpCnt > u32FileCnt[0]) {
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  srand(time(NULL));
+  for (i = 0; i < s32CntNum; i++) {
+    memset(&stResult, 0, sizeof(stResult));
+    if (bench_catalog(u32FileCnt[i], u32OpCnt, &stResult)) {
+      RKADK_LOGE("catalog bench with %d files failed", u32FileCnt[i]);
+      return -1;
+    }
+    print_result("catalog", u32FileCnt[i], u32OpCnt, &stResult);
+
+    if (bList) {
+      memset(&stResult, 0, sizeof(stResult));
+      if (bench_list(u32FileCnt[i], u32OpCnt, &stResult))
+        return -1;
+      print_result("list", u32FileCnt[i], u32OpCnt, &stResult);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "rkadk_common.h"
+#include "rkadk_log.h"
+#include "rkadk_storage_catalog.h"
+#include "rkadk_storage_journal.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern int optind;
+extern char *optarg;
+
+/* on-card layout, see rkadk_storage_journal.c */
+#define JOURNAL_HEADER_SIZE 16
+#define JOURNAL_RECORD_SIZE 128
+
+static RKADK_CHAR optstr[] = "f:n:h";
+
+static void print_usage(const RKADK_CHAR *name) {
+  printf("usage example:\n");
+  printf("\t%s [-f /tmp/rkadk_journal.cat] [-n 2000]\n", name);
+  printf("\t-f: journal file, removed first, Default:/tmp/rkadk_journal.cat\n");
+  printf("\t-n: files in the catalog, Default:2000\n");
+}
+
+static void file_name(RKADK_CHAR *name, RKADK_U32 i) {
+  snprintf(name, RKADK_MAX_FILE_PATH_LEN, "%08d_%06d_A.mp4", 20221016 + i / 86400,
+           i % 86400);
+}
+
+static void catalog_fill(RKADK_CATALOG_S *pstCatalog, RKADK_JOURNAL_S *pstJournal,
+                         RKADK_U32 u32Start, RKADK_U32 u32Num) {
+  RKADK_CHAR name[RKADK_MAX_FILE_PATH_LEN];
+
+  for (RKADK_U32 i = u32Start; i < u32Start + u32Num; i++) {
+    file_name(name, i);
+    RKADK_CATALOG_Add(pstCatalog, name, i, (off_t)i * 1024, (off_t)i * 1024 + 512);
+    if (pstJournal)
+      RKADK_JOURNAL_Append(pstJournal, pstCatalog, RKADK_JOURNAL_OP_ADD, name);
+  }
+}
+
+static void catalog_del(RKADK_CATALOG_S *pstCatalog, RKADK_JOURNAL_S *pstJournal,
+                        RKADK_U32 u32Start, RKADK_U32 u32Num) {
+  RKADK_CHAR name[RKADK_MAX_FILE_PATH_LEN];
+
+  for (RKADK_U32 i = u32Start; i < u32Start + u32Num; i++) {
+    file_name(name, i);
+    if (!RKADK_CATALOG_Del(pstCatalog, name) && pstJournal)
+      RKADK_JOURNAL_Append(pstJournal, pstCatalog, RKADK_JOURNAL_OP_DEL, name);
+  }
+}
+
+static bool catalog_equal(RKADK_CATALOG_S *pstExpect, RKADK_CATALOG_S *pstCatalog) {
+  RKADK_CATALOG_FILE_S *pstFile, *pstFound;
+
+  if (pstExpect->s32FileNum != pstCatalog->s32FileNum ||
+      pstExpect->totalSize != pstCatalog->totalSize ||
+      pstExpect->totalSpace != pstCatalog->totalSpace) {
+    RKADK_LOGE("%d files, %lld bytes loaded, expect %d files, %lld bytes",
+               pstCatalog->s32FileNum, (long long)pstCatalog->totalSize,
+               pstExpect->s32FileNum, (long long)pstExpect->totalSize);
+    return false;
+  }
+
+  for (pstFile = RKADK_CATALOG_First(pstExpect); pstFile;
+       pstFile = RKADK_CATALOG_Next(pstFile)) {
+    pstFound = RKADK_CATALOG_Find(pstCatalog, pstFile->filename);
+    if (!pstFound || pstFound->stTime != pstFile->stTime ||
+        pstFound->stSize != pstFile->stSize ||
+        pstFound->stSpace != pstFile->stSpace) {
+      RKADK_LOGE("%s is not loaded as recorded", pstFile->filename);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* load the file from scratch and compare with the catalog it records */
+static bool journal_reload(const RKADK_CHAR *path, RKADK_CATALOG_S *pstExpect) {
+  bool bEqual;
+  RKADK_CATALOG_S stCatalog;
+  RKADK_JOURNAL_S stJournal;
+
+  RKADK_CATALOG_Init(&stCatalog);
+  RKADK_JOURNAL_Init(&stJournal, path);
+  bEqual = RKADK_JOURNAL_Load(&stJournal, &stCatalog) == pstExpect->s32FileNum &&
+           catalog_equal(pstExpect, &stCatalog);
+  RKADK_CATALOG_Deinit(&stCatalog);
+  return bEqual;
+}
+
+static bool file_write(const RKADK_CHAR *path, off_t offset, const void *pData,
+                       size_t len) {
+  bool bOk;
+  int fd;
+
+  fd = open(path, O_WRONLY | (offset < 0 ? O_APPEND : 0));
+  if (fd < 0)
+    return false;
+
+  if (offset < 0)
+    bOk = write(fd, pData, len) == (ssize_t)len;
+  else
+    bOk = pwrite(fd, pData, len, offset) == (ssize_t)len;
+  close(fd);
+  return bOk;
+}
+
+static int check(const RKADK_CHAR *name, bool bPass) {
+  printf("%-40s %s\n", name, bPass ? "PASS" : "FAIL");
+  return bPass ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  int c, fail = 0;
+  RKADK_U32 u32FileNum = 2000;
+  const RKADK_CHAR *path = "/tmp/rkadk_journal.cat";
+  RKADK_CATALOG_S stCatalog, stLoad;
+  RKADK_JOURNAL_S stJournal;
+  RKADK_JOURNAL_SNAPSHOT_S stSnap;
+
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case 'n':
+      u32FileNum = atoi(optarg);
+      break;
+    case 'h':
+    default:
+      print_usage(argv[0]);
+      optind = 0;
+      return 0;
+    }
+  }
+  optind = 0;
+
+  if (u32FileNum < 2) {
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  unlink(path);
+  RKADK_CATALOG_Init(&stCatalog);
+  RKADK_CATALOG_Init(&stLoad);
+  RKADK_JOURNAL_Init(&stJournal, path);
+
+  fail += check("load missing file",
+                RKADK_JOURNAL_Load(&stJournal, &stLoad) == -1);
+
+  // nothing valid was loaded, the catalog is written as the first snapshot
+  catalog_fill(&stCatalog, NULL, 0, u32FileNum);
+  fail += check("open writes a snapshot",
+                RKADK_JOURNAL_Open(&stJournal, &stCatalog) == 1 &&
+                    stJournal.u32SnapshotNum == u32FileNum);
+  fail += check("load snapshot", journal_reload(path, &stCatalog));
+
+  catalog_fill(&stCatalog, &stJournal, u32FileNum, u32FileNum / 2);
+  catalog_del(&stCatalog, &stJournal, 0, u32FileNum / 4);
+  // an update of a file is an add record again
+  catalog_fill(&stCatalog, &stJournal, u32FileNum / 2, 1);
+  fail += check("load snapshot and journal", journal_reload(path, &stCatalog));
+  RKADK_JOURNAL_Close(&stJournal);
+
+  // power lost in the middle of an append
+  fail += check("torn append is written",
+                file_write(path, -1, "torn record", 11));
+  fail += check("load drops the torn record", journal_reload(path, &stCatalog));
+
+  RKADK_CATALOG_Deinit(&stLoad);
+  RKADK_CATALOG_Init(&stLoad);
+  RKADK_JOURNAL_Init(&stJournal, path);
+  RKADK_JOURNAL_Load(&stJournal, &stLoad);
+  fail += check("open after a torn append",
+                RKADK_JOURNAL_Open(&stJournal, &stLoad) == 0);
+  catalog_fill(&stCatalog, NULL, 2 * u32FileNum, 1);
+  catalog_fill(&stLoad, &stJournal, 2 * u32FileNum, 1);
+  fail += check("append after a torn append", journal_reload(path, &stCatalog));
+
+  // appends between the take and the commit end up after the new snapshot
+  fail += check("snapshot take",
+                RKADK_JOURNAL_SnapshotTake(&stJournal, &stLoad, &stSnap) == 0);
+  catalog_fill(&stCatalog, NULL, 3 * u32FileNum, 8);
+  catalog_fill(&stLoad, &stJournal, 3 * u32FileNum, 8);
+  catalog_del(&stCatalog, NULL, u32FileNum / 4, 1);
+  catalog_del(&stLoad, &stJournal, u32FileNum / 4, 1);
+  fail += check("snapshot write", RKADK_JOURNAL_SnapshotWrite(&stSnap) == 0);
+  fail += check("snapshot commit",
+                RKADK_JOURNAL_SnapshotCommit(&stJournal, &stSnap) == 0 &&
+                    stJournal.u32RecordNum == 9);
+  RKADK_JOURNAL_SnapshotFree(&stSnap);
+  fail += check("load compacted journal", journal_reload(path, &stCatalog));
+
+  catalog_fill(&stCatalog, NULL, 4 * u32FileNum, 1);
+  catalog_fill(&stLoad, &stJournal, 4 * u32FileNum, 1);
+  fail += check("append after compaction", journal_reload(path, &stCatalog));
+  RKADK_JOURNAL_Close(&stJournal);
+
+  // a damaged snapshot is not trusted, the folder is scanned instead
+  fail += check("snapshot record is damaged",
+                file_write(path, JOURNAL_HEADER_SIZE + JOURNAL_RECORD_SIZE + 40,
+                           "X", 1));
+  RKADK_CATALOG_Deinit(&stLoad);
+  RKADK_CATALOG_Init(&stLoad);
+  RKADK_JOURNAL_Init(&stJournal, path);
+  fail += check("load rejects the damaged snapshot",
+                RKADK_JOURNAL_Load(&stJournal, &stLoad) == -1 &&
+                    stLoad.s32FileNum == 0);
+
+  RKADK_CATALOG_Deinit(&stLoad);
+  RKADK_CATALOG_Deinit(&stCatalog);
+  unlink(path);
+
+  printf("%s: %d failed\n", path, fail);
+  return fail ? -1 : 0;
+}
@@ -61,6 +61,13 @@ static RKADK_VOID MountStatusCallback(RKADK_MW_PTR pHandle,
   }
 }
 
+static RKADK_VOID ScanProgressCallback(RKADK_MW_PTR pHandle,
+              RKADK_STR_SCAN_PROGRESS *pstProgress) {
+  RKADK_LOGD("+++++ scanned %d/%d folders, %d files, writable %d +++++",
+             pstProgress->s32FolderDone, pstProgress->s32FolderNum,
+             pstProgress->s32FileNum, pstProgress->bWritable);
+}
+
 RKADK_S32 CreatFile(char *name, long size) {
   int fd;
   int ret;
@@ -136,6 +143,7 @@ RKADK_S32 CreatFileTest(RKADK_MW_PTR *ppHandle) {
   int i;
   int totalSize;
   int freeSize;
+  int timeLeft;
   pthread_t tid[MAX_CH];
 
   for (i = 0; i < MAX_CH; i++) {
@@ -155,6 +163,11 @@ RKADK_S32 CreatFileTest(RKADK_MW_PTR *ppHandle) {
     RKADK_LOGD("sync end");
     RKADK_STORAGE_GetCapacity(ppHandle, &totalSize, &freeSize);
     RKADK_LOGI("sdcard totalSize: %d, freeSize: %d", totalSize, freeSize);
+    timeLeft = RKADK_STORAGE_GetRecordTimeLeft(*ppHandle);
+    if (timeLeft == RKADK_STORAGE_TIME_LEFT_UNKNOWN)
+      RKADK_LOGI("record time left: unknown, nothing is written");
+    else
+      RKADK_LOGI("record time left: %d s", timeLeft);
 
     if (RKADK_STORAGE_GetMountStatus(*ppHandle) == DISK_UNMOUNTED)
       quit = true;
@@ -210,6 +223,7 @@ RKADK_S32 SetDevAttr(RKADK_STR_DEV_ATTR *pstDevAttr) {
   pstDevAttr->pstFolderAttr[3].s32Limit = 15;
   sprintf(pstDevAttr->pstFolderAttr[3].cFolderPath, "/video_urgent/");
   pstDevAttr->pfnStatusCallback = MountStatusCallback;
+  pstDevAttr->pfnScanProgressCallback = ScanProgressCallback;
 
   return 0;
 }
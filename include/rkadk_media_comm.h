@@ -75,6 +75,23 @@ extern "C" {
 /* vpss venc maximum bind count */
 #define RKADK_VPSS_VENC_MAX_BIND_CNT RKADK_MEDIA_VPSS_MAX_CNT
 
+/* default venc frames queued to one consumer */
+#define RKADK_MEDIA_VENC_QUEUE_DEPTH 8
+
+/* aenc frames queued to one consumer, a full queue drops the frame */
+#define RKADK_MEDIA_AENC_QUEUE_DEPTH 16
+
+/* max frames of the venc gop cache, a longer gop isn't cached */
+#define RKADK_MEDIA_GOP_CACHE_MAX_CNT 64
+
+/* slices of a frame in the low latency live mode, see low_latency of [live] */
+#define RKADK_MEDIA_LOW_LATENCY_SLICE_CNT 4
+
+/* venc gop cache memory of one channel in KB, gop_cache_size of [common] */
+#define RKADK_MEDIA_GOP_CACHE_SIZE 1024
+#define RKADK_MEDIA_GOP_CACHE_SIZE_MIN 64
+#define RKADK_MEDIA_GOP_CACHE_SIZE_MAX 16384
+
 typedef struct {
   RKADK_U32 u32ChnId;
   VENC_STREAM_S stFrame;
@@ -82,9 +99,42 @@ typedef struct {
 
 typedef void (*RKADK_MEDIA_VENC_DATA_PROC_FUNC)(RKADK_MEDIA_VENC_DATA_S stData,
                                                 RKADK_VOID *pHandle);
+
+/* what the venc fetch thread does when a consumer queue is full */
+typedef enum {
+  RKADK_MEDIA_QUEUE_DROP_TO_IDR = 0, /* drop frames until the next IDR */
+  RKADK_MEDIA_QUEUE_BLOCK,           /* wait up to u32BlockMs, then drop to IDR */
+} RKADK_MEDIA_QUEUE_OVERFLOW_E;
+
+/* venc consumer queue attribute */
+typedef struct {
+  RKADK_U32 u32Depth; /* frames queued to the consumer, 0: default */
+  RKADK_MEDIA_QUEUE_OVERFLOW_E enOverflow;
+  RKADK_U32 u32BlockMs; /* RKADK_MEDIA_QUEUE_BLOCK only */
+  bool bGopCache;       /* keep the channel's last gop for RKADK_MEDIA_ReplayVencGop */
+  bool bNoRequestIDR;   /* on overflow wait for the encoder's next IDR, for a venc
+                           shared with the recorder */
+} RKADK_MEDIA_QUEUE_ATTR_S;
 typedef void (*RKADK_MEDIA_AENC_DATA_PROC_FUNC)(AUDIO_STREAM_S stFrame,
                                                 RKADK_VOID *pHandle);
 
+typedef enum {
+  RKADK_MEDIA_EVENT_VENC_STALL = 0, /* no venc stream, repeated with backoff */
+  RKADK_MEDIA_EVENT_VENC_RECOVER,   /* venc stream is back after a stall */
+  RKADK_MEDIA_EVENT_BUTT
+} RKADK_MEDIA_EVENT_E;
+
+typedef struct {
+  RKADK_MEDIA_EVENT_E enEvent;
+  RKADK_U32 u32CamId;
+  RKADK_S32 s32VencChnId;
+  RKADK_U64 u64TimeoutCnt; /* continuous GetStream timeouts, 1.2s each */
+  RKADK_S64 s64RecentPts;  /* pts of the last stream, 0: none yet */
+} RKADK_MEDIA_EVENT_INFO_S;
+
+typedef RKADK_VOID (*RKADK_MEDIA_EVENT_CALLBACK_FN)(
+    RKADK_MW_PTR pHandle, const RKADK_MEDIA_EVENT_INFO_S *pstEventInfo);
+
 RKADK_S32 RKADK_MPI_SYS_Init();
 RKADK_S32 RKADK_MPI_SYS_Exit();
 bool RKADK_MPI_SYS_CHECK();
@@ -138,6 +188,20 @@ RKADK_S32 RKADK_MEDIA_SetRcAttr(VENC_RC_ATTR_S *pstRcAttr, RKADK_U32 u32Gop,
                                 RKADK_U32 u32BitRate, RKADK_U32 u32SrcFrameRate,
                                 RKADK_U32 u32DstFrameRate);
 
+/* gop of the low latency live mode, one second at most */
+RKADK_U32 RKADK_MEDIA_GetLowLatencyGop(RKADK_U32 u32Gop, RKADK_U32 u32DstFrameRate);
+
+/* low latency live venc: cbr, P frames only, RKADK_MEDIA_GetLowLatencyGop */
+RKADK_S32 RKADK_MEDIA_SetLowLatencyAttr(VENC_CHN_ATTR_S *pstVencAttr,
+                                        RKADK_CODEC_TYPE_E enCodecType,
+                                        RKADK_U32 u32Gop, RKADK_U32 u32BitRate,
+                                        RKADK_U32 u32SrcFrameRate,
+                                        RKADK_U32 u32DstFrameRate);
+
+/* glass-to-wire latency of a sent stream, the venc pts is the vi frame pts */
+void RKADK_MEDIA_CountLatency(RKADK_U64 u64Pts, RKADK_U32 *pu32AvgUs,
+                              RKADK_U32 *pu32MaxUs);
+
 bool RKADK_MEDIA_CompareResolution(VENC_CHN_ATTR_S *pstRecAttr,
                                 RKADK_U32 u32Width, RKADK_U32 u32Height);
 
@@ -145,6 +209,11 @@ bool RKADK_MEDIA_VencAttrCmp(VENC_CHN_ATTR_S *pstRecAttr,
                                   RKADK_U32 u32Gop, RKADK_U32 u32DstFrameRate,
                                   RKADK_U32 u32Bitrate);
 
+/**
+ * @brief deliver the aenc stream of pstChn to pfnDataCB on a thread of the
+ *        consumer, the stream buffer is referenced until the callback
+ *        returns. A full queue drops the frame.
+ */
 RKADK_S32 RKADK_MEDIA_GetAencBuffer(MPP_CHN_S *pstChn,
                                     RKADK_MEDIA_AENC_DATA_PROC_FUNC pfnDataCB,
                                     RKADK_VOID *pHandle);
@@ -154,15 +223,43 @@ RKADK_MEDIA_StopGetAencBuffer(MPP_CHN_S *pstChn,
                               RKADK_MEDIA_AENC_DATA_PROC_FUNC pfnDataCB,
                               RKADK_VOID *pHandle);
 
+/**
+ * @brief deliver the venc stream of pstChn to pfnDataCB. Every consumer
+ *        has its own queue and thread, the stream buffer is referenced
+ *        until the callback returns. The default queue drops to IDR.
+ */
 RKADK_S32 RKADK_MEDIA_GetVencBuffer(MPP_CHN_S *pstChn,
                                     RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB,
                                     RKADK_VOID *pHandle);
 
+RKADK_S32 RKADK_MEDIA_GetVencBufferEx(MPP_CHN_S *pstChn,
+                                      RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB,
+                                      RKADK_VOID *pHandle,
+                                      const RKADK_MEDIA_QUEUE_ATTR_S *pstQueueAttr);
+
+/**
+ * @brief replay the cached gop of the venc channel, from the last IDR on,
+ *        to a consumer registered with bGopCache. The replayed frames run
+ *        on the consumer thread before its queued frames.
+ *
+ * @return 0 on success, -1 if no IDR is cached
+ */
+RKADK_S32 RKADK_MEDIA_ReplayVencGop(MPP_CHN_S *pstChn,
+                                    RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB,
+                                    RKADK_VOID *pHandle);
+
 RKADK_S32
 RKADK_MEDIA_StopGetVencBuffer(MPP_CHN_S *pstChn,
                               RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB,
                               RKADK_VOID *pHandle);
 
+/**
+ * @brief register the media pipeline event callback, it is called from
+ *        a low priority watchdog thread, NULL to unregister
+ */
+RKADK_S32 RKADK_MEDIA_RegisterEventCallback(
+    RKADK_MEDIA_EVENT_CALLBACK_FN pfnEventCallback, RKADK_MW_PTR pHandle);
+
 RKADK_S32 RKADK_MEDIA_FrameBufMalloc(RKADK_FRAME_ATTR_S *pstFrameAttr);
 
 RKADK_S32 RKADK_MEDIA_FrameFree(RKADK_FRAME_ATTR_S *pstFrameAttr);
@@ -178,6 +275,12 @@ int RKADK_MEDIA_GetPixelFormat(PIXEL_FORMAT_E enPixelFormat, RKADK_CHAR *cPixFmt
 
 bool RKADK_MEDIA_EnableAencRegister(RKADK_CODEC_TYPE_E eCodecType);
 
+/* aenc channel of the rtsp/rtmp audio, sessions of one codec share it */
+RKADK_S32 RKADK_MEDIA_GetLiveAencChn(RKADK_CODEC_TYPE_E enCodecType);
+
+/* length of the adts header of an aac frame, 0 if it has none */
+RKADK_U32 RKADK_MEDIA_GetAdtsHeaderLen(RKADK_U8 *pu8Data, RKADK_U32 u32Len);
+
 RKADK_S32 RKADK_MEDIA_SetVencRotation(RKADK_U32 u32CamId,
                               ROTATION_E enRotation, RKADK_STREAM_TYPE_E enStreamType);
 
@@ -31,7 +31,20 @@ extern "C" {
 #define RKADK_MUXER_FILE_NAME_LEN 256
 #define RKADK_MUXER_STREAM_MAX_CNT RECORD_FILE_NUM_MAX
 #define RKADK_MUXER_TRACK_MAX_CNT 2 /* a video track and a audio track */
-#define RKADK_MUXER_CELL_MAX_CNT 40
+#define RKADK_MUXER_CELL_DEF_CNT 40
+#define RKADK_MUXER_CELL_MIN_CNT 8
+#define RKADK_MUXER_CELL_MAX_CNT 1024
+#define RKADK_MUXER_WRITE_LATENCY_MS 1000 /* default write stall to absorb */
+#define RKADK_MUXER_PRE_RECORD_DRAIN_RATIO 4 /* pre-record backlog write speed vs realtime */
+#define RKADK_MUXER_PRE_OPEN_MS 3000 /* open the next file this long before the switch */
+#define RKADK_MUXER_ID_BANK_CNT 2 /* rkmuxer ids per stream, current and next file */
+#define RKADK_MUXER_ID_BANK_SIZE (RKADK_MUXER_STREAM_MAX_CNT * RKADK_MAX_SENSOR_CNT)
+#define RKADK_MUXER_FRAGMENT_GOP_CNT 1 /* fmp4 default: fdatasync every GOP */
+#define RKADK_MUXER_FRAGMENT_GOP_MAX 60
+#define RKADK_MUXER_WRITE_BLOCK_SIZE (1024 * 1024) /* default writeback block */
+#define RKADK_MUXER_WRITE_BLOCK_MIN (256 * 1024)
+#define RKADK_MUXER_WRITE_BLOCK_MAX (4 * 1024 * 1024)
+#define RKADK_MUXER_PRE_ALLOC_MARGIN 8 /* preallocate 1/8 over time x bitrate */
 
 typedef enum {
   RKADK_MUXER_EVENT_STREAM_START = 0,
@@ -42,6 +55,8 @@ typedef enum {
   RKADK_MUXER_EVENT_ERR_CREATE_FILE_FAIL,
   RKADK_MUXER_EVENT_ERR_WRITE_FILE_FAIL,
   RKADK_MUXER_EVENT_FILE_WRITING_SLOW,
+  RKADK_MUXER_EVENT_FMP4_FALLBACK, /* rkmuxer can't write fmp4, stFileInfo is
+                                      recorded as plain mp4 */
   RKADK_MUXER_EVENT_BUTT
 } RKADK_MUXER_EVENT_E;
 
@@ -90,9 +105,63 @@ typedef enum {
   RKADK_MUXER_TYPE_MP4 = 0,
   RKADK_MUXER_TYPE_MPEGTS,
   RKADK_MUXER_TYPE_FLV,
+  RKADK_MUXER_TYPE_FMP4, /* fragmented mp4 (ismv), a fragment per GOP, survives power
+                            loss. rkmuxer builds without ismv, the shipped one
+                            included, record plain mp4 and raise
+                            RKADK_MUXER_EVENT_FMP4_FALLBACK */
   RKADK_MUXER_TYPE_BUTT
 } RKADK_MUXER_FILE_TYPE_E;
 
+/* what a producer does when the stream cache is full */
+typedef enum {
+  RKADK_MUXER_BACKPRESSURE_BLOCK = 0,    /* wait until the muxer frees a cell */
+  RKADK_MUXER_BACKPRESSURE_DROP_NON_REF, /* drop non-reference video frames and
+                                            audio frames, wait on the others */
+  RKADK_MUXER_BACKPRESSURE_DROP_TO_IDR,  /* drop frames until the next IDR */
+  RKADK_MUXER_BACKPRESSURE_BUTT
+} RKADK_MUXER_BACKPRESSURE_E;
+
+typedef struct {
+  RKADK_U32 u32VideoDropCnt; /* video frames dropped by backpressure */
+  RKADK_U32 u32AudioDropCnt; /* audio frames dropped by backpressure */
+  RKADK_U32 u32BlockCnt;     /* frames that waited for a free cell */
+} RKADK_MUXER_DROP_STATS_S;
+
+/* latency histogram in the HdrHistogram layout: every [2^n, 2^(n+1)) us range
+ * is split in RKADK_MUXER_LATENCY_SUB_CNT equal sub-buckets, so a bucket is at
+ * most 1/RKADK_MUXER_LATENCY_SUB_CNT of the values it counts wide. Values
+ * below 2 * RKADK_MUXER_LATENCY_SUB_CNT us have a bucket each, the last bucket
+ * also counts everything from 2^RKADK_MUXER_LATENCY_RANGE_BITS us on. */
+#define RKADK_MUXER_LATENCY_SUB_BITS 3
+#define RKADK_MUXER_LATENCY_SUB_CNT (1 << RKADK_MUXER_LATENCY_SUB_BITS)
+#define RKADK_MUXER_LATENCY_RANGE_BITS 24 /* 16.7 s */
+#define RKADK_MUXER_LATENCY_BUCKET_CNT                                         \
+  ((RKADK_MUXER_LATENCY_RANGE_BITS - RKADK_MUXER_LATENCY_SUB_BITS + 1) *       \
+   RKADK_MUXER_LATENCY_SUB_CNT)
+
+typedef struct {
+  RKADK_U32 au32Bucket[RKADK_MUXER_LATENCY_BUCKET_CNT];
+  RKADK_U32 u32Cnt;
+  RKADK_U32 u32MaxUs;
+  RKADK_U64 u64TotalUs;
+} RKADK_MUXER_LATENCY_HIST_S;
+
+typedef struct {
+  RKADK_MUXER_LATENCY_HIST_S stVideoWrite; /* rkmuxer_write_video_frame */
+  RKADK_MUXER_LATENCY_HIST_S stAudioWrite; /* rkmuxer_write_audio_frame */
+  RKADK_MUXER_LATENCY_HIST_S stFileClose;  /* file switch in muxer close */
+  RKADK_MUXER_LATENCY_HIST_S stFileSync;   /* fmp4 fragment fdatasync */
+  RKADK_U32 u32VideoQueueHwm;   /* max video frames queued to the muxer thread */
+  RKADK_U32 u32AudioQueueHwm;   /* max audio frames queued to the muxer thread */
+  RKADK_U32 u32VideoQueueDepth; /* video cell count */
+  RKADK_U32 u32AudioQueueDepth; /* audio cell count */
+  RKADK_U64 u64WriteBytes;      /* bytes written since enable */
+  RKADK_U32 u32BytesPerSec;     /* write rate over the last second */
+  RKADK_U32 u32IdrReqCnt;       /* IDR requests sent to the encoder */
+  RKADK_U32 u32SwitchWaitCnt;   /* key frames a file switch waited for the next file */
+  RKADK_MUXER_DROP_STATS_S stDropStats;
+} RKADK_MUXER_STATS_S;
+
 typedef enum {
   RKADK_TRACK_SOURCE_TYPE_VIDEO = 0,
   RKADK_TRACK_SOURCE_TYPE_AUDIO,
@@ -138,6 +207,10 @@ typedef struct {
   RKADK_MUXER_TRACK_SOURCE_S
   aHTrackSrcHandle[RKADK_MUXER_TRACK_MAX_CNT]; /* array of track source cnt */
   RKADK_MUXER_FILE_TYPE_E enType;
+  RKADK_MUXER_BACKPRESSURE_E enBackpressure; /* cache full policy */
+  RKADK_U32 u32FragmentGop; /* fmp4 only, GOPs written between two fdatasync,
+                               0 means RKADK_MUXER_FRAGMENT_GOP_CNT. Only sets
+                               the sync cadence, it doesn't make fragments */
 } RKADK_MUXER_STREAM_ATTR_S;
 
 typedef enum {
@@ -160,6 +233,19 @@ typedef struct {
   RKADK_STREAM_TYPE_E enStreamType; /* stream type */
 } RKADK_MUXER_FPS_ATTR_S;
 
+/* muxer stream cache attribute, the cell count is derived from it */
+typedef struct {
+  RKADK_U32 u32WriteLatencyMs; /* longest write stall to absorb, 0: default */
+  RKADK_U32 u32MemBudget; /* max encoded bytes cached per stream, 0: no limit */
+} RKADK_MUXER_CACHE_ATTR_S;
+
+/* record file io attribute */
+typedef struct {
+  RKADK_U32 u32WriteBlockSize; /* dirty file data written back as one aligned
+                                  block, 0: default, rounded to a power of 2 */
+  bool bPreAllocate; /* reserve the file extent of a whole record file at open */
+} RKADK_MUXER_IO_ATTR_S;
+
 /* muxer attribute param */
 typedef struct {
   RKADK_U32 u32CamId;
@@ -168,6 +254,8 @@ typedef struct {
   RKADK_MUXER_STREAM_ATTR_S
   astStreamAttr[RKADK_MUXER_STREAM_MAX_CNT]; /* array of stream attr */
   RKADK_MUXER_PRE_RECORD_ATTR_S stPreRecordAttr;
+  RKADK_MUXER_CACHE_ATTR_S stCacheAttr;
+  RKADK_MUXER_IO_ATTR_S stIoAttr;
   RKADK_MUXER_REQUEST_FILE_NAME_CB pcbRequestFileNames;
   RKADK_MUXER_EVENT_CALLBACK_FN pfnEventCallback;
 } RKADK_MUXER_ATTR_S;
@@ -178,6 +266,7 @@ typedef struct {
   RKADK_U32 u32StreamCnt;
   RKADK_MW_PTR pMuxerHandle[RKADK_MUXER_STREAM_MAX_CNT];
   RKADK_U64 u64AudioPts;
+  void *pFileWorker; /* opens and finalizes record files, writes thumbnails */
 } RKADK_MUXER_HANDLE_S;
 
 /**
@@ -270,6 +359,41 @@ bool RKADK_MUXER_IsUseVpss(RKADK_MW_PTR pHandle, RKADK_U32 u32VencChn);
 RKADK_S32 RKADK_MUXER_UpdateRes(RKADK_MW_PTR pHandle, RKADK_U32 chnId,
                               RKADK_U32 u32Wdith, RKADK_U32 u32Hieght);
 
+/**
+ * @brief get the frames dropped or delayed by the stream cache full policy
+ */
+RKADK_S32 RKADK_MUXER_GetDropStats(RKADK_MW_PTR pHandle, RKADK_U32 u32VencChn,
+                                   RKADK_MUXER_DROP_STATS_S *pstStats);
+
+/**
+ * @brief get the write path stats of a stream since it was enabled
+ */
+RKADK_S32 RKADK_MUXER_GetStats(RKADK_MW_PTR pHandle, RKADK_U32 u32VencChn,
+                               RKADK_MUXER_STATS_S *pstStats);
+
+/**
+ * @brief latency below which dPercent of the samples of a histogram are
+ * @param[in]dPercent : 0 ~ 100, e.g. 99.9 for p999
+ * @return us, the top of the bucket the percentile falls in, at most
+ *         u32MaxUs; 0 for an empty histogram
+ */
+RKADK_U32 RKADK_MUXER_LatencyPercentile(const RKADK_MUXER_LATENCY_HIST_S *pstHist,
+                                        RKADK_DOUBLE dPercent);
+
+/**
+ * @brief frames a stream cache holds, the encoder stream buffers are sized
+ *        from it as well
+ * @param[in]u32FrameRate : frames per second of the stream
+ * @param[in]u32Gop : gop of the stream, 0 for audio
+ * @param[in]u32BitRate : bitrate of the stream, 0: unknown
+ * @param[in]u32PreRecCacheTime : pre-record cache time in second, 0: none
+ * @param[in]pstCacheAttr : stream cache attribute
+ * @return the cell count
+ */
+RKADK_U32 RKADK_MUXER_CalcCellCnt(RKADK_U32 u32FrameRate, RKADK_U32 u32Gop,
+                                  RKADK_U32 u32BitRate, RKADK_U32 u32PreRecCacheTime,
+                                  const RKADK_MUXER_CACHE_ATTR_S *pstCacheAttr);
+
 #ifdef __cplusplus
 }
 #endif
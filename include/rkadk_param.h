@@ -44,6 +44,7 @@ extern "C" {
 #define AUDIO_CHANNEL 2
 #define AUDIO_MIC_TYPE 0
 #define AUDIO_BIT_REAT 160000
+#define LIVE_AUDIO_BIT_REAT 24000
 #define AUDIO_FRAME_COUNT 1152
 #define AUDIO_BIT_WIDTH AUDIO_BIT_WIDTH_16
 #define AI_DEPTH 1
@@ -229,6 +230,7 @@ typedef struct tagRKADK_PARAM_COMM_CFG_S {
   RKADK_U32 speaker_volume; /* speaker volume, [0,100] */
   RKADK_U32 mic_volume;     /* mic input volume, [0,100] */
   RKADK_U32 vpss_devcie; /* 0: GPU device, 1: RGA device */
+  RKADK_U32 gop_cache_size; /* venc gop cache of one channel in KB */
 } RKADK_PARAM_COMM_CFG_S;
 
 typedef struct tagRKADK_PARAM_SENSOR_CFG_S {
@@ -259,6 +261,8 @@ typedef struct tagRKADK_PARAM_AUDIO_CFG_S {
   RKADK_VQE_MODE_E vqe_mode;
   char vqe_config_path[RKADK_PATH_LEN];
   RKADK_CODEC_TYPE_E codec_type;
+  RKADK_CODEC_TYPE_E live_codec_type; /* rtsp/rtmp audio: G711A, G711U or ACC */
+  RKADK_U32 live_bitrate;             /* rtsp/rtmp ACC bitrate */
 } RKADK_PARAM_AUDIO_CFG_S;
 
 typedef struct tagRKADK_PARAM_VENC_PARAM_S {
@@ -277,6 +281,10 @@ typedef struct tagRKADK_PARAM_VENC_PARAM_S {
 
   bool full_range;
   bool scaling_list;
+
+  /* live only: cbr, short gop, each slice sent as soon as it is encoded,
+   * ignored when the live venc is shared with the recorder or preview */
+  bool low_latency;
 } RKADK_PARAM_VENC_PARAM_S;
 
 typedef struct tagRKADK_PARAM_VENC_ATTR_S {
@@ -311,6 +319,7 @@ typedef struct tagRKADK_PARAM_REC_CFG_S {
   bool enable_audio;
   RKADK_REC_TYPE_E record_type;
   RKADK_MUXER_FILE_TYPE_E file_type;
+  RKADK_U32 fragment_gop; // fmp4 GOPs between two fdatasync, sync cadence only
   RKADK_U32 pre_record_time;
   RKADK_MUXER_PRE_RECORD_MODE_E pre_record_mode;
   RKADK_U32 lapse_multiple;
@@ -523,6 +532,12 @@ RKADK_VO_INTF_TYPE_E RKADK_PARAM_GetIntfType(char *intfType);
 
 RKADK_U32 RKADK_PARAM_GetStreamBufCnt(RKADK_U32 u32CamId, bool bIsAudio);
 
+/* stream buffers of a venc channel, more when several streams share it */
+RKADK_U32 RKADK_PARAM_GetVencStreamBufCnt(RKADK_U32 u32CamId, RKADK_U32 u32ChnId);
+
+/* low_latency of the venc, false when the channel is shared with another stream */
+bool RKADK_PARAM_VencLowLatency(RKADK_PARAM_VENC_ATTR_S *pstVencAttr);
+
 RKADK_VO_INTF_TYPE_E RKADK_PARAM_GetSpliceMode(char *spliceMode);
 
 #ifdef __cplusplus
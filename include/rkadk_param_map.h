@@ -63,6 +63,7 @@ static RKADK_SI_CONFIG_MAP_S g_stCommCfgMapTable[] = {
     DEFINE_MAP(common, tagRKADK_PARAM_COMM_CFG_S, int_e, speaker_volume),
     DEFINE_MAP(common, tagRKADK_PARAM_COMM_CFG_S, int_e, mic_volume),
     DEFINE_MAP(common, tagRKADK_PARAM_COMM_CFG_S, int_e, vpss_devcie),
+    DEFINE_MAP(common, tagRKADK_PARAM_COMM_CFG_S, int_e, gop_cache_size),
 };
 
 /* audio map table */
@@ -79,6 +80,8 @@ static RKADK_SI_CONFIG_MAP_S g_stAudioCfgMapTable[] = {
     DEFINE_MAP(audio, tagRKADK_PARAM_AUDIO_CFG_S, int_e, vqe_mode),
     DEFINE_MAP(audio, tagRKADK_PARAM_AUDIO_CFG_S, string_e, vqe_config_path),
     DEFINE_MAP(audio, tagRKADK_PARAM_AUDIO_CFG_S, int_e, codec_type),
+    DEFINE_MAP(audio, tagRKADK_PARAM_AUDIO_CFG_S, int_e, live_codec_type),
+    DEFINE_MAP(audio, tagRKADK_PARAM_AUDIO_CFG_S, int_e, live_bitrate),
 };
 
 /* sensor map table */
@@ -101,6 +104,7 @@ static RKADK_SI_CONFIG_MAP_S g_stSensorCfgMapTable[] = {
 static RKADK_SI_CONFIG_MAP_S g_stRecCfgMapTable[] = {
     DEFINE_MAP(record, tagRKADK_PARAM_REC_CFG_S, int_e, record_type),
     DEFINE_MAP(record, tagRKADK_PARAM_REC_CFG_S, int_e, file_type),
+    DEFINE_MAP(record, tagRKADK_PARAM_REC_CFG_S, int_e, fragment_gop),
     DEFINE_MAP(record, tagRKADK_PARAM_REC_CFG_S, int_e, pre_record_time),
     DEFINE_MAP(record, tagRKADK_PARAM_REC_CFG_S, int_e, pre_record_mode),
     DEFINE_MAP(record, tagRKADK_PARAM_REC_CFG_S, int_e, lapse_multiple),
@@ -233,6 +237,7 @@ static RKADK_SI_CONFIG_MAP_S g_stLiveParamMapTable[] = {
     DEFINE_MAP(live, tagRKADK_PARAM_VENC_PARAM_S, bool_e, hier_qp_en),
     DEFINE_MAP(live, tagRKADK_PARAM_VENC_PARAM_S, string_e, hier_qp_delta),
     DEFINE_MAP(live, tagRKADK_PARAM_VENC_PARAM_S, string_e, hier_frame_num),
+    DEFINE_MAP(live, tagRKADK_PARAM_VENC_PARAM_S, bool_e, low_latency),
 };
 
 /* photo map table */
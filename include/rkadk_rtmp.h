@@ -22,12 +22,45 @@ extern "C" {
 #endif
 
 #include "rkadk_common.h"
+#include <stdbool.h>
+
+/* encoded frames the rtmp sender may hold, in bytes and in frames */
+#define RKADK_RTMP_QUEUE_SIZE (2 * 1024 * 1024)
+#define RKADK_RTMP_QUEUE_CNT 256
+
+/* reconnect backoff, doubled after each failed connect */
+#define RKADK_RTMP_RECONNECT_MIN_MS 500
+#define RKADK_RTMP_RECONNECT_MAX_MS (30 * 1000)
+
+typedef struct {
+  bool bConnected;              /* the server is connected */
+  RKADK_U32 u32ConnectCnt;      /* successful connects, reconnects included */
+  RKADK_U32 u32ConnectFailCnt;  /* failed connects */
+  RKADK_U32 u32QueueSize;       /* send queue size in bytes */
+  RKADK_U32 u32QueueBytes;      /* bytes waiting to be sent */
+  RKADK_U32 u32QueueHwm;        /* max bytes waiting */
+  RKADK_U32 u32VideoDropCnt;    /* video frames dropped to the next IDR */
+  RKADK_U32 u32AudioDropCnt;    /* audio frames dropped on a full queue */
+  RKADK_U32 u32Bitrate;         /* current venc bitrate */
+  RKADK_U32 u32Framerate;       /* current venc fps */
+  RKADK_U32 u32AbrDownCnt;      /* bitrate/fps lowered on a growing queue */
+  RKADK_U32 u32AbrUpCnt;        /* bitrate/fps raised after recovery */
+  RKADK_U32 u32MaxSendUs;       /* slowest rkmuxer write */
+  RKADK_U32 u32LatencyUs;       /* vi frame to rkmuxer write done, moving average */
+  RKADK_U32 u32MaxLatencyUs;    /* max vi frame to rkmuxer write done */
+  RKADK_U64 u64SendBytes;       /* bytes handed to the muxer */
+} RKADK_RTMP_STATS_S;
 
 RKADK_S32 RKADK_RTMP_Init(RKADK_U32 u32CamId, const char *path,
                           RKADK_MW_PTR *ppHandle);
 
 RKADK_S32 RKADK_RTMP_DeInit(RKADK_MW_PTR pHandle);
 
+/**
+ * @brief get the sender stats of the rtmp stream
+ */
+RKADK_S32 RKADK_RTMP_GetStats(RKADK_MW_PTR pHandle, RKADK_RTMP_STATS_S *pstStats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,15 +23,69 @@ extern "C" {
 
 #include "rkadk_common.h"
 
+/* frames referenced by the rtsp send queue */
+#define RKADK_RTSP_VIDEO_QUEUE_DEPTH 8
+#define RKADK_RTSP_AUDIO_QUEUE_DEPTH 16
+
+typedef struct {
+  RKADK_U32 u32VideoQueueDepth; /* video send queue size */
+  RKADK_U32 u32AudioQueueDepth; /* audio send queue size */
+  RKADK_U32 u32VideoQueued;     /* video frames waiting to be sent */
+  RKADK_U32 u32AudioQueued;     /* audio frames waiting to be sent */
+  RKADK_U32 u32VideoQueueHwm;   /* max video frames waiting */
+  RKADK_U32 u32AudioQueueHwm;   /* max audio frames waiting */
+  RKADK_U32 u32VideoDropCnt;    /* video frames dropped to the next IDR */
+  RKADK_U32 u32AudioDropCnt;    /* audio frames dropped on a full queue */
+  RKADK_U32 u32IdrReqCnt;       /* IDR requests after a full queue */
+  RKADK_U32 u32MaxSendUs;       /* slowest rtsp_tx_video/rtsp_tx_audio */
+  RKADK_U32 u32LatencyUs;       /* vi frame to rtsp_tx_video done, moving average */
+  RKADK_U32 u32MaxLatencyUs;    /* max vi frame to rtsp_tx_video done */
+  RKADK_U64 u64SendBytes;       /* bytes handed to the rtsp session */
+} RKADK_RTSP_STATS_S;
+
+typedef struct {
+  RKADK_U32 u32CamId;
+  RKADK_STREAM_TYPE_E enStreamType; /* LIVE, VIDEO_MAIN or VIDEO_SUB */
+  RKADK_U32 u32Port;
+  const char *path;
+  RKADK_CODEC_TYPE_E enAudioCodec;  /* G711A, G711U or ACC, BUTT: live_codec_type */
+} RKADK_RTSP_ATTR_S;
+
 RKADK_S32 RKADK_RTSP_Init(RKADK_U32 u32CamId, RKADK_U32 port, const char *path,
                           RKADK_MW_PTR *ppHandle);
 
+/**
+ * @brief open a rtsp session on rtsp://ip:port/path
+ *
+ * Sessions on the same port share one server and its send thread.
+ * RKADK_STREAM_TYPE_LIVE encodes the live stream, RKADK_STREAM_TYPE_VIDEO_MAIN
+ * and RKADK_STREAM_TYPE_VIDEO_SUB serve the record encoder without a second
+ * encode. Opening an opened path with the same stream returns the same
+ * handle, each open needs its RKADK_RTSP_DeInit.
+ */
+RKADK_S32 RKADK_RTSP_InitEx(RKADK_U32 u32CamId, RKADK_STREAM_TYPE_E enStreamType,
+                            RKADK_U32 port, const char *path,
+                            RKADK_MW_PTR *ppHandle);
+
+/**
+ * @brief RKADK_RTSP_InitEx with the audio codec of the session
+ *
+ * Sessions of the same audio codec share one audio encoder, ACC is sent as
+ * aac-lc with its AudioSpecificConfig in the sdp.
+ */
+RKADK_S32 RKADK_RTSP_InitAttr(RKADK_RTSP_ATTR_S *pstAttr, RKADK_MW_PTR *ppHandle);
+
 RKADK_S32 RKADK_RTSP_DeInit(RKADK_MW_PTR pHandle);
 
 RKADK_S32 RKADK_RTSP_Start(RKADK_MW_PTR pHandle);
 
 RKADK_S32 RKADK_RTSP_Stop(RKADK_MW_PTR pHandle);
 
+/**
+ * @brief get the send queue stats of the rtsp session
+ */
+RKADK_S32 RKADK_RTSP_GetStats(RKADK_MW_PTR pHandle, RKADK_RTSP_STATS_S *pstStats);
+
 #ifdef __cplusplus
 }
 #endif
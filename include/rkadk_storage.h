@@ -25,6 +25,10 @@ extern "C" {
 
 #define RKADK_MAX_FORMAT_ID_LEN    8
 #define RKADK_MAX_VOLUME_LEN    11
+#define RKADK_STORAGE_MAX_STREAM    8
+
+/* RKADK_STORAGE_GetRecordTimeLeft while nothing is being written */
+#define RKADK_STORAGE_TIME_LEFT_UNKNOWN    0x7FFFFFFF
 
 typedef enum {
   DISK_UNMOUNTED = 0,
@@ -40,6 +44,17 @@ typedef enum {
 typedef RKADK_VOID (*RKADK_MOUNT_STATUS_CALLBACK_FN)(
     RKADK_MW_PTR pHandle, RKADK_MOUNT_STATUS status);
 
+typedef struct {
+  RKADK_BOOL bWritable;    /* recording may start, the scan is not done */
+  RKADK_S32 s32FolderNum;
+  RKADK_S32 s32FolderDone; /* folders scanned */
+  RKADK_S32 s32FileNum;    /* files scanned so far */
+} RKADK_STR_SCAN_PROGRESS;
+
+/* called from the scan workers while DISK_SCANNING */
+typedef RKADK_VOID (*RKADK_SCAN_PROGRESS_CALLBACK_FN)(
+    RKADK_MW_PTR pHandle, RKADK_STR_SCAN_PROGRESS *pstProgress);
+
 typedef enum {
   LIST_ASCENDING = 0,
   LIST_DESCENDING,
@@ -71,6 +86,9 @@ typedef struct {
   RKADK_S32 s32CheckFormatId;
   RKADK_STR_FOLDER_ATTR *pstFolderAttr;
   RKADK_MOUNT_STATUS_CALLBACK_FN pfnStatusCallback;
+  RKADK_S32 s32ScanReserveSize; /* MB free to record during the scan, 0: s32FreeSizeDelMax */
+  RKADK_S32 s32ScanThreadNum;   /* folder scan workers, 0: 2 */
+  RKADK_SCAN_PROGRESS_CALLBACK_FN pfnScanProgressCallback;
 } RKADK_STR_DEV_ATTR;
 
 typedef struct {
@@ -100,6 +118,15 @@ RKADK_STR_DEV_ATTR RKADK_STORAGE_GetDevAttr(RKADK_MW_PTR pHandle);
 
 RKADK_MOUNT_STATUS RKADK_STORAGE_GetMountStatus(RKADK_MW_PTR pHandle);
 
+/**
+ * @brief whether files may be written to the card
+ *
+ * The card becomes writable once it is checked and mounted with at least
+ * s32ScanReserveSize MB free, before the folder scan completes. While
+ * DISK_SCANNING, file lists are incomplete and auto delete is not running.
+ */
+RKADK_BOOL RKADK_STORAGE_IsWritable(RKADK_MW_PTR pHandle);
+
 RKADK_S32 RKADK_STORAGE_GetCapacity(RKADK_MW_PTR *ppHandle,
                                       RKADK_S32 *totalSize,
                                       RKADK_S32 *freeSize);
@@ -116,6 +143,30 @@ RKADK_CHAR *RKADK_STORAGE_GetDevPath(RKADK_MW_PTR pHandle);
 
 RKADK_S32 RKADK_STORAGE_Format(RKADK_MW_PTR pHandle, RKADK_CHAR* cFormat);
 
+/**
+ * @brief set the bitrate a recording stream writes to the card
+ *
+ * Auto delete keeps the space the registered streams, or the measured write
+ * rate if higher, will write before the next check free on top of
+ * s32FreeSizeDelMin. A bitrate of 0 removes the stream.
+ *
+ * @param u32StreamId 0 ~ RKADK_STORAGE_MAX_STREAM - 1
+ * @param u32Bitrate bits per second
+ */
+RKADK_S32 RKADK_STORAGE_SetStreamBitrate(RKADK_MW_PTR pHandle,
+                                         RKADK_U32 u32StreamId,
+                                         RKADK_U32 u32Bitrate);
+
+/**
+ * @brief seconds of recording the free space above s32FreeSizeDelMin holds
+ * at the current write rate, not counting the files auto delete would remove
+ *
+ * @return seconds, 0 if the card is not mounted or already at
+ * s32FreeSizeDelMin, RKADK_STORAGE_TIME_LEFT_UNKNOWN if nothing is being
+ * written, RKADK_FAILURE on an invalid handle
+ */
+RKADK_S32 RKADK_STORAGE_GetRecordTimeLeft(RKADK_MW_PTR pHandle);
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,14 +19,28 @@
 #include "rkadk_param.h"
 #include "rkadk_log.h"
 #include "rkadk_version.h"
+#include "rkadk_ring.h"
+#include "rkadk_signal.h"
+#include "rkadk_thread.h"
+#include "rkadk_watchdog.h"
+#include "linux_list.h"
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/sysinfo.h>
+#include <time.h>
 #include <unistd.h>
 
+#define RKADK_MEDIA_FETCH_TIMEOUT_MS 1200
+#define RKADK_MEDIA_FETCH_THROTTLE_MS 20
+#define RKADK_MEDIA_FETCH_BURST 4
+#define RKADK_MEDIA_FETCH_EVENT_CNT 16
+
 typedef struct {
   bool bUsed;
   RKADK_S32 s32BindCnt;
@@ -34,20 +48,96 @@ typedef struct {
   MPP_CHN_S stDestChn;
 } RKADK_BIND_INFO_S;
 
+// a venc/aenc channel polled by a shared fetcher
+typedef struct {
+  struct list_head mark;
+  int fd;
+  bool bVenc;
+  bool bAdded;
+  bool bThrottled;          // a blocking consumer is full, epoll disabled
+  RKADK_U64 u64ThrottleUs;  // throttled since
+  RKADK_U64 u64LastUs;      // last stream or stall report
+  void *pstMediaInfo;
+} RKADK_MEDIA_FETCH_SRC_S;
+
+typedef struct {
+  int epfd;
+  int wakeFd;               // eventfd, wakes the loop up to exit
+  pthread_t tid;
+  bool bRun;
+  int s32SrcCnt;
+  pthread_mutex_t mutex;    // source list vs fetch loop
+  struct list_head stSrcList;
+} RKADK_MEDIA_FETCHER_S;
+
+// an aenc stream consumer, queued like a venc one, but a full queue drops
+// the frame and never holds up the shared fetch thread
+typedef struct {
+  RKADK_S32 s32ChnId;
+  RKADK_MEDIA_AENC_DATA_PROC_FUNC pfnDataCB;
+  RKADK_VOID *pHandle;
+  AUDIO_STREAM_S *pstItem;
+  void *pFree;   // free items, consumer -> fetch thread
+  void *pProc;   // queued frames, fetch thread -> consumer
+  void *pSignal; // frame queued
+  void *pThread;
+  bool bExit;    // atomic, the consumer is being removed
+  RKADK_U32 u32DropCnt; // fetch thread only
+} RKADK_AENC_CONSUMER_S;
+
 typedef struct {
   bool bGetBuffer;
   RKADK_S32 s32GetCnt;
   pthread_t tid;
-  RKADK_VOID *pHandle[RKADK_MEDIA_AENC_MAX_CNT];
-  RKADK_MEDIA_AENC_DATA_PROC_FUNC cbList[RKADK_MEDIA_AENC_MAX_CNT];
+  RKADK_MEDIA_FETCH_SRC_S stFetchSrc;
+  pthread_mutex_t consumerMutex; // consumer table vs fetch thread
+  RKADK_AENC_CONSUMER_S *pstConsumer[RKADK_MEDIA_AENC_MAX_CNT];
 } RKADK_GET_AENC_MB_ATTR_S;
 
+typedef struct {
+  RKADK_MEDIA_VENC_DATA_S stData;
+  VENC_PACK_S stPack;
+} RKADK_VENC_ITEM_S;
+
+// a venc stream consumer, the fetch thread queues referenced stream buffers
+// to it and its own thread runs the callback
+typedef struct {
+  RKADK_S32 s32ChnId;
+  RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB;
+  RKADK_VOID *pHandle;
+  RKADK_MEDIA_QUEUE_ATTR_S stAttr;
+  RKADK_VENC_ITEM_S *pstItem;
+  void *pFree;       // free items, consumer -> fetch thread
+  void *pProc;       // queued frames, fetch thread -> consumer
+  void *pSignal;     // frame queued
+  void *pFreeSignal; // item freed
+  void *pThread;
+  bool bWaitIDR;     // fetch thread only
+  bool bExit;        // atomic, the consumer is being removed
+  RKADK_U32 u32DropCnt;
+  RKADK_VENC_ITEM_S *pstReplay; // gop snapshot, runs before the queued frames
+  RKADK_U32 u32ReplayCnt;
+  bool bReplay;                 // pstReplay is ready for the consumer thread
+  RKADK_U64 u64ReplayPts;       // consumer thread only, queued frames up to it were replayed
+} RKADK_VENC_CONSUMER_S;
+
+// referenced frames from the last IDR on, for consumers that start late
+typedef struct {
+  RKADK_S32 s32UserCnt;
+  RKADK_U32 u32Cnt;
+  RKADK_U32 u32Bytes;
+  RKADK_U32 u32MaxBytes;
+  RKADK_VENC_ITEM_S *pstItem;
+} RKADK_VENC_GOP_CACHE_S;
+
 typedef struct {
   bool bGetBuffer;
   RKADK_S32 s32GetCnt;
   pthread_t tid;
-  RKADK_VOID *pHandle[RKADK_MEDIA_VENC_MAX_CNT];
-  RKADK_MEDIA_VENC_DATA_PROC_FUNC cbList[RKADK_MEDIA_VENC_MAX_CNT];
+  RKADK_MEDIA_FETCH_SRC_S stFetchSrc;
+  pthread_mutex_t consumerMutex; // consumer table vs fetch thread
+  RKADK_VENC_CONSUMER_S *pstConsumer[RKADK_MEDIA_VENC_MAX_CNT];
+  RKADK_VENC_GOP_CACHE_S stGop; // under consumerMutex
   RKADK_S64 s64RecentPts;
   RKADK_U64 u64TimeoutCnt; //Continuous timeout count
 } RKADK_GET_VENC_MB_ATTR_S;
@@ -57,6 +147,7 @@ typedef struct {
   RKADK_S32 s32InitCnt;
   RKADK_S32 s32DevId;
   RKADK_S32 s32ChnId;
+  RKADK_U32 u32CamId;
   RK_CODEC_ID_E enCodecType;
   RKADK_GET_AENC_MB_ATTR_S stGetAencMBAttr;
   RKADK_GET_VENC_MB_ATTR_S stGetVencMBAttr;
@@ -80,6 +171,8 @@ typedef struct {
   RKADK_BIND_INFO_S stViVencInfo[RKADK_VI_VENC_MAX_BIND_CNT];
   RKADK_BIND_INFO_S stViVpssInfo[RKADK_VI_VPSS_MAX_BIND_CNT];
   RKADK_BIND_INFO_S stVpssVencInfo[RKADK_VPSS_VENC_MAX_BIND_CNT];
+  RKADK_MEDIA_FETCHER_S stVencFetcher; // one thread polls every venc channel
+  RKADK_MEDIA_FETCHER_S stAencFetcher; // and one every aenc channel
 } RKADK_MEDIA_CONTEXT_S;
 
 struct RKADK_FORMAT_MAP {
@@ -108,6 +201,13 @@ static RKADK_MEDIA_CONTEXT_S g_stMediaCtx;
 static int g_bVpssGrpInitCnt[VPSS_MAX_GRP_NUM] = {0};
 static int g_bVoLayerDevInitCnt[VO_MAX_LAYER_NUM][VO_MAX_DEV_NUM] = {0};
 
+static int RKADK_MEDIA_FetcherInit(RKADK_MEDIA_FETCHER_S *pstFetcher) {
+  pstFetcher->epfd = -1;
+  pstFetcher->wakeFd = -1;
+  INIT_LIST_HEAD(&pstFetcher->stSrcList);
+  return pthread_mutex_init(&pstFetcher->mutex, NULL);
+}
+
 static int RKADK_MEDIA_CtxInit() {
   int ret;
 
@@ -122,6 +222,14 @@ static int RKADK_MEDIA_CtxInit() {
   ret |= pthread_mutex_init(&g_stMediaCtx.vpssMutex, NULL);
   ret |= pthread_mutex_init(&g_stMediaCtx.voMutex, NULL);
   ret |= pthread_mutex_init(&g_stMediaCtx.bindMutex, NULL);
+  for (int i = 0; i < RKADK_MEDIA_VENC_MAX_CNT; i++)
+    ret |= pthread_mutex_init(
+        &g_stMediaCtx.stVencInfo[i].stGetVencMBAttr.consumerMutex, NULL);
+  for (int i = 0; i < RKADK_MEDIA_AENC_MAX_CNT; i++)
+    ret |= pthread_mutex_init(
+        &g_stMediaCtx.stAencInfo[i].stGetAencMBAttr.consumerMutex, NULL);
+  ret |= RKADK_MEDIA_FetcherInit(&g_stMediaCtx.stVencFetcher);
+  ret |= RKADK_MEDIA_FetcherInit(&g_stMediaCtx.stAencFetcher);
 
   if (ret) {
     RKADK_LOGE("pthread_mutex_init failed[%d]", ret);
@@ -134,6 +242,8 @@ static int RKADK_MEDIA_CtxInit() {
 static int RKADK_MEDIA_CtxDeInit() {
   int ret;
 
+  RKADK_WATCHDOG_DeInit();
+
   ret = pthread_mutex_destroy(&g_stMediaCtx.aiMutex);
   ret |= pthread_mutex_destroy(&g_stMediaCtx.aencMutex);
   ret |= pthread_mutex_destroy(&g_stMediaCtx.viMutex);
@@ -141,6 +251,14 @@ static int RKADK_MEDIA_CtxDeInit() {
   ret |= pthread_mutex_destroy(&g_stMediaCtx.vpssMutex);
   ret |= pthread_mutex_destroy(&g_stMediaCtx.voMutex);
   ret |= pthread_mutex_destroy(&g_stMediaCtx.bindMutex);
+  for (int i = 0; i < RKADK_MEDIA_VENC_MAX_CNT; i++)
+    ret |= pthread_mutex_destroy(
+        &g_stMediaCtx.stVencInfo[i].stGetVencMBAttr.consumerMutex);
+  for (int i = 0; i < RKADK_MEDIA_AENC_MAX_CNT; i++)
+    ret |= pthread_mutex_destroy(
+        &g_stMediaCtx.stAencInfo[i].stGetAencMBAttr.consumerMutex);
+  ret |= pthread_mutex_destroy(&g_stMediaCtx.stVencFetcher.mutex);
+  ret |= pthread_mutex_destroy(&g_stMediaCtx.stAencFetcher.mutex);
 
   if (ret) {
     RKADK_LOGE("pthread_mutex_destroy failed[%d]", ret);
@@ -1018,6 +1136,7 @@ RKADK_S32 RKADK_MPI_VENC_Init(RKADK_U32 u32CamId, RKADK_S32 s32ChnId,
 
     g_stMediaCtx.stVencInfo[i].bUsed = true;
     g_stMediaCtx.stVencInfo[i].s32ChnId = s32ChnId;
+    g_stMediaCtx.stVencInfo[i].u32CamId = u32CamId;
     g_stMediaCtx.stVencInfo[i].enCodecType = pstVencChnAttr->stVencAttr.enType;
   }
 
@@ -1329,6 +1448,147 @@ exit:
   return ret;
 }
 
+static RKADK_U64 RKADK_MEDIA_GetUs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (RKADK_U64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void RKADK_MEDIA_AencConsumerDrain(RKADK_AENC_CONSUMER_S *pstConsumer) {
+  AUDIO_STREAM_S *pstItem = NULL;
+
+  while ((pstItem = (AUDIO_STREAM_S *)RKADK_RING_Pop(pstConsumer->pProc))) {
+    RK_MPI_MB_ReleaseMB(pstItem->pMbBlk);
+    RKADK_RING_Push(pstConsumer->pFree, pstItem);
+  }
+}
+
+static bool RKADK_MEDIA_AencConsumerProc(void *params) {
+  AUDIO_STREAM_S *pstItem = NULL;
+  RKADK_AENC_CONSUMER_S *pstConsumer = (RKADK_AENC_CONSUMER_S *)params;
+
+  // queued frames and the exit both give the signal
+  RKADK_SIGNAL_Wait(pstConsumer->pSignal, -1);
+  if (__atomic_load_n(&pstConsumer->bExit, __ATOMIC_ACQUIRE))
+    return false;
+
+  while ((pstItem = (AUDIO_STREAM_S *)RKADK_RING_Pop(pstConsumer->pProc))) {
+    pstConsumer->pfnDataCB(*pstItem, pstConsumer->pHandle);
+    RK_MPI_MB_ReleaseMB(pstItem->pMbBlk);
+    RKADK_RING_Push(pstConsumer->pFree, pstItem);
+  }
+
+  return true;
+}
+
+static void RKADK_MEDIA_AencConsumerDestroy(RKADK_AENC_CONSUMER_S *pstConsumer) {
+  if (!pstConsumer)
+    return;
+
+  if (pstConsumer->pThread) {
+    __atomic_store_n(&pstConsumer->bExit, true, __ATOMIC_RELEASE);
+    RKADK_THREAD_SetExit(pstConsumer->pThread);
+    RKADK_SIGNAL_Give(pstConsumer->pSignal);
+    RKADK_THREAD_Destory(pstConsumer->pThread);
+  }
+
+  if (pstConsumer->pProc)
+    RKADK_MEDIA_AencConsumerDrain(pstConsumer);
+
+  if (pstConsumer->u32DropCnt)
+    RKADK_LOGI("aenc[%d] consumer dropped %d frames", pstConsumer->s32ChnId,
+               pstConsumer->u32DropCnt);
+
+  RKADK_RING_Destroy(pstConsumer->pFree);
+  RKADK_RING_Destroy(pstConsumer->pProc);
+  RKADK_SIGNAL_Destroy(pstConsumer->pSignal);
+  if (pstConsumer->pstItem)
+    free(pstConsumer->pstItem);
+  free(pstConsumer);
+}
+
+static RKADK_AENC_CONSUMER_S *
+RKADK_MEDIA_AencConsumerCreate(RKADK_S32 s32ChnId, int idx,
+                               RKADK_MEDIA_AENC_DATA_PROC_FUNC pfnDataCB,
+                               RKADK_VOID *pHandle) {
+  char name[256];
+  RKADK_AENC_CONSUMER_S *pstConsumer = NULL;
+
+  pstConsumer = (RKADK_AENC_CONSUMER_S *)malloc(sizeof(RKADK_AENC_CONSUMER_S));
+  if (!pstConsumer) {
+    RKADK_LOGE("malloc aenc consumer failed");
+    return NULL;
+  }
+  memset(pstConsumer, 0, sizeof(RKADK_AENC_CONSUMER_S));
+
+  pstConsumer->s32ChnId = s32ChnId;
+  pstConsumer->pfnDataCB = pfnDataCB;
+  pstConsumer->pHandle = pHandle;
+  pstConsumer->pstItem = (AUDIO_STREAM_S *)calloc(RKADK_MEDIA_AENC_QUEUE_DEPTH,
+                                                  sizeof(AUDIO_STREAM_S));
+  pstConsumer->pFree = RKADK_RING_Create(RKADK_MEDIA_AENC_QUEUE_DEPTH);
+  pstConsumer->pProc = RKADK_RING_Create(RKADK_MEDIA_AENC_QUEUE_DEPTH);
+  pstConsumer->pSignal = RKADK_SIGNAL_Create(0, 1);
+  if (!pstConsumer->pstItem || !pstConsumer->pFree || !pstConsumer->pProc ||
+      !pstConsumer->pSignal) {
+    RKADK_LOGE("aenc[%d] consumer queue init failed", s32ChnId);
+    RKADK_MEDIA_AencConsumerDestroy(pstConsumer);
+    return NULL;
+  }
+
+  for (int i = 0; i < RKADK_MEDIA_AENC_QUEUE_DEPTH; i++)
+    RKADK_RING_Push(pstConsumer->pFree, &pstConsumer->pstItem[i]);
+
+  snprintf(name, sizeof(name), "AencCb_%d_%d", s32ChnId, idx);
+  pstConsumer->pThread =
+      RKADK_THREAD_Create(RKADK_MEDIA_AencConsumerProc, pstConsumer, name);
+  if (!pstConsumer->pThread) {
+    RKADK_MEDIA_AencConsumerDestroy(pstConsumer);
+    return NULL;
+  }
+
+  return pstConsumer;
+}
+
+// fetch thread side, called with the consumer mutex held
+static void RKADK_MEDIA_AencDispatch(RKADK_AENC_CONSUMER_S *pstConsumer,
+                                     AUDIO_STREAM_S *pstFrame) {
+  AUDIO_STREAM_S *pstItem = NULL;
+
+  pstItem = (AUDIO_STREAM_S *)RKADK_RING_Pop(pstConsumer->pFree);
+  if (!pstItem) {
+    // log the 1st, 2nd, 4th, 8th... drop only
+    pstConsumer->u32DropCnt++;
+    if (!(pstConsumer->u32DropCnt & (pstConsumer->u32DropCnt - 1)))
+      RKADK_LOGW("aenc[%d] consumer queue full, dropped %d frames",
+                 pstConsumer->s32ChnId, pstConsumer->u32DropCnt);
+    return;
+  }
+
+  memcpy(pstItem, pstFrame, sizeof(AUDIO_STREAM_S));
+  RK_MPI_MB_AddUserCnt(pstItem->pMbBlk);
+
+  RKADK_RING_Push(pstConsumer->pProc, pstItem);
+  RKADK_SIGNAL_Give(pstConsumer->pSignal);
+}
+
+// only hand the buffer out here, every consumer runs on its own thread
+static void RKADK_MEDIA_AencDeliver(RKADK_MEDIA_INFO_S *pstMediaInfo,
+                                    AUDIO_STREAM_S *pstFrame) {
+  int ret;
+
+  RKADK_MUTEX_LOCK(pstMediaInfo->stGetAencMBAttr.consumerMutex);
+  for (int i = 0; i < RKADK_MEDIA_AENC_MAX_CNT; i++)
+    if (pstMediaInfo->stGetAencMBAttr.pstConsumer[i])
+      RKADK_MEDIA_AencDispatch(pstMediaInfo->stGetAencMBAttr.pstConsumer[i], pstFrame);
+  RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetAencMBAttr.consumerMutex);
+
+  ret = RK_MPI_AENC_ReleaseStream(pstMediaInfo->s32ChnId, pstFrame);
+  if (ret)
+    RKADK_LOGE("RK_MPI_AENC_ReleaseStream failed[%x]", ret);
+}
+
 static void *RKADK_MEDIA_GetAencMb(void *params) {
   int ret;
   AUDIO_STREAM_S stFrame;
@@ -1341,29 +1601,639 @@ static void *RKADK_MEDIA_GetAencMb(void *params) {
 
   while (pstMediaInfo->stGetAencMBAttr.bGetBuffer) {
     ret = RK_MPI_AENC_GetStream(pstMediaInfo->s32ChnId, &stFrame, 1200);
-    if (ret == RK_SUCCESS) {
-      for (int i = 0; i < (int)pstMediaInfo->stGetAencMBAttr.s32GetCnt; i++)
-        if (pstMediaInfo->stGetAencMBAttr.cbList[i])
-          pstMediaInfo->stGetAencMBAttr.cbList[i](
-              stFrame, pstMediaInfo->stGetAencMBAttr.pHandle[i]);
+    if (ret == RK_SUCCESS)
+      RKADK_MEDIA_AencDeliver(pstMediaInfo, &stFrame);
+  }
 
-      ret = RK_MPI_AENC_ReleaseStream(pstMediaInfo->s32ChnId, &stFrame);
-      if (ret)
-        RKADK_LOGE("RK_MPI_AENC_ReleaseStream failed[%x]", ret);
+  RKADK_LOGI("Exit get aenc mb thread");
+  return NULL;
+}
+
+static void RKADK_MEDIA_VencConsumerDrain(RKADK_VENC_CONSUMER_S *pstConsumer) {
+  RKADK_VENC_ITEM_S *pstItem = NULL;
+
+  while ((pstItem = (RKADK_VENC_ITEM_S *)RKADK_RING_Pop(pstConsumer->pProc))) {
+    RK_MPI_MB_ReleaseMB(pstItem->stPack.pMbBlk);
+    RKADK_RING_Push(pstConsumer->pFree, pstItem);
+  }
+}
+
+static void RKADK_MEDIA_VencReplayFree(RKADK_VENC_CONSUMER_S *pstConsumer) {
+  for (RKADK_U32 i = 0; i < pstConsumer->u32ReplayCnt; i++)
+    RK_MPI_MB_ReleaseMB(pstConsumer->pstReplay[i].stPack.pMbBlk);
+
+  if (pstConsumer->pstReplay)
+    free(pstConsumer->pstReplay);
+  pstConsumer->pstReplay = NULL;
+  pstConsumer->u32ReplayCnt = 0;
+}
+
+static void RKADK_MEDIA_VencConsumerReplay(RKADK_VENC_CONSUMER_S *pstConsumer) {
+  RKADK_VENC_ITEM_S *pstItem;
+
+  for (RKADK_U32 i = 0; i < pstConsumer->u32ReplayCnt; i++) {
+    pstItem = &pstConsumer->pstReplay[i];
+    pstItem->stData.stFrame.pstPack = &pstItem->stPack;
+    pstConsumer->pfnDataCB(pstItem->stData, pstConsumer->pHandle);
+    pstConsumer->u64ReplayPts = pstItem->stPack.u64PTS;
+  }
+
+  RKADK_MEDIA_VencReplayFree(pstConsumer);
+  __atomic_store_n(&pstConsumer->bReplay, false, __ATOMIC_RELEASE);
+}
+
+static bool RKADK_MEDIA_VencConsumerProc(void *params) {
+  RKADK_VENC_ITEM_S *pstItem = NULL;
+  RKADK_VENC_CONSUMER_S *pstConsumer = (RKADK_VENC_CONSUMER_S *)params;
+
+  // queued frames, a replay and the exit all give the signal
+  RKADK_SIGNAL_Wait(pstConsumer->pSignal, -1);
+  if (__atomic_load_n(&pstConsumer->bExit, __ATOMIC_ACQUIRE))
+    return false;
+
+  for (;;) {
+    if (__atomic_load_n(&pstConsumer->bReplay, __ATOMIC_ACQUIRE))
+      RKADK_MEDIA_VencConsumerReplay(pstConsumer);
+
+    pstItem = (RKADK_VENC_ITEM_S *)RKADK_RING_Pop(pstConsumer->pProc);
+    if (!pstItem)
+      break;
+
+    // the cached gop already had the frames queued before the replay
+    if (pstConsumer->u64ReplayPts && pstItem->stPack.u64PTS <= pstConsumer->u64ReplayPts) {
+      RK_MPI_MB_ReleaseMB(pstItem->stPack.pMbBlk);
+      RKADK_RING_Push(pstConsumer->pFree, pstItem);
+      RKADK_SIGNAL_Give(pstConsumer->pFreeSignal);
+      continue;
     }
+    pstConsumer->u64ReplayPts = 0;
+
+    pstConsumer->pfnDataCB(pstItem->stData, pstConsumer->pHandle);
+    RK_MPI_MB_ReleaseMB(pstItem->stPack.pMbBlk);
+    RKADK_RING_Push(pstConsumer->pFree, pstItem);
+    RKADK_SIGNAL_Give(pstConsumer->pFreeSignal);
   }
 
-  RKADK_LOGI("Exit get aenc mb thread");
+  return true;
+}
+
+static void RKADK_MEDIA_VencConsumerDestroy(RKADK_VENC_CONSUMER_S *pstConsumer) {
+  if (!pstConsumer)
+    return;
+
+  if (pstConsumer->pThread) {
+    __atomic_store_n(&pstConsumer->bExit, true, __ATOMIC_RELEASE);
+    RKADK_THREAD_SetExit(pstConsumer->pThread);
+    RKADK_SIGNAL_Give(pstConsumer->pSignal);
+    RKADK_THREAD_Destory(pstConsumer->pThread);
+  }
+
+  if (pstConsumer->pProc)
+    RKADK_MEDIA_VencConsumerDrain(pstConsumer);
+  RKADK_MEDIA_VencReplayFree(pstConsumer);
+
+  if (pstConsumer->u32DropCnt)
+    RKADK_LOGI("venc[%d] consumer dropped %d frames", pstConsumer->s32ChnId,
+               pstConsumer->u32DropCnt);
+
+  RKADK_RING_Destroy(pstConsumer->pFree);
+  RKADK_RING_Destroy(pstConsumer->pProc);
+  RKADK_SIGNAL_Destroy(pstConsumer->pSignal);
+  RKADK_SIGNAL_Destroy(pstConsumer->pFreeSignal);
+  if (pstConsumer->pstItem)
+    free(pstConsumer->pstItem);
+  free(pstConsumer);
+}
+
+static RKADK_VENC_CONSUMER_S *
+RKADK_MEDIA_VencConsumerCreate(RKADK_S32 s32ChnId, int idx,
+                               RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB,
+                               RKADK_VOID *pHandle,
+                               const RKADK_MEDIA_QUEUE_ATTR_S *pstQueueAttr) {
+  char name[256];
+  RKADK_VENC_CONSUMER_S *pstConsumer = NULL;
+
+  pstConsumer = (RKADK_VENC_CONSUMER_S *)malloc(sizeof(RKADK_VENC_CONSUMER_S));
+  if (!pstConsumer) {
+    RKADK_LOGE("malloc venc consumer failed");
+    return NULL;
+  }
+  memset(pstConsumer, 0, sizeof(RKADK_VENC_CONSUMER_S));
+
+  pstConsumer->s32ChnId = s32ChnId;
+  pstConsumer->pfnDataCB = pfnDataCB;
+  pstConsumer->pHandle = pHandle;
+  if (pstQueueAttr)
+    memcpy(&pstConsumer->stAttr, pstQueueAttr, sizeof(RKADK_MEDIA_QUEUE_ATTR_S));
+  if (!pstConsumer->stAttr.u32Depth)
+    pstConsumer->stAttr.u32Depth = RKADK_MEDIA_VENC_QUEUE_DEPTH;
+
+  pstConsumer->pstItem = (RKADK_VENC_ITEM_S *)calloc(pstConsumer->stAttr.u32Depth,
+                                                     sizeof(RKADK_VENC_ITEM_S));
+  pstConsumer->pFree = RKADK_RING_Create(pstConsumer->stAttr.u32Depth);
+  pstConsumer->pProc = RKADK_RING_Create(pstConsumer->stAttr.u32Depth);
+  pstConsumer->pSignal = RKADK_SIGNAL_Create(0, 1);
+  pstConsumer->pFreeSignal = RKADK_SIGNAL_Create(0, 1);
+  if (!pstConsumer->pstItem || !pstConsumer->pFree || !pstConsumer->pProc ||
+      !pstConsumer->pSignal || !pstConsumer->pFreeSignal) {
+    RKADK_LOGE("venc[%d] consumer queue init failed", s32ChnId);
+    RKADK_MEDIA_VencConsumerDestroy(pstConsumer);
+    return NULL;
+  }
+
+  for (int i = 0; i < (int)pstConsumer->stAttr.u32Depth; i++)
+    RKADK_RING_Push(pstConsumer->pFree, &pstConsumer->pstItem[i]);
+
+  snprintf(name, sizeof(name), "VencCb_%d_%d", s32ChnId, idx);
+  pstConsumer->pThread =
+      RKADK_THREAD_Create(RKADK_MEDIA_VencConsumerProc, pstConsumer, name);
+  if (!pstConsumer->pThread) {
+    RKADK_MEDIA_VencConsumerDestroy(pstConsumer);
+    return NULL;
+  }
+
+  return pstConsumer;
+}
+
+// fetch thread side, called with the consumer mutex held
+static void RKADK_MEDIA_VencDispatch(RKADK_VENC_CONSUMER_S *pstConsumer,
+                                     RKADK_MEDIA_VENC_DATA_S *pstData, bool bIdr,
+                                     bool bWait) {
+  RKADK_S64 s64LeftMs;
+  RKADK_U64 u64EndUs;
+  RKADK_VENC_ITEM_S *pstItem = NULL;
+
+  if (pstConsumer->bWaitIDR) {
+    if (!bIdr) {
+      pstConsumer->u32DropCnt++;
+      return;
+    }
+
+    pstConsumer->bWaitIDR = false;
+  }
+
+  pstItem = (RKADK_VENC_ITEM_S *)RKADK_RING_Pop(pstConsumer->pFree);
+  if (!pstItem && bWait && pstConsumer->stAttr.enOverflow == RKADK_MEDIA_QUEUE_BLOCK) {
+    // a freed item and the consumer removal both give the free signal
+    u64EndUs = RKADK_MEDIA_GetUs() + (RKADK_U64)pstConsumer->stAttr.u32BlockMs * 1000;
+    while (!pstItem && !__atomic_load_n(&pstConsumer->bExit, __ATOMIC_ACQUIRE)) {
+      s64LeftMs = ((RKADK_S64)u64EndUs - (RKADK_S64)RKADK_MEDIA_GetUs() + 999) / 1000;
+      if (s64LeftMs <= 0)
+        break;
+
+      RKADK_SIGNAL_Wait(pstConsumer->pFreeSignal, s64LeftMs);
+      pstItem = (RKADK_VENC_ITEM_S *)RKADK_RING_Pop(pstConsumer->pFree);
+    }
+  }
+
+  if (!pstItem) {
+    // the frames after a dropped one can't be decoded until the next IDR,
+    // a forced IDR would also land in the file of a shared venc
+    RKADK_LOGW("venc[%d] consumer queue full, drop to the next IDR",
+               pstConsumer->s32ChnId);
+    pstConsumer->u32DropCnt++;
+    pstConsumer->bWaitIDR = true;
+    if (!pstConsumer->stAttr.bNoRequestIDR)
+      RK_MPI_VENC_RequestIDR(pstConsumer->s32ChnId, RK_FALSE);
+    return;
+  }
+
+  memcpy(&pstItem->stData, pstData, sizeof(RKADK_MEDIA_VENC_DATA_S));
+  memcpy(&pstItem->stPack, pstData->stFrame.pstPack, sizeof(VENC_PACK_S));
+  pstItem->stData.stFrame.pstPack = &pstItem->stPack;
+  RK_MPI_MB_AddUserCnt(pstItem->stPack.pMbBlk);
+
+  RKADK_RING_Push(pstConsumer->pProc, pstItem);
+  RKADK_SIGNAL_Give(pstConsumer->pSignal);
+}
+
+static void RKADK_MEDIA_VencReport(RKADK_MEDIA_INFO_S *pstMediaInfo,
+                                   RKADK_MEDIA_EVENT_E enEvent, bool bDump) {
+  RKADK_MEDIA_EVENT_INFO_S stEventInfo;
+
+  memset(&stEventInfo, 0, sizeof(stEventInfo));
+  stEventInfo.enEvent = enEvent;
+  stEventInfo.u32CamId = pstMediaInfo->u32CamId;
+  stEventInfo.s32VencChnId = pstMediaInfo->s32ChnId;
+  stEventInfo.u64TimeoutCnt = pstMediaInfo->stGetVencMBAttr.u64TimeoutCnt;
+  stEventInfo.s64RecentPts = pstMediaInfo->stGetVencMBAttr.s64RecentPts;
+  RKADK_WATCHDOG_Report(&stEventInfo, bDump);
+}
+
+static void RKADK_MEDIA_VencGopClear(RKADK_VENC_GOP_CACHE_S *pstGop) {
+  for (RKADK_U32 i = 0; i < pstGop->u32Cnt; i++)
+    RK_MPI_MB_ReleaseMB(pstGop->pstItem[i].stPack.pMbBlk);
+
+  pstGop->u32Cnt = 0;
+  pstGop->u32Bytes = 0;
+}
+
+// fetch thread side, called with the consumer mutex held
+static void RKADK_MEDIA_VencGopCache(RKADK_VENC_GOP_CACHE_S *pstGop,
+                                     RKADK_MEDIA_VENC_DATA_S *pstData, bool bIdr) {
+  RKADK_VENC_ITEM_S *pstItem;
+
+  if (!pstGop->pstItem)
+    return;
+
+  if (bIdr)
+    RKADK_MEDIA_VencGopClear(pstGop);
+  else if (!pstGop->u32Cnt)
+    return;
+
+  // a gop larger than the cache, nothing is cached until the next IDR
+  if (pstGop->u32Cnt >= RKADK_MEDIA_GOP_CACHE_MAX_CNT
+      || pstGop->u32Bytes + pstData->stFrame.pstPack->u32Len > pstGop->u32MaxBytes) {
+    RKADK_LOGD("gop cache full, cnt[%d] bytes[%d]", pstGop->u32Cnt, pstGop->u32Bytes);
+    RKADK_MEDIA_VencGopClear(pstGop);
+    return;
+  }
+
+  pstItem = &pstGop->pstItem[pstGop->u32Cnt++];
+  memcpy(&pstItem->stData, pstData, sizeof(RKADK_MEDIA_VENC_DATA_S));
+  memcpy(&pstItem->stPack, pstData->stFrame.pstPack, sizeof(VENC_PACK_S));
+  pstItem->stData.stFrame.pstPack = &pstItem->stPack;
+  RK_MPI_MB_AddUserCnt(pstItem->stPack.pMbBlk);
+  pstGop->u32Bytes += pstItem->stPack.u32Len;
+}
+
+// only hand the buffer out here, every consumer runs on its own thread
+static void RKADK_MEDIA_VencDeliver(RKADK_MEDIA_INFO_S *pstMediaInfo,
+                                    RKADK_MEDIA_VENC_DATA_S *pstData, bool bWait) {
+  int ret;
+  bool bIdr;
+
+  bIdr = RKADK_MEDIA_CheckIdrFrame(RKADK_MEDIA_GetCodecType(pstMediaInfo->enCodecType),
+                                   pstData->stFrame.pstPack->DataType);
+  RKADK_MUTEX_LOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+  RKADK_MEDIA_VencGopCache(&pstMediaInfo->stGetVencMBAttr.stGop, pstData, bIdr);
+  for (int i = 0; i < RKADK_MEDIA_VENC_MAX_CNT; i++)
+    if (pstMediaInfo->stGetVencMBAttr.pstConsumer[i])
+      RKADK_MEDIA_VencDispatch(pstMediaInfo->stGetVencMBAttr.pstConsumer[i],
+                               pstData, bIdr, bWait);
+  RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+
+  if (pstMediaInfo->stGetVencMBAttr.u64TimeoutCnt) {
+    RKADK_LOGI("venc chn[%d] recovered after %llu timeouts", pstMediaInfo->s32ChnId,
+               pstMediaInfo->stGetVencMBAttr.u64TimeoutCnt);
+    RKADK_MEDIA_VencReport(pstMediaInfo, RKADK_MEDIA_EVENT_VENC_RECOVER, false);
+  }
+
+  pstMediaInfo->stGetVencMBAttr.s64RecentPts = pstData->stFrame.pstPack->u64PTS;
+  pstMediaInfo->stGetVencMBAttr.u64TimeoutCnt = 0;
+  ret = RK_MPI_VENC_ReleaseStream(pstMediaInfo->s32ChnId, &pstData->stFrame);
+  if (ret)
+    RKADK_LOGE("RK_MPI_VENC_ReleaseStream failed[%x]", ret);
+}
+
+static void RKADK_MEDIA_VencTimeout(RKADK_MEDIA_INFO_S *pstMediaInfo) {
+  RKADK_U64 u64TimeoutCnt = ++pstMediaInfo->stGetVencMBAttr.u64TimeoutCnt;
+
+  // report the 1st, 2nd, 4th, 8th... timeout of a stall only,
+  // the watchdog thread raises the event and dumps the video info
+  if (u64TimeoutCnt & (u64TimeoutCnt - 1))
+    return;
+
+  RKADK_LOGE("RK_MPI_VENC_GetStream chn[%d] timeout, cnt[%llu] recent pts[%lld]",
+             pstMediaInfo->s32ChnId, u64TimeoutCnt,
+             pstMediaInfo->stGetVencMBAttr.s64RecentPts);
+  RKADK_MEDIA_VencReport(pstMediaInfo, RKADK_MEDIA_EVENT_VENC_STALL,
+                         u64TimeoutCnt == 1);
+}
+
+static void *RKADK_MEDIA_GetVencMb(void *params) {
+  int ret;
+  RKADK_MEDIA_VENC_DATA_S stData;
+  VENC_PACK_S stPack;
+
+  RKADK_MEDIA_INFO_S *pstMediaInfo = (RKADK_MEDIA_INFO_S *)params;
+  if (!pstMediaInfo) {
+    RKADK_LOGE("Get MB thread invalid param");
+    return NULL;
+  }
+
+  memset(&stData, 0, sizeof(stData));
+  memset(&stPack, 0, sizeof(stPack));
+  stData.stFrame.pstPack = &stPack;
+  stData.u32ChnId = pstMediaInfo->s32ChnId;
+  while (pstMediaInfo->stGetVencMBAttr.bGetBuffer) {
+    ret = RK_MPI_VENC_GetStream(pstMediaInfo->s32ChnId, &stData.stFrame, 1200);
+
+    if (ret == RK_SUCCESS)
+      RKADK_MEDIA_VencDeliver(pstMediaInfo, &stData, true);
+    else
+      RKADK_MEDIA_VencTimeout(pstMediaInfo);
+  }
+
+  RKADK_LOGI("Exit get venc mb thread");
   return NULL;
 }
 
+static void RKADK_MEDIA_FetchEnable(RKADK_MEDIA_FETCHER_S *pstFetcher,
+                                    RKADK_MEDIA_FETCH_SRC_S *pstSrc, bool bEnable) {
+  struct epoll_event ev;
+
+  if (pstSrc->bThrottled == !bEnable)
+    return;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = bEnable ? EPOLLIN : 0;
+  ev.data.ptr = pstSrc;
+  if (epoll_ctl(pstFetcher->epfd, EPOLL_CTL_MOD, pstSrc->fd, &ev))
+    RKADK_LOGE("epoll mod fd[%d] failed[%d]", pstSrc->fd, errno);
+
+  pstSrc->bThrottled = !bEnable;
+  if (bEnable)
+    pstSrc->u64LastUs = RKADK_MEDIA_GetUs();
+}
+
+// the longest block time of the blocking consumers without a free slot
+static RKADK_U32 RKADK_MEDIA_VencBlockMs(RKADK_MEDIA_INFO_S *pstMediaInfo) {
+  RKADK_U32 u32BlockMs = 0;
+  RKADK_VENC_CONSUMER_S *pstConsumer;
+
+  RKADK_MUTEX_LOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+  for (int i = 0; i < RKADK_MEDIA_VENC_MAX_CNT; i++) {
+    pstConsumer = pstMediaInfo->stGetVencMBAttr.pstConsumer[i];
+    if (!pstConsumer || __atomic_load_n(&pstConsumer->bExit, __ATOMIC_ACQUIRE)
+        || pstConsumer->bWaitIDR
+        || pstConsumer->stAttr.enOverflow != RKADK_MEDIA_QUEUE_BLOCK)
+      continue;
+
+    if (!RKADK_RING_Count(pstConsumer->pFree)
+        && pstConsumer->stAttr.u32BlockMs > u32BlockMs)
+      u32BlockMs = pstConsumer->stAttr.u32BlockMs;
+  }
+  RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+
+  return u32BlockMs;
+}
+
+// leave the stream in the encoder while a blocking consumer is full,
+// it is dropped to the next IDR once its block time is up
+static bool RKADK_MEDIA_FetchThrottle(RKADK_MEDIA_FETCHER_S *pstFetcher,
+                                      RKADK_MEDIA_FETCH_SRC_S *pstSrc) {
+  RKADK_U32 u32BlockMs;
+  RKADK_U64 u64NowUs;
+
+  u32BlockMs = RKADK_MEDIA_VencBlockMs((RKADK_MEDIA_INFO_S *)pstSrc->pstMediaInfo);
+  if (!u32BlockMs) {
+    pstSrc->u64ThrottleUs = 0;
+    RKADK_MEDIA_FetchEnable(pstFetcher, pstSrc, true);
+    return false;
+  }
+
+  u64NowUs = RKADK_MEDIA_GetUs();
+  if (!pstSrc->u64ThrottleUs)
+    pstSrc->u64ThrottleUs = u64NowUs;
+
+  if (u64NowUs - pstSrc->u64ThrottleUs >= (RKADK_U64)u32BlockMs * 1000) {
+    RKADK_MEDIA_FetchEnable(pstFetcher, pstSrc, true);
+    return false;
+  }
+
+  RKADK_MEDIA_FetchEnable(pstFetcher, pstSrc, false);
+  return true;
+}
+
+static void RKADK_MEDIA_FetchVenc(RKADK_MEDIA_FETCHER_S *pstFetcher,
+                                  RKADK_MEDIA_FETCH_SRC_S *pstSrc) {
+  RKADK_MEDIA_VENC_DATA_S stData;
+  VENC_PACK_S stPack;
+  RKADK_MEDIA_INFO_S *pstMediaInfo = (RKADK_MEDIA_INFO_S *)pstSrc->pstMediaInfo;
+
+  memset(&stData, 0, sizeof(stData));
+  memset(&stPack, 0, sizeof(stPack));
+  stData.stFrame.pstPack = &stPack;
+  stData.u32ChnId = pstMediaInfo->s32ChnId;
+
+  // bounded, so a busy channel can't starve the others
+  for (int i = 0; i < RKADK_MEDIA_FETCH_BURST; i++) {
+    if (RKADK_MEDIA_FetchThrottle(pstFetcher, pstSrc))
+      break;
+
+    if (RK_MPI_VENC_GetStream(pstMediaInfo->s32ChnId, &stData.stFrame, 0))
+      break;
+
+    pstSrc->u64LastUs = RKADK_MEDIA_GetUs();
+    RKADK_MEDIA_VencDeliver(pstMediaInfo, &stData, false);
+  }
+}
+
+static void RKADK_MEDIA_FetchAenc(RKADK_MEDIA_FETCH_SRC_S *pstSrc) {
+  AUDIO_STREAM_S stFrame;
+  RKADK_MEDIA_INFO_S *pstMediaInfo = (RKADK_MEDIA_INFO_S *)pstSrc->pstMediaInfo;
+
+  for (int i = 0; i < RKADK_MEDIA_FETCH_BURST; i++) {
+    if (RK_MPI_AENC_GetStream(pstMediaInfo->s32ChnId, &stFrame, 0))
+      break;
+
+    pstSrc->u64LastUs = RKADK_MEDIA_GetUs();
+    RKADK_MEDIA_AencDeliver(pstMediaInfo, &stFrame);
+  }
+}
+
+// resume throttled channels and report stalled ones,
+// return the epoll timeout until the next check
+static int RKADK_MEDIA_FetchCheck(RKADK_MEDIA_FETCHER_S *pstFetcher) {
+  int timeout = RKADK_MEDIA_FETCH_TIMEOUT_MS;
+  RKADK_U64 u64NowUs, u64IdleUs, u64StallUs;
+  RKADK_MEDIA_FETCH_SRC_S *pstSrc;
+
+  u64StallUs = (RKADK_U64)RKADK_MEDIA_FETCH_TIMEOUT_MS * 1000;
+  list_for_each_entry(pstSrc, &pstFetcher->stSrcList, mark) {
+    if (!pstSrc->bVenc)
+      continue;
+
+    if (pstSrc->bThrottled) {
+      RKADK_MEDIA_FetchThrottle(pstFetcher, pstSrc);
+      if (pstSrc->bThrottled) {
+        timeout = RKADK_MEDIA_FETCH_THROTTLE_MS;
+        continue;
+      }
+    }
+
+    u64NowUs = RKADK_MEDIA_GetUs();
+    u64IdleUs = u64NowUs - pstSrc->u64LastUs;
+    if (u64IdleUs >= u64StallUs) {
+      RKADK_MEDIA_VencTimeout((RKADK_MEDIA_INFO_S *)pstSrc->pstMediaInfo);
+      pstSrc->u64LastUs = u64NowUs;
+      u64IdleUs = 0;
+    }
+
+    if ((u64StallUs - u64IdleUs) / 1000 < (RKADK_U64)timeout)
+      timeout = (u64StallUs - u64IdleUs) / 1000 + 1;
+  }
+
+  return timeout;
+}
+
+static void *RKADK_MEDIA_FetchProc(void *params) {
+  int cnt, timeout = RKADK_MEDIA_FETCH_TIMEOUT_MS;
+  eventfd_t value;
+  struct epoll_event events[RKADK_MEDIA_FETCH_EVENT_CNT];
+  RKADK_MEDIA_FETCH_SRC_S *pstSrc;
+  RKADK_MEDIA_FETCHER_S *pstFetcher = (RKADK_MEDIA_FETCHER_S *)params;
+
+  while (pstFetcher->bRun) {
+    cnt = epoll_wait(pstFetcher->epfd, events, RKADK_MEDIA_FETCH_EVENT_CNT, timeout);
+    if (cnt < 0) {
+      if (errno != EINTR) {
+        RKADK_LOGE("epoll_wait failed[%d]", errno);
+        usleep(RKADK_MEDIA_FETCH_THROTTLE_MS * 1000);
+      }
+      cnt = 0;
+    }
+
+    RKADK_MUTEX_LOCK(pstFetcher->mutex);
+    for (int i = 0; i < cnt; i++) {
+      pstSrc = (RKADK_MEDIA_FETCH_SRC_S *)events[i].data.ptr;
+      if (!pstSrc) {
+        eventfd_read(pstFetcher->wakeFd, &value);
+        continue;
+      }
+
+      // removed after epoll_wait returned
+      if (!pstSrc->bAdded)
+        continue;
+
+      if (pstSrc->bVenc)
+        RKADK_MEDIA_FetchVenc(pstFetcher, pstSrc);
+      else
+        RKADK_MEDIA_FetchAenc(pstSrc);
+    }
+    timeout = RKADK_MEDIA_FetchCheck(pstFetcher);
+    RKADK_MUTEX_UNLOCK(pstFetcher->mutex);
+  }
+
+  RKADK_LOGI("Exit media fetch thread");
+  return NULL;
+}
+
+static int RKADK_MEDIA_FetcherStart(RKADK_MEDIA_FETCHER_S *pstFetcher,
+                                    const char *name) {
+  int ret;
+  struct epoll_event ev;
+
+  pstFetcher->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (pstFetcher->epfd < 0) {
+    RKADK_LOGE("epoll_create1 failed[%d]", errno);
+    return -1;
+  }
+
+  pstFetcher->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (pstFetcher->wakeFd < 0) {
+    RKADK_LOGE("eventfd failed[%d]", errno);
+    goto failed;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(pstFetcher->epfd, EPOLL_CTL_ADD, pstFetcher->wakeFd, &ev)) {
+    RKADK_LOGE("epoll add eventfd failed[%d]", errno);
+    goto failed;
+  }
+
+  pstFetcher->bRun = true;
+  ret = pthread_create(&pstFetcher->tid, NULL, RKADK_MEDIA_FetchProc, pstFetcher);
+  if (ret) {
+    RKADK_LOGE("Create %s thread failed %d", name, ret);
+    pstFetcher->bRun = false;
+    pstFetcher->tid = 0;
+    goto failed;
+  }
+  pthread_setname_np(pstFetcher->tid, name);
+  return 0;
+
+failed:
+  if (pstFetcher->wakeFd >= 0)
+    close(pstFetcher->wakeFd);
+  close(pstFetcher->epfd);
+  pstFetcher->wakeFd = -1;
+  pstFetcher->epfd = -1;
+  return -1;
+}
+
+static int RKADK_MEDIA_FetcherAdd(RKADK_MEDIA_FETCHER_S *pstFetcher,
+                                  RKADK_MEDIA_FETCH_SRC_S *pstSrc,
+                                  const char *name) {
+  int ret = 0;
+  struct epoll_event ev;
+
+  RKADK_MUTEX_LOCK(pstFetcher->mutex);
+  if (pstFetcher->epfd < 0) {
+    ret = RKADK_MEDIA_FetcherStart(pstFetcher, name);
+    if (ret)
+      goto exit;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = pstSrc;
+  ret = epoll_ctl(pstFetcher->epfd, EPOLL_CTL_ADD, pstSrc->fd, &ev);
+  if (ret) {
+    RKADK_LOGE("epoll add fd[%d] failed[%d]", pstSrc->fd, errno);
+    goto exit;
+  }
+
+  pstSrc->bAdded = true;
+  pstSrc->bThrottled = false;
+  pstSrc->u64ThrottleUs = 0;
+  pstSrc->u64LastUs = RKADK_MEDIA_GetUs();
+  list_add_tail(&pstSrc->mark, &pstFetcher->stSrcList);
+  pstFetcher->s32SrcCnt++;
+
+exit:
+  RKADK_MUTEX_UNLOCK(pstFetcher->mutex);
+  return ret;
+}
+
+static void RKADK_MEDIA_FetcherDel(RKADK_MEDIA_FETCHER_S *pstFetcher,
+                                   RKADK_MEDIA_FETCH_SRC_S *pstSrc) {
+  RKADK_MUTEX_LOCK(pstFetcher->mutex);
+  if (!pstSrc->bAdded) {
+    RKADK_MUTEX_UNLOCK(pstFetcher->mutex);
+    return;
+  }
+
+  if (epoll_ctl(pstFetcher->epfd, EPOLL_CTL_DEL, pstSrc->fd, NULL))
+    RKADK_LOGE("epoll del fd[%d] failed[%d]", pstSrc->fd, errno);
+
+  pstSrc->bAdded = false;
+  list_del(&pstSrc->mark);
+  pstFetcher->s32SrcCnt--;
+  if (pstFetcher->s32SrcCnt > 0) {
+    RKADK_MUTEX_UNLOCK(pstFetcher->mutex);
+    return;
+  }
+
+  pstFetcher->bRun = false;
+  RKADK_MUTEX_UNLOCK(pstFetcher->mutex);
+
+  // add and del of one fetcher are serialized by the venc/aenc mutex
+  eventfd_write(pstFetcher->wakeFd, 1);
+  if (pthread_join(pstFetcher->tid, NULL))
+    RKADK_LOGE("Exit media fetch thread failed!");
+  else
+    RKADK_LOGI("Exit media fetch thread ok");
+
+  close(pstFetcher->wakeFd);
+  close(pstFetcher->epfd);
+  pstFetcher->wakeFd = -1;
+  pstFetcher->epfd = -1;
+  pstFetcher->tid = 0;
+}
+
 RKADK_S32 RKADK_MEDIA_GetAencBuffer(MPP_CHN_S *pstChn,
                                     RKADK_MEDIA_AENC_DATA_PROC_FUNC pfnDataCB,
                                     RKADK_VOID *pHandle) {
   int ret = -1;
   char name[256];
-  RKADK_S32 i;
+  RKADK_S32 i, idx;
   RKADK_MEDIA_INFO_S *pstMediaInfo;
+  RKADK_AENC_CONSUMER_S *pstConsumer;
+  RKADK_MEDIA_FETCH_SRC_S *pstSrc;
 
   RKADK_MUTEX_LOCK(g_stMediaCtx.aencMutex);
 
@@ -1380,11 +2250,25 @@ RKADK_S32 RKADK_MEDIA_GetAencBuffer(MPP_CHN_S *pstChn,
     goto exit;
   }
 
-  pstMediaInfo->stGetAencMBAttr
-      .cbList[pstMediaInfo->stGetAencMBAttr.s32GetCnt] = pfnDataCB;
-  pstMediaInfo->stGetAencMBAttr
-      .pHandle[pstMediaInfo->stGetAencMBAttr.s32GetCnt] = pHandle;
+  for (idx = 0; idx < RKADK_MEDIA_AENC_MAX_CNT; idx++)
+    if (!pstMediaInfo->stGetAencMBAttr.pstConsumer[idx])
+      break;
+
+  if (idx >= RKADK_MEDIA_AENC_MAX_CNT) {
+    RKADK_LOGE("aencChnId[%d] consumer cnt exceeds %d", pstChn->s32ChnId,
+               RKADK_MEDIA_AENC_MAX_CNT);
+    goto exit;
+  }
+
+  pstConsumer = RKADK_MEDIA_AencConsumerCreate(pstChn->s32ChnId, idx, pfnDataCB,
+                                               pHandle);
+  if (!pstConsumer)
+    goto exit;
+
+  RKADK_MUTEX_LOCK(pstMediaInfo->stGetAencMBAttr.consumerMutex);
+  pstMediaInfo->stGetAencMBAttr.pstConsumer[idx] = pstConsumer;
   pstMediaInfo->stGetAencMBAttr.s32GetCnt++;
+  RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetAencMBAttr.consumerMutex);
 
   if (pstMediaInfo->stGetAencMBAttr.bGetBuffer) {
     RKADK_LOGE("Get aencChnId[%d] MB thread has been created, s32GetCnt[%d]",
@@ -1394,6 +2278,24 @@ RKADK_S32 RKADK_MEDIA_GetAencBuffer(MPP_CHN_S *pstChn,
   }
 
   pstMediaInfo->stGetAencMBAttr.bGetBuffer = true;
+
+  pstSrc = &pstMediaInfo->stGetAencMBAttr.stFetchSrc;
+  pstSrc->fd = RK_MPI_AENC_GetFd(pstChn->s32ChnId);
+  pstSrc->bVenc = false;
+  pstSrc->pstMediaInfo = pstMediaInfo;
+  if (pstSrc->fd > 0 && !RKADK_MEDIA_FetcherAdd(&g_stMediaCtx.stAencFetcher,
+                                                pstSrc, "AencFetch")) {
+    ret = 0;
+    goto exit;
+  }
+
+  // no pollable fd, fall back to a thread of its own
+  RKADK_LOGW("aencChnId[%d] fd[%d] can't be polled", pstChn->s32ChnId, pstSrc->fd);
+  if (pstSrc->fd > 0) {
+    RK_MPI_AENC_CloseFd(pstChn->s32ChnId);
+    pstSrc->fd = -1;
+  }
+
   ret = pthread_create(&pstMediaInfo->stGetAencMBAttr.tid, NULL,
                        RKADK_MEDIA_GetAencMb, pstMediaInfo);
   if (ret) {
@@ -1415,6 +2317,7 @@ RKADK_MEDIA_StopGetAencBuffer(MPP_CHN_S *pstChn,
                               RKADK_VOID *pHandle) {
   int i, ret = 0;
   RKADK_MEDIA_INFO_S *pstMediaInfo;
+  RKADK_AENC_CONSUMER_S *pstConsumer;
 
   RKADK_MUTEX_LOCK(g_stMediaCtx.aencMutex);
 
@@ -1434,18 +2337,28 @@ RKADK_MEDIA_StopGetAencBuffer(MPP_CHN_S *pstChn,
   }
 
   for (i = 0; i < RKADK_MEDIA_AENC_MAX_CNT; i++) {
-    if (pstMediaInfo->stGetAencMBAttr.cbList[i] == pfnDataCB
-        && pstMediaInfo->stGetAencMBAttr.pHandle[i] == pHandle) {
-      RKADK_LOGD("remove i[%d] cbList s32GetCnt[%d]", i, pstMediaInfo->stGetAencMBAttr.s32GetCnt);
-      pstMediaInfo->stGetAencMBAttr.cbList[i] = NULL;
-      pstMediaInfo->stGetAencMBAttr.pHandle[i] = NULL;
+    pstConsumer = pstMediaInfo->stGetAencMBAttr.pstConsumer[i];
+    if (pstConsumer && pstConsumer->pfnDataCB == pfnDataCB
+        && pstConsumer->pHandle == pHandle) {
+      RKADK_LOGD("remove i[%d] consumer s32GetCnt[%d]", i, pstMediaInfo->stGetAencMBAttr.s32GetCnt);
+      RKADK_MUTEX_LOCK(pstMediaInfo->stGetAencMBAttr.consumerMutex);
+      pstMediaInfo->stGetAencMBAttr.pstConsumer[i] = NULL;
       pstMediaInfo->stGetAencMBAttr.s32GetCnt--;
+      RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetAencMBAttr.consumerMutex);
+
+      RKADK_MEDIA_AencConsumerDestroy(pstConsumer);
       break;
     }
   }
 
   if (!pstMediaInfo->stGetAencMBAttr.s32GetCnt) {
     pstMediaInfo->stGetAencMBAttr.bGetBuffer = false;
+    RKADK_MEDIA_FetcherDel(&g_stMediaCtx.stAencFetcher,
+                           &pstMediaInfo->stGetAencMBAttr.stFetchSrc);
+    if (pstMediaInfo->stGetAencMBAttr.stFetchSrc.fd > 0) {
+      RK_MPI_AENC_CloseFd(pstChn->s32ChnId);
+      pstMediaInfo->stGetAencMBAttr.stFetchSrc.fd = -1;
+    }
     if (pstMediaInfo->stGetAencMBAttr.tid) {
       RKADK_LOGD("Request to cancel aenc mb thread...");
       ret = pthread_join(pstMediaInfo->stGetAencMBAttr.tid, NULL);
@@ -1462,62 +2375,117 @@ exit:
   return ret;
 }
 
-static void *RKADK_MEDIA_GetVencMb(void *params) {
-  int ret;
-  RKADK_MEDIA_VENC_DATA_S stData;
-  VENC_PACK_S stPack;
+RKADK_S32 RKADK_MEDIA_RegisterEventCallback(
+    RKADK_MEDIA_EVENT_CALLBACK_FN pfnEventCallback, RKADK_MW_PTR pHandle) {
+  RKADK_WATCHDOG_SetCallback(pfnEventCallback, pHandle);
+  return 0;
+}
 
-  RKADK_MEDIA_INFO_S *pstMediaInfo = (RKADK_MEDIA_INFO_S *)params;
-  if (!pstMediaInfo) {
-    RKADK_LOGE("Get MB thread invalid param");
-    return NULL;
+// the cache is kept while a consumer asks for it, called with the consumer mutex held
+static void RKADK_MEDIA_VencGopGet(RKADK_VENC_GOP_CACHE_S *pstGop) {
+  RKADK_PARAM_COMM_CFG_S *pstCommCfg;
+
+  if (!pstGop->pstItem) {
+    pstCommCfg = RKADK_PARAM_GetCommCfg();
+    if (pstCommCfg && pstCommCfg->gop_cache_size)
+      pstGop->u32MaxBytes = pstCommCfg->gop_cache_size * 1024;
+    else
+      pstGop->u32MaxBytes = RKADK_MEDIA_GOP_CACHE_SIZE * 1024;
+
+    pstGop->pstItem = (RKADK_VENC_ITEM_S *)calloc(RKADK_MEDIA_GOP_CACHE_MAX_CNT,
+                                                  sizeof(RKADK_VENC_ITEM_S));
+    if (!pstGop->pstItem) {
+      RKADK_LOGE("malloc gop cache failed");
+      return;
+    }
   }
 
-  memset(&stData, 0, sizeof(stData));
-  memset(&stPack, 0, sizeof(stPack));
-  stData.stFrame.pstPack = &stPack;
-  stData.u32ChnId = pstMediaInfo->s32ChnId;
-  while (pstMediaInfo->stGetVencMBAttr.bGetBuffer) {
-    ret = RK_MPI_VENC_GetStream(pstMediaInfo->s32ChnId, &stData.stFrame, 1200);
+  pstGop->s32UserCnt++;
+}
 
-    if (ret == RK_SUCCESS) {
-      for (int i = 0; i < (int)pstMediaInfo->stGetVencMBAttr.s32GetCnt; i++)
-        if (pstMediaInfo->stGetVencMBAttr.cbList[i])
-          pstMediaInfo->stGetVencMBAttr.cbList[i](
-              stData, pstMediaInfo->stGetVencMBAttr.pHandle[i]);
+static void RKADK_MEDIA_VencGopPut(RKADK_VENC_GOP_CACHE_S *pstGop) {
+  if (!pstGop->pstItem || --pstGop->s32UserCnt > 0)
+    return;
 
-      pstMediaInfo->stGetVencMBAttr.s64RecentPts = stData.stFrame.pstPack->u64PTS;
-      pstMediaInfo->stGetVencMBAttr.u64TimeoutCnt = 0;
-      ret = RK_MPI_VENC_ReleaseStream(pstMediaInfo->s32ChnId, &stData.stFrame);
-      if (ret)
-        RKADK_LOGE("RK_MPI_VENC_ReleaseStream failed[%x]", ret);
-    } else {
-      RKADK_LOGE("RK_MPI_VENC_GetStream chn[%d] timeout[%x]", pstMediaInfo->s32ChnId, ret);
-      pstMediaInfo->stGetVencMBAttr.u64TimeoutCnt++;
-      //dump video info
-#ifdef RV1106_1103
-      system("cat /dev/mpi/vsys");
-      system("cat /proc/vcodec/enc/venc_info");
-#else
-      system("dumpsys sys");
-      system("dumpsys vi");
-      system("dumpsys vpss");
-      system("dumpsys venc");
-#endif
-    }
+  RKADK_MEDIA_VencGopClear(pstGop);
+  free(pstGop->pstItem);
+  pstGop->pstItem = NULL;
+  pstGop->s32UserCnt = 0;
+}
+
+RKADK_S32 RKADK_MEDIA_ReplayVencGop(MPP_CHN_S *pstChn,
+                                    RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB,
+                                    RKADK_VOID *pHandle) {
+  int i, ret = -1;
+  RKADK_MEDIA_INFO_S *pstMediaInfo;
+  RKADK_VENC_GOP_CACHE_S *pstGop;
+  RKADK_VENC_CONSUMER_S *pstConsumer = NULL;
+
+  RKADK_MUTEX_LOCK(g_stMediaCtx.vencMutex);
+
+  i = RKADK_MEDIA_GetIdx(g_stMediaCtx.stVencInfo, RKADK_MEDIA_VENC_MAX_CNT, 0,
+                         pstChn->s32ChnId, "VENC_GET_MB");
+  if (i < 0) {
+    RKADK_LOGE("not find matched index[%d] s32ChnId[%d]", i, pstChn->s32ChnId);
+    goto exit;
   }
 
-  RKADK_LOGI("Exit get venc mb thread");
-  return NULL;
+  pstMediaInfo = &g_stMediaCtx.stVencInfo[i];
+  pstGop = &pstMediaInfo->stGetVencMBAttr.stGop;
+
+  RKADK_MUTEX_LOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+  for (i = 0; i < RKADK_MEDIA_VENC_MAX_CNT; i++) {
+    pstConsumer = pstMediaInfo->stGetVencMBAttr.pstConsumer[i];
+    if (pstConsumer && pstConsumer->pfnDataCB == pfnDataCB
+        && pstConsumer->pHandle == pHandle)
+      break;
+    pstConsumer = NULL;
+  }
+
+  if (!pstConsumer || !pstGop->u32Cnt
+      || __atomic_load_n(&pstConsumer->bReplay, __ATOMIC_ACQUIRE)) {
+    RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+    goto exit;
+  }
+
+  pstConsumer->pstReplay = (RKADK_VENC_ITEM_S *)malloc(pstGop->u32Cnt * sizeof(RKADK_VENC_ITEM_S));
+  if (!pstConsumer->pstReplay) {
+    RKADK_LOGE("malloc gop replay failed");
+    RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+    goto exit;
+  }
+
+  memcpy(pstConsumer->pstReplay, pstGop->pstItem, pstGop->u32Cnt * sizeof(RKADK_VENC_ITEM_S));
+  pstConsumer->u32ReplayCnt = pstGop->u32Cnt;
+  for (RKADK_U32 j = 0; j < pstGop->u32Cnt; j++)
+    RK_MPI_MB_AddUserCnt(pstConsumer->pstReplay[j].stPack.pMbBlk);
+  __atomic_store_n(&pstConsumer->bReplay, true, __ATOMIC_RELEASE);
+  RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+
+  RKADK_SIGNAL_Give(pstConsumer->pSignal);
+  ret = 0;
+
+exit:
+  RKADK_MUTEX_UNLOCK(g_stMediaCtx.vencMutex);
+  return ret;
 }
 
 RKADK_S32 RKADK_MEDIA_GetVencBuffer(MPP_CHN_S *pstChn,
                                     RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB,
                                     RKADK_VOID *pHandle) {
+  return RKADK_MEDIA_GetVencBufferEx(pstChn, pfnDataCB, pHandle, NULL);
+}
+
+RKADK_S32 RKADK_MEDIA_GetVencBufferEx(MPP_CHN_S *pstChn,
+                                      RKADK_MEDIA_VENC_DATA_PROC_FUNC pfnDataCB,
+                                      RKADK_VOID *pHandle,
+                                      const RKADK_MEDIA_QUEUE_ATTR_S *pstQueueAttr) {
   int ret = -1;
-  RKADK_S32 i;
+  RKADK_S32 i, idx;
   char name[256];
   RKADK_MEDIA_INFO_S *pstMediaInfo;
+  RKADK_VENC_CONSUMER_S *pstConsumer;
+  RKADK_MEDIA_FETCH_SRC_S *pstSrc;
 
   RKADK_MUTEX_LOCK(g_stMediaCtx.vencMutex);
 
@@ -1534,11 +2502,27 @@ RKADK_S32 RKADK_MEDIA_GetVencBuffer(MPP_CHN_S *pstChn,
     goto exit;
   }
 
-  pstMediaInfo->stGetVencMBAttr
-      .cbList[pstMediaInfo->stGetVencMBAttr.s32GetCnt] = pfnDataCB;
-  pstMediaInfo->stGetVencMBAttr
-      .pHandle[pstMediaInfo->stGetVencMBAttr.s32GetCnt] = pHandle;
+  for (idx = 0; idx < RKADK_MEDIA_VENC_MAX_CNT; idx++)
+    if (!pstMediaInfo->stGetVencMBAttr.pstConsumer[idx])
+      break;
+
+  if (idx >= RKADK_MEDIA_VENC_MAX_CNT) {
+    RKADK_LOGE("vencChnId[%d] consumer cnt exceeds %d", pstChn->s32ChnId,
+               RKADK_MEDIA_VENC_MAX_CNT);
+    goto exit;
+  }
+
+  pstConsumer = RKADK_MEDIA_VencConsumerCreate(pstChn->s32ChnId, idx, pfnDataCB,
+                                               pHandle, pstQueueAttr);
+  if (!pstConsumer)
+    goto exit;
+
+  RKADK_MUTEX_LOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+  if (pstConsumer->stAttr.bGopCache)
+    RKADK_MEDIA_VencGopGet(&pstMediaInfo->stGetVencMBAttr.stGop);
+  pstMediaInfo->stGetVencMBAttr.pstConsumer[idx] = pstConsumer;
   pstMediaInfo->stGetVencMBAttr.s32GetCnt++;
+  RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
 
   if (pstMediaInfo->stGetVencMBAttr.bGetBuffer) {
     RKADK_LOGE("Get vencChnId[%d] MB thread has been created, s32GetCnt[%d]",
@@ -1548,6 +2532,24 @@ RKADK_S32 RKADK_MEDIA_GetVencBuffer(MPP_CHN_S *pstChn,
   }
 
   pstMediaInfo->stGetVencMBAttr.bGetBuffer = true;
+
+  pstSrc = &pstMediaInfo->stGetVencMBAttr.stFetchSrc;
+  pstSrc->fd = RK_MPI_VENC_GetFd(pstChn->s32ChnId);
+  pstSrc->bVenc = true;
+  pstSrc->pstMediaInfo = pstMediaInfo;
+  if (pstSrc->fd > 0 && !RKADK_MEDIA_FetcherAdd(&g_stMediaCtx.stVencFetcher,
+                                                pstSrc, "VencFetch")) {
+    ret = 0;
+    goto exit;
+  }
+
+  // no pollable fd, fall back to a thread of its own
+  RKADK_LOGW("vencChnId[%d] fd[%d] can't be polled", pstChn->s32ChnId, pstSrc->fd);
+  if (pstSrc->fd > 0) {
+    RK_MPI_VENC_CloseFd(pstChn->s32ChnId);
+    pstSrc->fd = -1;
+  }
+
   ret = pthread_create(&pstMediaInfo->stGetVencMBAttr.tid, NULL,
                        RKADK_MEDIA_GetVencMb, pstMediaInfo);
   if (ret) {
@@ -1569,6 +2571,7 @@ RKADK_MEDIA_StopGetVencBuffer(MPP_CHN_S *pstChn,
                               RKADK_VOID *pHandle) {
   int i, ret = 0;
   RKADK_MEDIA_INFO_S *pstMediaInfo;
+  RKADK_VENC_CONSUMER_S *pstConsumer;
 
   RKADK_MUTEX_LOCK(g_stMediaCtx.vencMutex);
 
@@ -1588,18 +2591,33 @@ RKADK_MEDIA_StopGetVencBuffer(MPP_CHN_S *pstChn,
   }
 
   for (i = 0; i < RKADK_MEDIA_VENC_MAX_CNT; i++) {
-    if (pstMediaInfo->stGetVencMBAttr.cbList[i] == pfnDataCB
-        && pstMediaInfo->stGetVencMBAttr.pHandle[i] == pHandle) {
-      RKADK_LOGD("remove i[%d] cbList s32GetCnt[%d]", i, pstMediaInfo->stGetVencMBAttr.s32GetCnt);
-      pstMediaInfo->stGetVencMBAttr.cbList[i] = NULL;
-      pstMediaInfo->stGetVencMBAttr.pHandle[i] = NULL;
+    pstConsumer = pstMediaInfo->stGetVencMBAttr.pstConsumer[i];
+    if (pstConsumer && pstConsumer->pfnDataCB == pfnDataCB
+        && pstConsumer->pHandle == pHandle) {
+      RKADK_LOGD("remove i[%d] consumer s32GetCnt[%d]", i, pstMediaInfo->stGetVencMBAttr.s32GetCnt);
+      // a blocked dispatch gives up, then the fetch thread lets go of it
+      __atomic_store_n(&pstConsumer->bExit, true, __ATOMIC_RELEASE);
+      RKADK_SIGNAL_Give(pstConsumer->pFreeSignal);
+      RKADK_MUTEX_LOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+      pstMediaInfo->stGetVencMBAttr.pstConsumer[i] = NULL;
       pstMediaInfo->stGetVencMBAttr.s32GetCnt--;
+      if (pstConsumer->stAttr.bGopCache)
+        RKADK_MEDIA_VencGopPut(&pstMediaInfo->stGetVencMBAttr.stGop);
+      RKADK_MUTEX_UNLOCK(pstMediaInfo->stGetVencMBAttr.consumerMutex);
+
+      RKADK_MEDIA_VencConsumerDestroy(pstConsumer);
       break;
     }
   }
 
   if (!pstMediaInfo->stGetVencMBAttr.s32GetCnt) {
     pstMediaInfo->stGetVencMBAttr.bGetBuffer = false;
+    RKADK_MEDIA_FetcherDel(&g_stMediaCtx.stVencFetcher,
+                           &pstMediaInfo->stGetVencMBAttr.stFetchSrc);
+    if (pstMediaInfo->stGetVencMBAttr.stFetchSrc.fd > 0) {
+      RK_MPI_VENC_CloseFd(pstChn->s32ChnId);
+      pstMediaInfo->stGetVencMBAttr.stFetchSrc.fd = -1;
+    }
     if (pstMediaInfo->stGetVencMBAttr.tid) {
       RKADK_LOGD("Request to cancel venc mb thread...");
       ret = pthread_join(pstMediaInfo->stGetVencMBAttr.tid, NULL);
@@ -2024,6 +3042,57 @@ RKADK_S32 RKADK_MEDIA_SetRcAttr(VENC_RC_ATTR_S *pstRcAttr, RKADK_U32 u32Gop,
   return 0;
 }
 
+RKADK_U32 RKADK_MEDIA_GetLowLatencyGop(RKADK_U32 u32Gop, RKADK_U32 u32DstFrameRate) {
+  // a lost slice is healed by the next IDR
+  if (u32DstFrameRate && u32Gop > u32DstFrameRate)
+    return u32DstFrameRate;
+
+  return u32Gop;
+}
+
+RKADK_S32 RKADK_MEDIA_SetLowLatencyAttr(VENC_CHN_ATTR_S *pstVencAttr,
+                                        RKADK_CODEC_TYPE_E enCodecType,
+                                        RKADK_U32 u32Gop, RKADK_U32 u32BitRate,
+                                        RKADK_U32 u32SrcFrameRate,
+                                        RKADK_U32 u32DstFrameRate) {
+  switch (enCodecType) {
+  case RKADK_CODEC_TYPE_H264:
+    pstVencAttr->stRcAttr.enRcMode = VENC_RC_MODE_H264CBR;
+    break;
+  case RKADK_CODEC_TYPE_H265:
+    pstVencAttr->stRcAttr.enRcMode = VENC_RC_MODE_H265CBR;
+    break;
+  default:
+    RKADK_LOGE("Nonsupport low latency codec type: %d", enCodecType);
+    return -1;
+  }
+
+  // no reordering, a frame is sent as soon as it is encoded
+  pstVencAttr->stGopAttr.enGopMode = VENC_GOPMODE_NORMALP;
+  return RKADK_MEDIA_SetRcAttr(&pstVencAttr->stRcAttr,
+                               RKADK_MEDIA_GetLowLatencyGop(u32Gop, u32DstFrameRate),
+                               u32BitRate, u32SrcFrameRate, u32DstFrameRate);
+}
+
+void RKADK_MEDIA_CountLatency(RKADK_U64 u64Pts, RKADK_U32 *pu32AvgUs,
+                              RKADK_U32 *pu32MaxUs) {
+  RKADK_U64 u64NowUs = RKADK_MEDIA_GetUs();
+  RKADK_U32 u32LatencyUs;
+
+  if (!u64Pts || u64NowUs < u64Pts)
+    return;
+
+  u32LatencyUs = u64NowUs - u64Pts;
+  if (u32LatencyUs > *pu32MaxUs)
+    *pu32MaxUs = u32LatencyUs;
+
+  // moving average over the last few frames
+  if (!*pu32AvgUs)
+    *pu32AvgUs = u32LatencyUs;
+  else
+    *pu32AvgUs = ((RKADK_U64)*pu32AvgUs * 7 + u32LatencyUs) / 8;
+}
+
 bool RKADK_MEDIA_CompareResolution(VENC_CHN_ATTR_S *pstVencChnAttr,
                                 RKADK_U32 u32Width, RKADK_U32 u32Height) {
   RKADK_LOGD("Old width height[%d %d], new width height[%d %d]",
@@ -2259,12 +3328,38 @@ int RKADK_MEDIA_GetPixelFormat(PIXEL_FORMAT_E enPixelFormat,
 }
 
 bool RKADK_MEDIA_EnableAencRegister(RKADK_CODEC_TYPE_E eCodecType) {
-  if (eCodecType == RKADK_CODEC_TYPE_MP3 || eCodecType == RKADK_CODEC_TYPE_ACC)
+  // only mp3 has an external encoder, acc is built in
+  if (eCodecType == RKADK_CODEC_TYPE_MP3)
     return true;
 
   return false;
 }
 
+RKADK_S32 RKADK_MEDIA_GetLiveAencChn(RKADK_CODEC_TYPE_E enCodecType) {
+  switch (enCodecType) {
+  case RKADK_CODEC_TYPE_G711A:
+    return LIVE_AENC_CHN + 1;
+  case RKADK_CODEC_TYPE_G711U:
+    return LIVE_AENC_CHN + 2;
+  case RKADK_CODEC_TYPE_ACC:
+    return LIVE_AENC_CHN + 3;
+  default:
+    RKADK_LOGE("unsupported live audio codec[%d]", enCodecType);
+    return -1;
+  }
+}
+
+RKADK_U32 RKADK_MEDIA_GetAdtsHeaderLen(RKADK_U8 *pu8Data, RKADK_U32 u32Len) {
+  RKADK_U32 u32HeaderLen;
+
+  if (u32Len < 7 || pu8Data[0] != 0xFF || (pu8Data[1] & 0xF6) != 0xF0)
+    return 0;
+
+  // protection_absent == 0 adds a crc
+  u32HeaderLen = (pu8Data[1] & 0x01) ? 7 : 9;
+  return u32Len > u32HeaderLen ? u32HeaderLen : 0;
+}
+
 
 RKADK_S32 RKADK_MEDIA_SetVencRotation(RKADK_U32 u32CamId,
                               ROTATION_E enRotation, RKADK_STREAM_TYPE_E enStreamType) {
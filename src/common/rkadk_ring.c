@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "rkadk_ring.h"
+#include "rkadk_log.h"
+#include <string.h>
+
+#define RKADK_RING_CACHE_LINE 64
+
+typedef struct {
+  // written by consumer only
+  unsigned int head __attribute__((aligned(RKADK_RING_CACHE_LINE)));
+  // written by producer only
+  unsigned int tail __attribute__((aligned(RKADK_RING_CACHE_LINE)));
+  unsigned int size __attribute__((aligned(RKADK_RING_CACHE_LINE)));
+  void **slot;
+} RKADK_RING_S;
+
+void *RKADK_RING_Create(unsigned int depth) {
+  RKADK_RING_S *pstRing = NULL;
+
+  if (!depth) {
+    RKADK_LOGE("invalid ring depth");
+    return NULL;
+  }
+
+  pstRing = (RKADK_RING_S *)malloc(sizeof(RKADK_RING_S));
+  if (!pstRing) {
+    RKADK_LOGE("malloc ring failed");
+    return NULL;
+  }
+  memset(pstRing, 0, sizeof(RKADK_RING_S));
+
+  // one slot is always left empty to tell full from empty
+  pstRing->size = depth + 1;
+  pstRing->slot = (void **)malloc(pstRing->size * sizeof(void *));
+  if (!pstRing->slot) {
+    RKADK_LOGE("malloc ring slot failed");
+    free(pstRing);
+    return NULL;
+  }
+  memset(pstRing->slot, 0, pstRing->size * sizeof(void *));
+
+  return (void *)pstRing;
+}
+
+void RKADK_RING_Destroy(void *ring) {
+  RKADK_RING_S *pstRing = (RKADK_RING_S *)ring;
+
+  if (!pstRing)
+    return;
+
+  if (pstRing->slot)
+    free(pstRing->slot);
+
+  free(pstRing);
+}
+
+bool RKADK_RING_Push(void *ring, void *data) {
+  unsigned int tail, next;
+  RKADK_RING_S *pstRing = (RKADK_RING_S *)ring;
+
+  tail = __atomic_load_n(&pstRing->tail, __ATOMIC_RELAXED);
+  next = tail + 1;
+  if (next == pstRing->size)
+    next = 0;
+
+  if (next == __atomic_load_n(&pstRing->head, __ATOMIC_ACQUIRE))
+    return false;
+
+  pstRing->slot[tail] = data;
+  __atomic_store_n(&pstRing->tail, next, __ATOMIC_RELEASE);
+  return true;
+}
+
+void *RKADK_RING_Peek(void *ring) {
+  unsigned int head;
+  RKADK_RING_S *pstRing = (RKADK_RING_S *)ring;
+
+  head = __atomic_load_n(&pstRing->head, __ATOMIC_RELAXED);
+  if (head == __atomic_load_n(&pstRing->tail, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  return pstRing->slot[head];
+}
+
+void *RKADK_RING_Pop(void *ring) {
+  unsigned int head, next;
+  void *data;
+  RKADK_RING_S *pstRing = (RKADK_RING_S *)ring;
+
+  head = __atomic_load_n(&pstRing->head, __ATOMIC_RELAXED);
+  if (head == __atomic_load_n(&pstRing->tail, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  data = pstRing->slot[head];
+  next = head + 1;
+  if (next == pstRing->size)
+    next = 0;
+
+  __atomic_store_n(&pstRing->head, next, __ATOMIC_RELEASE);
+  return data;
+}
+
+unsigned int RKADK_RING_Count(void *ring) {
+  unsigned int head, tail;
+  RKADK_RING_S *pstRing = (RKADK_RING_S *)ring;
+
+  head = __atomic_load_n(&pstRing->head, __ATOMIC_ACQUIRE);
+  tail = __atomic_load_n(&pstRing->tail, __ATOMIC_ACQUIRE);
+  if (tail >= head)
+    return tail - head;
+
+  return pstRing->size - head + tail;
+}
+
+unsigned int RKADK_RING_Depth(void *ring) {
+  RKADK_RING_S *pstRing = (RKADK_RING_S *)ring;
+
+  return pstRing->size - 1;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef __RKADK_RING_H__
+#define __RKADK_RING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring of pointers.
+ * Push may only be called from one thread and Pop/Peek from one other thread.
+ */
+
+/**
+ * @brief create a ring
+ *
+ * @param depth max number of elements in the ring
+ *
+ * @return ring handle on success, NULL on failure
+ */
+void *RKADK_RING_Create(unsigned int depth);
+
+void RKADK_RING_Destroy(void *ring);
+
+/**
+ * @brief push an element (producer side)
+ *
+ * @return true on success, false if the ring is full
+ */
+bool RKADK_RING_Push(void *ring, void *data);
+
+/**
+ * @brief pop the oldest element (consumer side)
+ *
+ * @return element, NULL if the ring is empty
+ */
+void *RKADK_RING_Pop(void *ring);
+
+/**
+ * @brief get the oldest element without removing it (consumer side)
+ *
+ * @return element, NULL if the ring is empty
+ */
+void *RKADK_RING_Peek(void *ring);
+
+/**
+ * @brief number of elements currently queued, may be called from any thread
+ */
+unsigned int RKADK_RING_Count(void *ring);
+
+unsigned int RKADK_RING_Depth(void *ring);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "rkadk_watchdog.h"
+#include "rkadk_log.h"
+#include "rkadk_signal.h"
+#include "rkadk_thread.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  pthread_mutex_t mutex;
+  void *pThread;
+  void *pSignal;
+  bool bLowPrio;
+  bool bDump;
+  RKADK_U64 u64DumpMs;
+  RKADK_U32 u32EventCnt;
+  RKADK_U32 u32LostCnt;
+  RKADK_MEDIA_EVENT_INFO_S stEvent[RKADK_WATCHDOG_EVENT_CNT];
+  RKADK_MEDIA_EVENT_CALLBACK_FN pfnEventCallback;
+  RKADK_MW_PTR pHandle;
+} RKADK_WATCHDOG_S;
+
+static RKADK_WATCHDOG_S g_stWatchdog = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static RKADK_U64 RKADK_WATCHDOG_GetMs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (RKADK_U64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#ifdef RV1106_1103
+static void RKADK_WATCHDOG_DumpFile(const char *path) {
+  char line[256];
+  FILE *fp;
+
+  fp = fopen(path, "r");
+  if (!fp) {
+    RKADK_LOGW("open %s failed", path);
+    return;
+  }
+
+  RKADK_LOGI("---- %s ----", path);
+  while (fgets(line, sizeof(line), fp))
+    printf("%s", line);
+  fclose(fp);
+}
+#endif
+
+static void RKADK_WATCHDOG_Dump() {
+#ifdef RV1106_1103
+  RKADK_WATCHDOG_DumpFile("/dev/mpi/vsys");
+  RKADK_WATCHDOG_DumpFile("/proc/vcodec/enc/venc_info");
+#else
+  // dumpsys is a tool of its own, the child inherits the low priority
+  system("dumpsys sys");
+  system("dumpsys vi");
+  system("dumpsys vpss");
+  system("dumpsys venc");
+#endif
+}
+
+static bool RKADK_WATCHDOG_Proc(void *params) {
+  bool bDump;
+  RKADK_U32 u32EventCnt, u32LostCnt;
+  RKADK_MEDIA_EVENT_INFO_S stEvent[RKADK_WATCHDOG_EVENT_CNT];
+  RKADK_MEDIA_EVENT_CALLBACK_FN pfnEventCallback;
+  RKADK_MW_PTR pHandle;
+  RKADK_WATCHDOG_S *pstWatchdog = (RKADK_WATCHDOG_S *)params;
+
+  // keep the diagnostics off the media threads' cpu time
+  if (!pstWatchdog->bLowPrio) {
+    if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19))
+      RKADK_LOGW("set watchdog priority failed");
+    pstWatchdog->bLowPrio = true;
+  }
+
+  RKADK_SIGNAL_Wait(pstWatchdog->pSignal, 1000);
+
+  RKADK_MUTEX_LOCK(pstWatchdog->mutex);
+  u32EventCnt = pstWatchdog->u32EventCnt;
+  memcpy(stEvent, pstWatchdog->stEvent, u32EventCnt * sizeof(RKADK_MEDIA_EVENT_INFO_S));
+  u32LostCnt = pstWatchdog->u32LostCnt;
+  bDump = pstWatchdog->bDump;
+  pfnEventCallback = pstWatchdog->pfnEventCallback;
+  pHandle = pstWatchdog->pHandle;
+  pstWatchdog->u32EventCnt = 0;
+  pstWatchdog->u32LostCnt = 0;
+  pstWatchdog->bDump = false;
+  RKADK_MUTEX_UNLOCK(pstWatchdog->mutex);
+
+  if (u32LostCnt)
+    RKADK_LOGW("watchdog dropped %d events", u32LostCnt);
+
+  if (pfnEventCallback)
+    for (RKADK_U32 i = 0; i < u32EventCnt; i++)
+      pfnEventCallback(pHandle, &stEvent[i]);
+
+  if (bDump)
+    RKADK_WATCHDOG_Dump();
+
+  return true;
+}
+
+void RKADK_WATCHDOG_SetCallback(RKADK_MEDIA_EVENT_CALLBACK_FN pfnEventCallback,
+                                RKADK_MW_PTR pHandle) {
+  RKADK_MUTEX_LOCK(g_stWatchdog.mutex);
+  g_stWatchdog.pfnEventCallback = pfnEventCallback;
+  g_stWatchdog.pHandle = pHandle;
+  RKADK_MUTEX_UNLOCK(g_stWatchdog.mutex);
+}
+
+void RKADK_WATCHDOG_Report(const RKADK_MEDIA_EVENT_INFO_S *pstEventInfo,
+                           bool bDump) {
+  RKADK_U64 u64NowMs;
+
+  RKADK_MUTEX_LOCK(g_stWatchdog.mutex);
+  if (!g_stWatchdog.pThread) {
+    if (!g_stWatchdog.pSignal)
+      g_stWatchdog.pSignal = RKADK_SIGNAL_Create(0, 1);
+    if (!g_stWatchdog.pSignal) {
+      RKADK_LOGE("create watchdog signal failed");
+      RKADK_MUTEX_UNLOCK(g_stWatchdog.mutex);
+      return;
+    }
+
+    g_stWatchdog.bLowPrio = false;
+    g_stWatchdog.pThread = RKADK_THREAD_Create(RKADK_WATCHDOG_Proc, &g_stWatchdog,
+                                               "MediaWatchdog");
+    if (!g_stWatchdog.pThread) {
+      RKADK_MUTEX_UNLOCK(g_stWatchdog.mutex);
+      return;
+    }
+  }
+
+  if (g_stWatchdog.u32EventCnt < RKADK_WATCHDOG_EVENT_CNT)
+    memcpy(&g_stWatchdog.stEvent[g_stWatchdog.u32EventCnt++], pstEventInfo,
+           sizeof(RKADK_MEDIA_EVENT_INFO_S));
+  else
+    g_stWatchdog.u32LostCnt++;
+
+  u64NowMs = RKADK_WATCHDOG_GetMs();
+  if (bDump && (!g_stWatchdog.u64DumpMs
+      || u64NowMs - g_stWatchdog.u64DumpMs >= RKADK_WATCHDOG_DUMP_INTERVAL_MS)) {
+    g_stWatchdog.bDump = true;
+    g_stWatchdog.u64DumpMs = u64NowMs;
+  }
+  RKADK_MUTEX_UNLOCK(g_stWatchdog.mutex);
+
+  RKADK_SIGNAL_Give(g_stWatchdog.pSignal);
+}
+
+void RKADK_WATCHDOG_DeInit() {
+  void *pThread;
+
+  RKADK_MUTEX_LOCK(g_stWatchdog.mutex);
+  pThread = g_stWatchdog.pThread;
+  g_stWatchdog.pThread = NULL;
+  RKADK_MUTEX_UNLOCK(g_stWatchdog.mutex);
+
+  if (pThread) {
+    RKADK_THREAD_SetExit(pThread);
+    RKADK_SIGNAL_Give(g_stWatchdog.pSignal);
+    RKADK_THREAD_Destory(pThread);
+  }
+
+  RKADK_SIGNAL_Destroy(g_stWatchdog.pSignal);
+  g_stWatchdog.pSignal = NULL;
+  g_stWatchdog.u32EventCnt = 0;
+  g_stWatchdog.u32LostCnt = 0;
+  g_stWatchdog.bDump = false;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef __RKADK_WATCHDOG_H__
+#define __RKADK_WATCHDOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rkadk_media_comm.h"
+
+/*
+ * Media pipeline watchdog. Stall reports are queued from the fetch threads,
+ * the event callback and the diagnostic dumps run on a low priority thread
+ * that is created on the first report.
+ */
+
+/* min interval between two diagnostic dumps */
+#define RKADK_WATCHDOG_DUMP_INTERVAL_MS (30 * 1000)
+
+/* max events waiting for the watchdog thread, the newest are dropped */
+#define RKADK_WATCHDOG_EVENT_CNT 16
+
+void RKADK_WATCHDOG_SetCallback(RKADK_MEDIA_EVENT_CALLBACK_FN pfnEventCallback,
+                                RKADK_MW_PTR pHandle);
+
+/**
+ * @brief queue an event, never blocks on the callback or the dump
+ *
+ * @param bDump collect the media proc info, rate limited
+ */
+void RKADK_WATCHDOG_Report(const RKADK_MEDIA_EVENT_INFO_S *pstEventInfo,
+                           bool bDump);
+
+void RKADK_WATCHDOG_DeInit();
+
+#ifdef __cplusplus
+}
+#endif
+#endif
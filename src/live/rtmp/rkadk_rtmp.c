@@ -20,16 +20,76 @@
 #include "rkadk_media_comm.h"
 #include "rkadk_param.h"
 #include "rkadk_audio_encoder.h"
+#include "rkadk_signal.h"
+#include "rkadk_thread.h"
+#include "linux_list.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+// the sender wakes up at least this often to reconnect and adapt the bitrate
+#define RKADK_RTMP_SEND_INTERVAL_MS 20
+
+// congestion control, the queue is sampled once per interval
+#define RKADK_RTMP_ABR_INTERVAL_MS 1000
+#define RKADK_RTMP_ABR_HIGH_BYTES (RKADK_RTMP_QUEUE_SIZE / 4)
+#define RKADK_RTMP_ABR_LOW_BYTES (RKADK_RTMP_QUEUE_SIZE / 16)
+#define RKADK_RTMP_ABR_RECOVER_CNT 5 // calm intervals before stepping up
+
+typedef struct {
+  struct list_head mark;
+  MB_BLK pMbBlk;
+  RKADK_U32 u32Offset;
+  RKADK_U32 u32Len;
+  RKADK_U64 u64Pts;
+  bool bVideo;
+  bool bKey;
+  bool bFrameEnd; // last slice of its frame
+} RKADK_RTMP_ITEM_S;
 
 typedef struct {
   bool bVencChnMux;
+  bool bEnableAudio; // ACC is the only codec flv takes
+  bool bLowLatency;  // live venc sends its frames as slices
   RKADK_U32 u32CamId;
   RKADK_U32 u32MuxerId;
   VideoParam stVideo;
   AudioParam stAudio;
+  char path[RKADK_MAX_FILE_PATH_LEN];
+
+  // frames waiting for the sender, fed by the venc and aenc callbacks
+  pthread_mutex_t mutex;
+  struct list_head stFreeList;
+  struct list_head stSendList;
+  RKADK_RTMP_ITEM_S *pstItem;
+  RKADK_U32 u32QueueBytes;
+  bool bConnected;
+  bool bDropToIDR;
+
+  // sender thread only
+  RKADK_U32 u32ReconnectMs;
+  RKADK_U64 u64ConnectUs;
+  bool bAbr;
+  RKADK_U32 u32VencChn;
+  RKADK_U32 u32Gop;
+  RKADK_U32 u32SrcFps;
+  RKADK_U32 u32BaseBitrate;
+  RKADK_U32 u32BaseFps;
+  RKADK_U32 u32CalmCnt;
+  RKADK_U64 u64AbrUs;
+
+  // flv takes whole frames, the slices of a low latency frame are joined here
+  RKADK_U8 *pu8Frame;
+  RKADK_U32 u32FrameSize;
+  RKADK_U32 u32FrameLen;
+  RKADK_U64 u64FramePts;
+  bool bFrameKey;
+
+  void *pSignal;
+  void *pThread;
+  RKADK_RTMP_STATS_S stStats;
 } RKADK_RTMP_HANDLE_S;
 
 static void RKADK_RTMP_AudioSetChn(MPP_CHN_S *pstAiChn, MPP_CHN_S *pstAencChn) {
@@ -37,9 +97,10 @@ static void RKADK_RTMP_AudioSetChn(MPP_CHN_S *pstAiChn, MPP_CHN_S *pstAencChn) {
   pstAiChn->s32DevId = 0;
   pstAiChn->s32ChnId = LIVE_AI_CHN;
 
+  // shared with the rtsp sessions of the same codec
   pstAencChn->enModId = RK_ID_AENC;
   pstAencChn->s32DevId = 0;
-  pstAencChn->s32ChnId = LIVE_AENC_CHN;
+  pstAencChn->s32ChnId = RKADK_MEDIA_GetLiveAencChn(RKADK_CODEC_TYPE_ACC);
 }
 
 static RKADK_S32 RKADK_RTMP_SetAiAttr(AIO_ATTR_S *pstAiAttr,
@@ -78,7 +139,7 @@ static RKADK_S32 RKADK_RTMP_SetAencAttr(RKADK_U32 u32CamId,
   RKADK_CHECK_POINTER(pstAencAttr, RKADK_FAILURE);
 
   memset(pstAencAttr, 0, sizeof(AENC_CHN_ATTR_S));
-  pstAencAttr->enType = RKADK_MEDIA_GetRkCodecType(pstAudioParam->codec_type);
+  pstAencAttr->enType = RKADK_MEDIA_GetRkCodecType(RKADK_CODEC_TYPE_ACC);
   pstAencAttr->u32BufCount = RKADK_PARAM_GetStreamBufCnt(u32CamId, true);
   pstAencAttr->stCodecAttr.enType = pstAencAttr->enType;
   pstAencAttr->stCodecAttr.u32Channels = pstAudioParam->channels;
@@ -86,10 +147,8 @@ static RKADK_S32 RKADK_RTMP_SetAencAttr(RKADK_U32 u32CamId,
   pstAencAttr->stCodecAttr.enBitwidth = pstAudioParam->bit_width;
   pstAencAttr->stCodecAttr.pstResv = RK_NULL;
 
-  if (pstAudioParam->codec_type == RKADK_CODEC_TYPE_ACC){
-    pstAencAttr->stCodecAttr.u32Resv[0] = 2;
-    pstAencAttr->stCodecAttr.u32Resv[1] = pstAudioParam->bitrate;
-  }
+  pstAencAttr->stCodecAttr.u32Resv[0] = 2;
+  pstAencAttr->stCodecAttr.u32Resv[1] = pstAudioParam->live_bitrate;
   return 0;
 }
 
@@ -152,6 +211,17 @@ static int RKADK_RTMP_SetVencAttr(RKADK_U32 u32CamId,
     return -1;
   }
 
+  if (RKADK_PARAM_VencLowLatency(&pstLiveCfg->attribute)) {
+    ret = RKADK_MEDIA_SetLowLatencyAttr(pstVencAttr, pstLiveCfg->attribute.codec_type,
+                                        pstLiveCfg->attribute.gop,
+                                        pstLiveCfg->attribute.bitrate,
+                                        pstSensorCfg->framerate, u32DstFrameRateNum);
+    if (ret) {
+      RKADK_LOGE("RKADK_MEDIA_SetLowLatencyAttr failed");
+      return -1;
+    }
+  }
+
   pstVencAttr->stVencAttr.enType =
       RKADK_MEDIA_GetRkCodecType(pstLiveCfg->attribute.codec_type);
   pstVencAttr->stVencAttr.enPixelFormat = pstLiveCfg->vi_attr.stChnAttr.enPixelFormat;
@@ -162,7 +232,8 @@ static int RKADK_RTMP_SetVencAttr(RKADK_U32 u32CamId,
   pstVencAttr->stVencAttr.u32VirWidth = pstLiveCfg->attribute.width;
   pstVencAttr->stVencAttr.u32VirHeight = pstLiveCfg->attribute.height;
   pstVencAttr->stVencAttr.u32Profile = pstLiveCfg->attribute.profile;
-  pstVencAttr->stVencAttr.u32StreamBufCnt = RKADK_PARAM_GetStreamBufCnt(u32CamId, false);
+  pstVencAttr->stVencAttr.u32StreamBufCnt =
+      RKADK_PARAM_GetVencStreamBufCnt(u32CamId, pstLiveCfg->attribute.venc_chn);
   pstVencAttr->stVencAttr.u32BufSize = pstLiveCfg->attribute.bufsize;
 
   return 0;
@@ -218,7 +289,7 @@ static int RKADK_RTMP_SetMuxerAttr(RKADK_U32 u32CamId,
     return -1;
   }
 
-  switch (pstAudioParam->codec_type) {
+  switch (pHandle->bEnableAudio ? RKADK_CODEC_TYPE_ACC : pstAudioParam->codec_type) {
   case RKADK_CODEC_TYPE_MP3:
     memcpy(pHandle->stAudio.codec, "MP3", strlen("MP3"));
     break;
@@ -387,8 +458,8 @@ static RKADK_S32 RKADK_RTMP_EnableAudio(RKADK_U32 u32CamId, MPP_CHN_S stAiChn,
   AIO_ATTR_S stAiAttr;
   AENC_CHN_ATTR_S stAencAttr;
 
-  if (RKADK_MEDIA_EnableAencRegister(pstAudioParam->codec_type)) {
-    ret = RKADK_AUDIO_ENCODER_Register(pstAudioParam->codec_type);
+  if (RKADK_MEDIA_EnableAencRegister(RKADK_CODEC_TYPE_ACC)) {
+    ret = RKADK_AUDIO_ENCODER_Register(RKADK_CODEC_TYPE_ACC);
     if (ret) {
       RKADK_LOGE("RKADK_AUDIO_ENCODER_Register failed(%d)", ret);
       return ret;
@@ -425,8 +496,8 @@ failed:
   RKADK_MPI_AI_DeInit(stAiChn.s32DevId, stAiChn.s32ChnId, pstAudioParam->vqe_mode);
 
 unregist:
-    if (RKADK_MEDIA_EnableAencRegister(pstAudioParam->codec_type))
-      RKADK_AUDIO_ENCODER_UnRegister(pstAudioParam->codec_type);
+    if (RKADK_MEDIA_EnableAencRegister(RKADK_CODEC_TYPE_ACC))
+      RKADK_AUDIO_ENCODER_UnRegister(RKADK_CODEC_TYPE_ACC);
 
   return ret;
 }
@@ -449,8 +520,8 @@ static RKADK_S32 RKADK_RTMP_DisableAudio(MPP_CHN_S stAiChn, MPP_CHN_S stAencChn,
     return ret;
   }
 
-  if (RKADK_MEDIA_EnableAencRegister(pstAudioParam->codec_type)) {
-    ret = RKADK_AUDIO_ENCODER_UnRegister(pstAudioParam->codec_type);
+  if (RKADK_MEDIA_EnableAencRegister(RKADK_CODEC_TYPE_ACC)) {
+    ret = RKADK_AUDIO_ENCODER_UnRegister(RKADK_CODEC_TYPE_ACC);
     if (ret) {
       RKADK_LOGE("RKADK_AUDIO_ENCODER_UnRegister failed(%d)", ret);
       return ret;
@@ -460,11 +531,387 @@ static RKADK_S32 RKADK_RTMP_DisableAudio(MPP_CHN_S stAiChn, MPP_CHN_S stAencChn,
   return 0;
 }
 
-static RKADK_S32 RKADK_RTMP_InitMuxer(RKADK_U32 u32CamId, char *path,
-                                      RKADK_PARAM_STREAM_CFG_S *pstLiveCfg,
-                                      RKADK_PARAM_AUDIO_CFG_S *pstAudioParam,
-                                      RKADK_RTMP_HANDLE_S *pHandle) {
+static RKADK_U64 RKADK_RTMP_GetUs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (RKADK_U64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// called with the queue mutex held
+static void RKADK_RTMP_QueueRelease(RKADK_RTMP_HANDLE_S *pstHandle,
+                                    RKADK_RTMP_ITEM_S *pstItem) {
+  RK_MPI_MB_ReleaseMB(pstItem->pMbBlk);
+  pstHandle->u32QueueBytes -= pstItem->u32Len;
+  list_add_tail(&pstItem->mark, &pstHandle->stFreeList);
+}
+
+// called with the queue mutex held
+static void RKADK_RTMP_QueueFlush(RKADK_RTMP_HANDLE_S *pstHandle) {
+  RKADK_RTMP_ITEM_S *pstItem, *pstTmp;
+
+  list_for_each_entry_safe(pstItem, pstTmp, &pstHandle->stSendList, mark) {
+    list_del(&pstItem->mark);
+    RKADK_RTMP_QueueRelease(pstHandle, pstItem);
+  }
+}
+
+static RKADK_S32 RKADK_RTMP_QueueCreate(RKADK_RTMP_HANDLE_S *pstHandle) {
+  pthread_mutex_init(&pstHandle->mutex, NULL);
+  INIT_LIST_HEAD(&pstHandle->stFreeList);
+  INIT_LIST_HEAD(&pstHandle->stSendList);
+
+  pstHandle->pstItem = (RKADK_RTMP_ITEM_S *)calloc(RKADK_RTMP_QUEUE_CNT,
+                                                   sizeof(RKADK_RTMP_ITEM_S));
+  if (!pstHandle->pstItem) {
+    RKADK_LOGE("malloc rtmp queue failed");
+    return -1;
+  }
+
+  for (int i = 0; i < RKADK_RTMP_QUEUE_CNT; i++)
+    list_add_tail(&pstHandle->pstItem[i].mark, &pstHandle->stFreeList);
+
+  pstHandle->stStats.u32QueueSize = RKADK_RTMP_QUEUE_SIZE;
+  return 0;
+}
+
+static void RKADK_RTMP_QueueDestroy(RKADK_RTMP_HANDLE_S *pstHandle) {
+  if (!pstHandle->pstItem)
+    return;
+
+  RKADK_MUTEX_LOCK(pstHandle->mutex);
+  RKADK_RTMP_QueueFlush(pstHandle);
+  RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+
+  free(pstHandle->pstItem);
+  pstHandle->pstItem = NULL;
+  pthread_mutex_destroy(&pstHandle->mutex);
+}
+
+// called from the encoder callbacks, a stalled network never blocks them
+static void RKADK_RTMP_QueuePush(RKADK_RTMP_HANDLE_S *pstHandle, MB_BLK pMbBlk,
+                                 RKADK_U32 u32Offset, RKADK_U32 u32Len,
+                                 RKADK_U64 u64Pts, bool bVideo, bool bKey,
+                                 bool bFrameEnd) {
+  bool bFull, bRequestIDR = false;
+  RKADK_RTMP_ITEM_S *pstItem;
+
+  RKADK_MUTEX_LOCK(pstHandle->mutex);
+  // frames are stale by the time a lost connection is back
+  if (!pstHandle->bConnected) {
+    pstHandle->bDropToIDR = true;
+    RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+    return;
+  }
+
+  bFull = list_empty(&pstHandle->stFreeList)
+          || pstHandle->u32QueueBytes + u32Len > RKADK_RTMP_QUEUE_SIZE;
+
+  if (bVideo) {
+    if (pstHandle->bDropToIDR && !bKey) {
+      pstHandle->stStats.u32VideoDropCnt++;
+      RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+      return;
+    }
+
+    if (bFull) {
+      pstHandle->stStats.u32VideoDropCnt++;
+      bRequestIDR = !pstHandle->bDropToIDR && !pstHandle->bVencChnMux;
+      pstHandle->bDropToIDR = true;
+      RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+      if (bRequestIDR)
+        RK_MPI_VENC_RequestIDR(pstHandle->u32VencChn, RK_FALSE);
+      return;
+    }
+
+    pstHandle->bDropToIDR = false;
+  } else if (bFull) {
+    pstHandle->stStats.u32AudioDropCnt++;
+    RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+    return;
+  }
+
+  pstItem = list_first_entry(&pstHandle->stFreeList, RKADK_RTMP_ITEM_S, mark);
+  list_del(&pstItem->mark);
+  pstItem->pMbBlk = pMbBlk;
+  pstItem->u32Offset = u32Offset;
+  pstItem->u32Len = u32Len;
+  pstItem->u64Pts = u64Pts;
+  pstItem->bVideo = bVideo;
+  pstItem->bKey = bKey;
+  pstItem->bFrameEnd = bFrameEnd;
+  RK_MPI_MB_AddUserCnt(pMbBlk);
+  list_add_tail(&pstItem->mark, &pstHandle->stSendList);
+
+  pstHandle->u32QueueBytes += u32Len;
+  if (pstHandle->u32QueueBytes > pstHandle->stStats.u32QueueHwm)
+    pstHandle->stStats.u32QueueHwm = pstHandle->u32QueueBytes;
+  RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+
+  RKADK_SIGNAL_Give(pstHandle->pSignal);
+}
+
+static void RKADK_RTMP_Connect(RKADK_RTMP_HANDLE_S *pstHandle, RKADK_U64 u64NowUs) {
+  int ret;
+
+  if (u64NowUs < pstHandle->u64ConnectUs)
+    return;
+
+  ret = rkmuxer_init(pstHandle->u32MuxerId, (char *)"flv", pstHandle->path,
+                     &pstHandle->stVideo, &pstHandle->stAudio);
+  if (ret) {
+    RKADK_LOGW("Rtmp[%d] connect %s failed[%d], retry in %d ms", pstHandle->u32CamId,
+               pstHandle->path, ret, pstHandle->u32ReconnectMs);
+    pstHandle->stStats.u32ConnectFailCnt++;
+    pstHandle->u64ConnectUs = RKADK_RTMP_GetUs() + pstHandle->u32ReconnectMs * 1000;
+    pstHandle->u32ReconnectMs *= 2;
+    if (pstHandle->u32ReconnectMs > RKADK_RTMP_RECONNECT_MAX_MS)
+      pstHandle->u32ReconnectMs = RKADK_RTMP_RECONNECT_MAX_MS;
+    return;
+  }
+
+  RKADK_LOGI("Rtmp[%d] %s connected", pstHandle->u32CamId, pstHandle->path);
+  pstHandle->u32ReconnectMs = RKADK_RTMP_RECONNECT_MIN_MS;
+  pstHandle->stStats.u32ConnectCnt++;
+
+  RKADK_MUTEX_LOCK(pstHandle->mutex);
+  pstHandle->bConnected = true;
+  pstHandle->bDropToIDR = true;
+  pstHandle->stStats.bConnected = true;
+  RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+
+  if (!pstHandle->bVencChnMux)
+    RK_MPI_VENC_RequestIDR(pstHandle->u32VencChn, RK_FALSE);
+}
+
+static void RKADK_RTMP_Disconnect(RKADK_RTMP_HANDLE_S *pstHandle) {
+  RKADK_LOGW("Rtmp[%d] %s disconnected, retry in %d ms", pstHandle->u32CamId,
+             pstHandle->path, pstHandle->u32ReconnectMs);
+
+  RKADK_MUTEX_LOCK(pstHandle->mutex);
+  pstHandle->bConnected = false;
+  pstHandle->stStats.bConnected = false;
+  RKADK_RTMP_QueueFlush(pstHandle);
+  RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+  pstHandle->u32FrameLen = 0;
+
+  rkmuxer_deinit(pstHandle->u32MuxerId);
+  pstHandle->u64ConnectUs = RKADK_RTMP_GetUs() + pstHandle->u32ReconnectMs * 1000;
+}
+
+static void RKADK_RTMP_SetVencRc(RKADK_RTMP_HANDLE_S *pstHandle,
+                                 RKADK_U32 u32Bitrate, RKADK_U32 u32Fps) {
+  int ret;
+  VENC_CHN_ATTR_S stVencChnAttr;
+
+  ret = RK_MPI_VENC_GetChnAttr(pstHandle->u32VencChn, &stVencChnAttr);
+  if (ret) {
+    RKADK_LOGE("RK_MPI_VENC_GetChnAttr[%d] failed[%x]", pstHandle->u32VencChn, ret);
+    return;
+  }
+
+  ret = RKADK_MEDIA_SetRcAttr(&stVencChnAttr.stRcAttr, pstHandle->u32Gop, u32Bitrate,
+                              pstHandle->u32SrcFps, u32Fps);
+  if (ret) {
+    RKADK_LOGE("RKADK_MEDIA_SetRcAttr failed");
+    return;
+  }
+
+  ret = RK_MPI_VENC_SetChnAttr(pstHandle->u32VencChn, &stVencChnAttr);
+  if (ret) {
+    RKADK_LOGE("RK_MPI_VENC_SetChnAttr[%d] failed[%x]", pstHandle->u32VencChn, ret);
+    return;
+  }
+
+  RKADK_LOGI("Rtmp[%d] bitrate[%d -> %d] fps[%d -> %d]", pstHandle->u32CamId,
+             pstHandle->stStats.u32Bitrate, u32Bitrate,
+             pstHandle->stStats.u32Framerate, u32Fps);
+  pstHandle->stStats.u32Bitrate = u32Bitrate;
+  pstHandle->stStats.u32Framerate = u32Fps;
+}
+
+// lower the bitrate, then the fps, while the queue grows; restore them in reverse
+static void RKADK_RTMP_Abr(RKADK_RTMP_HANDLE_S *pstHandle, RKADK_U64 u64NowUs) {
+  RKADK_U32 u32Bytes, u32Bitrate, u32Fps;
+  RKADK_U32 u32MinBitrate = pstHandle->u32BaseBitrate / 4;
+  RKADK_U32 u32MinFps = (pstHandle->u32BaseFps + 1) / 2;
+
+  if (!pstHandle->bAbr
+      || u64NowUs - pstHandle->u64AbrUs < RKADK_RTMP_ABR_INTERVAL_MS * 1000)
+    return;
+  pstHandle->u64AbrUs = u64NowUs;
+
+  RKADK_MUTEX_LOCK(pstHandle->mutex);
+  u32Bytes = pstHandle->u32QueueBytes;
+  RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+
+  u32Bitrate = pstHandle->stStats.u32Bitrate;
+  u32Fps = pstHandle->stStats.u32Framerate;
+
+  if (u32Bytes >= RKADK_RTMP_ABR_HIGH_BYTES) {
+    pstHandle->u32CalmCnt = 0;
+    if (u32Bitrate > u32MinBitrate) {
+      u32Bitrate = u32Bitrate * 3 / 4;
+      if (u32Bitrate < u32MinBitrate)
+        u32Bitrate = u32MinBitrate;
+    } else if (u32Fps > u32MinFps) {
+      u32Fps = u32Fps * 3 / 4;
+      if (u32Fps < u32MinFps)
+        u32Fps = u32MinFps;
+    } else {
+      return;
+    }
+
+    pstHandle->stStats.u32AbrDownCnt++;
+  } else if (u32Bytes <= RKADK_RTMP_ABR_LOW_BYTES) {
+    if (++pstHandle->u32CalmCnt < RKADK_RTMP_ABR_RECOVER_CNT)
+      return;
+
+    pstHandle->u32CalmCnt = 0;
+    if (u32Fps < pstHandle->u32BaseFps) {
+      u32Fps = pstHandle->u32BaseFps;
+    } else if (u32Bitrate < pstHandle->u32BaseBitrate) {
+      u32Bitrate = u32Bitrate * 5 / 4;
+      if (u32Bitrate > pstHandle->u32BaseBitrate)
+        u32Bitrate = pstHandle->u32BaseBitrate;
+    } else {
+      return;
+    }
+
+    pstHandle->stStats.u32AbrUpCnt++;
+  } else {
+    pstHandle->u32CalmCnt = 0;
+    return;
+  }
+
+  RKADK_RTMP_SetVencRc(pstHandle, u32Bitrate, u32Fps);
+}
+
+static int RKADK_RTMP_WriteFrame(RKADK_RTMP_HANDLE_S *pstHandle, RKADK_U8 *data,
+                                 RKADK_U32 u32Len, RKADK_U64 u64Pts, bool bKey) {
+  int ret;
+
+  ret = rkmuxer_write_video_frame(pstHandle->u32MuxerId, data, u32Len, u64Pts, bKey);
+  if (!ret)
+    RKADK_MEDIA_CountLatency(u64Pts, &pstHandle->stStats.u32LatencyUs,
+                             &pstHandle->stStats.u32MaxLatencyUs);
+
+  return ret;
+}
+
+static int RKADK_RTMP_WriteSlices(RKADK_RTMP_HANDLE_S *pstHandle) {
+  int ret;
+
+  ret = RKADK_RTMP_WriteFrame(pstHandle, pstHandle->pu8Frame, pstHandle->u32FrameLen,
+                              pstHandle->u64FramePts, pstHandle->bFrameKey);
+  pstHandle->u32FrameLen = 0;
+  return ret;
+}
+
+static int RKADK_RTMP_WriteVideo(RKADK_RTMP_HANDLE_S *pstHandle,
+                                 RKADK_RTMP_ITEM_S *pstItem, RKADK_U8 *data) {
+  int ret;
+  RKADK_U8 *pu8Frame;
+  RKADK_U32 u32Size;
+
+  if (!pstHandle->bLowLatency || (pstItem->bFrameEnd && !pstHandle->u32FrameLen))
+    return RKADK_RTMP_WriteFrame(pstHandle, data, pstItem->u32Len, pstItem->u64Pts,
+                                 pstItem->bKey);
+
+  // the end of the last frame was dropped, or isn't reported by the encoder
+  if (pstHandle->u32FrameLen && pstItem->u64Pts != pstHandle->u64FramePts) {
+    ret = RKADK_RTMP_WriteSlices(pstHandle);
+    if (ret)
+      return ret;
+  }
+
+  if (pstHandle->u32FrameLen + pstItem->u32Len > pstHandle->u32FrameSize) {
+    u32Size = pstHandle->u32FrameLen + pstItem->u32Len;
+    pu8Frame = (RKADK_U8 *)realloc(pstHandle->pu8Frame, u32Size);
+    if (!pu8Frame) {
+      RKADK_LOGE("realloc rtmp frame[%d] failed", u32Size);
+      pstHandle->u32FrameLen = 0;
+      return 0;
+    }
+
+    pstHandle->pu8Frame = pu8Frame;
+    pstHandle->u32FrameSize = u32Size;
+  }
+
+  if (!pstHandle->u32FrameLen) {
+    pstHandle->u64FramePts = pstItem->u64Pts;
+    pstHandle->bFrameKey = pstItem->bKey;
+  }
+  memcpy(pstHandle->pu8Frame + pstHandle->u32FrameLen, data, pstItem->u32Len);
+  pstHandle->u32FrameLen += pstItem->u32Len;
+
+  if (!pstItem->bFrameEnd)
+    return 0;
+
+  return RKADK_RTMP_WriteSlices(pstHandle);
+}
+
+// the only thread that talks to the rtmp server
+static bool RKADK_RTMP_SendProc(void *params) {
+  int ret;
+  RKADK_U8 *data;
+  RKADK_U64 u64StartUs, u64NowUs;
+  RKADK_RTMP_ITEM_S *pstItem;
+  RKADK_RTMP_HANDLE_S *pstHandle = (RKADK_RTMP_HANDLE_S *)params;
+
+  RKADK_SIGNAL_Wait(pstHandle->pSignal, RKADK_RTMP_SEND_INTERVAL_MS);
+
+  if (!pstHandle->bConnected) {
+    RKADK_RTMP_Connect(pstHandle, RKADK_RTMP_GetUs());
+    return true;
+  }
+
+  for (;;) {
+    RKADK_MUTEX_LOCK(pstHandle->mutex);
+    if (list_empty(&pstHandle->stSendList)) {
+      RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+      break;
+    }
+    pstItem = list_first_entry(&pstHandle->stSendList, RKADK_RTMP_ITEM_S, mark);
+    list_del(&pstItem->mark);
+    RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+
+    u64StartUs = RKADK_RTMP_GetUs();
+    data = (RKADK_U8 *)RK_MPI_MB_Handle2VirAddr(pstItem->pMbBlk) + pstItem->u32Offset;
+    if (pstItem->bVideo)
+      ret = RKADK_RTMP_WriteVideo(pstHandle, pstItem, data);
+    else
+      ret = rkmuxer_write_audio_frame(pstHandle->u32MuxerId, data, pstItem->u32Len,
+                                      pstItem->u64Pts);
+    u64NowUs = RKADK_RTMP_GetUs();
+
+    if (u64NowUs - u64StartUs > pstHandle->stStats.u32MaxSendUs)
+      pstHandle->stStats.u32MaxSendUs = u64NowUs - u64StartUs;
+    if (!ret)
+      pstHandle->stStats.u64SendBytes += pstItem->u32Len;
+
+    RKADK_MUTEX_LOCK(pstHandle->mutex);
+    RKADK_RTMP_QueueRelease(pstHandle, pstItem);
+    RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+
+    if (ret) {
+      RKADK_LOGE("Rtmp[%d] write %s frame failed[%d]", pstHandle->u32CamId,
+                 pstItem->bVideo ? "video" : "audio", ret);
+      RKADK_RTMP_Disconnect(pstHandle);
+      return true;
+    }
+  }
+
+  RKADK_RTMP_Abr(pstHandle, RKADK_RTMP_GetUs());
+  return true;
+}
+
+static RKADK_S32 RKADK_RTMP_InitSend(RKADK_U32 u32CamId, const char *path,
+                                     RKADK_PARAM_STREAM_CFG_S *pstLiveCfg,
+                                     RKADK_PARAM_AUDIO_CFG_S *pstAudioParam,
+                                     RKADK_RTMP_HANDLE_S *pHandle) {
   int ret = 0;
+  RKADK_PARAM_SENSOR_CFG_S *pstSensorCfg;
 
   ret = RKADK_RTMP_SetMuxerAttr(u32CamId, pstLiveCfg, pstAudioParam,
                                 pHandle);
@@ -473,30 +920,90 @@ static RKADK_S32 RKADK_RTMP_InitMuxer(RKADK_U32 u32CamId, char *path,
     return ret;
   }
 
-  ret = rkmuxer_init(pHandle->u32MuxerId, (char *)"flv", path,
-                     &pHandle->stVideo, &pHandle->stAudio);
-  if (ret) {
-    RKADK_LOGE("rkmuxer_init failed[%d]", ret);
+  pstSensorCfg = RKADK_PARAM_GetSensorCfg(u32CamId);
+  if (!pstSensorCfg) {
+    RKADK_LOGE("RKADK_PARAM_GetSensorCfg failed");
+    return -1;
+  }
+
+  snprintf(pHandle->path, sizeof(pHandle->path), "%s", path);
+  pHandle->u32ReconnectMs = RKADK_RTMP_RECONNECT_MIN_MS;
+  pHandle->u32VencChn = pstLiveCfg->attribute.venc_chn;
+  pHandle->u32Gop = pstLiveCfg->attribute.gop;
+  pHandle->u32SrcFps = pstSensorCfg->framerate;
+  pHandle->u32BaseBitrate = pstLiveCfg->attribute.bitrate;
+  pHandle->u32BaseFps = pstLiveCfg->attribute.framerate;
+  if (pHandle->u32BaseFps > pHandle->u32SrcFps)
+    pHandle->u32BaseFps = pHandle->u32SrcFps;
+
+  pHandle->bLowLatency = RKADK_PARAM_VencLowLatency(&pstLiveCfg->attribute);
+  if (pHandle->bLowLatency)
+    pHandle->u32Gop = RKADK_MEDIA_GetLowLatencyGop(pHandle->u32Gop, pHandle->u32BaseFps);
+  pHandle->stStats.u32Bitrate = pHandle->u32BaseBitrate;
+  pHandle->stStats.u32Framerate = pHandle->u32BaseFps;
+
+  if (RKADK_RTMP_QueueCreate(pHandle))
+    return -1;
+
+  pHandle->pSignal = RKADK_SIGNAL_Create(0, 1);
+  if (!pHandle->pSignal) {
+    RKADK_LOGE("RKADK_SIGNAL_Create failed");
+    return -1;
+  }
+
+  // the first connect is done by the sender too, Init doesn't wait for the server
+  pHandle->pThread = RKADK_THREAD_Create(RKADK_RTMP_SendProc, pHandle, "RtmpSend");
+  if (!pHandle->pThread) {
+    RKADK_LOGE("Create rtmp send thread failed");
     return -1;
   }
 
   return 0;
 }
 
+static void RKADK_RTMP_DeInitSend(RKADK_RTMP_HANDLE_S *pHandle) {
+  if (pHandle->pThread) {
+    RKADK_THREAD_Destory(pHandle->pThread);
+    pHandle->pThread = NULL;
+  }
+
+  if (pHandle->bConnected) {
+    rkmuxer_deinit(pHandle->u32MuxerId);
+    pHandle->bConnected = false;
+  }
+
+  RKADK_RTMP_QueueDestroy(pHandle);
+
+  if (pHandle->pu8Frame) {
+    free(pHandle->pu8Frame);
+    pHandle->pu8Frame = NULL;
+  }
+
+  if (pHandle->pSignal) {
+    RKADK_SIGNAL_Destroy(pHandle->pSignal);
+    pHandle->pSignal = NULL;
+  }
+}
+
 static void RKADK_RTMP_AencOutCb(AUDIO_STREAM_S stFrame,
                                  RKADK_VOID *pHandle) {
-  int headerSize = 7;
+  RKADK_U32 headerSize;
   RKADK_CHECK_POINTER_N(pHandle);
   RKADK_RTMP_HANDLE_S *pstHandle = (RKADK_RTMP_HANDLE_S *)pHandle;
-  RKADK_U8 *data;
   if (!pstHandle) {
     RKADK_LOGE("Can't find rtmp handle");
     return;
   }
 
-  data = (RKADK_U8 *)RK_MPI_MB_Handle2VirAddr(stFrame.pMbBlk);
-  rkmuxer_write_audio_frame(pstHandle->u32MuxerId, data + headerSize,
-                            stFrame.u32Len - headerSize, stFrame.u64TimeStamp);
+  // flv carries raw aac frames
+  headerSize = RKADK_MEDIA_GetAdtsHeaderLen(
+      (RKADK_U8 *)RK_MPI_MB_Handle2VirAddr(stFrame.pMbBlk), stFrame.u32Len);
+  if (stFrame.u32Len <= headerSize)
+    return;
+
+  RKADK_RTMP_QueuePush(pstHandle, stFrame.pMbBlk, headerSize,
+                       stFrame.u32Len - headerSize, stFrame.u64TimeStamp,
+                       false, false, true);
 }
 
 static int RKADK_RTMP_AencGetData(RKADK_U32 u32CamId,
@@ -518,31 +1025,27 @@ static void RKADK_RTMP_VencOutCb(RKADK_MEDIA_VENC_DATA_S stData,
                                  RKADK_VOID *pHandle) {
   RKADK_CHECK_POINTER_N(pHandle);
   RKADK_RTMP_HANDLE_S *pstHandle = (RKADK_RTMP_HANDLE_S *)pHandle;
-  RKADK_U8 *data;
+  bool bKey;
   if (!pstHandle) {
     RKADK_LOGE("Can't find rtmp handle");
     return;
   }
 
-  data = (RKADK_U8 *)RK_MPI_MB_Handle2VirAddr(stData.stFrame.pstPack->pMbBlk);
-  if ((stData.stFrame.pstPack->DataType.enH264EType == H264E_NALU_ISLICE ||
+  bKey = (stData.stFrame.pstPack->DataType.enH264EType == H264E_NALU_ISLICE ||
     stData.stFrame.pstPack->DataType.enH264EType == H264E_NALU_IDRSLICE) ||
     (stData.stFrame.pstPack->DataType.enH265EType == H265E_NALU_ISLICE ||
-    stData.stFrame.pstPack->DataType.enH265EType == H265E_NALU_IDRSLICE)) {
-    rkmuxer_write_video_frame(pstHandle->u32MuxerId, data,
-                              stData.stFrame.pstPack->u32Len,
-                              stData.stFrame.pstPack->u64PTS, 1);
-  } else {
-    rkmuxer_write_video_frame(pstHandle->u32MuxerId, data,
-                              stData.stFrame.pstPack->u32Len,
-                              stData.stFrame.pstPack->u64PTS, 0);
-  }
+    stData.stFrame.pstPack->DataType.enH265EType == H265E_NALU_IDRSLICE);
+  RKADK_RTMP_QueuePush(pstHandle, stData.stFrame.pstPack->pMbBlk, 0,
+                       stData.stFrame.pstPack->u32Len,
+                       stData.stFrame.pstPack->u64PTS, true, bKey,
+                       stData.stFrame.pstPack->bFrameEnd);
 }
 
 static int RKADK_RTMP_VencGetData(RKADK_U32 u32CamId,
                                   MPP_CHN_S *pstVencChn,
                                   RKADK_RTMP_HANDLE_S *pHandle) {
   int ret = 0;
+  RKADK_MEDIA_QUEUE_ATTR_S stQueueAttr;
 
   VENC_RECV_PIC_PARAM_S stRecvParam;
   stRecvParam.s32RecvPicNum = -1;
@@ -552,10 +1055,14 @@ static int RKADK_RTMP_VencGetData(RKADK_U32 u32CamId,
     return ret;
   }
 
-  ret = RKADK_MEDIA_GetVencBuffer(pstVencChn, RKADK_RTMP_VencOutCb,
-                                  (RKADK_VOID *)pHandle);
+  memset(&stQueueAttr, 0, sizeof(RKADK_MEDIA_QUEUE_ATTR_S));
+  stQueueAttr.bNoRequestIDR = pHandle->bVencChnMux;
+  if (pHandle->bLowLatency)
+    stQueueAttr.u32Depth = RKADK_MEDIA_VENC_QUEUE_DEPTH * RKADK_MEDIA_LOW_LATENCY_SLICE_CNT;
+  ret = RKADK_MEDIA_GetVencBufferEx(pstVencChn, RKADK_RTMP_VencOutCb,
+                                    (RKADK_VOID *)pHandle, &stQueueAttr);
   if (ret) {
-    RKADK_LOGE("RKADK_MEDIA_GetVencBuffer failed = %d", ret);
+    RKADK_LOGE("RKADK_MEDIA_GetVencBufferEx failed = %d", ret);
     return ret;
   }
 
@@ -603,8 +1110,9 @@ RKADK_S32 RKADK_RTMP_Init(RKADK_U32 u32CamId, const char *path,
     return -1;
   }
 
-  /* mp3 not compatible with flv */
-  bEnableAudio = pstAudioParam->codec_type == RKADK_CODEC_TYPE_ACC ? true : false;
+  /* mp3 and g711 not compatible with flv, the record codec is kept for old configs */
+  bEnableAudio = pstAudioParam->live_codec_type == RKADK_CODEC_TYPE_ACC
+                 || pstAudioParam->codec_type == RKADK_CODEC_TYPE_ACC;
 
   pHandle = (RKADK_RTMP_HANDLE_S *)malloc(sizeof(RKADK_RTMP_HANDLE_S));
   if (!pHandle) {
@@ -613,11 +1121,13 @@ RKADK_S32 RKADK_RTMP_Init(RKADK_U32 u32CamId, const char *path,
   }
   memset(pHandle, 0, sizeof(RKADK_RTMP_HANDLE_S));
   pHandle->u32CamId = u32CamId;
+  pHandle->bEnableAudio = bEnableAudio;
 
-  // Create Muxer
-  ret = RKADK_RTMP_InitMuxer(u32CamId, (char *)path, pstLiveCfg, pstAudioParam, pHandle);
+  // Create the sender, it connects and reconnects on its own
+  ret = RKADK_RTMP_InitSend(u32CamId, path, pstLiveCfg, pstAudioParam, pHandle);
   if (ret) {
-    RKADK_LOGE("RKADK_RTMP_InitMuxer failed");
+    RKADK_LOGE("RKADK_RTMP_InitSend failed");
+    RKADK_RTMP_DeInitSend(pHandle);
     free(pHandle);
     return ret;
   }
@@ -642,10 +1152,15 @@ RKADK_S32 RKADK_RTMP_Init(RKADK_U32 u32CamId, const char *path,
     }
     pHandle->bVencChnMux = true;
   }
+
+  // the rate of a venc shared with other streams isn't ours to change
+  pHandle->bAbr = !pHandle->bVencChnMux;
+
   ret = RKADK_RTMP_EnableVideo(u32CamId, stViChn, stVencChn, stSrcVpssChn,
                                pstLiveCfg, bUseVpss);
   if (ret) {
     RKADK_LOGE("RKADK_RTMP_EnableVideo failed[%d]", ret);
+    RKADK_RTMP_DeInitSend(pHandle);
     free(pHandle);
     return ret;
   }
@@ -656,6 +1171,7 @@ RKADK_S32 RKADK_RTMP_Init(RKADK_U32 u32CamId, const char *path,
     if (ret) {
       RKADK_LOGE("RKADK_RTMP_EnableAudio failed[%d]", ret);
       RKADK_RTMP_DisableVideo(u32CamId, stViChn, stVencChn, stSrcVpssChn, pstLiveCfg, bUseVpss);
+      RKADK_RTMP_DeInitSend(pHandle);
       free(pHandle);
       return ret;
     }
@@ -723,6 +1239,11 @@ unbind:
   }
 
 failed:
+  RKADK_MEDIA_StopGetVencBuffer(&stVencChn, RKADK_RTMP_VencOutCb, pHandle);
+  if (bEnableAudio)
+    RKADK_MEDIA_StopGetAencBuffer(&stAencChn, RKADK_RTMP_AencOutCb, pHandle);
+  RKADK_RTMP_DeInitSend(pHandle);
+
   RKADK_RTMP_DisableVideo(u32CamId, stViChn, stVencChn, stSrcVpssChn, pstLiveCfg, bUseVpss);
 
   if (bEnableAudio)
@@ -759,8 +1280,7 @@ RKADK_S32 RKADK_RTMP_DeInit(RKADK_MW_PTR pHandle) {
     return ret;
   }
 
-  bDisableAudio =
-      pstAudioParam->codec_type == RKADK_CODEC_TYPE_ACC ? true : false;
+  bDisableAudio = pstHandle->bEnableAudio;
 
   RKADK_RTMP_SetVideoChn(pstLiveCfg, pstHandle->u32CamId, &stViChn, &stVencChn,
                          &stSrcVpssChn, &stDstVpssChn);
@@ -774,6 +1294,9 @@ RKADK_S32 RKADK_RTMP_DeInit(RKADK_MW_PTR pHandle) {
     RKADK_MEDIA_StopGetAencBuffer(&stAencChn, RKADK_RTMP_AencOutCb, pstHandle);
   }
 
+  // stop the sender and release the queued buffers before the channels go
+  RKADK_RTMP_DeInitSend(pstHandle);
+
   bUseVpss = RKADK_RTMP_IsUseVpss(pstHandle->u32CamId, pstLiveCfg);
   if (bUseVpss) {
     // VPSS UnBind VENC
@@ -811,9 +1334,6 @@ RKADK_S32 RKADK_RTMP_DeInit(RKADK_MW_PTR pHandle) {
     }
   }
 
-  // Destroy MUXER
-  rkmuxer_deinit(pstHandle->u32MuxerId);
-
   // Disable Video
   ret = RKADK_RTMP_DisableVideo(pstHandle->u32CamId, stViChn, stVencChn,
                                 stSrcVpssChn, pstLiveCfg, bUseVpss);
@@ -836,3 +1356,17 @@ RKADK_S32 RKADK_RTMP_DeInit(RKADK_MW_PTR pHandle) {
   free(pHandle);
   return 0;
 }
+
+RKADK_S32 RKADK_RTMP_GetStats(RKADK_MW_PTR pHandle, RKADK_RTMP_STATS_S *pstStats) {
+  RKADK_RTMP_HANDLE_S *pstHandle;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstStats, RKADK_FAILURE);
+
+  pstHandle = (RKADK_RTMP_HANDLE_S *)pHandle;
+  RKADK_MUTEX_LOCK(pstHandle->mutex);
+  memcpy(pstStats, &pstHandle->stStats, sizeof(RKADK_RTMP_STATS_S));
+  pstStats->u32QueueBytes = pstHandle->u32QueueBytes;
+  RKADK_MUTEX_UNLOCK(pstHandle->mutex);
+  return 0;
+}
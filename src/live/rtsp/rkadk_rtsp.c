@@ -19,22 +19,98 @@
 #include "rkadk_media_comm.h"
 #include "rkadk_audio_encoder.h"
 #include "rkadk_param.h"
+#include "rkadk_ring.h"
+#include "rkadk_signal.h"
+#include "rkadk_thread.h"
 #include "rtsp_demo.h"
+#include "linux_list.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+// rtsp_do_event interval while no frame is queued
+#define RKADK_RTSP_EVENT_INTERVAL_MS 20
+
+// a full video queue is retried before dropping, a replayed gop is a burst
+#define RKADK_RTSP_PUSH_RETRY 5
+#define RKADK_RTSP_PUSH_RETRY_US 2000
+
+typedef struct {
+  MB_BLK pMbBlk;
+  RKADK_U32 u32Offset;
+  RKADK_U32 u32Len;
+  RKADK_U64 u64Pts;
+} RKADK_RTSP_ITEM_S;
+
+// frames referenced by the encoder callbacks, sent by the rtsp thread
 typedef struct {
+  RKADK_RTSP_ITEM_S *pstItem;
+  void *pFree;
+  void *pProc;
+} RKADK_RTSP_QUEUE_S;
+
+// one server per port, its thread sends every session and serves the clients.
+// After create_rtsp_demo only that thread calls into rtsp_demo and changes
+// the session list, other threads hand it a request and wait
+typedef struct {
+  struct list_head mark;
+  RKADK_U32 u32Port;
+  RKADK_S32 s32SessionCnt;
+  rtsp_demo_handle stRtspHandle;
+  pthread_mutex_t mutex;   // the request list only
+  pthread_cond_t cond;     // broadcast when a request is done
+  struct list_head stReqList;
+  struct list_head stSessionList; // changed on the send thread only
+  void *pSignal;
+  void *pThread;
+} RKADK_RTSP_SERVER_S;
+
+// one session per path, the clients of a path share its encoder
+typedef struct {
+  struct list_head mark;   // in pstServer->stSessionList
+  bool bAttached;
+  char path[RKADK_MAX_FILE_PATH_LEN];
+  RKADK_S32 s32RefCnt;     // handles opened on the path
+  RKADK_U32 u32StartCnt;
   bool start;
   bool bRequestIDR;
   bool bWaitIDR;
   bool bVencChnMux;
   bool bFirstKeyFrame;
+  bool bDropToIDR;  // send queue was full, skip to the next IDR
+  bool bLowLatency; // live venc sends its frames as slices
   RKADK_U32 u32CamId;
-  rtsp_demo_handle stRtspHandle;
+  RKADK_STREAM_TYPE_E enStreamType;
+  RKADK_CODEC_TYPE_E enCodecType;
+  RKADK_CODEC_TYPE_E enAudioCodec;
+  RKADK_U32 u32VencChn;
+  RKADK_U64 u64LastPts;    // newest video frame queued
+  RKADK_U64 u64StartUs;    // older frames are a replayed gop
+  RKADK_RTSP_SERVER_S *pstServer;
   rtsp_session_handle stRtspSession;
+  RKADK_RTSP_QUEUE_S stVideoQueue;
+  RKADK_RTSP_QUEUE_S stAudioQueue;
+  RKADK_RTSP_STATS_S stStats;
 } RKADK_RTSP_HANDLE_S;
 
+typedef RKADK_S32 (*RKADK_RTSP_REQ_FN)(RKADK_RTSP_HANDLE_S *pHandle);
+
+// a session change run on the send thread
+typedef struct {
+  struct list_head mark;
+  RKADK_RTSP_REQ_FN pfnRun;
+  RKADK_RTSP_HANDLE_S *pHandle;
+  RKADK_S32 s32Ret;
+  bool bDone;
+} RKADK_RTSP_REQ_S;
+
+// servers and their sessions, taken by init and deinit
+static LIST_HEAD(g_stRtspServerList);
+static pthread_mutex_t g_rtspMutex = PTHREAD_MUTEX_INITIALIZER;
+
 static void RKADK_RTSP_SetVideoChn(RKADK_PARAM_STREAM_CFG_S *pstLiveCfg, RKADK_U32 u32CamId,
                                    MPP_CHN_S *pstViChn, MPP_CHN_S *pstVencChn,
                                    MPP_CHN_S *pstSrcVpssChn, MPP_CHN_S *pstDstVpssChn) {
@@ -55,14 +131,15 @@ static void RKADK_RTSP_SetVideoChn(RKADK_PARAM_STREAM_CFG_S *pstLiveCfg, RKADK_U
   pstVencChn->s32ChnId = pstLiveCfg->attribute.venc_chn;
 }
 
-static void RKADK_RTSP_AudioSetChn(MPP_CHN_S *pstAiChn, MPP_CHN_S *pstAencChn) {
+static void RKADK_RTSP_AudioSetChn(MPP_CHN_S *pstAiChn, MPP_CHN_S *pstAencChn,
+                                   RKADK_CODEC_TYPE_E enAudioCodec) {
   pstAiChn->enModId = RK_ID_AI;
   pstAiChn->s32DevId = 0;
   pstAiChn->s32ChnId = LIVE_AI_CHN;
 
   pstAencChn->enModId = RK_ID_AENC;
   pstAencChn->s32DevId = 0;
-  pstAencChn->s32ChnId = LIVE_AENC_CHN + 1;
+  pstAencChn->s32ChnId = RKADK_MEDIA_GetLiveAencChn(enAudioCodec);
 }
 
 static int RKADK_RTSP_SetVencAttr(RKADK_U32 u32CamId,
@@ -104,6 +181,17 @@ static int RKADK_RTSP_SetVencAttr(RKADK_U32 u32CamId,
     return -1;
   }
 
+  if (RKADK_PARAM_VencLowLatency(&pstLiveCfg->attribute)) {
+    ret = RKADK_MEDIA_SetLowLatencyAttr(pstVencAttr, pstLiveCfg->attribute.codec_type,
+                                        pstLiveCfg->attribute.gop,
+                                        pstLiveCfg->attribute.bitrate,
+                                        pstSensorCfg->framerate, u32DstFrameRateNum);
+    if (ret) {
+      RKADK_LOGE("RKADK_MEDIA_SetLowLatencyAttr failed");
+      return -1;
+    }
+  }
+
   pstVencAttr->stVencAttr.enType =
       RKADK_MEDIA_GetRkCodecType(pstLiveCfg->attribute.codec_type);
   pstVencAttr->stVencAttr.enPixelFormat = pstLiveCfg->vi_attr.stChnAttr.enPixelFormat;
@@ -114,16 +202,306 @@ static int RKADK_RTSP_SetVencAttr(RKADK_U32 u32CamId,
   pstVencAttr->stVencAttr.u32VirWidth = pstLiveCfg->attribute.width;
   pstVencAttr->stVencAttr.u32VirHeight = pstLiveCfg->attribute.height;
   pstVencAttr->stVencAttr.u32Profile = pstLiveCfg->attribute.profile;
-  pstVencAttr->stVencAttr.u32StreamBufCnt = RKADK_PARAM_GetStreamBufCnt(u32CamId, false);
+  pstVencAttr->stVencAttr.u32StreamBufCnt =
+      RKADK_PARAM_GetVencStreamBufCnt(u32CamId, pstLiveCfg->attribute.venc_chn);
   pstVencAttr->stVencAttr.u32BufSize = pstLiveCfg->attribute.bufsize;
 
   return 0;
 }
 
-static RKADK_S32 RKADK_RTSP_InitService(RKADK_CODEC_TYPE_E enCodecType,
-                                        RKADK_U32 port, const char *path,
-                                        RKADK_RTSP_HANDLE_S *pHandle) {
+static void RKADK_RTSP_QueueDestroy(RKADK_RTSP_QUEUE_S *pstQueue) {
+  RKADK_RTSP_ITEM_S *pstItem;
+
+  if (pstQueue->pProc) {
+    while ((pstItem = (RKADK_RTSP_ITEM_S *)RKADK_RING_Pop(pstQueue->pProc)))
+      RK_MPI_MB_ReleaseMB(pstItem->pMbBlk);
+  }
+
+  RKADK_RING_Destroy(pstQueue->pFree);
+  RKADK_RING_Destroy(pstQueue->pProc);
+  if (pstQueue->pstItem)
+    free(pstQueue->pstItem);
+  memset(pstQueue, 0, sizeof(RKADK_RTSP_QUEUE_S));
+}
+
+static int RKADK_RTSP_QueueCreate(RKADK_RTSP_QUEUE_S *pstQueue, RKADK_U32 u32Depth) {
+  memset(pstQueue, 0, sizeof(RKADK_RTSP_QUEUE_S));
+
+  pstQueue->pstItem = (RKADK_RTSP_ITEM_S *)calloc(u32Depth, sizeof(RKADK_RTSP_ITEM_S));
+  pstQueue->pFree = RKADK_RING_Create(u32Depth);
+  pstQueue->pProc = RKADK_RING_Create(u32Depth);
+  if (!pstQueue->pstItem || !pstQueue->pFree || !pstQueue->pProc) {
+    RKADK_LOGE("create rtsp queue failed");
+    RKADK_RTSP_QueueDestroy(pstQueue);
+    return -1;
+  }
+
+  for (RKADK_U32 i = 0; i < u32Depth; i++)
+    RKADK_RING_Push(pstQueue->pFree, &pstQueue->pstItem[i]);
+
+  return 0;
+}
+
+// called from the encoder callback, only takes a reference of the buffer
+static bool RKADK_RTSP_QueuePush(RKADK_RTSP_QUEUE_S *pstQueue, MB_BLK pMbBlk,
+                                 RKADK_U32 u32Offset, RKADK_U32 u32Len,
+                                 RKADK_U64 u64Pts, RKADK_U32 *pu32Hwm) {
+  RKADK_U32 u32Cnt;
+  RKADK_RTSP_ITEM_S *pstItem;
+
+  pstItem = (RKADK_RTSP_ITEM_S *)RKADK_RING_Pop(pstQueue->pFree);
+  if (!pstItem)
+    return false;
+
+  pstItem->pMbBlk = pMbBlk;
+  pstItem->u32Offset = u32Offset;
+  pstItem->u32Len = u32Len;
+  pstItem->u64Pts = u64Pts;
+  RK_MPI_MB_AddUserCnt(pMbBlk);
+  RKADK_RING_Push(pstQueue->pProc, pstItem);
+
+  u32Cnt = RKADK_RING_Count(pstQueue->pProc);
+  if (u32Cnt > *pu32Hwm)
+    *pu32Hwm = u32Cnt;
+
+  return true;
+}
+
+static RKADK_U64 RKADK_RTSP_GetUs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (RKADK_U64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void RKADK_RTSP_QueueSend(RKADK_RTSP_HANDLE_S *pHandle,
+                                 RKADK_RTSP_QUEUE_S *pstQueue, bool bVideo) {
+  uint8_t *data;
+  RKADK_U64 u64StartUs, u64SendUs;
+  RKADK_RTSP_ITEM_S *pstItem;
+
+  while ((pstItem = (RKADK_RTSP_ITEM_S *)RKADK_RING_Pop(pstQueue->pProc))) {
+    u64StartUs = RKADK_RTSP_GetUs();
+    data = (uint8_t *)RK_MPI_MB_Handle2VirAddr(pstItem->pMbBlk) + pstItem->u32Offset;
+    if (bVideo)
+      rtsp_tx_video(pHandle->stRtspSession, data, pstItem->u32Len, pstItem->u64Pts);
+    else
+      rtsp_tx_audio(pHandle->stRtspSession, data, pstItem->u32Len, pstItem->u64Pts);
+
+    u64SendUs = RKADK_RTSP_GetUs() - u64StartUs;
+    if (u64SendUs > pHandle->stStats.u32MaxSendUs)
+      pHandle->stStats.u32MaxSendUs = u64SendUs;
+    pHandle->stStats.u64SendBytes += pstItem->u32Len;
+    if (bVideo && pstItem->u64Pts >= pHandle->u64StartUs)
+      RKADK_MEDIA_CountLatency(pstItem->u64Pts, &pHandle->stStats.u32LatencyUs,
+                               &pHandle->stStats.u32MaxLatencyUs);
+
+    RK_MPI_MB_ReleaseMB(pstItem->pMbBlk);
+    RKADK_RING_Push(pstQueue->pFree, pstItem);
+  }
+}
+
+static void RKADK_RTSP_ReqProc(RKADK_RTSP_SERVER_S *pstServer) {
+  RKADK_RTSP_REQ_S *pstReq;
+
+  RKADK_MUTEX_LOCK(pstServer->mutex);
+  while (!list_empty(&pstServer->stReqList)) {
+    pstReq = list_first_entry(&pstServer->stReqList, RKADK_RTSP_REQ_S, mark);
+    list_del_init(&pstReq->mark);
+    RKADK_MUTEX_UNLOCK(pstServer->mutex);
+
+    pstReq->s32Ret = pstReq->pfnRun(pstReq->pHandle);
+
+    RKADK_MUTEX_LOCK(pstServer->mutex);
+    pstReq->bDone = true;
+    pthread_cond_broadcast(&pstServer->cond);
+  }
+  RKADK_MUTEX_UNLOCK(pstServer->mutex);
+}
+
+// run a session change on the send thread and wait for it
+static RKADK_S32 RKADK_RTSP_ServerCall(RKADK_RTSP_SERVER_S *pstServer,
+                                       RKADK_RTSP_REQ_FN pfnRun,
+                                       RKADK_RTSP_HANDLE_S *pHandle) {
+  RKADK_RTSP_REQ_S stReq;
+
+  memset(&stReq, 0, sizeof(stReq));
+  stReq.pfnRun = pfnRun;
+  stReq.pHandle = pHandle;
+
+  RKADK_MUTEX_LOCK(pstServer->mutex);
+  list_add_tail(&stReq.mark, &pstServer->stReqList);
+  RKADK_SIGNAL_Give(pstServer->pSignal);
+  while (!stReq.bDone)
+    pthread_cond_wait(&pstServer->cond, &pstServer->mutex);
+  RKADK_MUTEX_UNLOCK(pstServer->mutex);
+
+  return stReq.s32Ret;
+}
+
+// the only thread that touches the rtsp service after init, no lock is held
+// while a session is sent
+static bool RKADK_RTSP_SendProc(void *params) {
+  RKADK_RTSP_HANDLE_S *pHandle;
+  RKADK_RTSP_SERVER_S *pstServer = (RKADK_RTSP_SERVER_S *)params;
+
+  RKADK_SIGNAL_Wait(pstServer->pSignal, RKADK_RTSP_EVENT_INTERVAL_MS);
+
+  RKADK_RTSP_ReqProc(pstServer);
+  list_for_each_entry(pHandle, &pstServer->stSessionList, mark) {
+    RKADK_RTSP_QueueSend(pHandle, &pHandle->stVideoQueue, true);
+    RKADK_RTSP_QueueSend(pHandle, &pHandle->stAudioQueue, false);
+  }
+  rtsp_do_event(pstServer->stRtspHandle);
+  return true;
+}
+
+static void RKADK_RTSP_ServerPut(RKADK_RTSP_SERVER_S *pstServer) {
+  if (--pstServer->s32SessionCnt > 0)
+    return;
+
+  RKADK_LOGI("Rtsp server[%d] exit", pstServer->u32Port);
+  list_del(&pstServer->mark);
+  RKADK_THREAD_Destory(pstServer->pThread);
+  if (pstServer->stRtspHandle)
+    rtsp_del_demo(pstServer->stRtspHandle);
+  RKADK_SIGNAL_Destroy(pstServer->pSignal);
+  pthread_mutex_destroy(&pstServer->mutex);
+  pthread_cond_destroy(&pstServer->cond);
+  free(pstServer);
+}
+
+// called with g_rtspMutex held
+static RKADK_RTSP_SERVER_S *RKADK_RTSP_ServerGet(RKADK_U32 port) {
+  RKADK_RTSP_SERVER_S *pstServer;
+
+  list_for_each_entry(pstServer, &g_stRtspServerList, mark) {
+    if (pstServer->u32Port == port) {
+      pstServer->s32SessionCnt++;
+      return pstServer;
+    }
+  }
+
+  pstServer = (RKADK_RTSP_SERVER_S *)malloc(sizeof(RKADK_RTSP_SERVER_S));
+  if (!pstServer) {
+    RKADK_LOGE("malloc rtsp server failed");
+    return NULL;
+  }
+  memset(pstServer, 0, sizeof(RKADK_RTSP_SERVER_S));
+  pstServer->u32Port = port;
+  pstServer->s32SessionCnt = 1;
+  pthread_mutex_init(&pstServer->mutex, NULL);
+  pthread_cond_init(&pstServer->cond, NULL);
+  INIT_LIST_HEAD(&pstServer->stReqList);
+  INIT_LIST_HEAD(&pstServer->stSessionList);
+  list_add_tail(&pstServer->mark, &g_stRtspServerList);
+
+  pstServer->stRtspHandle = create_rtsp_demo(port);
+  if (!pstServer->stRtspHandle) {
+    RKADK_LOGE("create_rtsp_demo port[%d] failed", port);
+    RKADK_RTSP_ServerPut(pstServer);
+    return NULL;
+  }
+
+  pstServer->pSignal = RKADK_SIGNAL_Create(0, 1);
+  if (!pstServer->pSignal) {
+    RKADK_LOGE("RKADK_SIGNAL_Create failed");
+    RKADK_RTSP_ServerPut(pstServer);
+    return NULL;
+  }
+
+  pstServer->pThread = RKADK_THREAD_Create(RKADK_RTSP_SendProc, pstServer, "RtspSend");
+  if (!pstServer->pThread) {
+    RKADK_LOGE("Create rtsp send thread failed");
+    RKADK_RTSP_ServerPut(pstServer);
+    return NULL;
+  }
+
+  RKADK_LOGI("Rtsp server[%d] start", port);
+  return pstServer;
+}
+
+// called with g_rtspMutex held
+static RKADK_RTSP_HANDLE_S *RKADK_RTSP_FindSession(RKADK_U32 port, const char *path) {
+  RKADK_RTSP_HANDLE_S *pHandle;
+  RKADK_RTSP_SERVER_S *pstServer;
+
+  list_for_each_entry(pstServer, &g_stRtspServerList, mark) {
+    if (pstServer->u32Port != port)
+      continue;
+
+    list_for_each_entry(pHandle, &pstServer->stSessionList, mark)
+      if (!strcmp(pHandle->path, path))
+        return pHandle;
+  }
+
+  return NULL;
+}
+
+// AudioSpecificConfig of aac-lc, the "config" of the sdp
+static RKADK_S32 RKADK_RTSP_GetAacConfig(RKADK_U32 u32SampleRate,
+                                         RKADK_U32 u32Channels,
+                                         RKADK_U8 *pu8Config) {
+  RKADK_U32 i;
+  const RKADK_U32 u32SampleRates[] = {96000, 88200, 64000, 48000, 44100, 32000,
+                                      24000, 22050, 16000, 12000, 11025, 8000,
+                                      7350};
+
+  for (i = 0; i < sizeof(u32SampleRates) / sizeof(u32SampleRates[0]); i++) {
+    if (u32SampleRates[i] == u32SampleRate)
+      break;
+  }
+
+  if (i == sizeof(u32SampleRates) / sizeof(u32SampleRates[0]) || !u32Channels
+      || u32Channels > 7) {
+    RKADK_LOGE("unsupported aac samplerate[%d] channels[%d]", u32SampleRate,
+               u32Channels);
+    return -1;
+  }
+
+  // object type 2 (aac-lc), sampling frequency index, channel configuration
+  pu8Config[0] = (2 << 3) | (i >> 1);
+  pu8Config[1] = ((i & 0x1) << 7) | (u32Channels << 3);
+  return 0;
+}
+
+static RKADK_S32 RKADK_RTSP_SetAudio(RKADK_RTSP_HANDLE_S *pHandle,
+                                     RKADK_PARAM_AUDIO_CFG_S *pstAudioCfg) {
+  int ret;
+  RKADK_U8 config[2];
+
+  switch (pHandle->enAudioCodec) {
+  case RKADK_CODEC_TYPE_G711A:
+    ret = rtsp_set_audio(pHandle->stRtspSession, RTSP_CODEC_ID_AUDIO_G711A, NULL, 0);
+    break;
+  case RKADK_CODEC_TYPE_G711U:
+    ret = rtsp_set_audio(pHandle->stRtspSession, RTSP_CODEC_ID_AUDIO_G711U, NULL, 0);
+    break;
+  case RKADK_CODEC_TYPE_ACC:
+    if (RKADK_RTSP_GetAacConfig(pstAudioCfg->samplerate, pstAudioCfg->channels,
+                                config))
+      return -1;
+
+    ret = rtsp_set_audio(pHandle->stRtspSession, RTSP_CODEC_ID_AUDIO_AAC, config,
+                         sizeof(config));
+    break;
+  default:
+    RKADK_LOGE("Unsupport audio codec: %d", pHandle->enAudioCodec);
+    return -1;
+  }
+
+  if (ret) {
+    RKADK_LOGE("rtsp_set_audio[%d] failed(%d)", pHandle->enAudioCodec, ret);
+    return -1;
+  }
+
+  return 0;
+}
+
+// send thread
+static RKADK_S32 RKADK_RTSP_InitSession(RKADK_RTSP_HANDLE_S *pHandle) {
   int ret = 0;
+  RKADK_CODEC_TYPE_E enCodecType = pHandle->enCodecType;
   RKADK_PARAM_AUDIO_CFG_S *pstAudioCfg = RKADK_PARAM_GetAudioCfg();
 
   if (!pstAudioCfg) {
@@ -131,8 +509,13 @@ static RKADK_S32 RKADK_RTSP_InitService(RKADK_CODEC_TYPE_E enCodecType,
     return -1;
   }
 
-  pHandle->stRtspHandle = create_rtsp_demo(port);
-  pHandle->stRtspSession = rtsp_new_session(pHandle->stRtspHandle, path);
+  pHandle->stRtspSession = rtsp_new_session(pHandle->pstServer->stRtspHandle,
+                                            pHandle->path);
+  if (!pHandle->stRtspSession) {
+    RKADK_LOGE("rtsp_new_session[%s] failed", pHandle->path);
+    return -1;
+  }
+
   if (enCodecType == RKADK_CODEC_TYPE_H264) {
     ret = rtsp_set_video(pHandle->stRtspSession, RTSP_CODEC_ID_VIDEO_H264, NULL, 0);
     if (ret) {
@@ -157,11 +540,8 @@ static RKADK_S32 RKADK_RTSP_InitService(RKADK_CODEC_TYPE_E enCodecType,
     return -1;
   }
 
-  ret = rtsp_set_audio(pHandle->stRtspSession, RTSP_CODEC_ID_AUDIO_G711A, NULL, 0);
-  if (ret) {
-    RKADK_LOGE("rtsp_set_audio failed(%d)", ret);
+  if (RKADK_RTSP_SetAudio(pHandle, pstAudioCfg))
     return -1;
-  }
 
   ret = rtsp_sync_audio_ts(pHandle->stRtspSession, rtsp_get_reltime(),
                             rtsp_get_ntptime());
@@ -182,15 +562,70 @@ static RKADK_S32 RKADK_RTSP_InitService(RKADK_CODEC_TYPE_E enCodecType,
     return -1;
   }
 
+  list_add_tail(&pHandle->mark, &pHandle->pstServer->stSessionList);
+  pHandle->bAttached = true;
+  return 0;
+}
+
+// send thread, nothing is sent from the queues after it
+static RKADK_S32 RKADK_RTSP_DetachSession(RKADK_RTSP_HANDLE_S *pHandle) {
+  if (pHandle->bAttached) {
+    list_del(&pHandle->mark);
+    pHandle->bAttached = false;
+  }
+
   return 0;
 }
 
+// send thread
+static RKADK_S32 RKADK_RTSP_DelSession(RKADK_RTSP_HANDLE_S *pHandle) {
+  rtsp_del_session(pHandle->stRtspSession);
+  return 0;
+}
+
+static RKADK_S32 RKADK_RTSP_InitService(RKADK_U32 port, const char *path,
+                                        RKADK_RTSP_HANDLE_S *pHandle) {
+  RKADK_U32 u32VideoDepth = RKADK_RTSP_VIDEO_QUEUE_DEPTH;
+
+  if (pHandle->bLowLatency)
+    u32VideoDepth *= RKADK_MEDIA_LOW_LATENCY_SLICE_CNT;
+
+  if (RKADK_RTSP_QueueCreate(&pHandle->stVideoQueue, u32VideoDepth)
+      || RKADK_RTSP_QueueCreate(&pHandle->stAudioQueue, RKADK_RTSP_AUDIO_QUEUE_DEPTH))
+    return -1;
+  pHandle->stStats.u32VideoQueueDepth = u32VideoDepth;
+  pHandle->stStats.u32AudioQueueDepth = RKADK_RTSP_AUDIO_QUEUE_DEPTH;
+
+  pHandle->pstServer = RKADK_RTSP_ServerGet(port);
+  if (!pHandle->pstServer)
+    return -1;
+
+  snprintf(pHandle->path, sizeof(pHandle->path), "%s", path);
+  return RKADK_RTSP_ServerCall(pHandle->pstServer, RKADK_RTSP_InitSession, pHandle);
+}
+
+// release the queued buffers before their channels are destroyed
+static void RKADK_RTSP_DeInitSend(RKADK_RTSP_HANDLE_S *pHandle) {
+  if (pHandle->pstServer && pHandle->bAttached)
+    RKADK_RTSP_ServerCall(pHandle->pstServer, RKADK_RTSP_DetachSession, pHandle);
+
+  RKADK_RTSP_QueueDestroy(&pHandle->stVideoQueue);
+  RKADK_RTSP_QueueDestroy(&pHandle->stAudioQueue);
+}
+
 static void RKADK_RTSP_DeInitService(RKADK_RTSP_HANDLE_S *pHandle) {
-  if (pHandle->stRtspSession)
-    rtsp_del_session(pHandle->stRtspSession);
+  RKADK_RTSP_DeInitSend(pHandle);
+
+  if (!pHandle->pstServer)
+    return;
 
-  if (pHandle->stRtspHandle)
-    rtsp_del_demo(pHandle->stRtspHandle);
+  if (pHandle->stRtspSession) {
+    RKADK_RTSP_ServerCall(pHandle->pstServer, RKADK_RTSP_DelSession, pHandle);
+    pHandle->stRtspSession = NULL;
+  }
+
+  RKADK_RTSP_ServerPut(pHandle->pstServer);
+  pHandle->pstServer = NULL;
 }
 
 static RKADK_S32 RKADK_RTSP_RequestIDR(RKADK_U32 u32CamId, RKADK_U32 u32ChnId) {
@@ -218,11 +653,26 @@ static RKADK_S32 RKADK_RTSP_RequestIDR(RKADK_U32 u32CamId, RKADK_U32 u32ChnId) {
   return ret;
 }
 
+// runs on the session's own venc consumer thread, so it may wait a little
+static bool RKADK_RTSP_VideoPush(RKADK_RTSP_HANDLE_S *pHandle, VENC_PACK_S *pstPack) {
+  int i;
+
+  for (i = 0; i < RKADK_RTSP_PUSH_RETRY; i++) {
+    if (RKADK_RTSP_QueuePush(&pHandle->stVideoQueue, pstPack->pMbBlk, 0,
+                             pstPack->u32Len, pstPack->u64PTS,
+                             &pHandle->stStats.u32VideoQueueHwm))
+      return true;
+
+    RKADK_SIGNAL_Give(pHandle->pstServer->pSignal);
+    usleep(RKADK_RTSP_PUSH_RETRY_US);
+  }
+
+  return false;
+}
+
 static void RKADK_RTSP_VencOutCb(RKADK_MEDIA_VENC_DATA_S mb, RKADK_VOID *handle) {
   RKADK_MEDIA_VENC_DATA_S stData = mb;
-  RKADK_PARAM_STREAM_CFG_S *pstLiveCfg;
   RKADK_RTSP_HANDLE_S *pHandle = (RKADK_RTSP_HANDLE_S *)handle;
-  RKADK_VOID *data;
 
   if (!pHandle) {
     RKADK_LOGE("Can't find rtsp handle");
@@ -230,21 +680,21 @@ static void RKADK_RTSP_VencOutCb(RKADK_MEDIA_VENC_DATA_S mb, RKADK_VOID *handle)
     return;
   }
 
-  pstLiveCfg = RKADK_PARAM_GetStreamCfg(pHandle->u32CamId, RKADK_STREAM_TYPE_LIVE);
-  if (!pstLiveCfg) {
-    RKADK_LOGE("Live RKADK_PARAM_GetStreamCfg Live failed");
+  if (!pHandle->start)
     return;
-  }
 
-  if (!pHandle->start)
+  // live frames queued while the gop was being replayed, a low latency
+  // encoder is never shared so never replayed, and its slices share a pts
+  if (!pHandle->bLowLatency && pHandle->u64LastPts
+      && stData.stFrame.pstPack->u64PTS <= pHandle->u64LastPts)
     return;
 
   if (!pHandle->bWaitIDR) {
-    if (!RKADK_MEDIA_CheckIdrFrame(pstLiveCfg->attribute.codec_type,
+    if (!RKADK_MEDIA_CheckIdrFrame(pHandle->enCodecType,
                                    stData.stFrame.pstPack->DataType)) {
       if (!pHandle->bRequestIDR) {
         RKADK_LOGD("requst idr frame");
-        RKADK_RTSP_RequestIDR(pHandle->u32CamId, pstLiveCfg->attribute.venc_chn);
+        RKADK_RTSP_RequestIDR(pHandle->u32CamId, pHandle->u32VencChn);
         pHandle->bRequestIDR = true;
       } else {
         RKADK_LOGD("wait first idr frame");
@@ -260,19 +710,39 @@ static void RKADK_RTSP_VencOutCb(RKADK_MEDIA_VENC_DATA_S mb, RKADK_VOID *handle)
     }
   }
 
-  data = RK_MPI_MB_Handle2VirAddr(stData.stFrame.pstPack->pMbBlk);
-  if (pHandle->stRtspHandle && pHandle->stRtspSession) {
-    rtsp_tx_video(pHandle->stRtspSession, (uint8_t *)data,
-                  stData.stFrame.pstPack->u32Len, stData.stFrame.pstPack->u64PTS);
-    rtsp_do_event(pHandle->stRtspHandle);
+  if (pHandle->bDropToIDR) {
+    if (!RKADK_MEDIA_CheckIdrFrame(pHandle->enCodecType,
+                                   stData.stFrame.pstPack->DataType)) {
+      pHandle->stStats.u32VideoDropCnt++;
+      return;
+    }
+
+    pHandle->bDropToIDR = false;
+  }
+
+  // a slow viewer only drops its own frames, the encoder never waits
+  if (!RKADK_RTSP_VideoPush(pHandle, stData.stFrame.pstPack)) {
+    RKADK_LOGW("rtsp[%d] send queue full, drop to the next IDR", pHandle->u32CamId);
+    pHandle->stStats.u32VideoDropCnt++;
+    pHandle->bDropToIDR = true;
+
+    // the recorder's gop isn't broken for a slow viewer, wait for its IDR
+    if (!pHandle->bVencChnMux) {
+      pHandle->stStats.u32IdrReqCnt++;
+      RKADK_RTSP_RequestIDR(pHandle->u32CamId, pHandle->u32VencChn);
+    }
+    return;
   }
+
+  pHandle->u64LastPts = stData.stFrame.pstPack->u64PTS;
+  RKADK_SIGNAL_Give(pHandle->pstServer->pSignal);
 }
 
 static void RKADK_RTSP_AencOutCb(AUDIO_STREAM_S stFrame,
                                  RKADK_VOID *pHandle) {
+  RKADK_U32 u32Offset = 0;
   RKADK_CHECK_POINTER_N(pHandle);
   RKADK_RTSP_HANDLE_S *pstHandle = (RKADK_RTSP_HANDLE_S *)pHandle;
-  RKADK_U8 *data;
   if (!pstHandle) {
     RKADK_LOGE("Can't find rtsp handle");
     return;
@@ -281,35 +751,53 @@ static void RKADK_RTSP_AencOutCb(AUDIO_STREAM_S stFrame,
   if (!pstHandle->start)
     return;
 
-  data = (RKADK_U8 *)RK_MPI_MB_Handle2VirAddr(stFrame.pMbBlk);
-  if (pstHandle->stRtspHandle && pstHandle->stRtspSession) {
-    rtsp_tx_audio(pstHandle->stRtspSession, (uint8_t *)data,
-                  stFrame.u32Len, stFrame.u64TimeStamp);
-    rtsp_do_event(pstHandle->stRtspHandle);
+  // rtp carries raw aac access units
+  if (pstHandle->enAudioCodec == RKADK_CODEC_TYPE_ACC) {
+    u32Offset = RKADK_MEDIA_GetAdtsHeaderLen(
+        (RKADK_U8 *)RK_MPI_MB_Handle2VirAddr(stFrame.pMbBlk), stFrame.u32Len);
   }
+
+  if (!RKADK_RTSP_QueuePush(&pstHandle->stAudioQueue, stFrame.pMbBlk, u32Offset,
+                            stFrame.u32Len - u32Offset, stFrame.u64TimeStamp,
+                            &pstHandle->stStats.u32AudioQueueHwm)) {
+    pstHandle->stStats.u32AudioDropCnt++;
+    return;
+  }
+
+  RKADK_SIGNAL_Give(pstHandle->pstServer->pSignal);
 }
 
 static RKADK_S32 RKADK_RTSP_VencGetData(RKADK_U32 u32CamId,
                                         MPP_CHN_S *pstVencChn,
                                         RKADK_RTSP_HANDLE_S *pHandle) {
   int ret = 0;
+  RKADK_MEDIA_QUEUE_ATTR_S stQueueAttr;
 
-  VENC_RECV_PIC_PARAM_S stRecvParam;
-  stRecvParam.s32RecvPicNum = -1;
-  ret = RK_MPI_VENC_StartRecvFrame(pstVencChn->s32ChnId, &stRecvParam);
-  if (ret) {
-    RKADK_LOGE("RK_MPI_VENC_StartRecvFrame failed = %d", ret);
-    return ret;
+  // a venc shared with the recorder is started by the recorder
+  if (pHandle->enStreamType == RKADK_STREAM_TYPE_LIVE) {
+    VENC_RECV_PIC_PARAM_S stRecvParam;
+    stRecvParam.s32RecvPicNum = -1;
+    ret = RK_MPI_VENC_StartRecvFrame(pstVencChn->s32ChnId, &stRecvParam);
+    if (ret) {
+      RKADK_LOGE("RK_MPI_VENC_StartRecvFrame failed = %d", ret);
+      return ret;
+    }
   }
 
-  ret = RKADK_MEDIA_GetVencBuffer(pstVencChn, RKADK_RTSP_VencOutCb,
-                                (RKADK_VOID *)pHandle);
+  // the cached gop lets a session start without forcing an IDR
+  memset(&stQueueAttr, 0, sizeof(RKADK_MEDIA_QUEUE_ATTR_S));
+  stQueueAttr.enOverflow = RKADK_MEDIA_QUEUE_DROP_TO_IDR;
+  stQueueAttr.bGopCache = pHandle->bVencChnMux;
+  stQueueAttr.bNoRequestIDR = pHandle->bVencChnMux;
+  if (pHandle->bLowLatency)
+    stQueueAttr.u32Depth = RKADK_MEDIA_VENC_QUEUE_DEPTH * RKADK_MEDIA_LOW_LATENCY_SLICE_CNT;
+  ret = RKADK_MEDIA_GetVencBufferEx(pstVencChn, RKADK_RTSP_VencOutCb,
+                                    (RKADK_VOID *)pHandle, &stQueueAttr);
   if (ret) {
-    RKADK_LOGE("RKADK_MEDIA_GetVencBuffer failed = %d", ret);
+    RKADK_LOGE("RKADK_MEDIA_GetVencBufferEx failed = %d", ret);
     return ret;
   }
 
-
   return ret;
 }
 
@@ -384,13 +872,14 @@ static RKADK_S32 RKADK_RTSP_SetAiAttr(AIO_ATTR_S *pstAiAttr,
 
 static RKADK_S32 RKADK_RTSP_SetAencAttr(RKADK_U32 u32CamId,
                                         RKADK_PARAM_AUDIO_CFG_S *pstAudioParam,
+                                        RKADK_CODEC_TYPE_E enAudioCodec,
                                         AENC_CHN_ATTR_S *pstAencAttr) {
 
   RKADK_CHECK_POINTER(pstAudioParam, RKADK_FAILURE);
   RKADK_CHECK_POINTER(pstAencAttr, RKADK_FAILURE);
 
   memset(pstAencAttr, 0, sizeof(AENC_CHN_ATTR_S));
-  pstAencAttr->enType = RK_AUDIO_ID_PCM_ALAW;
+  pstAencAttr->enType = RKADK_MEDIA_GetRkCodecType(enAudioCodec);
   pstAencAttr->u32BufCount = RKADK_PARAM_GetStreamBufCnt(u32CamId, true);
   pstAencAttr->stCodecAttr.enType = pstAencAttr->enType;
   pstAencAttr->stCodecAttr.u32Channels = pstAudioParam->channels;
@@ -398,31 +887,48 @@ static RKADK_S32 RKADK_RTSP_SetAencAttr(RKADK_U32 u32CamId,
   pstAencAttr->stCodecAttr.enBitwidth = pstAudioParam->bit_width;
   pstAencAttr->stCodecAttr.pstResv = RK_NULL;
 
+  if (enAudioCodec == RKADK_CODEC_TYPE_ACC) {
+    pstAencAttr->stCodecAttr.u32Resv[0] = 2;
+    pstAencAttr->stCodecAttr.u32Resv[1] = pstAudioParam->live_bitrate;
+  }
+
   return 0;
 }
 
 static RKADK_S32 RKADK_RTSP_EnableAudio(RKADK_U32 u32CamId, MPP_CHN_S stAiChn,
-                                        MPP_CHN_S stAencChn, RKADK_PARAM_AUDIO_CFG_S *pstAudioParam) {
+                                        MPP_CHN_S stAencChn, RKADK_PARAM_AUDIO_CFG_S *pstAudioParam,
+                                        RKADK_CODEC_TYPE_E enAudioCodec) {
   int ret;
   AIO_ATTR_S stAiAttr;
   AENC_CHN_ATTR_S stAencAttr;
 
+  if (RKADK_MEDIA_EnableAencRegister(enAudioCodec)) {
+    ret = RKADK_AUDIO_ENCODER_Register(enAudioCodec);
+    if (ret) {
+      RKADK_LOGE("RKADK_AUDIO_ENCODER_Register failed(%d)", ret);
+      return ret;
+    }
+  }
+
   // Create AI and AENC
   ret = RKADK_RTSP_SetAiAttr(&stAiAttr, pstAudioParam);
   if (ret) {
     RKADK_LOGE("RKADK_RTMP_SetAiAttr failed");
-    return -1;
+    ret = -1;
+    goto unregist;
   }
 
   ret = RKADK_MPI_AI_Init(0, stAiChn.s32ChnId, &stAiAttr, pstAudioParam->vqe_mode,
                           pstAudioParam->vqe_config_path, pstAudioParam->mic_type);
   if (ret) {
     RKADK_LOGE("RKADK_MPI_AI_Init faile(%d)", ret);
-    return -1;
+    ret = -1;
+    goto unregist;
   }
 
-  if (RKADK_RTSP_SetAencAttr(u32CamId, pstAudioParam, &stAencAttr)) {
+  if (RKADK_RTSP_SetAencAttr(u32CamId, pstAudioParam, enAudioCodec, &stAencAttr)) {
     RKADK_LOGE("RKADK_RTMP_SetAencAttr error");
+    ret = -1;
     goto failed;
   }
 
@@ -436,11 +942,16 @@ static RKADK_S32 RKADK_RTSP_EnableAudio(RKADK_U32 u32CamId, MPP_CHN_S stAiChn,
 failed:
   RKADK_MPI_AI_DeInit(stAiChn.s32DevId, stAiChn.s32ChnId, pstAudioParam->vqe_mode);
 
+unregist:
+  if (RKADK_MEDIA_EnableAencRegister(enAudioCodec))
+    RKADK_AUDIO_ENCODER_UnRegister(enAudioCodec);
+
   return ret;
 }
 
 static RKADK_S32 RKADK_RTSP_DisableAudio(MPP_CHN_S stAiChn, MPP_CHN_S stAencChn,
-                                         RKADK_PARAM_AUDIO_CFG_S *pstAudioParam) {
+                                         RKADK_PARAM_AUDIO_CFG_S *pstAudioParam,
+                                         RKADK_CODEC_TYPE_E enAudioCodec) {
   int ret;
 
   // Destroy AENC before AI
@@ -457,86 +968,27 @@ static RKADK_S32 RKADK_RTSP_DisableAudio(MPP_CHN_S stAiChn, MPP_CHN_S stAencChn,
     return ret;
   }
 
+  if (RKADK_MEDIA_EnableAencRegister(enAudioCodec)) {
+    ret = RKADK_AUDIO_ENCODER_UnRegister(enAudioCodec);
+    if (ret) {
+      RKADK_LOGE("RKADK_AUDIO_ENCODER_UnRegister failed(%d)", ret);
+      return ret;
+    }
+  }
+
   return 0;
 }
 
-RKADK_S32 RKADK_RTSP_Init(RKADK_U32 u32CamId, RKADK_U32 port, const char *path,
-                          RKADK_MW_PTR *ppHandle) {
+static RKADK_S32 RKADK_RTSP_EnableVideo(RKADK_U32 u32CamId,
+                                        RKADK_PARAM_STREAM_CFG_S *pstLiveCfg,
+                                        RKADK_PARAM_SENSOR_CFG_S *pstSensorCfg,
+                                        RKADK_RTSP_HANDLE_S *pHandle) {
   int ret = 0;
-  bool bSysInit = false;
   bool bUseVpss = false;
   MPP_CHN_S stViChn, stVencChn, stSrcVpssChn, stDstVpssChn;
-  MPP_CHN_S stAiChn, stAencChn;
   RKADK_STREAM_TYPE_E enType;
   VPSS_GRP_ATTR_S stGrpAttr;
   VPSS_CHN_ATTR_S stChnAttr;
-  RKADK_RTSP_HANDLE_S *pHandle;
-
-  RKADK_CHECK_CAMERAID(u32CamId, RKADK_FAILURE);
-  RKADK_CHECK_POINTER(path, RKADK_FAILURE);
-
-  RKADK_LOGI("Rtsp[%d, %d, %s] Init...", u32CamId, port, path);
-
-  if (*ppHandle) {
-    RKADK_LOGE("rtsp handle has been created");
-    return -1;
-  }
-
-  bSysInit = RKADK_MPI_SYS_CHECK();
-  if (!bSysInit) {
-    RKADK_LOGE("System is not initialized");
-    return -1;
-  }
-
-  RKADK_PARAM_STREAM_CFG_S *pstLiveCfg =
-      RKADK_PARAM_GetStreamCfg(u32CamId, RKADK_STREAM_TYPE_LIVE);
-  if (!pstLiveCfg) {
-    RKADK_LOGE("Live RKADK_PARAM_GetStreamCfg Live failed");
-    return -1;
-  }
-
-  RKADK_PARAM_SENSOR_CFG_S *pstSensorCfg = RKADK_PARAM_GetSensorCfg(u32CamId);
-  if (!pstSensorCfg) {
-    RKADK_LOGE("RKADK_PARAM_GetSensorCfg failed");
-    return -1;
-  }
-
-  RKADK_PARAM_AUDIO_CFG_S *pstAudioCfg = RKADK_PARAM_GetAudioCfg();
-  if (!pstAudioCfg) {
-    RKADK_LOGE("RKADK_PARAM_GetAudioCfg failed");
-    return -1;
-  }
-
-  pHandle = (RKADK_RTSP_HANDLE_S *)malloc(sizeof(RKADK_RTSP_HANDLE_S));
-  if (!pHandle) {
-    RKADK_LOGE("malloc pHandle failed");
-    return -1;
-  }
-  memset(pHandle, 0, sizeof(RKADK_RTSP_HANDLE_S));
-  pHandle->u32CamId = u32CamId;
-  pHandle->bFirstKeyFrame = true;
-
-  ret = RKADK_RTSP_InitService(pstLiveCfg->attribute.codec_type, port, path,
-                               pHandle);
-  if (ret) {
-    RKADK_LOGE("RKADK_RTSP_InitService failed");
-    free(pHandle);
-    return -1;
-  }
-
-  RKADK_RTSP_AudioSetChn(&stAiChn, &stAencChn);
-  ret = RKADK_RTSP_EnableAudio(u32CamId, stAiChn, stAencChn, pstAudioCfg);
-  if (ret) {
-    RKADK_LOGE("RKADK_RTSP_EnableAudio failed[%d]", ret);
-    free(pHandle);
-    return ret;
-  }
-
-  ret = RKADK_RTSP_AencGetData(u32CamId, &stAencChn, pHandle);
-  if (ret) {
-    RKADK_LOGE("RKADK_RTSP_AencGetData failed(%d)", ret);
-    goto failed;
-  }
 
   RKADK_RTSP_SetVideoChn(pstLiveCfg, u32CamId, &stViChn, &stVencChn, &stSrcVpssChn, &stDstVpssChn);
   enType = RKADK_PARAM_VencChnMux(u32CamId, stVencChn.s32ChnId);
@@ -564,7 +1016,7 @@ RKADK_S32 RKADK_RTSP_Init(RKADK_U32 u32CamId, RKADK_U32 port, const char *path,
                           &(pstLiveCfg->vi_attr.stChnAttr));
   if (ret) {
     RKADK_LOGE("RKADK_MPI_VI_Init faled %d", ret);
-    goto failed;
+    return ret;
   }
 
   bUseVpss = RKADK_RTSP_IsUseVpss(u32CamId, pstLiveCfg);
@@ -656,79 +1108,27 @@ RKADK_S32 RKADK_RTSP_Init(RKADK_U32 u32CamId, RKADK_U32 port, const char *path,
     }
   }
 
-  // Bind AI to AENC
-  ret = RKADK_MPI_SYS_Bind(&stAiChn, &stAencChn);
-  if (ret) {
-    RKADK_LOGE("Bind AI[%d] and AENC[%d] failed[%d]", stAiChn.s32ChnId,
-               stAencChn.s32ChnId, ret);
-    goto unbind;
-  }
 
-  *ppHandle = (RKADK_MW_PTR)pHandle;
-  RKADK_LOGI("Rtsp[%d, %d, %s] Init End...", u32CamId, port, path);
   return 0;
 
-unbind:
-  if (bUseVpss) {
-    RKADK_MPI_SYS_UnBind(&stSrcVpssChn, &stVencChn);
-    RKADK_MPI_SYS_UnBind(&stViChn, &stSrcVpssChn);
-  } else {
-    RKADK_MPI_SYS_UnBind(&stViChn, &stVencChn);
-  }
-
 failed:
-  RKADK_LOGE("failed");
+  RKADK_MEDIA_StopGetVencBuffer(&stVencChn, RKADK_RTSP_VencOutCb, pHandle);
   RKADK_MPI_VENC_DeInit(stVencChn.s32ChnId);
-
-  RKADK_MPI_VPSS_DeInit(stSrcVpssChn.s32DevId, stSrcVpssChn.s32ChnId);
-
+  if (bUseVpss)
+    RKADK_MPI_VPSS_DeInit(stSrcVpssChn.s32DevId, stSrcVpssChn.s32ChnId);
   RKADK_MPI_VI_DeInit(u32CamId, stViChn.s32ChnId);
-
-  RKADK_RTSP_DisableAudio(stAiChn, stAencChn, pstAudioCfg);
-
-  if (pHandle) {
-    RKADK_RTSP_DeInitService((RKADK_RTSP_HANDLE_S *)pHandle);
-    free(pHandle);
-  }
-
   return ret;
 }
 
-RKADK_S32 RKADK_RTSP_DeInit(RKADK_MW_PTR pHandle) {
+static RKADK_S32 RKADK_RTSP_DisableVideo(RKADK_RTSP_HANDLE_S *pstHandle,
+                                         RKADK_PARAM_STREAM_CFG_S *pstLiveCfg) {
   int ret = 0;
   bool bUseVpss = false;
   MPP_CHN_S stViChn, stVencChn, stSrcVpssChn, stDstVpssChn;
-  MPP_CHN_S stAiChn, stAencChn;
-
-  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
-  RKADK_RTSP_HANDLE_S *pstHandle = (RKADK_RTSP_HANDLE_S *)pHandle;
-
-  RKADK_LOGI("Rtsp[%d] DeInit...", pstHandle->u32CamId);
-
-  RKADK_PARAM_STREAM_CFG_S *pstLiveCfg =
-      RKADK_PARAM_GetStreamCfg(pstHandle->u32CamId, RKADK_STREAM_TYPE_LIVE);
-  if (!pstLiveCfg) {
-    RKADK_LOGE("RKADK_PARAM_GetStreamCfg failed");
-    return -1;
-  }
-
-  RKADK_PARAM_AUDIO_CFG_S *pstAudioCfg = RKADK_PARAM_GetAudioCfg();
-  if (!pstAudioCfg) {
-    RKADK_LOGE("RKADK_PARAM_GetAudioCfg failed");
-    return -1;
-  }
 
   RKADK_RTSP_SetVideoChn(pstLiveCfg, pstHandle->u32CamId, &stViChn, &stVencChn,
                          &stSrcVpssChn, &stDstVpssChn);
 
-  // exit get media buffer
-  if (pstHandle->bVencChnMux)
-    RKADK_MEDIA_StopGetVencBuffer(&stVencChn, RKADK_RTSP_VencOutCb, pstHandle);
-
-   // Stop get aenc data
-  RKADK_RTSP_AudioSetChn(&stAiChn, &stAencChn);
-  RKADK_MEDIA_StopGetAencBuffer(&stAencChn, RKADK_RTSP_AencOutCb, pstHandle);
-
   bUseVpss = RKADK_RTSP_IsUseVpss(pstHandle->u32CamId, pstLiveCfg);
   if (bUseVpss){
     // VPSS UnBind VENC
@@ -779,32 +1179,252 @@ RKADK_S32 RKADK_RTSP_DeInit(RKADK_MW_PTR pHandle) {
     return ret;
   }
 
-  ret = RKADK_MPI_SYS_UnBind(&stAiChn, &stAencChn);
+  return 0;
+}
+
+static RKADK_S32 RKADK_RTSP_SetVideoSrc(RKADK_U32 u32CamId,
+                                       RKADK_STREAM_TYPE_E enStreamType,
+                                       RKADK_RTSP_HANDLE_S *pHandle) {
+  RKADK_U32 u32Index;
+  RKADK_PARAM_REC_CFG_S *pstRecCfg;
+  RKADK_PARAM_STREAM_CFG_S *pstLiveCfg;
+
+  if (enStreamType == RKADK_STREAM_TYPE_LIVE) {
+    pstLiveCfg = RKADK_PARAM_GetStreamCfg(u32CamId, RKADK_STREAM_TYPE_LIVE);
+    if (!pstLiveCfg) {
+      RKADK_LOGE("Live RKADK_PARAM_GetStreamCfg Live failed");
+      return -1;
+    }
+
+    pHandle->enCodecType = pstLiveCfg->attribute.codec_type;
+    pHandle->u32VencChn = pstLiveCfg->attribute.venc_chn;
+    pHandle->bLowLatency = RKADK_PARAM_VencLowLatency(&pstLiveCfg->attribute);
+    return 0;
+  }
+
+  if (enStreamType != RKADK_STREAM_TYPE_VIDEO_MAIN
+      && enStreamType != RKADK_STREAM_TYPE_VIDEO_SUB) {
+    RKADK_LOGE("Unsupport rtsp stream type: %d", enStreamType);
+    return -1;
+  }
+
+  pstRecCfg = RKADK_PARAM_GetRecCfg(u32CamId);
+  if (!pstRecCfg) {
+    RKADK_LOGE("RKADK_PARAM_GetRecCfg failed");
+    return -1;
+  }
+
+  u32Index = (enStreamType == RKADK_STREAM_TYPE_VIDEO_MAIN) ? 0 : 1;
+  if (u32Index >= pstRecCfg->file_num) {
+    RKADK_LOGE("Record stream[%d] isn't configured", enStreamType);
+    return -1;
+  }
+
+  // the recorder owns the encoder, the session only reads its stream
+  pHandle->enCodecType = pstRecCfg->attribute[u32Index].codec_type;
+  pHandle->u32VencChn = pstRecCfg->attribute[u32Index].venc_chn;
+  pHandle->bVencChnMux = true;
+  return 0;
+}
+
+RKADK_S32 RKADK_RTSP_InitAttr(RKADK_RTSP_ATTR_S *pstAttr, RKADK_MW_PTR *ppHandle) {
+  int ret = 0;
+  bool bSysInit = false;
+  MPP_CHN_S stVencChn, stAiChn, stAencChn;
+  RKADK_RTSP_HANDLE_S *pHandle;
+  RKADK_U32 u32CamId, port;
+  RKADK_STREAM_TYPE_E enStreamType;
+  RKADK_CODEC_TYPE_E enAudioCodec;
+  const char *path;
+
+  RKADK_CHECK_POINTER(pstAttr, RKADK_FAILURE);
+  RKADK_CHECK_CAMERAID(pstAttr->u32CamId, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstAttr->path, RKADK_FAILURE);
+
+  u32CamId = pstAttr->u32CamId;
+  enStreamType = pstAttr->enStreamType;
+  port = pstAttr->u32Port;
+  path = pstAttr->path;
+  RKADK_LOGI("Rtsp[%d, %d, %d, %s] Init...", u32CamId, enStreamType, port, path);
+
+  if (*ppHandle) {
+    RKADK_LOGE("rtsp handle has been created");
+    return -1;
+  }
+
+  bSysInit = RKADK_MPI_SYS_CHECK();
+  if (!bSysInit) {
+    RKADK_LOGE("System is not initialized");
+    return -1;
+  }
+
+  RKADK_PARAM_STREAM_CFG_S *pstLiveCfg =
+      RKADK_PARAM_GetStreamCfg(u32CamId, RKADK_STREAM_TYPE_LIVE);
+  if (!pstLiveCfg) {
+    RKADK_LOGE("Live RKADK_PARAM_GetStreamCfg Live failed");
+    return -1;
+  }
+
+  RKADK_PARAM_SENSOR_CFG_S *pstSensorCfg = RKADK_PARAM_GetSensorCfg(u32CamId);
+  if (!pstSensorCfg) {
+    RKADK_LOGE("RKADK_PARAM_GetSensorCfg failed");
+    return -1;
+  }
+
+  RKADK_PARAM_AUDIO_CFG_S *pstAudioCfg = RKADK_PARAM_GetAudioCfg();
+  if (!pstAudioCfg) {
+    RKADK_LOGE("RKADK_PARAM_GetAudioCfg failed");
+    return -1;
+  }
+
+  enAudioCodec = pstAttr->enAudioCodec;
+  if (enAudioCodec == RKADK_CODEC_TYPE_BUTT)
+    enAudioCodec = pstAudioCfg->live_codec_type;
+
+  if (RKADK_MEDIA_GetLiveAencChn(enAudioCodec) < 0)
+    return -1;
+
+  RKADK_MUTEX_LOCK(g_rtspMutex);
+
+  // another viewer of an opened path shares its session
+  pHandle = RKADK_RTSP_FindSession(port, path);
+  if (pHandle) {
+    if (pHandle->u32CamId != u32CamId || pHandle->enStreamType != enStreamType
+        || pHandle->enAudioCodec != enAudioCodec) {
+      RKADK_LOGE("rtsp[%d, %s] is opened by cam[%d] stream[%d] audio[%d]", port,
+                 path, pHandle->u32CamId, pHandle->enStreamType,
+                 pHandle->enAudioCodec);
+      RKADK_MUTEX_UNLOCK(g_rtspMutex);
+      return -1;
+    }
+
+    pHandle->s32RefCnt++;
+    *ppHandle = (RKADK_MW_PTR)pHandle;
+    RKADK_MUTEX_UNLOCK(g_rtspMutex);
+    RKADK_LOGI("Rtsp[%d, %s] shared, RefCnt[%d]", port, path, pHandle->s32RefCnt);
+    return 0;
+  }
+
+  pHandle = (RKADK_RTSP_HANDLE_S *)malloc(sizeof(RKADK_RTSP_HANDLE_S));
+  if (!pHandle) {
+    RKADK_LOGE("malloc pHandle failed");
+    RKADK_MUTEX_UNLOCK(g_rtspMutex);
+    return -1;
+  }
+  memset(pHandle, 0, sizeof(RKADK_RTSP_HANDLE_S));
+  pHandle->u32CamId = u32CamId;
+  pHandle->enStreamType = enStreamType;
+  pHandle->enAudioCodec = enAudioCodec;
+  pHandle->s32RefCnt = 1;
+  pHandle->bFirstKeyFrame = true;
+
+  ret = RKADK_RTSP_SetVideoSrc(u32CamId, enStreamType, pHandle);
   if (ret) {
-    RKADK_LOGE("UnBind AI[%d] and AENC[%d] failed[%d]", stAiChn.s32ChnId,
-               stAencChn.s32ChnId, ret);
-    return ret;
+    free(pHandle);
+    RKADK_MUTEX_UNLOCK(g_rtspMutex);
+    return -1;
   }
 
-  ret = RKADK_RTSP_DisableAudio(stAiChn, stAencChn, pstAudioCfg);
+  stVencChn.enModId = RK_ID_VENC;
+  stVencChn.s32DevId = 0;
+  stVencChn.s32ChnId = pHandle->u32VencChn;
+
+  ret = RKADK_RTSP_InitService(port, path, pHandle);
   if (ret) {
-    RKADK_LOGE("RKADK_RTSP_DisableAudio failed(%d)", ret);
+    RKADK_LOGE("RKADK_RTSP_InitService failed");
+    RKADK_RTSP_DeInitService(pHandle);
+    free(pHandle);
+    RKADK_MUTEX_UNLOCK(g_rtspMutex);
+    return -1;
+  }
+
+  RKADK_RTSP_AudioSetChn(&stAiChn, &stAencChn, enAudioCodec);
+  ret = RKADK_RTSP_EnableAudio(u32CamId, stAiChn, stAencChn, pstAudioCfg,
+                               enAudioCodec);
+  if (ret) {
+    RKADK_LOGE("RKADK_RTSP_EnableAudio failed[%d]", ret);
+    RKADK_RTSP_DeInitService(pHandle);
+    free(pHandle);
+    RKADK_MUTEX_UNLOCK(g_rtspMutex);
     return ret;
   }
 
-  RKADK_RTSP_DeInitService((RKADK_RTSP_HANDLE_S *)pHandle);
+  ret = RKADK_RTSP_AencGetData(u32CamId, &stAencChn, pHandle);
+  if (ret) {
+    RKADK_LOGE("RKADK_RTSP_AencGetData failed(%d)", ret);
+    goto failed;
+  }
+
+  if (enStreamType == RKADK_STREAM_TYPE_LIVE) {
+    ret = RKADK_RTSP_EnableVideo(u32CamId, pstLiveCfg, pstSensorCfg, pHandle);
+    if (ret) {
+      RKADK_LOGE("RKADK_RTSP_EnableVideo failed(%d)", ret);
+      goto failed;
+    }
+  } else {
+    ret = RKADK_RTSP_VencGetData(u32CamId, &stVencChn, pHandle);
+    if (ret) {
+      RKADK_LOGE("RKADK_RTSP_VencGetData failed(%d)", ret);
+      goto failed;
+    }
+  }
 
-  RKADK_LOGI("Rtsp[%d] DeInit End...", pstHandle->u32CamId);
-  free(pHandle);
+  // Bind AI to AENC
+  ret = RKADK_MPI_SYS_Bind(&stAiChn, &stAencChn);
+  if (ret) {
+    RKADK_LOGE("Bind AI[%d] and AENC[%d] failed[%d]", stAiChn.s32ChnId,
+               stAencChn.s32ChnId, ret);
+    goto unbind;
+  }
+
+  *ppHandle = (RKADK_MW_PTR)pHandle;
+  RKADK_MUTEX_UNLOCK(g_rtspMutex);
+  RKADK_LOGI("Rtsp[%d, %d, %s] Init End...", u32CamId, port, path);
   return 0;
+
+unbind:
+  RKADK_MEDIA_StopGetVencBuffer(&stVencChn, RKADK_RTSP_VencOutCb, pHandle);
+  if (enStreamType == RKADK_STREAM_TYPE_LIVE)
+    RKADK_RTSP_DisableVideo(pHandle, pstLiveCfg);
+
+failed:
+  RKADK_LOGE("failed");
+  RKADK_MEDIA_StopGetAencBuffer(&stAencChn, RKADK_RTSP_AencOutCb, pHandle);
+  RKADK_RTSP_DisableAudio(stAiChn, stAencChn, pstAudioCfg, enAudioCodec);
+  RKADK_RTSP_DeInitService(pHandle);
+  free(pHandle);
+  RKADK_MUTEX_UNLOCK(g_rtspMutex);
+  return ret;
 }
 
-RKADK_S32 RKADK_RTSP_Start(RKADK_MW_PTR pHandle) {
-  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+RKADK_S32 RKADK_RTSP_InitEx(RKADK_U32 u32CamId, RKADK_STREAM_TYPE_E enStreamType,
+                            RKADK_U32 port, const char *path,
+                            RKADK_MW_PTR *ppHandle) {
+  RKADK_RTSP_ATTR_S stAttr;
+
+  memset(&stAttr, 0, sizeof(stAttr));
+  stAttr.u32CamId = u32CamId;
+  stAttr.enStreamType = enStreamType;
+  stAttr.u32Port = port;
+  stAttr.path = path;
+  stAttr.enAudioCodec = RKADK_CODEC_TYPE_BUTT;
+  return RKADK_RTSP_InitAttr(&stAttr, ppHandle);
+}
+
+RKADK_S32 RKADK_RTSP_Init(RKADK_U32 u32CamId, RKADK_U32 port, const char *path,
+                          RKADK_MW_PTR *ppHandle) {
+  return RKADK_RTSP_InitEx(u32CamId, RKADK_STREAM_TYPE_LIVE, port, path,
+                           ppHandle);
+}
+
+RKADK_S32 RKADK_RTSP_DeInit(RKADK_MW_PTR pHandle) {
+  int ret = 0;
+  MPP_CHN_S stVencChn, stAiChn, stAencChn;
 
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
   RKADK_RTSP_HANDLE_S *pstHandle = (RKADK_RTSP_HANDLE_S *)pHandle;
-  if (pstHandle->start)
-    return 0;
+
+  RKADK_LOGI("Rtsp[%d, %s] DeInit...", pstHandle->u32CamId, pstHandle->path);
 
   RKADK_PARAM_STREAM_CFG_S *pstLiveCfg =
       RKADK_PARAM_GetStreamCfg(pstHandle->u32CamId, RKADK_STREAM_TYPE_LIVE);
@@ -813,42 +1433,135 @@ RKADK_S32 RKADK_RTSP_Start(RKADK_MW_PTR pHandle) {
     return -1;
   }
 
-  pstHandle->start = true;
-  pstHandle->bRequestIDR = false;
+  RKADK_PARAM_AUDIO_CFG_S *pstAudioCfg = RKADK_PARAM_GetAudioCfg();
+  if (!pstAudioCfg) {
+    RKADK_LOGE("RKADK_PARAM_GetAudioCfg failed");
+    return -1;
+  }
+
+  RKADK_MUTEX_LOCK(g_rtspMutex);
+  if (--pstHandle->s32RefCnt > 0) {
+    RKADK_MUTEX_UNLOCK(g_rtspMutex);
+    RKADK_LOGI("Rtsp[%d, %s] RefCnt[%d]", pstHandle->u32CamId, pstHandle->path,
+               pstHandle->s32RefCnt);
+    return 0;
+  }
+
+  stVencChn.enModId = RK_ID_VENC;
+  stVencChn.s32DevId = 0;
+  stVencChn.s32ChnId = pstHandle->u32VencChn;
+
+  // exit get media buffer, the send queue can't be fed after DeInit
+  RKADK_MEDIA_StopGetVencBuffer(&stVencChn, RKADK_RTSP_VencOutCb, pstHandle);
+
+   // Stop get aenc data
+  RKADK_RTSP_AudioSetChn(&stAiChn, &stAencChn, pstHandle->enAudioCodec);
+  RKADK_MEDIA_StopGetAencBuffer(&stAencChn, RKADK_RTSP_AencOutCb, pstHandle);
+  RKADK_RTSP_DeInitSend(pstHandle);
+
+  if (pstHandle->enStreamType == RKADK_STREAM_TYPE_LIVE) {
+    ret = RKADK_RTSP_DisableVideo(pstHandle, pstLiveCfg);
+    if (ret)
+      goto exit;
+  }
+
+  ret = RKADK_MPI_SYS_UnBind(&stAiChn, &stAencChn);
+  if (ret) {
+    RKADK_LOGE("UnBind AI[%d] and AENC[%d] failed[%d]", stAiChn.s32ChnId,
+               stAencChn.s32ChnId, ret);
+    goto exit;
+  }
+
+  ret = RKADK_RTSP_DisableAudio(stAiChn, stAencChn, pstAudioCfg,
+                                pstHandle->enAudioCodec);
+  if (ret) {
+    RKADK_LOGE("RKADK_RTSP_DisableAudio failed(%d)", ret);
+    goto exit;
+  }
+
+  RKADK_RTSP_DeInitService(pstHandle);
+
+  RKADK_LOGI("Rtsp[%d] DeInit End...", pstHandle->u32CamId);
+  free(pHandle);
+
+exit:
+  RKADK_MUTEX_UNLOCK(g_rtspMutex);
+  return ret;
+}
+
+RKADK_S32 RKADK_RTSP_Start(RKADK_MW_PTR pHandle) {
+  int ret = 0;
+  MPP_CHN_S stVencChn;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+
+  RKADK_RTSP_HANDLE_S *pstHandle = (RKADK_RTSP_HANDLE_S *)pHandle;
+  RKADK_MUTEX_LOCK(g_rtspMutex);
+  if (pstHandle->u32StartCnt++)
+    goto exit;
+
+  stVencChn.enModId = RK_ID_VENC;
+  stVencChn.s32DevId = 0;
+  stVencChn.s32ChnId = pstHandle->u32VencChn;
+
+  // a shared encoder starts from the cached gop instead of a forced IDR
+  pstHandle->bRequestIDR = pstHandle->bVencChnMux;
   pstHandle->bWaitIDR = false;
+  pstHandle->bDropToIDR = false;
+  pstHandle->u64LastPts = 0;
+  pstHandle->u64StartUs = RKADK_RTSP_GetUs();
+  pstHandle->start = true;
 
   // multiplex venc chn, thread get mediabuffer
-  if (pstHandle->bVencChnMux)
-    return 0;
+  if (pstHandle->bVencChnMux) {
+    if (RKADK_MEDIA_ReplayVencGop(&stVencChn, RKADK_RTSP_VencOutCb, pstHandle))
+      pstHandle->bRequestIDR = false;
+    goto exit;
+  }
 
   VENC_RECV_PIC_PARAM_S stRecvParam;
   stRecvParam.s32RecvPicNum = -1;
-  return RK_MPI_VENC_StartRecvFrame(pstLiveCfg->attribute.venc_chn,
-                                    &stRecvParam);
+  ret = RK_MPI_VENC_StartRecvFrame(pstHandle->u32VencChn, &stRecvParam);
+
+exit:
+  RKADK_MUTEX_UNLOCK(g_rtspMutex);
+  return ret;
+}
+
+RKADK_S32 RKADK_RTSP_GetStats(RKADK_MW_PTR pHandle, RKADK_RTSP_STATS_S *pstStats) {
+  RKADK_RTSP_HANDLE_S *pstHandle;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstStats, RKADK_FAILURE);
+
+  pstHandle = (RKADK_RTSP_HANDLE_S *)pHandle;
+  memcpy(pstStats, &pstHandle->stStats, sizeof(RKADK_RTSP_STATS_S));
+  pstStats->u32VideoQueued = RKADK_RING_Count(pstHandle->stVideoQueue.pProc);
+  pstStats->u32AudioQueued = RKADK_RING_Count(pstHandle->stAudioQueue.pProc);
+  return 0;
 }
 
 RKADK_S32 RKADK_RTSP_Stop(RKADK_MW_PTR pHandle) {
+  int ret = 0;
+
   RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
 
   RKADK_RTSP_HANDLE_S *pstHandle = (RKADK_RTSP_HANDLE_S *)pHandle;
-  if (!pstHandle->start)
-    return 0;
-
-  RKADK_PARAM_STREAM_CFG_S *pstLiveCfg =
-      RKADK_PARAM_GetStreamCfg(pstHandle->u32CamId, RKADK_STREAM_TYPE_LIVE);
-  if (!pstLiveCfg) {
-    RKADK_LOGE("RKADK_PARAM_GetStreamCfg failed");
-    return -1;
-  }
+  RKADK_MUTEX_LOCK(g_rtspMutex);
+  if (!pstHandle->u32StartCnt || --pstHandle->u32StartCnt)
+    goto exit;
 
   pstHandle->start = false;
 
   // multiplex venc chn, thread get mediabuffer
   if (pstHandle->bVencChnMux)
-    return 0;
+    goto exit;
 
   VENC_RECV_PIC_PARAM_S stRecvParam;
   stRecvParam.s32RecvPicNum = 0;
-  return RK_MPI_VENC_StartRecvFrame(pstLiveCfg->attribute.venc_chn,
-                                    &stRecvParam);
+  ret = RK_MPI_VENC_StartRecvFrame(pstHandle->u32VencChn, &stRecvParam);
+
+exit:
+  RKADK_MUTEX_UNLOCK(g_rtspMutex);
+  return ret;
 }
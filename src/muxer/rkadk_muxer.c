@@ -21,8 +21,13 @@
 #include "rkadk_log.h"
 #include "rkadk_signal.h"
 #include "rkadk_thread.h"
+#include "rkadk_ring.h"
 #include "rkmuxer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(_a) (sizeof(_a) / sizeof((_a)[0]))
@@ -46,8 +51,9 @@ typedef struct {
   RKADK_U32 size;
   int isKeyFrame;
   int64_t pts;
-  bool bIsPool;
-  struct list_head *pool;
+  bool bIsPool; // false for a pre-record drain cell
+  void *pool; // free ring of the cell's lane, pVFree or pAFree
+  struct list_head *pDrainFree; // drain list the cell returns to if !bIsPool
 } MUXER_BUF_CELL_S;
 
 typedef struct {
@@ -61,9 +67,27 @@ typedef struct {
   bool bRequestThumb;
 } MANUAL_THUMB_PARAM;
 
+typedef enum {
+  MUXER_NEXT_NONE = 0,
+  MUXER_NEXT_OPENING, // open job queued to the file worker
+  MUXER_NEXT_READY,   // next file is open and waits for the switch
+} MUXER_NEXT_STATE_E;
+
+typedef struct {
+  MUXER_BUF_CELL_S *pstCell;    // cached frames, slot array of u32Depth
+  RKADK_U32 u32Depth;
+  RKADK_U32 u32Head;            // oldest slot
+  RKADK_U32 u32Cnt;
+  RKADK_U32 *pu32KeyIdx;        // slots of cached key frames, oldest first
+  RKADK_U32 u32KeyHead;
+  RKADK_U32 u32KeyCnt;
+  MUXER_BUF_CELL_S *pstDrain;   // cells handed to the muxer thread
+  struct list_head stDrainFree; // free drain cells, owned by muxer thread
+} PRE_RECORD_RING_S;
+
 typedef struct {
-  struct list_head stVList;
-  struct list_head stAList;
+  PRE_RECORD_RING_S stVRing;
+  PRE_RECORD_RING_S stARing;
   RKADK_MUXER_PRE_RECORD_ATTR_S stAttr;
   pthread_mutex_t mutex;
 } MANUAL_PRE_RECORD_PARAM;
@@ -74,12 +98,19 @@ typedef struct {
   RKADK_U32 u32ViChn; // vi channel id
   RKADK_U32 u32VencChn; // venc channel id
   RKADK_U32 u32ThumbVencChn; // thumb venc channel id
+  RKADK_CODEC_TYPE_E enCodecType; // video codec
   bool bUseVpss;
-  int muxerId;
+  int muxerId; // rkmuxer id of the current file
+  int aMuxerId[RKADK_MUXER_ID_BANK_CNT]; // current and next file alternate
+  int muxerIdx; // bank of muxerId
   char cFileName[RKADK_MAX_FILE_PATH_LEN];
   const char *cOutputFmt;
   VideoParam stVideo;
   AudioParam stAudio;
+  RKADK_U32 u32AudioHeaderSize; // aenc header stripped from every audio frame
+  RKADK_U32 u32FragmentGop; // fmp4 GOPs between two fdatasync, 0 for no sync
+  RKADK_U32 u32FragmentCnt; // GOPs finished since the last sync
+  RKADK_U32 u32AudioBitRate;
   int32_t gop;
   int32_t duration;     // s
   int32_t realDuration; // ms
@@ -98,47 +129,348 @@ typedef struct {
   RKADK_MUXER_EVENT_CALLBACK_FN pfnEventCallback;
 
   void *pThread;
-  pthread_mutex_t mutex;
   void *pSignal;
 
-  // list param
-  MUXER_BUF_CELL_S stVCell[RKADK_MUXER_CELL_MAX_CNT]; // video list cache size
-  MUXER_BUF_CELL_S stACell[RKADK_MUXER_CELL_MAX_CNT]; // audio list cache size
-  struct list_head stVFree;     // video list remain size
-  struct list_head stAFree;     // audio list remain size
-  struct list_head stProcList;  // process list
+  // cell param, every lane is a pair of single-producer/single-consumer rings
+  // between the venc/aenc callback thread and the muxer thread
+  MUXER_BUF_CELL_S *pstVCellPool; // video cells
+  MUXER_BUF_CELL_S *pstACellPool; // audio cells
+  RKADK_U32 u32VCellCnt;          // video list cache size
+  RKADK_U32 u32ACellCnt;          // audio list cache size
+  void *pVFree;                 // video free cells, muxer -> venc thread
+  void *pAFree;                 // audio free cells, muxer -> aenc thread
+  void *pVProc;                 // video cells to write, venc thread -> muxer
+  void *pAProc;                 // audio cells to write, aenc thread -> muxer
+  struct list_head stProcList;  // pre-record cells, owned by muxer thread
+
+  // backpressure param
+  RKADK_MUXER_BACKPRESSURE_E enBackpressure;
+  pthread_mutex_t waitMutex;
+  pthread_cond_t waitCond;
+  int waitCnt;                  // producers waiting for a free cell
+  bool bWaitIDR;                // video lane drops frames until the next IDR
+  RKADK_MUXER_DROP_STATS_S stDropStats;
+
+  // write path stats, written by the muxer thread unless noted
+  RKADK_MUXER_STATS_S stStats;
+  RKADK_U64 u64RateStartUs;
+  RKADK_U64 u64RateBytes;
 
   struct timeval checkWriteTime;
 
   MANUAL_THUMB_PARAM stThumbParam;
   MANUAL_SPLIT_ATTR stManualSplit;
   MANUAL_PRE_RECORD_PARAM stPreRecParam;
+
+  // next file param, protected by the file worker mutex
+  MUXER_NEXT_STATE_E enNextState;
+  int aBusyCnt[RKADK_MUXER_ID_BANK_CNT]; // close jobs queued per bank
+  RKADK_U32 u32ParamGen; // bumped by every av param change
+  RKADK_U32 u32NextParamGen;
+  char cNextFileName[RKADK_MAX_FILE_PATH_LEN];
+  bool bSyncPending; // sync job queued
+
+  // file io param, the page cache gathers the small muxer writes and the file
+  // worker writes them back in aligned blocks
+  RKADK_U32 u32WriteBlock;  // power of 2
+  RKADK_U32 u32DirtyBytes;  // written since the last writeback job, muxer thread
+  RKADK_U64 u64WbStart;     // writeback started but not waited, file worker
+  RKADK_U64 u64WbEnd;
+  bool bPreAllocate;
 } MUXER_HANDLE_S;
 
-static void RKADK_MUXER_ListInit(MUXER_HANDLE_S *pstMuxerHandle) {
-  INIT_LIST_HEAD(&pstMuxerHandle->stVFree);
-  INIT_LIST_HEAD(&pstMuxerHandle->stAFree);
+typedef struct {
+  RKADK_MUXER_HANDLE_S stMuxer;                 // handed out, keep it first
+  MUXER_HANDLE_S *pChnHandle[VENC_MAX_CHN_NUM]; // venc chn to muxer handle
+} MUXER_PRIV_HANDLE_S;
+
+typedef enum {
+  MUXER_FILE_JOB_THUMB = 0, // write the thumbnail into a record file
+  MUXER_FILE_JOB_OPEN,      // open the next record file
+  MUXER_FILE_JOB_CLOSE,     // finalize a record file
+  MUXER_FILE_JOB_DISCARD,   // close and remove an unused next file
+  MUXER_FILE_JOB_SYNC,      // flush the finished fmp4 fragments to the disk
+  MUXER_FILE_JOB_WRITEBACK, // write back the dirty blocks of a record file
+} MUXER_FILE_JOB_TYPE_E;
+
+typedef struct {
+  struct list_head mark;
+  MUXER_FILE_JOB_TYPE_E enType;
+  MUXER_HANDLE_S *pstMuxerHandle;
+  int muxerIdx;
+  char cFileName[RKADK_MAX_FILE_PATH_LEN];
+
+  // thumb job
+  MB_BLK pMbBlk;
+  RKADK_U32 u32Len;
+  RKADK_U32 u32Seq;
+  int position;
+
+  // open job
+  RKADK_U32 u32Duration;
+
+  // close job
+  RKADK_MUXER_EVENT_E enEvent;
+  int32_t realDuration;
+} MUXER_FILE_JOB_S;
+
+// open jobs run on a thread of their own, so a next file isn't opened behind
+// a slow close or sync of the previous one
+typedef struct {
+  void *pThread;
+  void *pSignal;
+  void *pOpenThread;
+  void *pOpenSignal;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond; // broadcast when a job is done
+  struct list_head stJobList;
+  struct list_head stOpenList;
+} MUXER_FILE_WORKER_S;
+
+static int RKADK_MUXER_PreRecRingInit(PRE_RECORD_RING_S *pstRing,
+                                      RKADK_U32 u32Depth, bool bKeyIdx) {
+  memset(pstRing, 0, sizeof(PRE_RECORD_RING_S));
+  INIT_LIST_HEAD(&pstRing->stDrainFree);
+  if (!u32Depth)
+    return 0;
+
+  pstRing->pstCell = (MUXER_BUF_CELL_S *)calloc(u32Depth, sizeof(MUXER_BUF_CELL_S));
+  // one more drain cell for the one the muxer thread may hold
+  pstRing->pstDrain = (MUXER_BUF_CELL_S *)calloc(u32Depth + 1, sizeof(MUXER_BUF_CELL_S));
+  if (bKeyIdx)
+    pstRing->pu32KeyIdx = (RKADK_U32 *)calloc(u32Depth, sizeof(RKADK_U32));
+  if (!pstRing->pstCell || !pstRing->pstDrain || (bKeyIdx && !pstRing->pu32KeyIdx))
+    return -1;
+
+  for (RKADK_U32 i = 0; i < u32Depth + 1; i++) {
+    pstRing->pstDrain[i].pDrainFree = &pstRing->stDrainFree;
+    list_add_tail(&pstRing->pstDrain[i].mark, &pstRing->stDrainFree);
+  }
+
+  pstRing->u32Depth = u32Depth;
+  return 0;
+}
+
+static void RKADK_MUXER_PreRecRingDeinit(PRE_RECORD_RING_S *pstRing) {
+  if (pstRing->pstCell)
+    free(pstRing->pstCell);
+
+  if (pstRing->pstDrain)
+    free(pstRing->pstDrain);
+
+  if (pstRing->pu32KeyIdx)
+    free(pstRing->pu32KeyIdx);
+
+  memset(pstRing, 0, sizeof(PRE_RECORD_RING_S));
+  INIT_LIST_HEAD(&pstRing->stDrainFree);
+}
+
+RKADK_U32 RKADK_MUXER_CalcCellCnt(RKADK_U32 u32FrameRate, RKADK_U32 u32Gop,
+                                  RKADK_U32 u32BitRate, RKADK_U32 u32PreRecCacheTime,
+                                  const RKADK_MUXER_CACHE_ATTR_S *pstCacheAttr) {
+  RKADK_U64 u64SlackMs, u64Cnt, u64FrameSize;
+
+  if (!u32FrameRate)
+    return RKADK_MUXER_CELL_MIN_CNT;
+
+  // absorb a write stall and the key frame wait of a file switch
+  u64SlackMs = pstCacheAttr->u32WriteLatencyMs ? pstCacheAttr->u32WriteLatencyMs
+                                               : RKADK_MUXER_WRITE_LATENCY_MS;
+  u64SlackMs += (RKADK_U64)u32Gop * 1000 / u32FrameRate;
+
+  // live frames queue up while the pre-record backlog is written
+  u64SlackMs += (RKADK_U64)u32PreRecCacheTime * 1000 / RKADK_MUXER_PRE_RECORD_DRAIN_RATIO;
+
+  u64Cnt = (u64SlackMs * u32FrameRate + 999) / 1000;
+
+  if (pstCacheAttr->u32MemBudget && u32BitRate) {
+    u64FrameSize = (RKADK_U64)u32BitRate / 8 / u32FrameRate;
+    if (u64FrameSize && u64Cnt > pstCacheAttr->u32MemBudget / u64FrameSize)
+      u64Cnt = pstCacheAttr->u32MemBudget / u64FrameSize;
+  }
+
+  if (u64Cnt < RKADK_MUXER_CELL_MIN_CNT)
+    u64Cnt = RKADK_MUXER_CELL_MIN_CNT;
+  else if (u64Cnt > RKADK_MUXER_CELL_MAX_CNT)
+    u64Cnt = RKADK_MUXER_CELL_MAX_CNT;
+
+  return (RKADK_U32)u64Cnt;
+}
+
+static void RKADK_MUXER_ListDeinit(MUXER_HANDLE_S *pstMuxerHandle) {
+  RKADK_RING_Destroy(pstMuxerHandle->pVFree);
+  RKADK_RING_Destroy(pstMuxerHandle->pAFree);
+  RKADK_RING_Destroy(pstMuxerHandle->pVProc);
+  RKADK_RING_Destroy(pstMuxerHandle->pAProc);
+  pstMuxerHandle->pVFree = NULL;
+  pstMuxerHandle->pAFree = NULL;
+  pstMuxerHandle->pVProc = NULL;
+  pstMuxerHandle->pAProc = NULL;
+
+  if (pstMuxerHandle->pstVCellPool) {
+    free(pstMuxerHandle->pstVCellPool);
+    pstMuxerHandle->pstVCellPool = NULL;
+  }
+
+  if (pstMuxerHandle->pstACellPool) {
+    free(pstMuxerHandle->pstACellPool);
+    pstMuxerHandle->pstACellPool = NULL;
+  }
+
+  RKADK_MUXER_PreRecRingDeinit(&pstMuxerHandle->stPreRecParam.stVRing);
+  RKADK_MUXER_PreRecRingDeinit(&pstMuxerHandle->stPreRecParam.stARing);
+}
+
+static int RKADK_MUXER_ListInit(MUXER_HANDLE_S *pstMuxerHandle,
+                                RKADK_MUXER_ATTR_S *pstMuxerAttr) {
+  RKADK_U32 u32AudioRate = 0;
+  RKADK_U32 u32PreRecCacheTime = 0;
+  RKADK_U32 u32PreRecDepth;
+
   INIT_LIST_HEAD(&pstMuxerHandle->stProcList);
-  INIT_LIST_HEAD(&pstMuxerHandle->stPreRecParam.stAList);
-  INIT_LIST_HEAD(&pstMuxerHandle->stPreRecParam.stVList);
 
-  for (unsigned int i = 0; i < ARRAY_SIZE(pstMuxerHandle->stVCell); i++) {
-    INIT_LIST_HEAD(&pstMuxerHandle->stVCell[i].mark);
-    pstMuxerHandle->stVCell[i].pool = &pstMuxerHandle->stVFree;
-    list_add_tail(&pstMuxerHandle->stVCell[i].mark, &pstMuxerHandle->stVFree);
+  if (pstMuxerAttr->stPreRecordAttr.enPreRecordMode != RKADK_MUXER_PRE_RECORD_NONE)
+    u32PreRecCacheTime = pstMuxerAttr->stPreRecordAttr.u32PreRecCacheTime;
+
+  if (pstMuxerHandle->stAudio.frame_size > 0)
+    u32AudioRate = pstMuxerHandle->stAudio.sample_rate / pstMuxerHandle->stAudio.frame_size;
+
+  pstMuxerHandle->u32VCellCnt = RKADK_MUXER_CalcCellCnt(
+      pstMuxerHandle->stVideo.frame_rate_num, pstMuxerHandle->gop,
+      pstMuxerHandle->stVideo.bit_rate, u32PreRecCacheTime, &pstMuxerAttr->stCacheAttr);
+  pstMuxerHandle->u32ACellCnt = RKADK_MUXER_CalcCellCnt(
+      u32AudioRate, 0, 0, u32PreRecCacheTime, &pstMuxerAttr->stCacheAttr);
+  RKADK_LOGI("Stream[%d]: video cell cnt = %d, audio cell cnt = %d",
+             pstMuxerHandle->u32VencChn, pstMuxerHandle->u32VCellCnt,
+             pstMuxerHandle->u32ACellCnt);
+
+  pstMuxerHandle->pstVCellPool = (MUXER_BUF_CELL_S *)calloc(
+      pstMuxerHandle->u32VCellCnt, sizeof(MUXER_BUF_CELL_S));
+  pstMuxerHandle->pstACellPool = (MUXER_BUF_CELL_S *)calloc(
+      pstMuxerHandle->u32ACellCnt, sizeof(MUXER_BUF_CELL_S));
+  pstMuxerHandle->pVFree = RKADK_RING_Create(pstMuxerHandle->u32VCellCnt);
+  pstMuxerHandle->pAFree = RKADK_RING_Create(pstMuxerHandle->u32ACellCnt);
+  pstMuxerHandle->pVProc = RKADK_RING_Create(pstMuxerHandle->u32VCellCnt);
+  pstMuxerHandle->pAProc = RKADK_RING_Create(pstMuxerHandle->u32ACellCnt);
+  if (!pstMuxerHandle->pstVCellPool || !pstMuxerHandle->pstACellPool ||
+      !pstMuxerHandle->pVFree || !pstMuxerHandle->pAFree ||
+      !pstMuxerHandle->pVProc || !pstMuxerHandle->pAProc) {
+    RKADK_LOGE("Stream[%d]: create cell pool failed", pstMuxerHandle->u32VencChn);
+    RKADK_MUXER_ListDeinit(pstMuxerHandle);
+    return -1;
+  }
+
+  // manual split may turn pre-record on later, so size by time only
+  u32PreRecDepth = 0;
+  if (pstMuxerAttr->stPreRecordAttr.u32PreRecTimeSec > 0)
+    u32PreRecDepth = pstMuxerAttr->stPreRecordAttr.u32PreRecCacheTime + 1;
+
+  if (RKADK_MUXER_PreRecRingInit(&pstMuxerHandle->stPreRecParam.stVRing,
+                                 u32PreRecDepth * pstMuxerHandle->stVideo.frame_rate_num,
+                                 true) ||
+      RKADK_MUXER_PreRecRingInit(&pstMuxerHandle->stPreRecParam.stARing,
+                                 u32PreRecDepth * u32AudioRate, false)) {
+    RKADK_LOGE("Stream[%d]: create pre_record ring failed", pstMuxerHandle->u32VencChn);
+    RKADK_MUXER_ListDeinit(pstMuxerHandle);
+    return -1;
+  }
+
+  for (RKADK_U32 i = 0; i < pstMuxerHandle->u32VCellCnt; i++) {
+    INIT_LIST_HEAD(&pstMuxerHandle->pstVCellPool[i].mark);
+    pstMuxerHandle->pstVCellPool[i].pool = pstMuxerHandle->pVFree;
+    RKADK_RING_Push(pstMuxerHandle->pVFree, &pstMuxerHandle->pstVCellPool[i]);
   }
 
-  for (unsigned int i = 0; i < ARRAY_SIZE(pstMuxerHandle->stACell); i++) {
-    INIT_LIST_HEAD(&pstMuxerHandle->stACell[i].mark);
-    pstMuxerHandle->stACell[i].pool = &pstMuxerHandle->stAFree;
-    list_add_tail(&pstMuxerHandle->stACell[i].mark, &pstMuxerHandle->stAFree);
+  for (RKADK_U32 i = 0; i < pstMuxerHandle->u32ACellCnt; i++) {
+    INIT_LIST_HEAD(&pstMuxerHandle->pstACellPool[i].mark);
+    pstMuxerHandle->pstACellPool[i].pool = pstMuxerHandle->pAFree;
+    RKADK_RING_Push(pstMuxerHandle->pAFree, &pstMuxerHandle->pstACellPool[i]);
   }
+
+  return 0;
+}
+
+static RKADK_U64 RKADK_MUXER_GetUs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (RKADK_U64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int RKADK_MUXER_LatencyBucket(RKADK_U64 u64Us) {
+  int msb, shift;
+
+  if (u64Us >= (1ULL << RKADK_MUXER_LATENCY_RANGE_BITS))
+    return RKADK_MUXER_LATENCY_BUCKET_CNT - 1;
+
+  if (u64Us < RKADK_MUXER_LATENCY_SUB_CNT)
+    return (int)u64Us;
+
+  // the power of two picks the range, the next bits the sub-bucket in it
+  msb = 63 - __builtin_clzll(u64Us);
+  shift = msb - RKADK_MUXER_LATENCY_SUB_BITS;
+  return (shift + 1) * RKADK_MUXER_LATENCY_SUB_CNT +
+         (int)(u64Us >> shift) - RKADK_MUXER_LATENCY_SUB_CNT;
+}
+
+// the last us a bucket counts
+static RKADK_U64 RKADK_MUXER_LatencyBucketTop(int bucket) {
+  int range = bucket / RKADK_MUXER_LATENCY_SUB_CNT;
+  int sub = bucket % RKADK_MUXER_LATENCY_SUB_CNT;
+
+  if (!range)
+    return sub;
+
+  return ((RKADK_U64)(RKADK_MUXER_LATENCY_SUB_CNT + sub + 1) << (range - 1)) - 1;
+}
+
+static void RKADK_MUXER_LatencyAdd(RKADK_MUXER_LATENCY_HIST_S *pstHist,
+                                   RKADK_U64 u64Us) {
+  pstHist->au32Bucket[RKADK_MUXER_LatencyBucket(u64Us)]++;
+  pstHist->u32Cnt++;
+  pstHist->u64TotalUs += u64Us;
+  if (u64Us > pstHist->u32MaxUs)
+    pstHist->u32MaxUs = (RKADK_U32)u64Us;
+}
+
+static void RKADK_MUXER_RateAdd(MUXER_HANDLE_S *pstMuxerHandle, RKADK_U32 u32Size,
+                                RKADK_U64 u64NowUs) {
+  RKADK_U64 u64Elapsed;
+
+  pstMuxerHandle->stStats.u64WriteBytes += u32Size;
+  pstMuxerHandle->u64RateBytes += u32Size;
+
+  u64Elapsed = u64NowUs - pstMuxerHandle->u64RateStartUs;
+  if (u64Elapsed >= 1000000) {
+    pstMuxerHandle->stStats.u32BytesPerSec =
+        (RKADK_U32)(pstMuxerHandle->u64RateBytes * 1000000 / u64Elapsed);
+    pstMuxerHandle->u64RateBytes = 0;
+    pstMuxerHandle->u64RateStartUs = u64NowUs;
+  }
+}
+
+static void RKADK_MUXER_RequestIDR(MUXER_HANDLE_S *pstMuxerHandle) {
+  __atomic_add_fetch(&pstMuxerHandle->stStats.u32IdrReqCnt, 1, __ATOMIC_RELAXED);
+  RK_MPI_VENC_RequestIDR(pstMuxerHandle->u32VencChn, RK_FALSE);
+}
+
+static void RKADK_MUXER_WakeProducer(MUXER_HANDLE_S *pstMuxerHandle,
+                                     bool bForce) {
+  // pairs with the waitCnt increment in RKADK_MUXER_CellWait
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!bForce && !__atomic_load_n(&pstMuxerHandle->waitCnt, __ATOMIC_RELAXED))
+    return;
+
+  RKADK_MUTEX_LOCK(pstMuxerHandle->waitMutex);
+  pthread_cond_broadcast(&pstMuxerHandle->waitCond);
+  RKADK_MUTEX_UNLOCK(pstMuxerHandle->waitMutex);
 }
 
 static void RKADK_MUXER_CellFree(MUXER_HANDLE_S *pstMuxerHandle,
                                  MUXER_BUF_CELL_S *cell) {
   bool bIsPool = cell->bIsPool;
-  struct list_head *pool = cell->pool;
+  void *pool = cell->pool;
+  struct list_head *pDrainFree = cell->pDrainFree;
 
   list_del_init(&cell->mark);
   if (cell->buf)
@@ -147,16 +479,16 @@ static void RKADK_MUXER_CellFree(MUXER_HANDLE_S *pstMuxerHandle,
   if (cell->pfnCellReleaseBuf)
     cell->pfnCellReleaseBuf(cell->pMbBlk);
 
+  memset(cell, 0, sizeof(MUXER_BUF_CELL_S));
+  INIT_LIST_HEAD(&cell->mark);
+  cell->pool = pool;
+  cell->pDrainFree = pDrainFree;
   if (bIsPool) {
-    memset(cell, 0, sizeof(MUXER_BUF_CELL_S));
-    INIT_LIST_HEAD(&cell->mark);
-    cell->pool = pool;
-    RKADK_MUTEX_LOCK(pstMuxerHandle->mutex);
-    list_add_tail(&cell->mark, cell->pool);
-    RKADK_MUTEX_UNLOCK(pstMuxerHandle->mutex);
+    if (!RKADK_RING_Push(cell->pool, cell))
+      RKADK_LOGE("Stream[%d]: free ring overflow", pstMuxerHandle->u32VencChn);
+    RKADK_MUXER_WakeProducer(pstMuxerHandle, false);
   } else {
-    free(cell);
-    cell = NULL;
+    list_add_tail(&cell->mark, pDrainFree);
   }
 }
 
@@ -186,176 +518,170 @@ static void RKADK_MUXER_ListRelease(MUXER_HANDLE_S *pstMuxerHandle,
 }
 
 static MUXER_BUF_CELL_S *RKADK_MUXER_CellGet(MUXER_HANDLE_S *pstMuxerHandle,
-                                             struct list_head *head) {
-  MUXER_BUF_CELL_S *cell = NULL;
-  MUXER_BUF_CELL_S *cell_n = NULL;
+                                             void *pFree) {
+  return (MUXER_BUF_CELL_S *)RKADK_RING_Pop(pFree);
+}
 
-  RKADK_MUTEX_LOCK(pstMuxerHandle->mutex);
-  list_for_each_entry_safe(cell, cell_n, head, mark) {
-    list_del_init(&cell->mark);
-    RKADK_MUTEX_UNLOCK(pstMuxerHandle->mutex);
-    return cell;
+static void RKADK_MUXER_CellPush(MUXER_HANDLE_S *pstMuxerHandle,
+                                 void *pProc, MUXER_BUF_CELL_S *one) {
+  RKADK_U32 u32Cnt;
+  RKADK_U32 *pu32Hwm;
+  bool bVideo = pProc == pstMuxerHandle->pVProc;
+
+  // a lane never holds more cells than its free ring hands out
+  if (!RKADK_RING_Push(pProc, one)) {
+    RKADK_LOGE("Stream[%d]: proc ring overflow", pstMuxerHandle->u32VencChn);
+    __atomic_add_fetch(bVideo ? &pstMuxerHandle->stDropStats.u32VideoDropCnt
+                              : &pstMuxerHandle->stDropStats.u32AudioDropCnt,
+                       1, __ATOMIC_RELAXED);
+    if (one->pfnCellReleaseBuf)
+      one->pfnCellReleaseBuf(one->pMbBlk);
+    return;
   }
-  RKADK_MUTEX_UNLOCK(pstMuxerHandle->mutex);
-  return NULL;
+
+  // each high-water mark is only written by its lane producer
+  pu32Hwm = bVideo ? &pstMuxerHandle->stStats.u32VideoQueueHwm
+                   : &pstMuxerHandle->stStats.u32AudioQueueHwm;
+  u32Cnt = RKADK_RING_Count(pProc);
+  if (u32Cnt > *pu32Hwm)
+    *pu32Hwm = u32Cnt;
 }
 
-static int RKADK_MUXER_GetListSize(struct list_head *head) {
-  int size = 0;
+static MUXER_BUF_CELL_S *RKADK_MUXER_CellPop(MUXER_HANDLE_S *pstMuxerHandle) {
   MUXER_BUF_CELL_S *cell = NULL;
+  MUXER_BUF_CELL_S *pstVCell, *pstACell;
 
-  list_for_each_entry(cell, head, mark) {
-    size++;
+  // pre-record cells go ahead of the live lanes
+  if (!list_empty(&pstMuxerHandle->stProcList)) {
+    cell = list_first_entry(&pstMuxerHandle->stProcList, MUXER_BUF_CELL_S, mark);
+    list_del_init(&cell->mark);
+    return cell;
   }
 
-  return size;
+  // merge video and audio lanes by pts
+  pstVCell = (MUXER_BUF_CELL_S *)RKADK_RING_Peek(pstMuxerHandle->pVProc);
+  pstACell = (MUXER_BUF_CELL_S *)RKADK_RING_Peek(pstMuxerHandle->pAProc);
+  if (pstVCell && (!pstACell || pstVCell->pts <= pstACell->pts))
+    return (MUXER_BUF_CELL_S *)RKADK_RING_Pop(pstMuxerHandle->pVProc);
+  else if (pstACell)
+    return (MUXER_BUF_CELL_S *)RKADK_RING_Pop(pstMuxerHandle->pAProc);
+
+  return NULL;
 }
 
-static void RKADK_MUXER_CellPush(MUXER_HANDLE_S *pstMuxerHandle,
-                                 struct list_head *head,
-                                 MUXER_BUF_CELL_S *one) {
-  int ret = -1;
+static void RKADK_MUXER_ProcRelease(MUXER_HANDLE_S *pstMuxerHandle) {
   MUXER_BUF_CELL_S *cell = NULL;
-  MUXER_BUF_CELL_S *cell_n = NULL;
 
-  RKADK_MUTEX_LOCK(pstMuxerHandle->mutex);
-  do {
-    list_for_each_entry_safe(cell, cell_n, head, mark) {
-      if ((cell->pts > one->pts) && (cell->pool == one->pool)) {
-        list_add_tail(&one->mark, &cell->mark);
-        ret = 0;
-        break;
-      }
-    }
-    if (ret) {
-      list_add_tail(&one->mark, head);
-    }
-  } while (0);
-  RKADK_MUTEX_UNLOCK(pstMuxerHandle->mutex);
-}
+  RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stProcList);
 
-static MUXER_BUF_CELL_S *RKADK_MUXER_CellPop(MUXER_HANDLE_S *pstMuxerHandle,
-                                             struct list_head *head) {
-  MUXER_BUF_CELL_S *rst = NULL;
-  MUXER_BUF_CELL_S *cell = NULL;
-  MUXER_BUF_CELL_S *cell_n = NULL;
+  while ((cell = (MUXER_BUF_CELL_S *)RKADK_RING_Pop(pstMuxerHandle->pVProc)))
+    RKADK_MUXER_CellFree(pstMuxerHandle, cell);
 
-  RKADK_MUTEX_LOCK(pstMuxerHandle->mutex);
-  do {
-    list_for_each_entry_safe(cell, cell_n, head, mark) {
-      list_del_init(&cell->mark);
-      rst = cell;
-      break;
-    }
-  } while (0);
-  RKADK_MUTEX_UNLOCK(pstMuxerHandle->mutex);
-  return rst;
+  while ((cell = (MUXER_BUF_CELL_S *)RKADK_RING_Pop(pstMuxerHandle->pAProc)))
+    RKADK_MUXER_CellFree(pstMuxerHandle, cell);
 }
 
-void RKADK_MUXER_ListDropPFrame(MUXER_HANDLE_S *pstMuxerHandle) {
-  MUXER_BUF_CELL_S *rst = NULL;
-  MUXER_BUF_CELL_S *cell = NULL;
-  MUXER_BUF_CELL_S *cell_n = NULL;
+static void RKADK_MUXER_PreRecEvict(PRE_RECORD_RING_S *pstRing, bool bRelease) {
+  MUXER_BUF_CELL_S *cell = &pstRing->pstCell[pstRing->u32Head];
 
-  RKADK_MUTEX_LOCK(pstMuxerHandle->mutex);
-  list_for_each_entry_safe(cell, cell_n, &pstMuxerHandle->stProcList, mark) {
-    if (cell->isKeyFrame == 0 && cell->pool == &pstMuxerHandle->stVFree) {
-      rst = cell;
-    }
-  }
-  if (rst) {
-    list_del_init(&rst->mark);
+  if (pstRing->u32KeyCnt && pstRing->pu32KeyIdx[pstRing->u32KeyHead] == pstRing->u32Head) {
+    pstRing->u32KeyHead = (pstRing->u32KeyHead + 1) % pstRing->u32Depth;
+    pstRing->u32KeyCnt--;
   }
-  RKADK_MUTEX_UNLOCK(pstMuxerHandle->mutex);
 
-  if (rst)
-    RKADK_MUXER_CellFree(pstMuxerHandle, rst);
-  else
-    RKADK_LOGE("drop pframe fail");
+  if (bRelease && cell->pfnCellReleaseBuf)
+    cell->pfnCellReleaseBuf(cell->pMbBlk);
+
+  cell->pMbBlk = NULL;
+  pstRing->u32Head = (pstRing->u32Head + 1) % pstRing->u32Depth;
+  pstRing->u32Cnt--;
+}
+
+static void RKADK_MUXER_PreRecRelease(MUXER_HANDLE_S *pstMuxerHandle,
+                                      PRE_RECORD_RING_S *pstRing) {
+  RKADK_MUTEX_LOCK(pstMuxerHandle->stPreRecParam.mutex);
+  while (pstRing->u32Cnt)
+    RKADK_MUXER_PreRecEvict(pstRing, true);
+  RKADK_MUTEX_UNLOCK(pstMuxerHandle->stPreRecParam.mutex);
 }
 
 static void RKADK_MUXER_PreRecPush(MUXER_HANDLE_S *pstMuxerHandle,
-                                struct list_head *pstList, MUXER_BUF_CELL_S *one) {
-  int ret = -1;
-  int64_t cacheDuration = 0;
-  MUXER_BUF_CELL_S *cell = NULL, *cell_n = NULL;
-  MUXER_BUF_CELL_S *pstPreRecCell = NULL;
-  MANUAL_PRE_RECORD_PARAM *pstPreRecParam;
+                                   PRE_RECORD_RING_S *pstRing, MUXER_BUF_CELL_S *one) {
+  RKADK_U32 u32Tail;
+  int64_t cacheDuration;
+  MANUAL_PRE_RECORD_PARAM *pstPreRecParam = &pstMuxerHandle->stPreRecParam;
+
+  if (!pstRing->u32Depth ||
+      pstPreRecParam->stAttr.enPreRecordMode == RKADK_MUXER_PRE_RECORD_NONE)
+    return;
 
   if (pstMuxerHandle->bLapseRecord) {
-    if (RKADK_MUXER_GetListSize(pstList) > 0)
-      RKADK_MUXER_ListRelease(pstMuxerHandle, pstList);
+    if (pstRing->u32Cnt > 0)
+      RKADK_MUXER_PreRecRelease(pstMuxerHandle, pstRing);
 
     return;
   }
 
-  pstPreRecParam = &pstMuxerHandle->stPreRecParam;
-  if (pstPreRecParam->stAttr.u32PreRecTimeSec <= 0)
-      return;
+  RKADK_MUTEX_LOCK(pstPreRecParam->mutex);
+  // frames of one encoder come in pts order, append at the tail
+  if (pstRing->u32Cnt == pstRing->u32Depth)
+    RKADK_MUXER_PreRecEvict(pstRing, true);
 
-  pstPreRecCell = (MUXER_BUF_CELL_S *)malloc(sizeof(MUXER_BUF_CELL_S));
-  if (NULL == pstPreRecCell) {
-    RKADK_LOGE("Stream[%d]: malloc pre_record cell failed", pstMuxerHandle->u32VencChn);
-    return;
+  u32Tail = (pstRing->u32Head + pstRing->u32Cnt) % pstRing->u32Depth;
+  memcpy(&pstRing->pstCell[u32Tail], one, sizeof(MUXER_BUF_CELL_S));
+  pstRing->pstCell[u32Tail].pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
+  RK_MPI_MB_AddUserCnt(one->pMbBlk);
+  pstRing->u32Cnt++;
+
+  if (one->isKeyFrame && pstRing->pu32KeyIdx) {
+    pstRing->pu32KeyIdx[(pstRing->u32KeyHead + pstRing->u32KeyCnt) % pstRing->u32Depth] = u32Tail;
+    pstRing->u32KeyCnt++;
   }
 
-  INIT_LIST_HEAD(&pstPreRecCell->mark);
-  pstPreRecCell->buf = one->buf;
-  pstPreRecCell->isKeyFrame = one->isKeyFrame;
-  pstPreRecCell->pts = one->pts;
-  pstPreRecCell->size = one->size;
-  pstPreRecCell->bIsPool = false;
-  pstPreRecCell->pool = one->pool;
-  pstPreRecCell->pMbBlk = one->pMbBlk;
-  pstPreRecCell->pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
-  RK_MPI_MB_AddUserCnt(one->pMbBlk);
+  while (pstRing->u32Cnt > 1) {
+    cacheDuration = one->pts - pstRing->pstCell[pstRing->u32Head].pts;
+    if (cacheDuration < (int64_t)pstPreRecParam->stAttr.u32PreRecCacheTime * 1000000)
+      break;
 
-  RKADK_MUTEX_LOCK(pstMuxerHandle->stPreRecParam.mutex);
-  do {
-    list_for_each_entry_safe(cell, cell_n, pstList, mark) {
-      if (cell->pts > pstPreRecCell->pts) {
-        list_add_tail(&pstPreRecCell->mark, &cell->mark);
-        ret = 0;
-        break;
-      }
-    }
+    RKADK_MUXER_PreRecEvict(pstRing, true);
+  }
+  RKADK_MUTEX_UNLOCK(pstPreRecParam->mutex);
+}
 
-    if (ret) {
-      list_add_tail(&pstPreRecCell->mark, pstList);
-    }
-  } while (0);
+// move cached frames to stProcList, the MB references go with them
+static void RKADK_MUXER_PreRecDrain(MUXER_HANDLE_S *pstMuxerHandle,
+                                    PRE_RECORD_RING_S *pstRing) {
+  MUXER_BUF_CELL_S *cell = NULL;
 
-  if (!list_empty(pstList)) {
-    cell = list_first_entry(pstList, MUXER_BUF_CELL_S, mark);
-    if (cell) {
-      cell_n = list_entry(pstList->prev, MUXER_BUF_CELL_S, mark);
-      if (cell_n)
-        cacheDuration = cell_n->pts - cell->pts;
-
-      if (cacheDuration >= pstPreRecParam->stAttr.u32PreRecCacheTime * 1000000)
-        RKADK_MUXER_CellFree(pstMuxerHandle, cell);
+  while (pstRing->u32Cnt) {
+    if (list_empty(&pstRing->stDrainFree)) {
+      RKADK_LOGE("Stream[%d]: no free drain cell", pstMuxerHandle->u32VencChn);
+      RKADK_MUXER_PreRecEvict(pstRing, true);
+      continue;
     }
-  }
 
-  RKADK_MUTEX_UNLOCK(pstMuxerHandle->stPreRecParam.mutex);
+    // the copy keeps the lane's pool, Proc writes the cell by it
+    cell = list_first_entry(&pstRing->stDrainFree, MUXER_BUF_CELL_S, mark);
+    list_del_init(&cell->mark);
+    memcpy(cell, &pstRing->pstCell[pstRing->u32Head], sizeof(MUXER_BUF_CELL_S));
+    INIT_LIST_HEAD(&cell->mark);
+    cell->bIsPool = false;
+    cell->pDrainFree = &pstRing->stDrainFree;
+    list_add_tail(&cell->mark, &pstMuxerHandle->stProcList);
+    RKADK_MUXER_PreRecEvict(pstRing, false);
+  }
 }
 
 static MUXER_HANDLE_S *RKADK_MUXER_FindHandle(RKADK_MUXER_HANDLE_S *pstMuxer,
                                               RKADK_U32 chnId) {
-  MUXER_HANDLE_S *pstMuxerHandle = NULL;
-
-  for (int i = 0; i < (int)pstMuxer->u32StreamCnt; i++) {
-    pstMuxerHandle = (MUXER_HANDLE_S *)pstMuxer->pMuxerHandle[i];
-
-    if (pstMuxerHandle && pstMuxerHandle->u32VencChn == chnId)
-      break;
-  }
+  if (chnId >= VENC_MAX_CHN_NUM)
+    return NULL;
 
-  return pstMuxerHandle;
+  return ((MUXER_PRIV_HANDLE_S *)pstMuxer)->pChnHandle[chnId];
 }
 
-void RKADK_MUXER_ProcessEvent(MUXER_HANDLE_S *pstMuxerHandle,
-                              RKADK_MUXER_EVENT_E enEventType, int64_t value) {
+static void RKADK_MUXER_NotifyEvent(MUXER_HANDLE_S *pstMuxerHandle, char *cFileName,
+                                    RKADK_MUXER_EVENT_E enEventType, int64_t value) {
   RKADK_MUXER_EVENT_INFO_S stEventInfo;
   memset(&stEventInfo, 0, sizeof(RKADK_MUXER_EVENT_INFO_S));
 
@@ -367,10 +693,15 @@ void RKADK_MUXER_ProcessEvent(MUXER_HANDLE_S *pstMuxerHandle,
   stEventInfo.enEvent = enEventType;
   stEventInfo.unEventInfo.stFileInfo.u32Duration = value;
   memcpy(stEventInfo.unEventInfo.stFileInfo.asFileName,
-         pstMuxerHandle->cFileName, strlen(pstMuxerHandle->cFileName));
+         cFileName, strlen(cFileName));
   pstMuxerHandle->pfnEventCallback(pstMuxerHandle->ptr, &stEventInfo);
 }
 
+void RKADK_MUXER_ProcessEvent(MUXER_HANDLE_S *pstMuxerHandle,
+                              RKADK_MUXER_EVENT_E enEventType, int64_t value) {
+  RKADK_MUXER_NotifyEvent(pstMuxerHandle, pstMuxerHandle->cFileName, enEventType, value);
+}
+
 static void RKADK_MUXER_CheckWriteSpeed(MUXER_HANDLE_S *pstMuxerHandle) {
   int size = 0;
   struct timeval curTime;
@@ -378,7 +709,7 @@ static void RKADK_MUXER_CheckWriteSpeed(MUXER_HANDLE_S *pstMuxerHandle) {
   long diffMs = 0;
 
   gettimeofday(&curTime, NULL);
-  size = RKADK_MUXER_GetListSize(&pstMuxerHandle->stVFree);
+  size = RKADK_RING_Count(pstMuxerHandle->pVFree);
   if(size <= 5) {
     if (pstMuxerHandle->checkWriteTime.tv_sec == 0 && pstMuxerHandle->checkWriteTime.tv_usec == 0) {
       pstMuxerHandle->checkWriteTime.tv_sec = curTime.tv_sec;
@@ -400,158 +731,932 @@ static void RKADK_MUXER_CheckWriteSpeed(MUXER_HANDLE_S *pstMuxerHandle) {
   }
 }
 
-int RKADK_MUXER_WriteVideoFrame(RKADK_MEDIA_VENC_DATA_S stData, void *handle) {
-  int cnt = 0, isKeyFrame = 0;
-  MUXER_BUF_CELL_S cell;
-  MUXER_BUF_CELL_S *pstCell;
-  RKADK_U64 pts = 0;
-  RKADK_U32 framerate = 0;
+static bool RKADK_MUXER_IsNonRefFrame(MUXER_HANDLE_S *pstMuxerHandle,
+                                      MUXER_BUF_CELL_S *one) {
+  RKADK_U32 i, u32Len;
+  unsigned char nalType;
+
+  if (one->isKeyFrame)
+    return false;
+
+  // the slice nalu of a p frame follows the first few start codes
+  u32Len = one->size < 256 ? one->size : 256;
+  for (i = 0; i + 3 < u32Len; i++) {
+    if (one->buf[i] != 0 || one->buf[i + 1] != 0 || one->buf[i + 2] != 1)
+      continue;
+
+    nalType = one->buf[i + 3];
+    if (pstMuxerHandle->enCodecType == RKADK_CODEC_TYPE_H264) {
+      if ((nalType & 0x1f) == H264E_NALU_PSLICE)
+        return ((nalType >> 5) & 0x3) == 0; // nal_ref_idc
+    } else if (pstMuxerHandle->enCodecType == RKADK_CODEC_TYPE_H265) {
+      nalType = (nalType >> 1) & 0x3f;
+      if (nalType < 16) // sub-layer non-reference types are even
+        return !(nalType & 0x1);
+    }
+  }
+
+  return false;
+}
+
+static MUXER_BUF_CELL_S *RKADK_MUXER_CellWait(MUXER_HANDLE_S *pstMuxerHandle,
+                                              void *pFree) {
+  int ret, cnt = 0;
+  struct timeval timeNow;
+  struct timespec timeout;
+  MUXER_BUF_CELL_S *pstCell = NULL;
+  bool bVideo = pFree == pstMuxerHandle->pVFree;
+
+  __atomic_add_fetch(&pstMuxerHandle->stDropStats.u32BlockCnt, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&pstMuxerHandle->waitCnt, 1, __ATOMIC_SEQ_CST);
+  while (pstMuxerHandle->bEnableStream && !pstMuxerHandle->bReseting) {
+    ret = 0;
+    RKADK_MUTEX_LOCK(pstMuxerHandle->waitMutex);
+    // recheck under the lock, RKADK_MUXER_CellFree wakes us after the push
+    pstCell = RKADK_MUXER_CellGet(pstMuxerHandle, pFree);
+    if (!pstCell && pstMuxerHandle->bEnableStream && !pstMuxerHandle->bReseting) {
+      gettimeofday(&timeNow, NULL);
+      timeout.tv_sec = timeNow.tv_sec + 1;
+      timeout.tv_nsec = timeNow.tv_usec * 1000;
+      ret = pthread_cond_timedwait(&pstMuxerHandle->waitCond,
+                                   &pstMuxerHandle->waitMutex, &timeout);
+    }
+    RKADK_MUTEX_UNLOCK(pstMuxerHandle->waitMutex);
+
+    if (pstCell)
+      break;
+
+    if (ret == ETIMEDOUT) {
+      cnt++;
+      RKADK_LOGW("Stream[%d] wait %s cell %d s", pstMuxerHandle->u32VencChn,
+                 bVideo ? "video" : "audio", cnt);
+      if (bVideo)
+        RKADK_MUXER_CheckWriteSpeed(pstMuxerHandle);
+      else
+        RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_FILE_WRITING_SLOW, 0);
+    }
+  }
+  __atomic_sub_fetch(&pstMuxerHandle->waitCnt, 1, __ATOMIC_SEQ_CST);
+
+  return pstCell;
+}
+
+static MUXER_BUF_CELL_S *RKADK_MUXER_CellBackpressure(MUXER_HANDLE_S *pstMuxerHandle,
+                                                      MUXER_BUF_CELL_S *one) {
+  bool bDrop = false;
+  bool bVideo = one->pool == pstMuxerHandle->pVFree;
+
+  switch (pstMuxerHandle->enBackpressure) {
+  case RKADK_MUXER_BACKPRESSURE_DROP_NON_REF:
+    bDrop = !bVideo || RKADK_MUXER_IsNonRefFrame(pstMuxerHandle, one);
+    break;
+  case RKADK_MUXER_BACKPRESSURE_DROP_TO_IDR:
+    bDrop = true;
+    if (bVideo && !pstMuxerHandle->bWaitIDR) {
+      RKADK_LOGW("Stream[%d] cache full, drop video until next IDR",
+                 pstMuxerHandle->u32VencChn);
+      pstMuxerHandle->bWaitIDR = true;
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (!bDrop)
+    return RKADK_MUXER_CellWait(pstMuxerHandle, one->pool);
+
+  if (bVideo)
+    __atomic_add_fetch(&pstMuxerHandle->stDropStats.u32VideoDropCnt, 1, __ATOMIC_RELAXED);
+  else
+    __atomic_add_fetch(&pstMuxerHandle->stDropStats.u32AudioDropCnt, 1, __ATOMIC_RELAXED);
+
+  return NULL;
+}
+
+int RKADK_MUXER_WriteVideoFrame(RKADK_MEDIA_VENC_DATA_S stData, void *handle) {
+  int isKeyFrame = 0;
+  MUXER_BUF_CELL_S cell;
+  MUXER_BUF_CELL_S *pstCell;
+  RKADK_U64 pts = 0;
+
+  RKADK_CHECK_POINTER(handle, RKADK_FAILURE);
+
+  RKADK_MUXER_HANDLE_S *pstMuxer = (RKADK_MUXER_HANDLE_S *)handle;
+  MUXER_HANDLE_S *pstMuxerHandle = RKADK_MUXER_FindHandle(pstMuxer, stData.u32ChnId);
+  if (!pstMuxerHandle)
+    return -1;
+
+  if (pstMuxerHandle->bReseting)
+    return 0;
+
+  if(pstMuxer->bLapseRecord)
+    pts = stData.stFrame.pstPack->u64PTS / pstMuxerHandle->stVideo.frame_rate_num;
+  else
+    pts = stData.stFrame.pstPack->u64PTS;
+
+  if ((stData.stFrame.pstPack->DataType.enH264EType == H264E_NALU_ISLICE ||
+      stData.stFrame.pstPack->DataType.enH264EType == H264E_NALU_IDRSLICE) ||
+      (stData.stFrame.pstPack->DataType.enH265EType == H265E_NALU_ISLICE ||
+      stData.stFrame.pstPack->DataType.enH265EType == H265E_NALU_IDRSLICE))
+      isKeyFrame = 1;
+
+  if (pstMuxerHandle->bFirstKeyFrame && isKeyFrame) {
+    RKADK_KLOG("Muxer[%d] Stream[%d] first key frame pts: %lld",
+               pstMuxerHandle->muxerId, stData.u32ChnId, pts);
+    pstMuxerHandle->bFirstKeyFrame = false;
+  }
+
+  cell.buf = (unsigned char *)RK_MPI_MB_Handle2VirAddr(stData.stFrame.pstPack->pMbBlk);
+  if (NULL == cell.buf) {
+    RKADK_LOGE("Stream[%d]: RK_MPI_MB_Handle2VirAddr failed", pstMuxerHandle->u32VencChn);
+    return -1;
+  }
+
+  cell.isKeyFrame = isKeyFrame;
+  cell.pts = pts;
+  cell.size = stData.stFrame.pstPack->u32Len;
+  cell.bIsPool = true;
+  cell.pool = pstMuxerHandle->pVFree;
+  cell.pMbBlk = stData.stFrame.pstPack->pMbBlk;
+  cell.pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
+  RKADK_MUXER_PreRecPush(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stVRing, &cell);
+
+  if (!pstMuxerHandle->bEnableStream)
+    return 0;
+
+  if (pstMuxerHandle->bWaitIDR) {
+    if (!isKeyFrame) {
+      __atomic_add_fetch(&pstMuxerHandle->stDropStats.u32VideoDropCnt, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+
+    RKADK_LOGI("Stream[%d] resume at IDR, dropped %d video frames", stData.u32ChnId,
+               pstMuxerHandle->stDropStats.u32VideoDropCnt);
+    pstMuxerHandle->bWaitIDR = false;
+  }
+
+  RKADK_MUXER_CheckWriteSpeed(pstMuxerHandle);
+  pstCell = RKADK_MUXER_CellGet(pstMuxerHandle, pstMuxerHandle->pVFree);
+  if (!pstCell) {
+    pstCell = RKADK_MUXER_CellBackpressure(pstMuxerHandle, &cell);
+    if (!pstCell)
+      return 0;
+  }
+
+  pstCell->buf = cell.buf;
+  pstCell->isKeyFrame = isKeyFrame;
+  pstCell->pts = pts;
+  pstCell->size = cell.size;
+  pstCell->bIsPool = true;
+  pstCell->pMbBlk = cell.pMbBlk;
+  pstCell->pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
+  RK_MPI_MB_AddUserCnt(stData.stFrame.pstPack->pMbBlk);
+  RKADK_MUXER_CellPush(pstMuxerHandle, pstMuxerHandle->pVProc, pstCell);
+  RKADK_SIGNAL_Give(pstMuxerHandle->pSignal);
+  return 0;
+}
+
+int RKADK_MUXER_WriteAudioFrame(void *pMbBlk, RKADK_U32 size, int64_t pts,
+                                void *handle) {
+  MUXER_HANDLE_S *pstMuxerHandle = NULL;
+  RKADK_MUXER_HANDLE_S *pstMuxer = NULL;
+  MUXER_BUF_CELL_S cell;
+  MUXER_BUF_CELL_S *pstCell;
+
+  RKADK_CHECK_POINTER(handle, RKADK_FAILURE);
+
+  pstMuxer = (RKADK_MUXER_HANDLE_S *)handle;
+  for (int i = 0; i < (int)pstMuxer->u32StreamCnt; i++) {
+    pstMuxerHandle = (MUXER_HANDLE_S *)pstMuxer->pMuxerHandle[i];
+    if (!pstMuxerHandle)
+      continue;
+
+    if (pstMuxerHandle->bReseting)
+      continue;
+
+    cell.buf = (unsigned char *)RK_MPI_MB_Handle2VirAddr(pMbBlk);
+    if (NULL == cell.buf) {
+      RKADK_LOGE("Stream[%d]: RK_MPI_MB_Handle2VirAddr failed", pstMuxerHandle->u32VencChn);
+      return -1;
+    }
+
+    cell.buf += pstMuxerHandle->u32AudioHeaderSize;
+    cell.size = size - pstMuxerHandle->u32AudioHeaderSize;
+    cell.isKeyFrame = 0;
+    cell.pts = pts;
+    cell.bIsPool = true;
+    cell.pool = pstMuxerHandle->pAFree;
+    cell.pMbBlk = pMbBlk;
+    cell.pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
+    RKADK_MUXER_PreRecPush(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stARing, &cell);
+
+    if (!pstMuxerHandle->bEnableStream)
+      continue;
+
+    pstCell = RKADK_MUXER_CellGet(pstMuxerHandle, pstMuxerHandle->pAFree);
+    if (!pstCell) {
+      pstCell = RKADK_MUXER_CellBackpressure(pstMuxerHandle, &cell);
+      if (!pstCell)
+        continue;
+    }
+
+    pstCell->buf = cell.buf;
+    pstCell->size = cell.size;
+    pstCell->isKeyFrame = 0;
+    pstCell->pts = pts;
+    pstCell->bIsPool = true;
+    pstCell->pMbBlk = pMbBlk;
+    pstCell->pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
+    RK_MPI_MB_AddUserCnt(pMbBlk);
+    RKADK_MUXER_CellPush(pstMuxerHandle, pstMuxerHandle->pAProc, pstCell);
+    RKADK_SIGNAL_Give(pstMuxerHandle->pSignal);
+  }
+
+  return 0;
+}
+
+static int RKADK_MUXER_ThumbWrite(MUXER_FILE_JOB_S *pstJob) {
+  int fd;
+  ssize_t len;
+  RKADK_U32 u32Offset = 0;
+  unsigned char *pData;
+
+  pData = (unsigned char *)RK_MPI_MB_Handle2VirAddr(pstJob->pMbBlk);
+  if (!pData) {
+    RKADK_LOGE("RK_MPI_MB_Handle2VirAddr failed");
+    return -1;
+  }
+
+  fd = open(pstJob->cFileName, O_WRONLY);
+  if (fd < 0) {
+    RKADK_LOGE("Open %s file failed, errno = %d", pstJob->cFileName, errno);
+    return -1;
+  }
+
+  while (u32Offset < pstJob->u32Len) {
+    len = pwrite(fd, pData + u32Offset, pstJob->u32Len - u32Offset,
+                 pstJob->position + u32Offset);
+    if (len < 0 && errno == EINTR)
+      continue;
+
+    if (len <= 0) {
+      RKADK_LOGE("Write %s thumbnail failed, errno = %d", pstJob->cFileName, errno);
+      close(fd);
+      return -1;
+    }
+
+    u32Offset += len;
+  }
+
+  close(fd);
+  RKADK_LOGI("Stream [%d] thumbnail [seq: %d, len: %d] build in %s file position = %d done!",
+             pstJob->pstMuxerHandle->u32VencChn, pstJob->u32Seq, pstJob->u32Len,
+             pstJob->cFileName, pstJob->position);
+  return 0;
+}
+
+// reserve the extent of the whole file up front, so the card allocates it in
+// one piece instead of cluster by cluster as the file grows
+static void RKADK_MUXER_FileAllocate(MUXER_HANDLE_S *pstMuxerHandle, char *cFileName,
+                                     RKADK_U32 u32Duration) {
+  int fd;
+  RKADK_U64 u64Size;
+
+  if (!pstMuxerHandle->bPreAllocate || !u32Duration)
+    return;
+
+  u64Size = (RKADK_U64)u32Duration *
+            (pstMuxerHandle->stVideo.bit_rate + pstMuxerHandle->u32AudioBitRate) / 8;
+  u64Size += u64Size / RKADK_MUXER_PRE_ALLOC_MARGIN;
+  if (!u64Size)
+    return;
+
+  fd = open(cFileName, O_WRONLY);
+  if (fd < 0) {
+    RKADK_LOGE("Open %s file failed, errno = %d", cFileName, errno);
+    return;
+  }
+
+  // keep the file size, the unused tail is trimmed at close
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)u64Size))
+    RKADK_LOGW("fallocate %s [%llu] failed, errno = %d", cFileName, u64Size, errno);
+
+  close(fd);
+}
+
+// release the preallocated extent past the end of a finished file
+static void RKADK_MUXER_FileTrim(MUXER_HANDLE_S *pstMuxerHandle, char *cFileName) {
+  int fd;
+  struct stat stStat;
+
+  if (!pstMuxerHandle->bPreAllocate)
+    return;
+
+  fd = open(cFileName, O_WRONLY);
+  if (fd < 0) {
+    RKADK_LOGE("Open %s file failed, errno = %d", cFileName, errno);
+    return;
+  }
+
+  if (!fstat(fd, &stStat) && ftruncate(fd, stStat.st_size))
+    RKADK_LOGE("ftruncate %s failed, errno = %d", cFileName, errno);
+
+  close(fd);
+}
+
+// called with paramMutex held
+static int RKADK_MUXER_InitFile(MUXER_HANDLE_S *pstMuxerHandle, int muxerId,
+                                char *cFileName, bool *pbFallback) {
+  int ret;
+
+  *pbFallback = false;
+  ret = rkmuxer_init(muxerId, (char *)pstMuxerHandle->cOutputFmt, cFileName,
+                     &pstMuxerHandle->stVideo, &pstMuxerHandle->stAudio);
+  if (!ret || strcmp(pstMuxerHandle->cOutputFmt, "ismv"))
+    return ret;
+
+  // the shipped rkmuxer has no ismv, record plain mp4 rather than nothing.
+  // It's still synced every u32FragmentGop GOPs, but has no moov until closed
+  RKADK_LOGW("rkmuxer_init[%d] ismv failed[%d], fall back to mp4", muxerId, ret);
+  pstMuxerHandle->cOutputFmt = "mp4";
+  ret = rkmuxer_init(muxerId, (char *)pstMuxerHandle->cOutputFmt, cFileName,
+                     &pstMuxerHandle->stVideo, &pstMuxerHandle->stAudio);
+  *pbFallback = !ret;
+  return ret;
+}
+
+static void RKADK_MUXER_FileOpen(MUXER_FILE_WORKER_S *pstWorker,
+                                 MUXER_FILE_JOB_S *pstJob) {
+  int ret = -1;
+  bool bFallback = false;
+  RKADK_U32 u32ParamGen = 0;
+  MUXER_HANDLE_S *pstMuxerHandle = pstJob->pstMuxerHandle;
+
+  // the bank may still be finalizing an older file on the file thread
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  while (pstMuxerHandle->aBusyCnt[pstJob->muxerIdx] > 0)
+    pthread_cond_wait(&pstWorker->cond, &pstWorker->mutex);
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+
+  // stream stopped while the job was queued
+  if (pstMuxerHandle->bEnableStream) {
+    ret = pstMuxerHandle->pcbRequestFileNames(pstMuxerHandle->ptr, pstJob->cFileName,
+                                              pstMuxerHandle->aMuxerId[0]);
+    if (ret) {
+      RKADK_LOGE("request next file name failed");
+    } else {
+      RKADK_MUTEX_LOCK(pstMuxerHandle->paramMutex);
+      u32ParamGen = pstMuxerHandle->u32ParamGen;
+      ret = RKADK_MUXER_InitFile(pstMuxerHandle,
+                                 pstMuxerHandle->aMuxerId[pstJob->muxerIdx],
+                                 pstJob->cFileName, &bFallback);
+      RKADK_MUTEX_UNLOCK(pstMuxerHandle->paramMutex);
+      if (bFallback)
+        RKADK_MUXER_NotifyEvent(pstMuxerHandle, pstJob->cFileName,
+                                RKADK_MUXER_EVENT_FMP4_FALLBACK, 0);
+      if (ret) {
+        RKADK_LOGE("rkmuxer_init[%d] failed[%d]",
+                   pstMuxerHandle->aMuxerId[pstJob->muxerIdx], ret);
+      } else {
+        RKADK_MUXER_FileAllocate(pstMuxerHandle, pstJob->cFileName, pstJob->u32Duration);
+        RKADK_LOGI("Stream[%d] next file [%s] ready", pstMuxerHandle->u32VencChn,
+                   pstJob->cFileName);
+      }
+    }
+  }
+
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  if (ret) {
+    pstMuxerHandle->enNextState = MUXER_NEXT_NONE;
+  } else {
+    memcpy(pstMuxerHandle->cNextFileName, pstJob->cFileName, RKADK_MAX_FILE_PATH_LEN);
+    pstMuxerHandle->u32NextParamGen = u32ParamGen;
+    pstMuxerHandle->enNextState = MUXER_NEXT_READY;
+  }
+  pthread_cond_broadcast(&pstWorker->cond);
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+}
+
+static void RKADK_MUXER_FileClose(MUXER_FILE_WORKER_S *pstWorker,
+                                  MUXER_FILE_JOB_S *pstJob) {
+  RKADK_U64 u64StartUs;
+  MUXER_HANDLE_S *pstMuxerHandle = pstJob->pstMuxerHandle;
+
+  u64StartUs = RKADK_MUXER_GetUs();
+  rkmuxer_deinit(pstMuxerHandle->aMuxerId[pstJob->muxerIdx]);
+  RKADK_MUXER_LatencyAdd(&pstMuxerHandle->stStats.stFileClose,
+                         RKADK_MUXER_GetUs() - u64StartUs);
+
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  pstMuxerHandle->aBusyCnt[pstJob->muxerIdx]--;
+  pthread_cond_broadcast(&pstWorker->cond);
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+
+  if (pstJob->enType == MUXER_FILE_JOB_DISCARD) {
+    RKADK_LOGI("Stream[%d] discard unused file [%s]", pstMuxerHandle->u32VencChn,
+               pstJob->cFileName);
+    if (remove(pstJob->cFileName))
+      RKADK_LOGE("remove %s failed, errno = %d", pstJob->cFileName, errno);
+    return;
+  }
+
+  // writeback jobs of the next file are queued after this one
+  pstMuxerHandle->u64WbStart = 0;
+  pstMuxerHandle->u64WbEnd = 0;
+  RKADK_MUXER_FileTrim(pstMuxerHandle, pstJob->cFileName);
+
+  RKADK_MUXER_NotifyEvent(pstMuxerHandle, pstJob->cFileName, pstJob->enEvent,
+                          pstJob->realDuration);
+}
+
+static void RKADK_MUXER_FileSync(MUXER_FILE_WORKER_S *pstWorker,
+                                 MUXER_FILE_JOB_S *pstJob) {
+  int fd;
+  RKADK_U64 u64StartUs;
+  MUXER_HANDLE_S *pstMuxerHandle = pstJob->pstMuxerHandle;
+
+  // fragments finished from now on need another sync
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  pstMuxerHandle->bSyncPending = false;
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+
+  u64StartUs = RKADK_MUXER_GetUs();
+  fd = open(pstJob->cFileName, O_RDONLY);
+  if (fd < 0) {
+    RKADK_LOGE("Open %s file failed, errno = %d", pstJob->cFileName, errno);
+    return;
+  }
+
+  if (fdatasync(fd))
+    RKADK_LOGE("fdatasync %s failed, errno = %d", pstJob->cFileName, errno);
+
+  close(fd);
+  RKADK_MUXER_LatencyAdd(&pstMuxerHandle->stStats.stFileSync,
+                         RKADK_MUXER_GetUs() - u64StartUs);
+}
+
+// start the writeback of the full blocks written since the last job, then wait
+// for the blocks started by the previous job and drop them from the page cache
+static void RKADK_MUXER_FileWriteback(MUXER_FILE_JOB_S *pstJob) {
+  int fd;
+  RKADK_U64 u64End;
+  struct stat stStat;
+  MUXER_HANDLE_S *pstMuxerHandle = pstJob->pstMuxerHandle;
+
+  fd = open(pstJob->cFileName, O_RDONLY);
+  if (fd < 0) {
+    RKADK_LOGE("Open %s file failed, errno = %d", pstJob->cFileName, errno);
+    return;
+  }
+
+  if (fstat(fd, &stStat)) {
+    RKADK_LOGE("fstat %s failed, errno = %d", pstJob->cFileName, errno);
+    close(fd);
+    return;
+  }
+
+  u64End = (RKADK_U64)stStat.st_size & ~((RKADK_U64)pstMuxerHandle->u32WriteBlock - 1);
+  if (u64End <= pstMuxerHandle->u64WbEnd) {
+    close(fd);
+    return;
+  }
+
+  if (sync_file_range(fd, pstMuxerHandle->u64WbEnd, u64End - pstMuxerHandle->u64WbEnd,
+                      SYNC_FILE_RANGE_WRITE))
+    RKADK_LOGE("sync_file_range %s failed, errno = %d", pstJob->cFileName, errno);
+
+  if (pstMuxerHandle->u64WbEnd > pstMuxerHandle->u64WbStart) {
+    sync_file_range(fd, pstMuxerHandle->u64WbStart,
+                    pstMuxerHandle->u64WbEnd - pstMuxerHandle->u64WbStart,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, pstMuxerHandle->u64WbStart,
+                  pstMuxerHandle->u64WbEnd - pstMuxerHandle->u64WbStart,
+                  POSIX_FADV_DONTNEED);
+  }
+
+  pstMuxerHandle->u64WbStart = pstMuxerHandle->u64WbEnd;
+  pstMuxerHandle->u64WbEnd = u64End;
+  close(fd);
+}
+
+static void RKADK_MUXER_FileJobRun(MUXER_FILE_WORKER_S *pstWorker,
+                                   MUXER_FILE_JOB_S *pstJob) {
+  switch (pstJob->enType) {
+  case MUXER_FILE_JOB_THUMB:
+    RKADK_MUXER_ThumbWrite(pstJob);
+    RK_MPI_MB_ReleaseMB(pstJob->pMbBlk);
+    break;
+  case MUXER_FILE_JOB_OPEN:
+    RKADK_MUXER_FileOpen(pstWorker, pstJob);
+    break;
+  case MUXER_FILE_JOB_CLOSE:
+  case MUXER_FILE_JOB_DISCARD:
+    RKADK_MUXER_FileClose(pstWorker, pstJob);
+    break;
+  case MUXER_FILE_JOB_SYNC:
+    RKADK_MUXER_FileSync(pstWorker, pstJob);
+    break;
+  case MUXER_FILE_JOB_WRITEBACK:
+    RKADK_MUXER_FileWriteback(pstJob);
+    break;
+  default:
+    RKADK_LOGE("unknown file job type %d", pstJob->enType);
+    break;
+  }
+
+  free(pstJob);
+}
+
+static MUXER_FILE_JOB_S *RKADK_MUXER_FileJobPop(MUXER_FILE_WORKER_S *pstWorker,
+                                                struct list_head *pstList) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  if (!list_empty(pstList)) {
+    pstJob = list_first_entry(pstList, MUXER_FILE_JOB_S, mark);
+    list_del_init(&pstJob->mark);
+  }
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+
+  return pstJob;
+}
+
+static MUXER_FILE_JOB_S *RKADK_MUXER_FileJobCreate(MUXER_HANDLE_S *pstMuxerHandle,
+                                                   MUXER_FILE_JOB_TYPE_E enType,
+                                                   int muxerIdx) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+
+  pstJob = (MUXER_FILE_JOB_S *)malloc(sizeof(MUXER_FILE_JOB_S));
+  if (!pstJob) {
+    RKADK_LOGE("malloc file job failed");
+    return NULL;
+  }
+
+  memset(pstJob, 0, sizeof(MUXER_FILE_JOB_S));
+  INIT_LIST_HEAD(&pstJob->mark);
+  pstJob->enType = enType;
+  pstJob->pstMuxerHandle = pstMuxerHandle;
+  pstJob->muxerIdx = muxerIdx;
+  return pstJob;
+}
+
+// the caller holds the worker mutex
+static void RKADK_MUXER_FileJobPush(MUXER_FILE_WORKER_S *pstWorker,
+                                    MUXER_FILE_JOB_S *pstJob) {
+  if (pstJob->enType == MUXER_FILE_JOB_OPEN) {
+    list_add_tail(&pstJob->mark, &pstWorker->stOpenList);
+    RKADK_SIGNAL_Give(pstWorker->pOpenSignal);
+    return;
+  }
+
+  if (pstJob->enType == MUXER_FILE_JOB_CLOSE || pstJob->enType == MUXER_FILE_JOB_DISCARD)
+    pstJob->pstMuxerHandle->aBusyCnt[pstJob->muxerIdx]++;
+
+  list_add_tail(&pstJob->mark, &pstWorker->stJobList);
+  RKADK_SIGNAL_Give(pstWorker->pSignal);
+}
+
+// the caller holds the worker mutex
+static void RKADK_MUXER_DiscardNextLocked(MUXER_FILE_WORKER_S *pstWorker,
+                                    MUXER_HANDLE_S *pstMuxerHandle) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+
+  if (pstMuxerHandle->enNextState != MUXER_NEXT_READY)
+    return;
+
+  pstMuxerHandle->enNextState = MUXER_NEXT_NONE;
+  pstJob = RKADK_MUXER_FileJobCreate(pstMuxerHandle, MUXER_FILE_JOB_DISCARD,
+                                     pstMuxerHandle->muxerIdx ^ 1);
+  if (!pstJob) {
+    rkmuxer_deinit(pstMuxerHandle->aMuxerId[pstMuxerHandle->muxerIdx ^ 1]);
+    return;
+  }
+
+  memcpy(pstJob->cFileName, pstMuxerHandle->cNextFileName, RKADK_MAX_FILE_PATH_LEN);
+  RKADK_MUXER_FileJobPush(pstWorker, pstJob);
+}
+
+static bool RKADK_MUXER_FileWorkerProc(void *params) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+  MUXER_FILE_WORKER_S *pstWorker = (MUXER_FILE_WORKER_S *)params;
+
+  RKADK_SIGNAL_Wait(pstWorker->pSignal, 1000);
+
+  // jobs run in queue order, so a file is closed after its thumbnail is written
+  while ((pstJob = RKADK_MUXER_FileJobPop(pstWorker, &pstWorker->stJobList)))
+    RKADK_MUXER_FileJobRun(pstWorker, pstJob);
+
+  return true;
+}
+
+static bool RKADK_MUXER_OpenWorkerProc(void *params) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+  MUXER_FILE_WORKER_S *pstWorker = (MUXER_FILE_WORKER_S *)params;
+
+  RKADK_SIGNAL_Wait(pstWorker->pOpenSignal, 1000);
+
+  while ((pstJob = RKADK_MUXER_FileJobPop(pstWorker, &pstWorker->stOpenList)))
+    RKADK_MUXER_FileJobRun(pstWorker, pstJob);
+
+  return true;
+}
+
+static void RKADK_MUXER_FileWorkerDestroy(RKADK_MUXER_HANDLE_S *pstMuxer) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+  MUXER_FILE_WORKER_S *pstWorker = (MUXER_FILE_WORKER_S *)pstMuxer->pFileWorker;
+
+  if (!pstWorker)
+    return;
+
+  RKADK_THREAD_SetExit(pstWorker->pThread);
+  RKADK_SIGNAL_Give(pstWorker->pSignal);
+  RKADK_THREAD_Destory(pstWorker->pThread);
+  pstWorker->pThread = NULL;
+
+  // finish the jobs queued before exit, an open job waits for these closes
+  while ((pstJob = RKADK_MUXER_FileJobPop(pstWorker, &pstWorker->stJobList)))
+    RKADK_MUXER_FileJobRun(pstWorker, pstJob);
+
+  RKADK_THREAD_SetExit(pstWorker->pOpenThread);
+  RKADK_SIGNAL_Give(pstWorker->pOpenSignal);
+  RKADK_THREAD_Destory(pstWorker->pOpenThread);
+  pstWorker->pOpenThread = NULL;
+
+  while ((pstJob = RKADK_MUXER_FileJobPop(pstWorker, &pstWorker->stOpenList)))
+    RKADK_MUXER_FileJobRun(pstWorker, pstJob);
+
+  // a next file opened while the streams were stopping
+  for (int i = 0; i < (int)pstMuxer->u32StreamCnt; i++) {
+    MUXER_HANDLE_S *pstMuxerHandle = (MUXER_HANDLE_S *)pstMuxer->pMuxerHandle[i];
+    if (!pstMuxerHandle || pstMuxerHandle->enNextState != MUXER_NEXT_READY)
+      continue;
+
+    RKADK_MUTEX_LOCK(pstWorker->mutex);
+    RKADK_MUXER_DiscardNextLocked(pstWorker, pstMuxerHandle);
+    RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+    while ((pstJob = RKADK_MUXER_FileJobPop(pstWorker, &pstWorker->stJobList)))
+      RKADK_MUXER_FileJobRun(pstWorker, pstJob);
+  }
+
+  RKADK_SIGNAL_Destroy(pstWorker->pSignal);
+  RKADK_SIGNAL_Destroy(pstWorker->pOpenSignal);
+  pthread_mutex_destroy(&pstWorker->mutex);
+  pthread_cond_destroy(&pstWorker->cond);
+  free(pstWorker);
+  pstMuxer->pFileWorker = NULL;
+}
+
+static int RKADK_MUXER_FileWorkerCreate(RKADK_MUXER_HANDLE_S *pstMuxer) {
+  char name[256];
+  MUXER_FILE_WORKER_S *pstWorker = NULL;
 
-  RKADK_CHECK_POINTER(handle, RKADK_FAILURE);
+  if (pstMuxer->pFileWorker)
+    return 0;
 
-  RKADK_MUXER_HANDLE_S *pstMuxer = (RKADK_MUXER_HANDLE_S *)handle;
-  MUXER_HANDLE_S *pstMuxerHandle = RKADK_MUXER_FindHandle(pstMuxer, stData.u32ChnId);
-  if (!pstMuxerHandle)
+  pstWorker = (MUXER_FILE_WORKER_S *)malloc(sizeof(MUXER_FILE_WORKER_S));
+  if (!pstWorker) {
+    RKADK_LOGE("malloc file worker failed");
     return -1;
+  }
+  memset(pstWorker, 0, sizeof(MUXER_FILE_WORKER_S));
+  INIT_LIST_HEAD(&pstWorker->stJobList);
+  INIT_LIST_HEAD(&pstWorker->stOpenList);
+  pthread_mutex_init(&pstWorker->mutex, NULL);
+  pthread_cond_init(&pstWorker->cond, NULL);
+
+  pstWorker->pSignal = RKADK_SIGNAL_Create(0, 1);
+  pstWorker->pOpenSignal = RKADK_SIGNAL_Create(0, 1);
+  if (!pstWorker->pSignal || !pstWorker->pOpenSignal) {
+    RKADK_LOGE("RKADK_SIGNAL_Create failed");
+    goto failed;
+  }
 
-  if (pstMuxerHandle->bReseting)
-    return 0;
-
-  if(pstMuxer->bLapseRecord)
-    pts = stData.stFrame.pstPack->u64PTS / pstMuxerHandle->stVideo.frame_rate_num;
-  else
-    pts = stData.stFrame.pstPack->u64PTS;
+  snprintf(name, sizeof(name), "MuxerFile_%d", pstMuxer->u32CamId);
+  pstWorker->pThread = RKADK_THREAD_Create(RKADK_MUXER_FileWorkerProc, pstWorker, name);
+  if (!pstWorker->pThread) {
+    RKADK_LOGE("RKADK_THREAD_Create failed");
+    goto failed;
+  }
 
-  if ((stData.stFrame.pstPack->DataType.enH264EType == H264E_NALU_ISLICE ||
-      stData.stFrame.pstPack->DataType.enH264EType == H264E_NALU_IDRSLICE) ||
-      (stData.stFrame.pstPack->DataType.enH265EType == H265E_NALU_ISLICE ||
-      stData.stFrame.pstPack->DataType.enH265EType == H265E_NALU_IDRSLICE))
-      isKeyFrame = 1;
+  snprintf(name, sizeof(name), "MuxerOpen_%d", pstMuxer->u32CamId);
+  pstWorker->pOpenThread = RKADK_THREAD_Create(RKADK_MUXER_OpenWorkerProc, pstWorker, name);
+  if (!pstWorker->pOpenThread) {
+    RKADK_LOGE("RKADK_THREAD_Create failed");
+    RKADK_THREAD_SetExit(pstWorker->pThread);
+    RKADK_SIGNAL_Give(pstWorker->pSignal);
+    RKADK_THREAD_Destory(pstWorker->pThread);
+    goto failed;
+  }
 
-  if (pstMuxerHandle->bFirstKeyFrame && isKeyFrame) {
-    RKADK_KLOG("Muxer[%d] Stream[%d] first key frame pts: %lld",
-               pstMuxerHandle->muxerId, stData.u32ChnId, pts);
-    pstMuxerHandle->bFirstKeyFrame = false;
+  pstMuxer->pFileWorker = pstWorker;
+  return 0;
+
+failed:
+  RKADK_SIGNAL_Destroy(pstWorker->pSignal);
+  RKADK_SIGNAL_Destroy(pstWorker->pOpenSignal);
+  pthread_mutex_destroy(&pstWorker->mutex);
+  pthread_cond_destroy(&pstWorker->cond);
+  free(pstWorker);
+  return -1;
+}
+
+static MUXER_FILE_WORKER_S *RKADK_MUXER_GetFileWorker(MUXER_HANDLE_S *pstMuxerHandle) {
+  RKADK_MUXER_HANDLE_S *pstMuxer = (RKADK_MUXER_HANDLE_S *)pstMuxerHandle->ptr;
+
+  return (MUXER_FILE_WORKER_S *)pstMuxer->pFileWorker;
+}
+
+// open the next file ahead of the switch, off the write thread
+static void RKADK_MUXER_PreOpen(MUXER_HANDLE_S *pstMuxerHandle, RKADK_U32 u32Duration) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+  MUXER_FILE_WORKER_S *pstWorker = RKADK_MUXER_GetFileWorker(pstMuxerHandle);
+
+  if (!pstWorker || pstMuxerHandle->duration <= 0 || pstMuxerHandle->bIOError)
+    return;
+
+  if (pstMuxerHandle->enNextState != MUXER_NEXT_NONE)
+    return;
+
+  if (pstMuxerHandle->realDuration + RKADK_MUXER_PRE_OPEN_MS < (int32_t)u32Duration * 1000)
+    return;
+
+  pstJob = RKADK_MUXER_FileJobCreate(pstMuxerHandle, MUXER_FILE_JOB_OPEN,
+                                     pstMuxerHandle->muxerIdx ^ 1);
+  if (!pstJob)
+    return;
+
+  pstJob->u32Duration = u32Duration;
+
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  pstMuxerHandle->enNextState = MUXER_NEXT_OPENING;
+  RKADK_MUXER_FileJobPush(pstWorker, pstJob);
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+}
+
+// a key frame completes the previous GOP, sync the file every u32FragmentGop
+// GOPs so a power loss loses no more data. Only an ismv file, one fragment
+// per GOP, is playable from the synced data, a plain mp4 needs its moov
+static void RKADK_MUXER_SyncFragment(MUXER_HANDLE_S *pstMuxerHandle,
+                                     MUXER_BUF_CELL_S *cell) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+  MUXER_FILE_WORKER_S *pstWorker = RKADK_MUXER_GetFileWorker(pstMuxerHandle);
+
+  // the first key frame of a file has no GOP before it
+  if (!pstWorker || !pstMuxerHandle->u32FragmentGop || !cell->isKeyFrame ||
+      pstMuxerHandle->frameCnt <= 1)
+    return;
+
+  pstMuxerHandle->u32FragmentCnt++;
+  if (pstMuxerHandle->u32FragmentCnt < pstMuxerHandle->u32FragmentGop)
+    return;
+
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  if (pstMuxerHandle->bSyncPending) {
+    RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+    return;
   }
 
-  cell.buf = (unsigned char *)RK_MPI_MB_Handle2VirAddr(stData.stFrame.pstPack->pMbBlk);
-  if (NULL == cell.buf) {
-    RKADK_LOGE("Stream[%d]: RK_MPI_MB_Handle2VirAddr failed", pstMuxerHandle->u32VencChn);
-    return -1;
+  pstJob = RKADK_MUXER_FileJobCreate(pstMuxerHandle, MUXER_FILE_JOB_SYNC,
+                                     pstMuxerHandle->muxerIdx);
+  if (pstJob) {
+    memcpy(pstJob->cFileName, pstMuxerHandle->cFileName, RKADK_MAX_FILE_PATH_LEN);
+    pstMuxerHandle->bSyncPending = true;
+    pstMuxerHandle->u32FragmentCnt = 0;
+    RKADK_MUXER_FileJobPush(pstWorker, pstJob);
   }
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+}
 
-  cell.isKeyFrame = isKeyFrame;
-  cell.pts = pts;
-  cell.size = stData.stFrame.pstPack->u32Len;
-  cell.bIsPool = true;
-  cell.pool = &pstMuxerHandle->stVFree;
-  cell.pMbBlk = stData.stFrame.pstPack->pMbBlk;
-  cell.pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
-  RKADK_MUXER_PreRecPush(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stVList, &cell);
+static void RKADK_MUXER_Writeback(MUXER_HANDLE_S *pstMuxerHandle, RKADK_U32 u32Size) {
+  MUXER_FILE_JOB_S *pstJob = NULL;
+  MUXER_FILE_WORKER_S *pstWorker = RKADK_MUXER_GetFileWorker(pstMuxerHandle);
 
-  if (!pstMuxerHandle->bEnableStream)
-    return 0;
+  pstMuxerHandle->u32DirtyBytes += u32Size;
+  if (!pstWorker || pstMuxerHandle->u32DirtyBytes < pstMuxerHandle->u32WriteBlock)
+    return;
 
-  RKADK_MUXER_CheckWriteSpeed(pstMuxerHandle);
-  framerate = pstMuxerHandle->stVideo.frame_rate_num / pstMuxerHandle->stVideo.frame_rate_den;
-  while ((pstCell = RKADK_MUXER_CellGet(pstMuxerHandle, &pstMuxerHandle->stVFree)) == NULL) {
-      if (cnt % framerate == 0)
-        RKADK_LOGW("Stream[%d] get video cell fail, retry, cnt = %d", stData.u32ChnId, cnt);
+  pstJob = RKADK_MUXER_FileJobCreate(pstMuxerHandle, MUXER_FILE_JOB_WRITEBACK,
+                                     pstMuxerHandle->muxerIdx);
+  if (!pstJob)
+    return;
 
-      cnt++;
-      RKADK_MUXER_CheckWriteSpeed(pstMuxerHandle);
-      usleep(10000);
-  }
+  memcpy(pstJob->cFileName, pstMuxerHandle->cFileName, RKADK_MAX_FILE_PATH_LEN);
+  pstMuxerHandle->u32DirtyBytes = 0;
 
-  if (cnt % framerate != 0)
-    RKADK_LOGW("Stream[%d] get video cell fail, retry, cnt = %d", stData.u32ChnId, cnt);
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  RKADK_MUXER_FileJobPush(pstWorker, pstJob);
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+}
 
-  pstCell->buf = cell.buf;
-  pstCell->isKeyFrame = isKeyFrame;
-  pstCell->pts = pts;
-  pstCell->size = cell.size;
-  pstCell->bIsPool = true;
-  pstCell->pMbBlk = cell.pMbBlk;
-  pstCell->pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
-  RK_MPI_MB_AddUserCnt(stData.stFrame.pstPack->pMbBlk);
-  RKADK_MUXER_CellPush(pstMuxerHandle, &pstMuxerHandle->stProcList, pstCell);
-  RKADK_SIGNAL_Give(pstMuxerHandle->pSignal);
-  return 0;
+static void RKADK_MUXER_DiscardNext(MUXER_HANDLE_S *pstMuxerHandle) {
+  MUXER_FILE_WORKER_S *pstWorker = RKADK_MUXER_GetFileWorker(pstMuxerHandle);
+
+  if (!pstWorker)
+    return;
+
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  RKADK_MUXER_DiscardNextLocked(pstWorker, pstMuxerHandle);
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
 }
 
-int RKADK_MUXER_WriteAudioFrame(void *pMbBlk, RKADK_U32 size, int64_t pts,
-                                void *handle) {
-  int cnt = 0;
-  MUXER_HANDLE_S *pstMuxerHandle = NULL;
-  RKADK_MUXER_HANDLE_S *pstMuxer = NULL;
-  int headerSize = 0; // aenc header size
-  MUXER_BUF_CELL_S cell;
-  MUXER_BUF_CELL_S *pstCell;
+// the write thread never waits for the file worker, a file switch is put off
+// to a later key frame while the next file is opening or its bank is closing
+static bool RKADK_MUXER_NextReady(MUXER_HANDLE_S *pstMuxerHandle) {
+  bool bReady;
+  MUXER_FILE_WORKER_S *pstWorker = RKADK_MUXER_GetFileWorker(pstMuxerHandle);
 
-  RKADK_CHECK_POINTER(handle, RKADK_FAILURE);
+  if (!pstWorker)
+    return true;
 
-  pstMuxer = (RKADK_MUXER_HANDLE_S *)handle;
-  for (int i = 0; i < (int)pstMuxer->u32StreamCnt; i++) {
-    pstMuxerHandle = (MUXER_HANDLE_S *)pstMuxer->pMuxerHandle[i];
-    if (!pstMuxerHandle)
-      continue;
+  RKADK_MUTEX_LOCK(pstWorker->mutex);
+  bReady = pstMuxerHandle->enNextState == MUXER_NEXT_READY ||
+           (pstMuxerHandle->enNextState == MUXER_NEXT_NONE &&
+            !pstMuxerHandle->aBusyCnt[pstMuxerHandle->muxerIdx ^ 1]);
+  RKADK_MUTEX_UNLOCK(pstWorker->mutex);
 
-    if (pstMuxerHandle->bReseting)
-      continue;
+  if (!bReady)
+    __atomic_add_fetch(&pstMuxerHandle->stStats.u32SwitchWaitCnt, 1, __ATOMIC_RELAXED);
+  return bReady;
+}
 
-    if (!strcmp(pstMuxerHandle->stAudio.codec, "ACC"))
-      headerSize = 7; //ACC header size
+static int RKADK_MUXER_Open(MUXER_HANDLE_S *pstMuxerHandle, RKADK_U32 u32Duration) {
+  int ret = 0;
+  bool bFallback = false;
+  int muxerIdx = pstMuxerHandle->muxerIdx ^ 1;
+  MUXER_FILE_WORKER_S *pstWorker = RKADK_MUXER_GetFileWorker(pstMuxerHandle);
+
+  if (pstWorker) {
+    RKADK_MUTEX_LOCK(pstWorker->mutex);
+    // no file is open here, so the frames until a later key frame are dropped
+    if (pstMuxerHandle->enNextState == MUXER_NEXT_OPENING ||
+        pstMuxerHandle->aBusyCnt[muxerIdx] > 0) {
+      RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+      RKADK_LOGW("Stream[%d] muxer[%d] busy, retry at next key frame",
+                 pstMuxerHandle->u32VencChn, pstMuxerHandle->aMuxerId[muxerIdx]);
+      return -1;
+    }
 
-    cell.buf = (unsigned char *)RK_MPI_MB_Handle2VirAddr(pMbBlk) + headerSize;
-    if (NULL == cell.buf) {
-      RKADK_LOGE("Stream[%d]: RK_MPI_MB_Handle2VirAddr failed", pstMuxerHandle->u32VencChn);
+    if (pstMuxerHandle->enNextState == MUXER_NEXT_READY &&
+        pstMuxerHandle->u32NextParamGen != pstMuxerHandle->u32ParamGen) {
+      RKADK_LOGI("Stream[%d] av param changed, discard next file", pstMuxerHandle->u32VencChn);
+      RKADK_MUXER_DiscardNextLocked(pstWorker, pstMuxerHandle);
+      RKADK_MUTEX_UNLOCK(pstWorker->mutex);
       return -1;
     }
 
-    cell.size = size - headerSize;
-    cell.isKeyFrame = 0;
-    cell.pts = pts;
-    cell.bIsPool = true;
-    cell.pool = &pstMuxerHandle->stAFree;
-    cell.pMbBlk = pMbBlk;
-    cell.pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
-    RKADK_MUXER_PreRecPush(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stAList, &cell);
+    if (pstMuxerHandle->enNextState == MUXER_NEXT_READY) {
+      pstMuxerHandle->enNextState = MUXER_NEXT_NONE;
+      memcpy(pstMuxerHandle->cFileName, pstMuxerHandle->cNextFileName,
+             RKADK_MAX_FILE_PATH_LEN);
+      RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+
+      pstMuxerHandle->muxerIdx = muxerIdx;
+      pstMuxerHandle->muxerId = pstMuxerHandle->aMuxerId[muxerIdx];
+      RKADK_LOGI("Switch to pre-opened video file path:[%s]", pstMuxerHandle->cFileName);
+      RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_FILE_BEGIN, u32Duration);
+      return 0;
+    }
+    RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+  }
 
-    if (!pstMuxerHandle->bEnableStream)
-      continue;
+  ret = pstMuxerHandle->pcbRequestFileNames(pstMuxerHandle->ptr,
+                                            pstMuxerHandle->cFileName,
+                                            pstMuxerHandle->aMuxerId[0]);
+  if (ret) {
+    RKADK_LOGE("request file name failed");
+    return -1;
+  }
 
-    while ((pstCell = RKADK_MUXER_CellGet(pstMuxerHandle, &pstMuxerHandle->stAFree)) == NULL) {
-      if (cnt % 100 == 0) {
-        RKADK_LOGI("Stream[%d] get audio cell fail, retry, cnt = %d",pstMuxerHandle->u32VencChn, cnt);
-        if (cnt != 0)
-          RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_FILE_WRITING_SLOW, 0);
-      }
-      cnt++;
-      usleep(10000);
-    }
+  RKADK_LOGI("Ready to recod new video file path:[%s]",
+            pstMuxerHandle->cFileName);
+  RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_FILE_BEGIN, u32Duration);
 
-    pstCell->buf = cell.buf;
-    pstCell->size = cell.size;
-    pstCell->isKeyFrame = 0;
-    pstCell->pts = pts;
-    pstCell->bIsPool = true;
-    pstCell->pMbBlk = pMbBlk;
-    pstCell->pfnCellReleaseBuf = RKADK_MUXER_CellReleaseBuf;
-    RK_MPI_MB_AddUserCnt(pMbBlk);
-    RKADK_MUXER_CellPush(pstMuxerHandle, &pstMuxerHandle->stProcList, pstCell);
-    RKADK_SIGNAL_Give(pstMuxerHandle->pSignal);
+  RKADK_MUTEX_LOCK(pstMuxerHandle->paramMutex);
+  ret = RKADK_MUXER_InitFile(pstMuxerHandle, pstMuxerHandle->aMuxerId[muxerIdx],
+                             pstMuxerHandle->cFileName, &bFallback);
+  RKADK_MUTEX_UNLOCK(pstMuxerHandle->paramMutex);
+  if (bFallback)
+    RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_FMP4_FALLBACK, 0);
+  if (ret) {
+    RKADK_LOGE("rkmuxer_init[%d] failed[%d]", pstMuxerHandle->aMuxerId[muxerIdx], ret);
+    return -1;
   }
 
+  RKADK_MUXER_FileAllocate(pstMuxerHandle, pstMuxerHandle->cFileName, u32Duration);
+  pstMuxerHandle->muxerIdx = muxerIdx;
+  pstMuxerHandle->muxerId = pstMuxerHandle->aMuxerId[muxerIdx];
   return 0;
 }
 
 static void RKADK_MUXER_Close(MUXER_HANDLE_S *pstMuxerHandle) {
+  RKADK_MUXER_EVENT_E enEvent;
+  MUXER_FILE_JOB_S *pstJob = NULL;
+  MUXER_FILE_WORKER_S *pstWorker = RKADK_MUXER_GetFileWorker(pstMuxerHandle);
+
   if (!pstMuxerHandle->bMuxering)
     return;
 
-  // Stop muxer
-  rkmuxer_deinit(pstMuxerHandle->muxerId);
-
   if (pstMuxerHandle->realDuration <= 0) {
     pstMuxerHandle->realDuration =
       pstMuxerHandle->frameCnt * (1000 / pstMuxerHandle->stVideo.frame_rate_num);
@@ -560,16 +1665,33 @@ static void RKADK_MUXER_Close(MUXER_HANDLE_S *pstMuxerHandle) {
   }
 
   if (pstMuxerHandle->stManualSplit.bSplitRecord)
-    RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_MANUAL_SPLIT_END,
-                             pstMuxerHandle->realDuration);
+    enEvent = RKADK_MUXER_EVENT_MANUAL_SPLIT_END;
   else
-    RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_FILE_END,
-                             pstMuxerHandle->realDuration);
+    enEvent = RKADK_MUXER_EVENT_FILE_END;
+
+  // Stop muxer, the file is finalized on the file worker
+  if (pstWorker)
+    pstJob = RKADK_MUXER_FileJobCreate(pstMuxerHandle, MUXER_FILE_JOB_CLOSE,
+                                       pstMuxerHandle->muxerIdx);
+  if (pstJob) {
+    pstJob->enEvent = enEvent;
+    pstJob->realDuration = pstMuxerHandle->realDuration;
+    memcpy(pstJob->cFileName, pstMuxerHandle->cFileName, RKADK_MAX_FILE_PATH_LEN);
+
+    RKADK_MUTEX_LOCK(pstWorker->mutex);
+    RKADK_MUXER_FileJobPush(pstWorker, pstJob);
+    RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+  } else {
+    rkmuxer_deinit(pstMuxerHandle->muxerId);
+    RKADK_MUXER_ProcessEvent(pstMuxerHandle, enEvent, pstMuxerHandle->realDuration);
+  }
 
   // Reset muxer
   pstMuxerHandle->realDuration = 0;
   pstMuxerHandle->startTime = 0;
   pstMuxerHandle->frameCnt = 0;
+  pstMuxerHandle->u32FragmentCnt = 0;
+  pstMuxerHandle->u32DirtyBytes = 0;
   pstMuxerHandle->bMuxering = false;
   pstMuxerHandle->bFirstFile = false;
   pstMuxerHandle->bIOError = false;
@@ -581,57 +1703,48 @@ static void RKADK_MUXER_Close(MUXER_HANDLE_S *pstMuxerHandle) {
 
 static bool RKADK_MUXER_GetThumb(MUXER_HANDLE_S *pstMuxerHandle) {
   int ret;
-  bool bBuildInOk = false;
   int position = 0;
-  RKADK_CHAR *pData = NULL;
   VENC_PACK_S stPack;
   VENC_STREAM_S stFrame;
-  FILE *fp = NULL;
-  bool bGetThumb = false;
+  MUXER_FILE_JOB_S *pstJob = NULL;
+  MUXER_FILE_WORKER_S *pstWorker = RKADK_MUXER_GetFileWorker(pstMuxerHandle);
 
   stFrame.pstPack = &stPack;
 
   position = rkmuxer_get_thumb_pos(pstMuxerHandle->muxerId);
-  if (pstMuxerHandle->bIOError || position > 0)
-    bGetThumb = true;
-
-  if (bGetThumb) {
-    ret = RK_MPI_VENC_GetStream(pstMuxerHandle->u32ThumbVencChn, &stFrame, 1);
-    if (ret == RK_SUCCESS) {
-      pData = (RKADK_CHAR *)RK_MPI_MB_Handle2VirAddr(stFrame.pstPack->pMbBlk);
-      fp = fopen(pstMuxerHandle->cFileName, "r+");
-      if (!fp) {
-        RKADK_LOGE("Open %s file failed, errno = %d", pstMuxerHandle->cFileName, errno);
-        RK_MPI_VENC_ReleaseStream(pstMuxerHandle->u32ThumbVencChn, &stFrame);
-        return false;
-      }
+  if (!pstMuxerHandle->bIOError && position <= 0) {
+    RKADK_LOGI("Stream [%d] position[%d] invalid value!",pstMuxerHandle->u32VencChn, position);
+    return true;
+  }
 
-      if (!fseek(fp, position, SEEK_SET)) {
-        fwrite(pData, 1, stFrame.pstPack->u32Len, fp);
-        RKADK_LOGI("Stream [%d] thumbnail [seq: %d, len: %d] build in %s file position = %d done!",
-                    pstMuxerHandle->u32VencChn, stFrame.u32Seq, stFrame.pstPack->u32Len,
-                    pstMuxerHandle->cFileName, position);
-        bBuildInOk = false;
-      } else {
-        RKADK_LOGE("Seek failed");
-        bBuildInOk = true;
-      }
+  ret = RK_MPI_VENC_GetStream(pstMuxerHandle->u32ThumbVencChn, &stFrame, 1);
+  if (ret != RK_SUCCESS)
+    return true;
 
-      fclose(fp);
-      ret = RK_MPI_VENC_ReleaseStream(pstMuxerHandle->u32ThumbVencChn, &stFrame);
-      if (ret != RK_SUCCESS) {
-        RKADK_LOGE("RK_MPI_VENC_ReleaseStream fail %x", ret);
-      }
+  // the file is patched on the worker, keep the stream buffer until then
+  if (position > 0 && pstWorker)
+    pstJob = RKADK_MUXER_FileJobCreate(pstMuxerHandle, MUXER_FILE_JOB_THUMB,
+                                       pstMuxerHandle->muxerIdx);
+  if (pstJob) {
+    pstJob->pMbBlk = stFrame.pstPack->pMbBlk;
+    pstJob->u32Len = stFrame.pstPack->u32Len;
+    pstJob->u32Seq = stFrame.u32Seq;
+    pstJob->position = position;
+    strncpy(pstJob->cFileName, pstMuxerHandle->cFileName, RKADK_MAX_FILE_PATH_LEN - 1);
+    RK_MPI_MB_AddUserCnt(pstJob->pMbBlk);
+
+    RKADK_MUTEX_LOCK(pstWorker->mutex);
+    RKADK_MUXER_FileJobPush(pstWorker, pstJob);
+    RKADK_MUTEX_UNLOCK(pstWorker->mutex);
+  }
 
-      RK_MPI_VENC_ResetChn(pstMuxerHandle->u32ThumbVencChn);
-      return bBuildInOk;
-    } else {
-      return true;
-    }
-  } else {
-    RKADK_LOGI("Stream [%d] position[%d] invalid value!",pstMuxerHandle->u32VencChn, position);
-    return true;
+  ret = RK_MPI_VENC_ReleaseStream(pstMuxerHandle->u32ThumbVencChn, &stFrame);
+  if (ret != RK_SUCCESS) {
+    RKADK_LOGE("RK_MPI_VENC_ReleaseStream fail %x", ret);
   }
+
+  RK_MPI_VENC_ResetChn(pstMuxerHandle->u32ThumbVencChn);
+  return false;
 }
 
 static void RKADK_MUXER_RequestThumb(MUXER_HANDLE_S *pstMuxerHandle,
@@ -728,6 +1841,9 @@ static bool RKADK_MUXER_CheckEnd(MUXER_HANDLE_S *pstMuxerHandle,
     if(position <= 0)
       return false;
 
+    if (!RKADK_MUXER_NextReady(pstMuxerHandle))
+      return false;
+
     RKADK_LOGI("File switch: manual_split[%d], duration: %d",
         pstMuxerHandle->u32VencChn, pstMuxerHandle->realDuration);
     pstMuxerHandle->stManualSplit.bEnableSplit = false;
@@ -738,6 +1854,13 @@ static bool RKADK_MUXER_CheckEnd(MUXER_HANDLE_S *pstMuxerHandle,
 
   bFileSwitch = cell->pts - pstMuxerHandle->startTime >=
                 (u32Duration * 1000000 - 1000000 / pstMuxerHandle->stVideo.frame_rate_num);
+  if (bFileSwitch && !RKADK_MUXER_NextReady(pstMuxerHandle)) {
+    // keep appending to the current file until the next one is ready
+    RKADK_LOGW("Stream[%d] next file not ready, switch at a later key frame",
+               pstMuxerHandle->u32VencChn);
+    return false;
+  }
+
   if (bFileSwitch) {
     RKADK_LOGI("File switch: chn = %d, duration: %d, frameCnt = %d",
         pstMuxerHandle->u32VencChn, pstMuxerHandle->realDuration, pstMuxerHandle->frameCnt + 1);
@@ -749,17 +1872,17 @@ static bool RKADK_MUXER_CheckEnd(MUXER_HANDLE_S *pstMuxerHandle,
 }
 
 static int RKADK_MUXER_PreRecProc(MUXER_HANDLE_S *pstMuxerHandle) {
-  int size;
   int64_t s64FirstTime = 0, s64SeekTime = 0;
-  bool bPreRecord = false, bFindKeyFrame = false;
+  bool bPreRecord = false;
   MUXER_BUF_CELL_S *cell = NULL;
   RKADK_MUXER_PRE_RECORD_ATTR_S *pstAttr;
+  PRE_RECORD_RING_S *pstVRing = &pstMuxerHandle->stPreRecParam.stVRing;
+  PRE_RECORD_RING_S *pstARing = &pstMuxerHandle->stPreRecParam.stARing;
 
   if (pstMuxerHandle->bLapseRecord)
     return 0;
 
-  size = RKADK_MUXER_GetListSize(&pstMuxerHandle->stPreRecParam.stVList);
-  if (size < pstMuxerHandle->stVideo.frame_rate_num)
+  if (pstVRing->u32Cnt < (RKADK_U32)pstMuxerHandle->stVideo.frame_rate_num)
     return 0;
 
   pstAttr = &pstMuxerHandle->stPreRecParam.stAttr;
@@ -778,45 +1901,28 @@ static int RKADK_MUXER_PreRecProc(MUXER_HANDLE_S *pstMuxerHandle) {
     return 0;
 
   RKADK_MUTEX_LOCK(pstMuxerHandle->stPreRecParam.mutex);
-  RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stProcList);
-  while (!list_empty(&pstMuxerHandle->stPreRecParam.stVList)) {
-    cell = list_first_entry(&pstMuxerHandle->stPreRecParam.stVList, MUXER_BUF_CELL_S, mark);
-    if (!s64FirstTime)
-      s64FirstTime = cell->pts;
-
-    if (!bFindKeyFrame) {
-      if (cell->isKeyFrame) {
-        bFindKeyFrame = true;
-        s64SeekTime = cell->pts - s64FirstTime;
-      } else {
-        RKADK_MUXER_CellFree(pstMuxerHandle, cell);
-        continue;
-      }
-    }
-
-    list_del_init(&cell->mark);
-    list_add_tail(&cell->mark, &pstMuxerHandle->stProcList);
-  }
-
-  if (!bFindKeyFrame) {
+  if (!pstVRing->u32KeyCnt) {
     RKADK_LOGD("don't find KeyFrame, pre_record fialed");
     RKADK_MUTEX_UNLOCK(pstMuxerHandle->stPreRecParam.mutex);
     return 0;
   }
 
-  s64FirstTime = 0;
-  while (!list_empty(&pstMuxerHandle->stPreRecParam.stAList)) {
-    cell = list_first_entry(&pstMuxerHandle->stPreRecParam.stAList, MUXER_BUF_CELL_S, mark);
-    if (!s64FirstTime)
-      s64FirstTime = cell->pts;
-
-    if ((cell->pts - s64FirstTime) < s64SeekTime) {
-      RKADK_MUXER_CellFree(pstMuxerHandle, cell);
-      continue;
-    }
-
-    list_del_init(&cell->mark);
-    list_add_tail(&cell->mark, &pstMuxerHandle->stProcList);
+  RKADK_MUXER_ProcRelease(pstMuxerHandle);
+
+  // start from the oldest cached GOP
+  s64FirstTime = pstVRing->pstCell[pstVRing->u32Head].pts;
+  cell = &pstVRing->pstCell[pstVRing->pu32KeyIdx[pstVRing->u32KeyHead]];
+  s64SeekTime = cell->pts - s64FirstTime;
+  while (pstVRing->u32Head != pstVRing->pu32KeyIdx[pstVRing->u32KeyHead])
+    RKADK_MUXER_PreRecEvict(pstVRing, true);
+  RKADK_MUXER_PreRecDrain(pstMuxerHandle, pstVRing);
+
+  if (pstARing->u32Cnt) {
+    s64FirstTime = pstARing->pstCell[pstARing->u32Head].pts;
+    while (pstARing->u32Cnt &&
+           (pstARing->pstCell[pstARing->u32Head].pts - s64FirstTime) < s64SeekTime)
+      RKADK_MUXER_PreRecEvict(pstARing, true);
+    RKADK_MUXER_PreRecDrain(pstMuxerHandle, pstARing);
   }
 
   RKADK_MUTEX_UNLOCK(pstMuxerHandle->stPreRecParam.mutex);
@@ -826,6 +1932,7 @@ static int RKADK_MUXER_PreRecProc(MUXER_HANDLE_S *pstMuxerHandle) {
 static bool RKADK_MUXER_Proc(void *params) {
   int ret = 0;
   RKADK_U32 u32Duration;
+  RKADK_U64 u64StartUs, u64EndUs;
   MUXER_BUF_CELL_S *cell = NULL;
 
   if (!params) {
@@ -836,7 +1943,7 @@ static bool RKADK_MUXER_Proc(void *params) {
   MUXER_HANDLE_S *pstMuxerHandle = (MUXER_HANDLE_S *)params;
   RKADK_SIGNAL_Wait(pstMuxerHandle->pSignal, pstMuxerHandle->duration * 1000);
 
-  cell = RKADK_MUXER_CellPop(pstMuxerHandle, &pstMuxerHandle->stProcList);
+  cell = RKADK_MUXER_CellPop(pstMuxerHandle);
   while (cell) {
     // Create muxer
     if (pstMuxerHandle->bEnableStream) {
@@ -846,46 +1953,28 @@ static bool RKADK_MUXER_Proc(void *params) {
         u32Duration = pstMuxerHandle->duration;
 
       if (!pstMuxerHandle->bMuxering && cell->isKeyFrame) {
-        ret = pstMuxerHandle->pcbRequestFileNames(pstMuxerHandle->ptr,
-                                                  pstMuxerHandle->cFileName,
-                                                  pstMuxerHandle->muxerId);
-        if (ret) {
-          RKADK_LOGE("request file name failed");
-        } else {
-          RKADK_LOGI("Ready to recod new video file path:[%s]",
-                    pstMuxerHandle->cFileName);
-          RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_FILE_BEGIN, u32Duration);
-
-          RKADK_MUTEX_LOCK(pstMuxerHandle->paramMutex);
-          ret = rkmuxer_init(pstMuxerHandle->muxerId,
-                            (char *)pstMuxerHandle->cOutputFmt,
-                            pstMuxerHandle->cFileName, &pstMuxerHandle->stVideo,
-                            &pstMuxerHandle->stAudio);
-          RKADK_MUTEX_UNLOCK(pstMuxerHandle->paramMutex);
-          if (ret) {
-            RKADK_LOGE("rkmuxer_init[%d] failed[%d]", pstMuxerHandle->muxerId, ret);
-          } else {
-            if (RKADK_MUXER_PreRecProc(pstMuxerHandle)) {
-              MUXER_BUF_CELL_S *firstCell = RKADK_MUXER_CellPop(pstMuxerHandle, &pstMuxerHandle->stProcList);
-              if (firstCell) {
-                RKADK_MUXER_CellFree(pstMuxerHandle, cell);
-                cell = firstCell;
-              } else {
-                RKADK_LOGE("pre_record proc ok, but cell pop fialed");
-                RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stProcList);
-              }
+        ret = RKADK_MUXER_Open(pstMuxerHandle, u32Duration);
+        if (!ret) {
+          if (RKADK_MUXER_PreRecProc(pstMuxerHandle)) {
+            MUXER_BUF_CELL_S *firstCell = RKADK_MUXER_CellPop(pstMuxerHandle);
+            if (firstCell) {
+              RKADK_MUXER_CellFree(pstMuxerHandle, cell);
+              cell = firstCell;
+            } else {
+              RKADK_LOGE("pre_record proc ok, but cell pop fialed");
+              RKADK_MUXER_ProcRelease(pstMuxerHandle);
             }
-
-            pstMuxerHandle->bMuxering = true;
-            pstMuxerHandle->startTime = cell->pts;
-            pstMuxerHandle->stThumbParam.bGetThumb = true;
-            pstMuxerHandle->stThumbParam.bRequestThumb = true;
           }
+
+          pstMuxerHandle->bMuxering = true;
+          pstMuxerHandle->startTime = cell->pts;
+          pstMuxerHandle->stThumbParam.bGetThumb = true;
+          pstMuxerHandle->stThumbParam.bRequestThumb = true;
         }
       } else if (!pstMuxerHandle->bMuxering) {
-        if(cell->pool == &pstMuxerHandle->stVFree) {
+        if(cell->pool == pstMuxerHandle->pVFree) {
           RKADK_LOGI("Stream [%d] request idr!", pstMuxerHandle->u32VencChn);
-          RK_MPI_VENC_RequestIDR(pstMuxerHandle->u32VencChn, RK_FALSE);
+          RKADK_MUXER_RequestIDR(pstMuxerHandle);
         }
       }
 
@@ -895,9 +1984,12 @@ static bool RKADK_MUXER_Proc(void *params) {
           continue;
 
         // Write
-        if (cell->pool == &pstMuxerHandle->stVFree) {
+        if (cell->pool == pstMuxerHandle->pVFree) {
+          u64StartUs = RKADK_MUXER_GetUs();
           ret = rkmuxer_write_video_frame(pstMuxerHandle->muxerId, cell->buf,
                                     cell->size, cell->pts, cell->isKeyFrame);
+          u64EndUs = RKADK_MUXER_GetUs();
+          RKADK_MUXER_LatencyAdd(&pstMuxerHandle->stStats.stVideoWrite, u64EndUs - u64StartUs);
            if (ret) {
               RKADK_LOGE("Muxer[%d] write video frame failed", pstMuxerHandle->muxerId);
               RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_ERR_WRITE_FILE_FAIL, 0);
@@ -911,24 +2003,36 @@ static bool RKADK_MUXER_Proc(void *params) {
             pstMuxerHandle->bWriteFirstFrame = false;
           }
 
+          RKADK_MUXER_RateAdd(pstMuxerHandle, cell->size, u64EndUs);
+          RKADK_MUXER_Writeback(pstMuxerHandle, cell->size);
+
           if (cell->pts < pstMuxerHandle->startTime)
             RKADK_LOGE("Stream [%d] muxer pts err pts = %lld, startTime = %lld",
                         pstMuxerHandle->u32VencChn, cell->pts, pstMuxerHandle->startTime);
           pstMuxerHandle->realDuration = (cell->pts - pstMuxerHandle->startTime) / 1000;
           pstMuxerHandle->frameCnt++;
+          RKADK_MUXER_SyncFragment(pstMuxerHandle, cell);
           RKADK_MUXER_RequestThumb(pstMuxerHandle, cell);
 
           if (pstMuxerHandle->stThumbParam.bGetThumb && pstMuxerHandle->realDuration >= 5000)
             pstMuxerHandle->stThumbParam.bGetThumb = RKADK_MUXER_GetThumb(pstMuxerHandle);
-        } else if (cell->pool == &pstMuxerHandle->stAFree) {
+
+          RKADK_MUXER_PreOpen(pstMuxerHandle, u32Duration);
+        } else if (cell->pool == pstMuxerHandle->pAFree) {
+          u64StartUs = RKADK_MUXER_GetUs();
           ret = rkmuxer_write_audio_frame(pstMuxerHandle->muxerId, cell->buf,
                                     cell->size, cell->pts);
+          u64EndUs = RKADK_MUXER_GetUs();
+          RKADK_MUXER_LatencyAdd(&pstMuxerHandle->stStats.stAudioWrite, u64EndUs - u64StartUs);
           if (ret) {
             RKADK_LOGE("Muxer[%d] write audio frame failed", pstMuxerHandle->muxerId);
             RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_ERR_WRITE_FILE_FAIL, 0);
             pstMuxerHandle->bIOError = true;
             continue;
           }
+
+          RKADK_MUXER_RateAdd(pstMuxerHandle, cell->size, u64EndUs);
+          RKADK_MUXER_Writeback(pstMuxerHandle, cell->size);
         } else {
           RKADK_LOGE("unknow pool");
         }
@@ -937,12 +2041,14 @@ static bool RKADK_MUXER_Proc(void *params) {
 
     // free and next
     RKADK_MUXER_CellFree(pstMuxerHandle, cell);
-    cell = RKADK_MUXER_CellPop(pstMuxerHandle, &pstMuxerHandle->stProcList);
+    cell = RKADK_MUXER_CellPop(pstMuxerHandle);
   }
 
   // Check exit
-  if (!pstMuxerHandle->bEnableStream)
+  if (!pstMuxerHandle->bEnableStream) {
     RKADK_MUXER_Close(pstMuxerHandle);
+    RKADK_MUXER_DiscardNext(pstMuxerHandle);
+  }
 
   return pstMuxerHandle->bEnableStream;
 }
@@ -960,6 +2066,7 @@ static RKADK_S32 RKADK_MUXER_SetAVParam(MUXER_HANDLE_S *pMuxerHandle,
   }
 
   RKADK_MUTEX_LOCK(pMuxerHandle->paramMutex);
+  pMuxerHandle->u32ParamGen++;
   for (i = 0; i < (int)pstSrcStreamAttr->u32TrackCnt; i++) {
     pstTrackSource = &(pstSrcStreamAttr->aHTrackSrcHandle[i]);
     if (pstTrackSource->enTrackType == RKADK_TRACK_SOURCE_TYPE_VIDEO) {
@@ -975,6 +2082,7 @@ static RKADK_S32 RKADK_MUXER_SetAVParam(MUXER_HANDLE_S *pMuxerHandle,
       pMuxerHandle->stVideo.profile = pstVideoInfo->u16Profile;
       pMuxerHandle->stVideo.level = pstVideoInfo->u16Level;
 
+      pMuxerHandle->enCodecType = pstVideoInfo->enCodecType;
       switch (pstVideoInfo->enCodecType) {
       case RKADK_CODEC_TYPE_H264:
         memcpy(pMuxerHandle->stVideo.codec, "H.264", strlen("H.264"));
@@ -1007,6 +2115,7 @@ static RKADK_S32 RKADK_MUXER_SetAVParam(MUXER_HANDLE_S *pMuxerHandle,
       pMuxerHandle->stAudio.channels = pstAudioInfo->u32ChnCnt;
       pMuxerHandle->stAudio.frame_size = pstAudioInfo->u32SamplesPerFrame;
       pMuxerHandle->stAudio.sample_rate = pstAudioInfo->u32SampleRate;
+      pMuxerHandle->u32AudioBitRate = pstAudioInfo->u32Bitrate;
 
       switch (pstAudioInfo->u32BitWidth) {
       case 16:
@@ -1033,6 +2142,11 @@ static RKADK_S32 RKADK_MUXER_SetAVParam(MUXER_HANDLE_S *pMuxerHandle,
         ret = -1;
         goto exit;
       }
+
+      if (!strcmp(pMuxerHandle->stAudio.codec, "ACC"))
+        pMuxerHandle->u32AudioHeaderSize = 7; //ACC header size
+      else
+        pMuxerHandle->u32AudioHeaderSize = 0;
     }
   }
 
@@ -1041,6 +2155,18 @@ exit:
   return ret;
 }
 
+static RKADK_U32 RKADK_MUXER_WriteBlockSize(RKADK_U32 u32Size) {
+  RKADK_U32 u32Block = RKADK_MUXER_WRITE_BLOCK_MIN;
+
+  if (!u32Size)
+    return RKADK_MUXER_WRITE_BLOCK_SIZE;
+
+  while (u32Block < RKADK_MUXER_WRITE_BLOCK_MAX && u32Block * 2 <= u32Size)
+    u32Block *= 2;
+
+  return u32Block;
+}
+
 RKADK_S32 RKADK_MUXER_Enable(RKADK_MUXER_ATTR_S *pstMuxerAttr,
                                     RKADK_MW_PTR pHandle) {
   int i, ret;
@@ -1063,6 +2189,11 @@ RKADK_S32 RKADK_MUXER_Enable(RKADK_MUXER_ATTR_S *pstMuxerAttr,
     return -1;
   }
 
+  if (RKADK_MUXER_FileWorkerCreate(pstMuxer)) {
+    RKADK_LOGE("Create file worker failed");
+    return -1;
+  }
+
   for (i = 0; i < (int)pstMuxerAttr->u32StreamCnt; i++) {
     pMuxerHandle = (MUXER_HANDLE_S *)malloc(sizeof(MUXER_HANDLE_S));
     if (!pMuxerHandle) {
@@ -1074,6 +2205,10 @@ RKADK_S32 RKADK_MUXER_Enable(RKADK_MUXER_ATTR_S *pstMuxerAttr,
     pMuxerHandle->u32CamId = pstMuxerAttr->u32CamId;
     pMuxerHandle->muxerId =
         i + (pstMuxerAttr->u32CamId * RKADK_MUXER_STREAM_MAX_CNT);
+    for (int j = 0; j < RKADK_MUXER_ID_BANK_CNT; j++)
+      pMuxerHandle->aMuxerId[j] = pMuxerHandle->muxerId + j * RKADK_MUXER_ID_BANK_SIZE;
+    // the first file opens on bank 0
+    pMuxerHandle->muxerIdx = RKADK_MUXER_ID_BANK_CNT - 1;
     pMuxerHandle->pcbRequestFileNames = pstMuxerAttr->pcbRequestFileNames;
     pMuxerHandle->pfnEventCallback = pstMuxerAttr->pfnEventCallback;
     pMuxerHandle->bLapseRecord = pstMuxer->bLapseRecord;
@@ -1109,6 +2244,17 @@ RKADK_S32 RKADK_MUXER_Enable(RKADK_MUXER_ATTR_S *pstMuxerAttr,
     case RKADK_MUXER_TYPE_FLV:
       pMuxerHandle->cOutputFmt = "flv";
       break;
+    case RKADK_MUXER_TYPE_FMP4:
+      // the ism flavour of the mp4 muxer writes an empty moov and a moof/mdat
+      // fragment per key frame, so the file stays playable up to the last fragment.
+      // The shipped rkmuxer has none, RKADK_MUXER_InitFile falls back to mp4
+      pMuxerHandle->cOutputFmt = "ismv";
+      pMuxerHandle->u32FragmentGop = pstSrcStreamAttr->u32FragmentGop;
+      if (!pMuxerHandle->u32FragmentGop)
+        pMuxerHandle->u32FragmentGop = RKADK_MUXER_FRAGMENT_GOP_CNT;
+      else if (pMuxerHandle->u32FragmentGop > RKADK_MUXER_FRAGMENT_GOP_MAX)
+        pMuxerHandle->u32FragmentGop = RKADK_MUXER_FRAGMENT_GOP_MAX;
+      break;
     default:
       RKADK_LOGE("not support type: %d", pstSrcStreamAttr->enType);
       free(pMuxerHandle);
@@ -1118,33 +2264,41 @@ RKADK_S32 RKADK_MUXER_Enable(RKADK_MUXER_ATTR_S *pstMuxerAttr,
     pMuxerHandle->u32ViChn = pstSrcStreamAttr->u32ViChn;
     pMuxerHandle->u32VencChn = pstSrcStreamAttr->u32VencChn;
     pMuxerHandle->bUseVpss = pstSrcStreamAttr->bUseVpss;
+    pMuxerHandle->enBackpressure = pstSrcStreamAttr->enBackpressure;
+    pMuxerHandle->bPreAllocate = pstMuxerAttr->stIoAttr.bPreAllocate;
+    pMuxerHandle->u32WriteBlock = RKADK_MUXER_WriteBlockSize(pstMuxerAttr->stIoAttr.u32WriteBlockSize);
     if (RKADK_MUXER_SetAVParam(pMuxerHandle, pstSrcStreamAttr)) {
       RKADK_LOGE("RKADK_MUXER_SetAVParam failed");
       free(pMuxerHandle);
       return -1;
     }
 
-    ret = pthread_mutex_init(&pMuxerHandle->mutex, NULL);
+    ret = pthread_mutex_init(&pMuxerHandle->paramMutex, NULL);
     if (ret) {
-      RKADK_LOGE("handle mutex init failed[%d]", ret);
+      RKADK_LOGE("param mutex init failed[%d]", ret);
       free(pMuxerHandle);
       return -1;
     }
 
-    ret = pthread_mutex_init(&pMuxerHandle->paramMutex, NULL);
+    ret = pthread_mutex_init(&pMuxerHandle->waitMutex, NULL);
     if (ret) {
-      RKADK_LOGE("param mutex init failed[%d]", ret);
+      RKADK_LOGE("wait mutex init failed[%d]", ret);
       free(pMuxerHandle);
       return -1;
     }
+    pthread_cond_init(&pMuxerHandle->waitCond, NULL);
 
     // Init List
-    RKADK_MUXER_ListInit(pMuxerHandle);
+    if (RKADK_MUXER_ListInit(pMuxerHandle, pstMuxerAttr)) {
+      free(pMuxerHandle);
+      return -1;
+    }
 
     // Create signal
     pMuxerHandle->pSignal = RKADK_SIGNAL_Create(0, 1);
     if (!pMuxerHandle->pSignal) {
       RKADK_LOGE("RKADK_SIGNAL_Create failed");
+      RKADK_MUXER_ListDeinit(pMuxerHandle);
       free(pMuxerHandle);
       return -1;
     }
@@ -1155,10 +2309,13 @@ RKADK_S32 RKADK_MUXER_Enable(RKADK_MUXER_ATTR_S *pstMuxerAttr,
     if (!pMuxerHandle->pThread) {
       RKADK_LOGE("RKADK_THREAD_Create failed");
       RKADK_SIGNAL_Destroy(pMuxerHandle->pSignal);
+      RKADK_MUXER_ListDeinit(pMuxerHandle);
       free(pMuxerHandle);
       return -1;
     }
     pstMuxer->pMuxerHandle[i] = (RKADK_MW_PTR)pMuxerHandle;
+    if (pMuxerHandle->u32VencChn < VENC_MAX_CHN_NUM)
+      ((MUXER_PRIV_HANDLE_S *)pstMuxer)->pChnHandle[pMuxerHandle->u32VencChn] = pMuxerHandle;
   }
 
   RKADK_LOGI("Enable Muxer[%d] Stop...", pstMuxer->u32CamId);
@@ -1179,12 +2336,12 @@ RKADK_S32 RKADK_MUXER_Create(RKADK_MUXER_ATTR_S *pstMuxerAttr,
     return -1;
   }
 
-  pstMuxer = (RKADK_MUXER_HANDLE_S *)malloc(sizeof(RKADK_MUXER_HANDLE_S));
+  pstMuxer = (RKADK_MUXER_HANDLE_S *)malloc(sizeof(MUXER_PRIV_HANDLE_S));
   if (!pstMuxer) {
     RKADK_LOGE("malloc pstMuxer failed");
     return -1;
   }
-  memset(pstMuxer, 0, sizeof(RKADK_MUXER_HANDLE_S));
+  memset(pstMuxer, 0, sizeof(MUXER_PRIV_HANDLE_S));
 
   pstMuxer->u32CamId = pstMuxerAttr->u32CamId;
   pstMuxer->u32StreamCnt = pstMuxerAttr->u32StreamCnt;
@@ -1216,6 +2373,7 @@ RKADK_S32 RKADK_MUXER_Disable(RKADK_MW_PTR pHandle) {
 
     // Set flag off
     pstMuxerHandle->bEnableStream = false;
+    RKADK_MUXER_WakeProducer(pstMuxerHandle, true);
 
     // exit thread
     RKADK_THREAD_SetExit(pstMuxerHandle->pThread);
@@ -1225,21 +2383,26 @@ RKADK_S32 RKADK_MUXER_Disable(RKADK_MW_PTR pHandle) {
     // Destroy thread
     RKADK_THREAD_Destory(pstMuxerHandle->pThread);
     pstMuxerHandle->pThread = NULL;
+    RKADK_MUXER_DiscardNext(pstMuxerHandle);
 
     // Destroy signal
     RKADK_SIGNAL_Destroy(pstMuxerHandle->pSignal);
 
     // Release list
-    RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stProcList);
-    RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stAList);
-    RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stVList);
+    RKADK_MUXER_ProcRelease(pstMuxerHandle);
+    RKADK_MUXER_PreRecRelease(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stARing);
+    RKADK_MUXER_PreRecRelease(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stVRing);
+    RKADK_MUXER_ListDeinit(pstMuxerHandle);
 
     // Destory mutex
-    pthread_mutex_destroy(&pstMuxerHandle->mutex);
     pthread_mutex_destroy(&pstMuxerHandle->paramMutex);
     pthread_mutex_destroy(&pstMuxerHandle->stPreRecParam.mutex);
+    pthread_mutex_destroy(&pstMuxerHandle->waitMutex);
+    pthread_cond_destroy(&pstMuxerHandle->waitCond);
   }
 
+  RKADK_MUXER_FileWorkerDestroy(pstMuxer);
+
   RKADK_LOGI("Disable Muxer[%d] Stop...", pstMuxer->u32CamId);
   return 0;
 }
@@ -1268,6 +2431,9 @@ RKADK_S32 RKADK_MUXER_Destroy(RKADK_MW_PTR pHandle) {
       pstMuxerHandle->stVideo.thumb.data = NULL;
     }
 
+    if (pstMuxerHandle->u32VencChn < VENC_MAX_CHN_NUM)
+      ((MUXER_PRIV_HANDLE_S *)pstMuxer)->pChnHandle[pstMuxerHandle->u32VencChn] = NULL;
+
     free(pstMuxer->pMuxerHandle[i]);
     pstMuxer->pMuxerHandle[i] = NULL;
   }
@@ -1298,8 +2464,9 @@ RKADK_S32 RKADK_MUXER_Start(RKADK_MW_PTR pHandle) {
       continue;
     }
 
-    RK_MPI_VENC_RequestIDR(pstMuxerHandle->u32VencChn, RK_FALSE);
+    RKADK_MUXER_RequestIDR(pstMuxerHandle);
     RKADK_MUXER_ForceRequestThumb(pstMuxerHandle);
+    pstMuxerHandle->bWaitIDR = false;
     pstMuxerHandle->bEnableStream = true;
     pstMuxerHandle->bFirstFile = true;
     RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_STREAM_START, 0);
@@ -1327,6 +2494,7 @@ RKADK_S32 RKADK_MUXER_Stop(RKADK_MW_PTR pHandle) {
     pstMuxerHandle->bEnableStream = false;
     pstMuxerHandle->stManualSplit.bEnableSplit = false;
     pstMuxerHandle->stManualSplit.bSplitRecord = false;
+    RKADK_MUXER_WakeProducer(pstMuxerHandle, true);
     RKADK_MUXER_ProcessEvent(pstMuxerHandle, RKADK_MUXER_EVENT_STREAM_STOP, 0);
     RKADK_SIGNAL_Give(pstMuxerHandle->pSignal);
   }
@@ -1371,7 +2539,7 @@ RKADK_MUXER_ManualSplit(RKADK_MW_PTR pHandle,
       pstMuxerHandle->stPreRecParam.stAttr.enPreRecordMode = RKADK_MUXER_PRE_RECORD_MANUAL_SPLIT;
 
     pstMuxerHandle->stManualSplit.bEnableSplit = true;
-    RK_MPI_VENC_RequestIDR(pstMuxerHandle->u32VencChn, RK_FALSE);
+    RKADK_MUXER_RequestIDR(pstMuxerHandle);
     RKADK_MUXER_ForceRequestThumb(pstMuxerHandle);
     pstMuxerHandle->stManualSplit.u32SplitDurationSec = pstSplitAttr->u32DurationSec;
   }
@@ -1439,6 +2607,7 @@ RKADK_S32 RKADK_MUXER_ResetParam(RKADK_U32 chnId, RKADK_MW_PTR pHandle,
 
   pstMuxerHandle->bLapseRecord = pstMuxerAttr->bLapseRecord;
   pstMuxerHandle->duration = pstMuxerAttr->astStreamAttr[index].u32TimeLenSec;
+  pstMuxerHandle->enBackpressure = pstMuxerAttr->astStreamAttr[index].enBackpressure;
   if (pstMuxerHandle->bLapseRecord)
     memset(&pstMuxerHandle->stAudio, 0, sizeof(AudioParam));
 
@@ -1477,6 +2646,11 @@ RKADK_S32 RKADK_MUXER_Reset(RKADK_MW_PTR pHandle, RKADK_U32 chnId) {
   RKADK_THREAD_Destory(pstMuxerHandle->pThread);
   pstMuxerHandle->pThread = NULL;
 
+  // Release list, the muxer thread is the only ring consumer
+  RKADK_MUXER_ProcRelease(pstMuxerHandle);
+  RKADK_MUXER_PreRecRelease(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stARing);
+  RKADK_MUXER_PreRecRelease(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stVRing);
+
   snprintf(name, sizeof(name), "Muxer_%d", pstMuxerHandle->u32VencChn);
   pstMuxerHandle->pThread = RKADK_THREAD_Create(RKADK_MUXER_Proc, pstMuxerHandle, name);
   if (!pstMuxerHandle->pThread) {
@@ -1484,11 +2658,6 @@ RKADK_S32 RKADK_MUXER_Reset(RKADK_MW_PTR pHandle, RKADK_U32 chnId) {
     return -1;
   }
 
-  // Release list
-  RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stProcList);
-  RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stAList);
-  RKADK_MUXER_ListRelease(pstMuxerHandle, &pstMuxerHandle->stPreRecParam.stVList);
-
   RKADK_LOGI("Reset Muxer[%d] End...", chnId);
   return 0;
 }
@@ -1510,6 +2679,8 @@ void RKADK_MUXER_SetResetState(RKADK_MW_PTR pHandle, bool state) {
     }
 
     pstMuxerHandle->bReseting = state;
+    if (state)
+      RKADK_MUXER_WakeProducer(pstMuxerHandle, true);
   }
 }
 
@@ -1572,4 +2743,86 @@ RKADK_S32 RKADK_MUXER_UpdateRes(RKADK_MW_PTR pHandle, RKADK_U32 chnId,
   pstMuxerHandle->stVideo.height = u32Hieght;
   RKADK_MUTEX_UNLOCK(pstMuxerHandle->paramMutex);
   return 0;
-}
\ No newline at end of file
+}
+RKADK_S32 RKADK_MUXER_GetDropStats(RKADK_MW_PTR pHandle, RKADK_U32 u32VencChn,
+                                   RKADK_MUXER_DROP_STATS_S *pstStats) {
+  MUXER_HANDLE_S *pstMuxerHandle = NULL;
+  RKADK_MUXER_HANDLE_S *pstRecorder = NULL;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstStats, RKADK_FAILURE);
+
+  pstRecorder = (RKADK_MUXER_HANDLE_S *)pHandle;
+  pstMuxerHandle = RKADK_MUXER_FindHandle(pstRecorder, u32VencChn);
+  if (!pstMuxerHandle) {
+    RKADK_LOGD("Muxer Handle is NULL");
+    return -1;
+  }
+
+  memcpy(pstStats, &pstMuxerHandle->stDropStats, sizeof(RKADK_MUXER_DROP_STATS_S));
+  return 0;
+}
+
+RKADK_S32 RKADK_MUXER_GetStats(RKADK_MW_PTR pHandle, RKADK_U32 u32VencChn,
+                               RKADK_MUXER_STATS_S *pstStats) {
+  MUXER_HANDLE_S *pstMuxerHandle = NULL;
+  RKADK_MUXER_HANDLE_S *pstRecorder = NULL;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstStats, RKADK_FAILURE);
+
+  pstRecorder = (RKADK_MUXER_HANDLE_S *)pHandle;
+  pstMuxerHandle = RKADK_MUXER_FindHandle(pstRecorder, u32VencChn);
+  if (!pstMuxerHandle) {
+    RKADK_LOGD("Muxer Handle is NULL");
+    return -1;
+  }
+
+  // counters are updated without a lock, a snapshot may be slightly skewed
+  memcpy(pstStats, &pstMuxerHandle->stStats, sizeof(RKADK_MUXER_STATS_S));
+  memcpy(&pstStats->stDropStats, &pstMuxerHandle->stDropStats,
+         sizeof(RKADK_MUXER_DROP_STATS_S));
+  pstStats->u32VideoQueueDepth = pstMuxerHandle->u32VCellCnt;
+  pstStats->u32AudioQueueDepth = pstMuxerHandle->u32ACellCnt;
+  return 0;
+}
+
+RKADK_U32 RKADK_MUXER_LatencyPercentile(const RKADK_MUXER_LATENCY_HIST_S *pstHist,
+                                        RKADK_DOUBLE dPercent) {
+  RKADK_U64 u64Rank, u64Sum = 0, u64Top;
+  RKADK_U32 u32Cnt = 0;
+  RKADK_DOUBLE dRank;
+
+  RKADK_CHECK_POINTER(pstHist, 0);
+
+  // the bucket sum, u32Cnt of a snapshot may be a sample ahead
+  for (int i = 0; i < RKADK_MUXER_LATENCY_BUCKET_CNT; i++)
+    u32Cnt += pstHist->au32Bucket[i];
+  if (!u32Cnt)
+    return 0;
+
+  if (dPercent < 0)
+    dPercent = 0;
+  else if (dPercent > 100)
+    dPercent = 100;
+
+  // the sample at the rank, counted from 1
+  dRank = u32Cnt * dPercent / 100;
+  u64Rank = (RKADK_U64)dRank;
+  if (u64Rank < dRank || !u64Rank)
+    u64Rank++;
+
+  for (int i = 0; i < RKADK_MUXER_LATENCY_BUCKET_CNT; i++) {
+    u64Sum += pstHist->au32Bucket[i];
+    if (u64Sum < u64Rank)
+      continue;
+
+    if (i == RKADK_MUXER_LATENCY_BUCKET_CNT - 1)
+      break;
+
+    u64Top = RKADK_MUXER_LatencyBucketTop(i);
+    return u64Top < pstHist->u32MaxUs ? (RKADK_U32)u64Top : pstHist->u32MaxUs;
+  }
+
+  return pstHist->u32MaxUs;
+}
@@ -373,6 +373,10 @@ static void RKADK_PARAM_CheckCommCfg(char *path) {
                                     "speaker_volume");
   change |= RKADK_PARAM_CheckCfgU32(&pstCommCfg->mic_volume, 0, 100, 70,
                                     "mic_volume");
+  change |= RKADK_PARAM_CheckCfgU32(&pstCommCfg->gop_cache_size,
+                                    RKADK_MEDIA_GOP_CACHE_SIZE_MIN,
+                                    RKADK_MEDIA_GOP_CACHE_SIZE_MAX,
+                                    RKADK_MEDIA_GOP_CACHE_SIZE, "gop_cache_size");
 
   if (change)
     RKADK_PARAM_SaveCommCfg(path);
@@ -409,6 +413,16 @@ static void RKADK_PARAM_CheckAudioCfg(char *path) {
   change |= RKADK_PARAM_CheckCfgU32((RKADK_U32 *)&pstAudioCfg->codec_type,
                                     RKADK_CODEC_TYPE_G711A, RKADK_CODEC_TYPE_PCM,
                                     RKADK_CODEC_TYPE_MP3, "codec_type");
+  if (pstAudioCfg->live_codec_type != RKADK_CODEC_TYPE_G711A
+      && pstAudioCfg->live_codec_type != RKADK_CODEC_TYPE_G711U
+      && pstAudioCfg->live_codec_type != RKADK_CODEC_TYPE_ACC) {
+    RKADK_LOGW("live_codec_type: invalid value(%d), use default(%d)",
+               pstAudioCfg->live_codec_type, RKADK_CODEC_TYPE_G711A);
+    pstAudioCfg->live_codec_type = RKADK_CODEC_TYPE_G711A;
+    change = true;
+  }
+  change |= RKADK_PARAM_CheckCfg(&pstAudioCfg->live_bitrate, LIVE_AUDIO_BIT_REAT,
+                                 "live_bitrate");
 
   if (change)
     RKADK_PARAM_SaveAudioCfg(path);
@@ -531,9 +545,13 @@ static void RKADK_PARAM_CheckRecCfg(char *path, RKADK_U32 u32CamId) {
                                    RKADK_REC_TYPE_NORMAL, "record_type");
 
   change |= RKADK_PARAM_CheckCfgU32((RKADK_U32 *)&pstRecCfg->file_type,
-                                    RKADK_MUXER_TYPE_MP4, RKADK_MUXER_TYPE_FLV,
+                                    RKADK_MUXER_TYPE_MP4, RKADK_MUXER_TYPE_FMP4,
                                     RKADK_MUXER_TYPE_MP4, "file_type");
 
+  change |= RKADK_PARAM_CheckCfgU32(&pstRecCfg->fragment_gop, 1,
+                                    RKADK_MUXER_FRAGMENT_GOP_MAX,
+                                    RKADK_MUXER_FRAGMENT_GOP_CNT, "fragment_gop");
+
   change |= RKADK_PARAM_CheckCfgU32(
       (RKADK_U32 *)&pstRecCfg->pre_record_mode, RKADK_MUXER_PRE_RECORD_NONE,
       RKADK_MUXER_PRE_RECORD_SINGLE, RKADK_MUXER_PRE_RECORD_NONE,
@@ -779,6 +797,7 @@ static void RKADK_PARAM_DefCommCfg(char *path) {
   pstCommCfg->speaker_volume = 70;
   pstCommCfg->mic_volume = 70;
   pstCommCfg->vpss_devcie = 1;
+  pstCommCfg->gop_cache_size = RKADK_MEDIA_GOP_CACHE_SIZE;
   RKADK_PARAM_SaveCommCfg(path);
 }
 
@@ -798,6 +817,8 @@ static void RKADK_PARAM_DefAudioCfg(char *path) {
   pstAudioCfg->vqe_mode = RKADK_VQE_MODE_AI_RECORD;
   memcpy(pstAudioCfg->vqe_config_path, AI_VQE_CONFIG_PATH, strlen(AI_VQE_CONFIG_PATH));
   pstAudioCfg->codec_type = RKADK_CODEC_TYPE_MP3;
+  pstAudioCfg->live_codec_type = RKADK_CODEC_TYPE_G711A;
+  pstAudioCfg->live_bitrate = LIVE_AUDIO_BIT_REAT;
   RKADK_PARAM_SaveAudioCfg(path);
 }
 
@@ -953,6 +974,7 @@ static void RKADK_PARAM_DefRecCfg(RKADK_U32 u32CamId, char *path) {
   memset(pstRecCfg, 0, sizeof(RKADK_PARAM_REC_CFG_S));
   pstRecCfg->record_type = RKADK_REC_TYPE_NORMAL;
   pstRecCfg->file_type = RKADK_MUXER_TYPE_MP4;
+  pstRecCfg->fragment_gop = RKADK_MUXER_FRAGMENT_GOP_CNT;
   pstRecCfg->pre_record_time = 0;
   pstRecCfg->pre_record_mode = RKADK_MUXER_PRE_RECORD_NONE;
   pstRecCfg->lapse_multiple = VIDEO_FRAME_RATE;
@@ -1074,6 +1096,7 @@ static void RKADK_PARAM_Dump() {
   printf("\tspeaker_volume: %d\n", pstCfg->stCommCfg.speaker_volume);
   printf("\tmic_volume: %d\n", pstCfg->stCommCfg.mic_volume);
   printf("\tvpss_devcie: %d\n", pstCfg->stCommCfg.vpss_devcie);
+  printf("\tgop_cache_size: %d\n", pstCfg->stCommCfg.gop_cache_size);
 
   printf("Audio Config\n");
   printf("\tai_audio_node: %s\n", pstCfg->stAudioCfg.ai_audio_node);
@@ -1088,6 +1111,8 @@ static void RKADK_PARAM_Dump() {
   printf("\tvqe_mode: %d\n", pstCfg->stAudioCfg.vqe_mode);
   printf("\tvqe_mode: %s\n", pstCfg->stAudioCfg.vqe_config_path);
   printf("\tcodec_type: %d\n", pstCfg->stAudioCfg.codec_type);
+  printf("\tlive_codec_type: %d\n", pstCfg->stAudioCfg.live_codec_type);
+  printf("\tlive_bitrate: %d\n", pstCfg->stAudioCfg.live_bitrate);
 
   for (i = 0; i < (int)pstCfg->stCommCfg.sensor_count; i++) {
     printf("Sensor[%d] Config\n", i);
@@ -1126,6 +1151,8 @@ static void RKADK_PARAM_Dump() {
            pstCfg->stMediaCfg[i].stRecCfg.record_type);
     printf("\t\tsensor[%d] stRecCfg file_type: %d\n", i,
            pstCfg->stMediaCfg[i].stRecCfg.file_type);
+    printf("\t\tsensor[%d] stRecCfg fragment_gop: %d\n", i,
+           pstCfg->stMediaCfg[i].stRecCfg.fragment_gop);
     printf("\t\tsensor[%d] stRecCfg pre_record_time: %d\n", i,
            pstCfg->stMediaCfg[i].stRecCfg.pre_record_time);
     printf("\t\tsensor[%d] stRecCfg pre_record_mode: %d\n", i,
@@ -1322,6 +1349,8 @@ static void RKADK_PARAM_Dump() {
            pstCfg->stMediaCfg[i].stLiveCfg.attribute.venc_param.full_range);
     printf("\t\tsensor[%d] stLiveCfg scaling_list: %d\n", i,
            pstCfg->stMediaCfg[i].stLiveCfg.attribute.venc_param.scaling_list);
+    printf("\t\tsensor[%d] stLiveCfg low_latency: %d\n", i,
+           pstCfg->stMediaCfg[i].stLiveCfg.attribute.venc_param.low_latency);
 
     printf("\tDisplay Config\n");
     printf("\t\tsensor[%d] stDispCfg x: %d\n", i,
@@ -2790,6 +2819,34 @@ static RKADK_S32 RKADK_PARAM_SetVencHierarchicalQp(RKADK_PARAM_VENC_ATTR_S stVen
   return 0;
 }
 
+static RKADK_S32 RKADK_PARAM_SetVencSliceSplit(RKADK_PARAM_VENC_ATTR_S stVencAttr) {
+  int ret = 0;
+  RKADK_U32 u32Align, u32Rows;
+  VENC_SLICE_SPLIT_S stSliceSplit;
+
+  //default false
+  if (!RKADK_PARAM_VencLowLatency(&stVencAttr))
+    return 0;
+
+  // split by macroblock/ctu count, whole rows so each slice is a band of the picture
+  u32Align = stVencAttr.codec_type == RKADK_CODEC_TYPE_H265 ? 32 : 16;
+  u32Rows = (stVencAttr.height + u32Align - 1) / u32Align;
+  u32Rows = (u32Rows + RKADK_MEDIA_LOW_LATENCY_SLICE_CNT - 1)
+            / RKADK_MEDIA_LOW_LATENCY_SLICE_CNT;
+
+  memset(&stSliceSplit, 0, sizeof(VENC_SLICE_SPLIT_S));
+  stSliceSplit.bSplitEnable = RK_TRUE;
+  stSliceSplit.u32SplitMode = 1;
+  stSliceSplit.u32SplitSize = u32Rows * ((stVencAttr.width + u32Align - 1) / u32Align);
+  ret = RK_MPI_VENC_SetSliceSplit(stVencAttr.venc_chn, &stSliceSplit);
+  // frames are still sent whole, only the gop and rc are low latency
+  if (ret)
+    RKADK_LOGW("venc_chn[%d] SetSliceSplit failed[%d], frame output",
+               stVencAttr.venc_chn, ret);
+
+  return 0;
+}
+
 RKADK_S32 RKADK_PARAM_SetVAdvancedParam(RKADK_PARAM_VENC_ATTR_S stVencAttr) {
   int ret;
 
@@ -2797,6 +2854,7 @@ RKADK_S32 RKADK_PARAM_SetVAdvancedParam(RKADK_PARAM_VENC_ATTR_S stVencAttr) {
   ret |= RKADK_PARAM_SetVencTrans(stVencAttr);
   ret |= RKADK_PARAM_SetVencVui(stVencAttr);
   ret |= RKADK_PARAM_SetVencHierarchicalQp(stVencAttr);
+  ret |= RKADK_PARAM_SetVencSliceSplit(stVencAttr);
 
   return ret;
 }
@@ -3968,10 +4026,15 @@ RKADK_STREAM_TYPE_E RKADK_PARAM_VencChnMux(RKADK_U32 u32CamId,
   return RKADK_STREAM_TYPE_BUTT;
 }
 
+// every stream buffer the record path may hold at once: the consumer queue,
+// the muxer cells (sized by RKADK_MUXER_ListInit the same way) and the
+// pre-record ring, plus one for the encoder
 RKADK_U32 RKADK_PARAM_GetStreamBufCnt(RKADK_U32 u32CamId, bool bIsAudio) {
   RKADK_U32 u32Integer = 0, u32Remainder = 0;
-  RKADK_U32 u32PreRecCacheTime = 0;
-  RKADK_U32 u32BufCount = RKADK_MUXER_CELL_MAX_CNT;
+  RKADK_U32 u32PreRecCacheTime = 0, u32CellCacheTime = 0;
+  RKADK_U32 u32FrameRate, u32CellCnt, u32RingCnt = 0;
+  RKADK_U32 u32BufCount = RKADK_MUXER_CELL_DEF_CNT;
+  RKADK_MUXER_CACHE_ATTR_S stCacheAttr;
   RKADK_PARAM_AUDIO_CFG_S *pstAudioParam = NULL;
   RKADK_PARAM_SENSOR_CFG_S *pstSensorCfg = NULL;
   RKADK_PARAM_REC_CFG_S *pstRecCfg = NULL;
@@ -3994,20 +4057,95 @@ RKADK_U32 RKADK_PARAM_GetStreamBufCnt(RKADK_U32 u32CamId, bool bIsAudio) {
     return u32BufCount;
   }
 
-  if(pstRecCfg->pre_record_time == 0)
+  if (!pstRecCfg->attribute[0].framerate)
     return u32BufCount;
 
-  u32Integer = pstRecCfg->attribute[0].gop / pstRecCfg->attribute[0].framerate;
-  u32Remainder = pstRecCfg->attribute[0].gop % pstRecCfg->attribute[0].framerate;
-  u32PreRecCacheTime = pstRecCfg->pre_record_time + u32Integer;
-  if (u32Remainder)
-    u32PreRecCacheTime += 1;
+  if (pstRecCfg->pre_record_time) {
+    u32Integer = pstRecCfg->attribute[0].gop / pstRecCfg->attribute[0].framerate;
+    u32Remainder = pstRecCfg->attribute[0].gop % pstRecCfg->attribute[0].framerate;
+    u32PreRecCacheTime = pstRecCfg->pre_record_time + u32Integer;
+    if (u32Remainder)
+      u32PreRecCacheTime += 1;
 
-  if (bIsAudio)
-    u32BufCount = pstAudioParam->channels * (pstAudioParam->samplerate
-                  / pstAudioParam->samples_per_frame) * (u32PreRecCacheTime + 2);
-  else
-    u32BufCount = (u32PreRecCacheTime + 2) * pstRecCfg->attribute[0].framerate;
+    if (pstRecCfg->pre_record_mode != RKADK_MUXER_PRE_RECORD_NONE)
+      u32CellCacheTime = u32PreRecCacheTime;
+  }
+
+  // the recorder leaves the cache attribute at its defaults
+  memset(&stCacheAttr, 0, sizeof(RKADK_MUXER_CACHE_ATTR_S));
+  if (bIsAudio) {
+    if (!pstAudioParam->samples_per_frame)
+      return u32BufCount;
+
+    u32FrameRate = pstAudioParam->samplerate / pstAudioParam->samples_per_frame;
+    u32CellCnt = RKADK_MUXER_CalcCellCnt(u32FrameRate, 0, 0, u32CellCacheTime,
+                                         &stCacheAttr);
+    if (u32PreRecCacheTime)
+      u32RingCnt = (u32PreRecCacheTime + 1) * u32FrameRate;
+
+    u32BufCount = pstAudioParam->channels * (u32CellCnt + u32RingCnt + 1);
+  } else {
+    u32FrameRate = pstRecCfg->attribute[0].framerate;
+    u32CellCnt = RKADK_MUXER_CalcCellCnt(u32FrameRate, pstRecCfg->attribute[0].gop,
+                                         pstRecCfg->attribute[0].bitrate,
+                                         u32CellCacheTime, &stCacheAttr);
+    if (u32PreRecCacheTime)
+      u32RingCnt = (u32PreRecCacheTime + 1) * u32FrameRate;
+
+    u32BufCount = RKADK_MEDIA_VENC_QUEUE_DEPTH + u32CellCnt + u32RingCnt + 1;
+  }
 
   return u32BufCount;
 }
+
+// streams of the camera encoded by the venc channel
+static int RKADK_PARAM_VencChnUserCnt(RKADK_U32 u32CamId, RKADK_U32 u32ChnId) {
+  int i, s32UserCnt = 0;
+  RKADK_PARAM_REC_CFG_S *pstRecCfg;
+  RKADK_PARAM_STREAM_CFG_S *pstStreamCfg;
+
+  pstRecCfg = RKADK_PARAM_GetRecCfg(u32CamId);
+  if (pstRecCfg) {
+    for (i = 0; i < (int)pstRecCfg->file_num; i++)
+      if (pstRecCfg->attribute[i].venc_chn == u32ChnId)
+        s32UserCnt++;
+  }
+
+  pstStreamCfg = RKADK_PARAM_GetStreamCfg(u32CamId, RKADK_STREAM_TYPE_PREVIEW);
+  if (pstStreamCfg && pstStreamCfg->attribute.venc_chn == u32ChnId)
+    s32UserCnt++;
+
+  pstStreamCfg = RKADK_PARAM_GetStreamCfg(u32CamId, RKADK_STREAM_TYPE_LIVE);
+  if (pstStreamCfg && pstStreamCfg->attribute.venc_chn == u32ChnId)
+    s32UserCnt++;
+
+  return s32UserCnt;
+}
+
+RKADK_U32 RKADK_PARAM_GetVencStreamBufCnt(RKADK_U32 u32CamId, RKADK_U32 u32ChnId) {
+  RKADK_U32 u32BufCount;
+
+  u32BufCount = RKADK_PARAM_GetStreamBufCnt(u32CamId, false);
+
+  // a shared venc keeps a gop cached for the late starter and its queue
+  if (RKADK_PARAM_VencChnUserCnt(u32CamId, u32ChnId) > 1)
+    u32BufCount += RKADK_MEDIA_GOP_CACHE_MAX_CNT
+                   + RKADK_MEDIA_VENC_QUEUE_DEPTH * RKADK_MEDIA_LOW_LATENCY_SLICE_CNT;
+
+  return u32BufCount;
+}
+
+bool RKADK_PARAM_VencLowLatency(RKADK_PARAM_VENC_ATTR_S *pstVencAttr) {
+  if (!pstVencAttr->venc_param.low_latency)
+    return false;
+
+  // slices and the low latency rc would also go to the other streams
+  for (int i = 0; i < (int)g_stPARAMCtx.stCfg.stCommCfg.sensor_count; i++) {
+    if (RKADK_PARAM_VencChnUserCnt(i, pstVencAttr->venc_chn) > 1) {
+      RKADK_LOGW("venc_chn[%d] is shared, low_latency ignored", pstVencAttr->venc_chn);
+      return false;
+    }
+  }
+
+  return true;
+}
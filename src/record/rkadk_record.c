@@ -297,7 +297,8 @@ static int RKADK_RECORD_SetVideoAttr(int index, RKADK_U32 u32CamId,
   pstVencAttr->stVencAttr.u32VirWidth = pstRecCfg->attribute[index].width;
   pstVencAttr->stVencAttr.u32VirHeight = pstRecCfg->attribute[index].height;
   pstVencAttr->stVencAttr.u32Profile = pstRecCfg->attribute[index].profile;
-  pstVencAttr->stVencAttr.u32StreamBufCnt = RKADK_PARAM_GetStreamBufCnt(u32CamId, false);
+  pstVencAttr->stVencAttr.u32StreamBufCnt =
+      RKADK_PARAM_GetVencStreamBufCnt(u32CamId, pstRecCfg->attribute[index].venc_chn);
 
   return 0;
 }
@@ -721,6 +722,7 @@ static RKADK_S32 RKADK_RECORD_VencGetData(RKADK_U32 u32CamId,
                                           MPP_CHN_S *pstVencChn,
                                           RKADK_MW_PTR pRecorder) {
   int ret = 0;
+  RKADK_MEDIA_QUEUE_ATTR_S stQueueAttr;
 
   VENC_RECV_PIC_PARAM_S stRecvParam;
   stRecvParam.s32RecvPicNum = -1;
@@ -730,8 +732,12 @@ static RKADK_S32 RKADK_RECORD_VencGetData(RKADK_U32 u32CamId,
     return ret;
   }
 
-  ret =
-      RKADK_MEDIA_GetVencBuffer(pstVencChn, RKADK_RECORD_VencOutCb, pRecorder);
+  // the muxer has its own frame cache, wait for it rather than drop frames
+  memset(&stQueueAttr, 0, sizeof(RKADK_MEDIA_QUEUE_ATTR_S));
+  stQueueAttr.enOverflow = RKADK_MEDIA_QUEUE_BLOCK;
+  stQueueAttr.u32BlockMs = RKADK_MUXER_WRITE_LATENCY_MS;
+  ret = RKADK_MEDIA_GetVencBufferEx(pstVencChn, RKADK_RECORD_VencOutCb, pRecorder,
+                                    &stQueueAttr);
   if (ret) {
     RKADK_LOGE("RKADK_MEDIA_GetVencBuffer failed[%x]", ret);
     return ret;
@@ -932,6 +938,7 @@ static RKADK_S32 RKADK_RECORD_SetMuxerAttr(RKADK_U32 u32CamId,
   pstMuxerAttr->stPreRecordAttr.u32PreRecTimeSec = pstRecCfg->pre_record_time;
   pstMuxerAttr->stPreRecordAttr.enPreRecordMode = pstRecCfg->pre_record_mode;
   pstMuxerAttr->stPreRecordAttr.u32PreRecCacheTime = GetPreRecordCacheTime(pstRecCfg, pstSensorCfg);
+  pstMuxerAttr->stIoAttr.bPreAllocate = true;
   pstMuxerAttr->pcbRequestFileNames = GetRecordFileName;
 
   for (int i = 0; i < (int)pstMuxerAttr->u32StreamCnt; i++) {
@@ -943,6 +950,7 @@ static RKADK_S32 RKADK_RECORD_SetMuxerAttr(RKADK_U32 u32CamId,
     pstMuxerAttr->astStreamAttr[i].u32VencChn = pstRecCfg->attribute[i].venc_chn;
     pstMuxerAttr->astStreamAttr[i].bUseVpss = RKADK_RECORD_IsUseVpss(u32CamId, i, pstRecCfg);
     pstMuxerAttr->astStreamAttr[i].enType = pstRecCfg->file_type;
+    pstMuxerAttr->astStreamAttr[i].u32FragmentGop = pstRecCfg->fragment_gop;
     if (pstRecCfg->record_type == RKADK_REC_TYPE_LAPSE) {
       bitrate = pstRecCfg->attribute[i].bitrate / pstRecCfg->lapse_multiple;
       pstMuxerAttr->astStreamAttr[i].u32TimeLenSec =
@@ -1108,7 +1116,8 @@ static RKADK_S32 RKADK_RECORD_ResetVideoAttr(RKADK_U32 u32CamId, RKADK_U32 index
   pstVencAttr->stVencAttr.u32VirWidth = u32Width;
   pstVencAttr->stVencAttr.u32VirHeight = u32Height;
   pstVencAttr->stVencAttr.enType = enType;
-  pstVencAttr->stVencAttr.u32StreamBufCnt = RKADK_PARAM_GetStreamBufCnt(u32CamId, false);
+  pstVencAttr->stVencAttr.u32StreamBufCnt =
+      RKADK_PARAM_GetVencStreamBufCnt(u32CamId, pstRecCfg->attribute[index].venc_chn);
   pstVencAttr->stRcAttr.enRcMode =
         RKADK_PARAM_GetRcMode(pstRecCfg->attribute[index].rc_mode,
                               pstRecCfg->attribute[index].codec_type);
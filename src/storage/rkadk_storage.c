@@ -24,11 +24,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/vfs.h>
 #include <time.h>
@@ -37,45 +40,36 @@
 #include <rkfsmk.h>
 
 #include "rkadk_storage.h"
-#include "cjson/cJSON.h"
+#include "rkadk_storage_catalog.h"
+#include "rkadk_storage_journal.h"
 
 #define MAX_TYPE_NMSG_LEN 32
 #define MAX_ATTR_LEN 256
 #define MAX_STRLINE_LEN 1024
 #define REPAIR_FILE_NUM 8
-
-#define JSON_KEY_FOLDER_NAME "FolderName"
-#define JSON_KEY_FILE_NUMBER "FileNumber"
-#define JSON_KEY_TOTAL_SIZE "TotalSize"
-#define JSON_KEY_TOTAL_SPACE "TotalSpace"
-#define JSON_KEY_FILE_ARRAY "FileArray"
-#define JSON_KEY_FILE_NAME "FileName"
-#define JSON_KEY_MODIFY_TIME "ModifyTime"
-#define JSON_KEY_FILE_SIZE "FileSize"
-#define JSON_KEY_FILE_SPACE "FileSpace"
-
-typedef RKADK_S32 (*RKADK_REC_MSG_CB)(RKADK_MW_PTR, RKADK_S32, RKADK_MW_PTR,
-                                      RKADK_S32, RKADK_MW_PTR);
-
-struct RKADK_STR_FILE {
-  struct RKADK_STR_FILE *next;
-  RKADK_CHAR filename[RKADK_MAX_FILE_PATH_LEN];
-  time_t stTime;
-  off_t stSize;
-  off_t stSpace;
-  mode_t stMode;
-};
+#define SCAN_THREAD_NUM 2
+#define SCAN_THREAD_MAX 8
+#define SCAN_PROGRESS_FILE_NUM 256
+#define SPACE_CHECK_MIN_MS 1000
+#define SPACE_CHECK_MAX_MS 30000
+#define SPACE_FORECAST_SEC (SPACE_CHECK_MAX_MS / 1000)
+#define SPACE_RATE_MIN_MS 500
+#define DELETE_BATCH_MAX 16
+#define UEVENT_BUF_LEN 2000
+#define INOTIFY_MASK (IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | \
+                      IN_CLOSE_WRITE | IN_UNMOUNT)
+
+/* RKADK_CATALOG_FILE_S.u32ScanFlag */
+#define SCAN_FLAG_SEEN 1
+#define SCAN_FLAG_CHANGED 2
 
 typedef struct {
   RKADK_CHAR cpath[RKADK_MAX_FILE_PATH_LEN];
   RKADK_SORT_CONDITION s32SortCond;
   RKADK_S32 wd;
-  RKADK_S32 s32FileNum;
-  off_t totalSize;
-  off_t totalSpace;
   pthread_mutex_t mutex;
-  struct RKADK_STR_FILE *pstFileListFirst;
-  struct RKADK_STR_FILE *pstFileListLast;
+  RKADK_CATALOG_S stCatalog;
+  RKADK_JOURNAL_S stJournal;
 } RKADK_STR_FOLDER;
 
 typedef struct {
@@ -88,43 +82,67 @@ typedef struct {
   RKADK_S32 s32TotalSize;
   RKADK_S32 s32FreeSize;
   RKADK_S32 s32FsckQuit;
+  RKADK_BOOL bWritable;
+  RKADK_S32 s32AutoDel;
+  RKADK_S32 s32CheckFreeSize; /* at the last space check */
+  struct timespec checkTime;
+  RKADK_S32 s32WriteRate;     /* KB/s measured between space checks */
+  RKADK_BOOL bDeleted;        /* files deleted since the last check */
+  RKADK_U32 u32MountGen;      /* bumped when the folders are freed */
   RKADK_STR_FOLDER *pstFolder;
 } RKADK_STR_DEV_STA;
 
-struct RKADK_TMSG_ELEMENT {
-  struct RKADK_TMSG_ELEMENT *next;
-  RKADK_S32 msg;
-  RKADK_CHAR *data;
-  RKADK_S32 s32DataLen;
-};
-
+/*
+ * One thread waits on the inotify fd of the folders, the uevent socket and a
+ * timer for the space checks, and sleeps while none of them fires.
+ */
 typedef struct {
-  struct RKADK_TMSG_ELEMENT *first;
-  struct RKADK_TMSG_ELEMENT *last;
-  RKADK_S32 num;
-  RKADK_S32 quit;
+  RKADK_S32 s32EpollFd;
+  RKADK_S32 s32InotifyFd;
+  RKADK_S32 s32UeventFd;
+  RKADK_S32 s32TimerFd;
+  RKADK_S32 s32WakeFd;
+  RKADK_S32 s32Run;
+  pthread_t tid;
+} RKADK_STR_EVENT_LOOP;
+
+/* batched auto delete and journal compaction, off the event loop */
+typedef struct {
+  RKADK_S32 s32Run;
+  RKADK_BOOL bPending;
+  RKADK_BOOL bCompact;
+  off_t target; /* bytes to free */
+  pthread_t tid;
   pthread_mutex_t mutex;
-  pthread_cond_t notEmpty;
-  RKADK_REC_MSG_CB recMsgCb;
-  pthread_t recTid;
-  RKADK_MW_PTR pHandlePath;
-} RKADK_TMSG_BUFFER;
-
-typedef enum {
-  MSG_DEV_ADD = 1,
-  MSG_DEV_REMOVE = 2,
-  MSG_DEV_CHANGED = 3,
-} RKADK_ENUM_MSG;
+  pthread_cond_t cond;
+} RKADK_STR_DELETER;
+
+typedef struct {
+  RKADK_S32 s32Folder;
+  RKADK_CHAR filename[RKADK_MAX_FILE_PATH_LEN];
+} RKADK_STR_VICTIM;
 
 typedef struct {
-  RKADK_TMSG_BUFFER stMsgHd;
-  pthread_t eventListenerTid;
-  RKADK_S32 eventListenerRun;
+  RKADK_STR_EVENT_LOOP stLoop;
+  RKADK_STR_DELETER stDeleter;
+  RKADK_U32 u32StreamBitrate[RKADK_STORAGE_MAX_STREAM];
+  pthread_mutex_t mountMutex;  /* DevAdd, DevRemove, unmount */
+  pthread_mutex_t folderMutex; /* stDevSta.pstFolder against the event loop */
   RKADK_STR_DEV_STA stDevSta;
   RKADK_STR_DEV_ATTR stDevAttr;
   RKADK_MOUNT_STATUS_CALLBACK_FN pfnStatusCallback;
 } RKADK_STORAGE_HANDLE;
 
+typedef struct {
+  RKADK_STORAGE_HANDLE *pHandle;
+  RKADK_STR_DEV_ATTR *pstDevAttr;
+  RKADK_S32 s32ReserveSize; /* KB */
+  RKADK_S32 s32FolderNext;
+  time_t startTime;
+  RKADK_STR_SCAN_PROGRESS stProgress;
+  pthread_mutex_t mutex;
+} RKADK_STR_SCAN_CTX;
+
 static RKADK_S32 RKADK_STORAGE_RKFSCK(RKADK_STORAGE_HANDLE *pHandle, RKADK_STR_DEV_ATTR *pdevAttr);
 
 void RKADK_STORAGE_ProcessStatus(RKADK_STORAGE_HANDLE *pHandle,
@@ -183,34 +201,6 @@ static RKADK_S32 RKADK_STORAGE_CreateFolder(RKADK_CHAR *folder) {
   return 0;
 }
 
-static RKADK_S32 RKADK_STORAGE_ReadTimeout(RKADK_S32 fd, RKADK_U32 u32WaitMs) {
-  RKADK_S32 ret = 0;
-
-  if (u32WaitMs > 0) {
-    fd_set readFdset;
-    struct timeval timeout;
-
-    FD_ZERO(&readFdset);
-    FD_SET(fd, &readFdset);
-
-    timeout.tv_sec = u32WaitMs / 1000;
-    timeout.tv_usec = (u32WaitMs % 1000) * 1000;
-
-    do {
-      ret = select(fd + 1, &readFdset, NULL, NULL, &timeout);
-    } while (ret < 0 && errno == EINTR);
-
-    if (ret == 0) {
-      ret = -1;
-      errno = ETIMEDOUT;
-    } else if (ret == 1) {
-      return 0;
-    }
-  }
-
-  return ret;
-}
-
 static RKADK_S32 RKADK_STORAGE_GetDiskSize(RKADK_CHAR *path,
                                            RKADK_S32 *totalSize,
                                            RKADK_S32 *freeSize) {
@@ -307,57 +297,17 @@ exit:
   return ret;
 }
 
-static bool RKADK_STORAGE_FileCompare(struct RKADK_STR_FILE *existingFile,
-                                      struct RKADK_STR_FILE *newFile,
-                                      RKADK_SORT_CONDITION cond) {
-  bool ret = false;
-
-  switch (cond) {
-  case SORT_MODIFY_TIME: {
-    ret = (newFile->stTime <= existingFile->stTime);
-    break;
-  }
-  case SORT_FILE_NAME: {
-    ret = (strcmp(newFile->filename, existingFile->filename) <= 0);
-    break;
-  }
-  case SORT_BUTT: {
-    ret = false;
-    RKADK_LOGE("Invalid condition.");
-    break;
-  }
-  }
-
-  return ret;
-}
-
 static RKADK_S32 RKADK_STORAGE_FileListCheck(RKADK_STR_FOLDER *folder,
                                            RKADK_CHAR *filename,
                                            struct stat *statbuf) {
   RKADK_S32 ret = 0;
-  struct RKADK_STR_FILE *tmp = NULL;
 
   RKADK_CHECK_POINTER(folder, RKADK_FAILURE);
   RKADK_CHECK_POINTER(filename, RKADK_FAILURE);
 
   pthread_mutex_lock(&folder->mutex);
-
-  if (folder->pstFileListFirst) {
-    tmp = folder->pstFileListFirst;
-
-    if (!strcmp(tmp->filename, filename)) {
-      ret = 1;
-    } else {
-      while (tmp->next) {
-        if (!strcmp(tmp->next->filename, filename)) {
-          ret = 1;
-          break;
-        }
-        tmp = tmp->next;
-      }
-    }
-  }
-
+  if (RKADK_CATALOG_Find(&folder->stCatalog, filename))
+    ret = 1;
   pthread_mutex_unlock(&folder->mutex);
 
   return ret;
@@ -366,439 +316,749 @@ static RKADK_S32 RKADK_STORAGE_FileListCheck(RKADK_STR_FOLDER *folder,
 static RKADK_S32 RKADK_STORAGE_FileListAdd(RKADK_STR_FOLDER *folder,
                                            RKADK_CHAR *filename,
                                            struct stat *statbuf) {
-  struct RKADK_STR_FILE *tmp = NULL;
-  struct RKADK_STR_FILE *tmp_1 = NULL;
+  RKADK_S32 ret;
 
   RKADK_CHECK_POINTER(folder, RKADK_FAILURE);
   RKADK_CHECK_POINTER(filename, RKADK_FAILURE);
 
   pthread_mutex_lock(&folder->mutex);
+  ret = RKADK_CATALOG_Add(&folder->stCatalog, filename, statbuf->st_mtime,
+                          statbuf->st_size, statbuf->st_blocks << 9);
+  if (!ret) {
+    // keep files recorded during the mount scan out of its sweep
+    RKADK_CATALOG_Find(&folder->stCatalog, filename)->u32ScanFlag =
+        SCAN_FLAG_SEEN;
+    RKADK_JOURNAL_Append(&folder->stJournal, &folder->stCatalog,
+                         RKADK_JOURNAL_OP_ADD, filename);
+  }
+  pthread_mutex_unlock(&folder->mutex);
 
-  tmp_1 = (struct RKADK_STR_FILE *)malloc(sizeof(struct RKADK_STR_FILE));
+  return ret;
+}
 
-  if (!tmp_1) {
-    RKADK_LOGE("tmp malloc failed.");
-    pthread_mutex_unlock(&folder->mutex);
-    return -1;
+static RKADK_S32 RKADK_STORAGE_FileListDel(RKADK_STR_FOLDER *folder,
+                                           RKADK_CHAR *filename) {
+  RKADK_CHECK_POINTER(folder, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(filename, RKADK_FAILURE);
+
+  pthread_mutex_lock(&folder->mutex);
+  if (!RKADK_CATALOG_Del(&folder->stCatalog, filename))
+    RKADK_JOURNAL_Append(&folder->stJournal, &folder->stCatalog,
+                         RKADK_JOURNAL_OP_DEL, filename);
+  pthread_mutex_unlock(&folder->mutex);
+  return 0;
+}
+
+static RKADK_S32 RKADK_STORAGE_FileListScan(RKADK_STR_FOLDER *folder,
+                                            RKADK_CHAR *filename,
+                                            struct stat *statbuf) {
+  RKADK_S32 ret = 0;
+  RKADK_CATALOG_FILE_S *file;
+
+  pthread_mutex_lock(&folder->mutex);
+  file = RKADK_CATALOG_Find(&folder->stCatalog, filename);
+  if (!file || file->stTime != statbuf->st_mtime ||
+      file->stSize != statbuf->st_size) {
+    ret = RKADK_CATALOG_Add(&folder->stCatalog, filename, statbuf->st_mtime,
+                            statbuf->st_size, statbuf->st_blocks << 9);
+    if (!ret) {
+      RKADK_JOURNAL_Append(&folder->stJournal, &folder->stCatalog,
+                           RKADK_JOURNAL_OP_ADD, filename);
+      file = RKADK_CATALOG_Find(&folder->stCatalog, filename);
+      file->u32ScanFlag = SCAN_FLAG_CHANGED;
+      ret = 1;
+    }
+  } else if (!file->u32ScanFlag) {
+    file->u32ScanFlag = SCAN_FLAG_SEEN;
+  }
+  pthread_mutex_unlock(&folder->mutex);
+
+  return ret;
+}
+
+/*
+ * End of a folder scan: files loaded from the journal that the scan did not
+ * see are gone from the card.
+ */
+static RKADK_S32 RKADK_STORAGE_FileListSweep(RKADK_STR_FOLDER *folder) {
+  RKADK_S32 del = 0;
+  RKADK_CATALOG_FILE_S *file, *next;
+  RKADK_CHAR filename[RKADK_MAX_FILE_PATH_LEN];
+
+  pthread_mutex_lock(&folder->mutex);
+  for (file = RKADK_CATALOG_First(&folder->stCatalog); file; file = next) {
+    next = RKADK_CATALOG_Next(file);
+    if (!file->u32ScanFlag) {
+      snprintf(filename, RKADK_MAX_FILE_PATH_LEN, "%s", file->filename);
+      RKADK_CATALOG_Del(&folder->stCatalog, filename);
+      RKADK_JOURNAL_Append(&folder->stJournal, &folder->stCatalog,
+                           RKADK_JOURNAL_OP_DEL, filename);
+      del++;
+      continue;
+    }
+    file->u32ScanFlag = 0;
   }
+  pthread_mutex_unlock(&folder->mutex);
 
-  sprintf(tmp_1->filename, "%s", filename);
-  tmp_1->stSize = statbuf->st_size;
-  tmp_1->stSpace = statbuf->st_blocks << 9;
-  tmp_1->stTime = statbuf->st_mtime;
-  tmp_1->next = NULL;
+  return del;
+}
 
-  if (folder->pstFileListFirst) {
-    tmp = folder->pstFileListFirst;
-    if (tmp_1->stTime >= tmp->stTime) {
-      tmp_1->next = tmp;
-      folder->pstFileListFirst = tmp_1;
+static RKADK_VOID RKADK_STORAGE_JournalPath(RKADK_CHAR *cMountPath,
+                                            RKADK_CHAR *cFolderPath,
+                                            RKADK_CHAR *path, RKADK_S32 len) {
+  RKADK_CHAR name[RKADK_MAX_FILE_PATH_LEN];
+  RKADK_S32 i, j = 0;
+
+  // "/video_front/" -> "<mount>/.video_front.cat"
+  for (i = 0; cFolderPath[i] && j < RKADK_MAX_FILE_PATH_LEN - 1; i++) {
+    if (cFolderPath[i] == '/') {
+      if (j == 0 || !cFolderPath[i + 1])
+        continue;
+      name[j++] = '_';
     } else {
-      while (tmp->next) {
-        if (tmp_1->stTime >= tmp->next->stTime) {
-          tmp_1->next = tmp->next;
-          tmp->next = tmp_1;
-          break;
-        }
-        tmp = tmp->next;
-      }
-      if (tmp->next == NULL) {
-        tmp->next = tmp_1;
-        folder->pstFileListLast = tmp_1;
-      }
+      name[j++] = cFolderPath[i];
     }
-  } else {
-    folder->pstFileListFirst = tmp_1;
-    folder->pstFileListLast = tmp_1;
   }
+  name[j] = '\0';
+
+  snprintf(path, len, "%s/.%s.cat", cMountPath, name);
+}
+
+// files written since the scan started may still be recording
+static void RKADK_STORAGE_FileSync(const RKADK_CHAR *path) {
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    RKADK_LOGE("Open %s failed, errno = %d", path, errno);
+    return;
+  }
+
+  if (fsync(fd))
+    RKADK_LOGE("fsync %s failed, errno = %d", path, errno);
 
-  folder->totalSize += tmp_1->stSize;
-  folder->totalSpace += tmp_1->stSpace;
-  folder->s32FileNum++;
+  close(fd);
+}
 
+static RKADK_S32 RKADK_STORAGE_Repair(RKADK_STR_FOLDER *folder,
+                                      time_t startTime) {
+  RKADK_S32 i, num = 0;
+  bool bRemoved = false;
+  RKADK_CHAR filename[REPAIR_FILE_NUM][RKADK_MAX_FILE_PATH_LEN];
+  off_t size[REPAIR_FILE_NUM];
+  RKADK_CHAR file[2 * RKADK_MAX_FILE_PATH_LEN];
+  RKADK_CATALOG_FILE_S *current;
+
+  pthread_mutex_lock(&folder->mutex);
+  current = RKADK_CATALOG_First(&folder->stCatalog);
+  for (; current && num < REPAIR_FILE_NUM; current = RKADK_CATALOG_Next(current)) {
+    // vfat keeps mtime in 2 s steps
+    if (current->stTime >= startTime - 2)
+      continue;
+    snprintf(filename[num], RKADK_MAX_FILE_PATH_LEN, "%s", current->filename);
+    size[num++] = current->stSize;
+  }
   pthread_mutex_unlock(&folder->mutex);
+
+  for (i = 0; i < num; i++) {
+    snprintf(file, sizeof(file), "%s%s", folder->cpath, filename[i]);
+    if ((size[i] == 0) || (repair_mp4(file) == REPA_FAIL)) {
+      RKADK_LOGE("Delete %s file. %lld", file, (long long)size[i]);
+      if (remove(file))
+        RKADK_LOGE("Delete %s file error.", file);
+      RKADK_STORAGE_FileListDel(folder, filename[i]);
+      bRemoved = true;
+      continue;
+    }
+
+    // the card is recording, sync what the repair touched only
+    RKADK_STORAGE_FileSync(file);
+  }
+  if (bRemoved)
+    RKADK_STORAGE_FileSync(folder->cpath);
+
   return 0;
 }
 
-static RKADK_S32 RKADK_STORAGE_FileListDel(RKADK_STR_FOLDER *folder,
-                                           RKADK_CHAR *filename) {
-  RKADK_S32 s32FileNum = 0;
-  off_t totalSize = 0;
-  off_t totalSpace = 0;
-  struct RKADK_STR_FILE *next = NULL;
+// returns RKADK_TRUE when files were written and the space should be checked
+static RKADK_BOOL RKADK_STORAGE_FileEvent(RKADK_STORAGE_HANDLE *pHandle,
+                                          struct inotify_event *event) {
+  RKADK_S32 j;
+  RKADK_BOOL bCheck = RKADK_FALSE;
 
-  RKADK_CHECK_POINTER(folder, RKADK_FAILURE);
-  RKADK_CHECK_POINTER(filename, RKADK_FAILURE);
+  for (j = 0; j < pHandle->stDevSta.s32FolderNum; j++) {
+    RKADK_STR_FOLDER *folder = &pHandle->stDevSta.pstFolder[j];
 
-  pthread_mutex_lock(&folder->mutex);
+    if (event->wd != folder->wd)
+      continue;
 
-again:
-  if (folder->pstFileListFirst) {
-    struct RKADK_STR_FILE *tmp = folder->pstFileListFirst;
-    if (!strcmp(tmp->filename, filename)) {
-      folder->pstFileListFirst = folder->pstFileListFirst->next;
-      free(tmp);
-      tmp = folder->pstFileListFirst;
-      if (folder->pstFileListFirst == NULL) {
-        folder->pstFileListLast = NULL;
+    if (event->mask & IN_CREATE)
+      bCheck = RKADK_TRUE;
+
+    if (event->mask & IN_MOVED_TO) {
+      RKADK_CHAR d_name[RKADK_MAX_FILE_PATH_LEN];
+      struct stat statbuf;
+      snprintf(d_name, RKADK_MAX_FILE_PATH_LEN, "%s%s", folder->cpath,
+               event->name);
+      if (lstat(d_name, &statbuf)) {
+        RKADK_LOGE("lstat[%s](IN_MOVED_TO) failed", d_name);
+      } else {
+        if ((RKADK_STORAGE_FileListCheck(folder, event->name, &statbuf) == 0) &&
+            RKADK_STORAGE_FileListAdd(folder, event->name, &statbuf))
+          RKADK_LOGE("FileListAdd failed");
+        bCheck = RKADK_TRUE;
       }
-      goto again;
     }
 
-    while (tmp) {
-      next = tmp->next;
-      totalSize += tmp->stSize;
-      totalSpace += tmp->stSpace;
-      s32FileNum++;
-      if (next == NULL) {
-        folder->pstFileListLast = tmp;
-        break;
-      }
-      if (!strcmp(next->filename, filename)) {
-        tmp->next = next->next;
-        free(next);
-        next = tmp->next;
-        if(tmp->next == NULL)
-          folder->pstFileListLast = tmp;
+    if ((event->mask & IN_DELETE) || (event->mask & IN_MOVED_FROM))
+      if (RKADK_STORAGE_FileListDel(folder, event->name))
+        RKADK_LOGE("FileListDel failed");
+
+    if (event->mask & IN_CLOSE_WRITE) {
+      RKADK_CHAR d_name[RKADK_MAX_FILE_PATH_LEN];
+      struct stat statbuf;
+      snprintf(d_name, RKADK_MAX_FILE_PATH_LEN, "%s%s", folder->cpath,
+               event->name);
+      if (lstat(d_name, &statbuf)) {
+        RKADK_LOGE("lstat[%s](IN_CLOSE_WRITE) failed", d_name);
+      } else {
+        if (statbuf.st_size == 0) {
+          if (remove(d_name))
+            RKADK_LOGE("Delete %s file error.", d_name);
+        } else if ((RKADK_STORAGE_FileListCheck(folder, event->name,
+                                                &statbuf) == 0) &&
+                   RKADK_STORAGE_FileListAdd(folder, event->name, &statbuf)) {
+          RKADK_LOGE("FileListAdd failed");
+        }
+        bCheck = RKADK_TRUE;
       }
-      tmp = next;
     }
   }
-  folder->s32FileNum = s32FileNum;
-  folder->totalSize = totalSize;
-  folder->totalSpace = totalSpace;
 
-  pthread_mutex_unlock(&folder->mutex);
-  return 0;
+  return bCheck;
 }
 
-static RKADK_S32 RKADK_STORAGE_FileListSave(RKADK_STR_FOLDER pstFolder,
-                                            RKADK_STR_FOLDER_ATTR pstFolderAttr,
-                                            RKADK_CHAR *cMountPath) {
-  RKADK_S32 i, len;
-  RKADK_CHAR dataFileName[RKADK_MAX_FILE_PATH_LEN];
-  RKADK_CHAR jsonFileName[2 * RKADK_MAX_FILE_PATH_LEN];
-  FILE *fp;
-  cJSON *folder = NULL;
-  cJSON *fileArray = NULL;
-  cJSON *info = NULL;
-  RKADK_CHAR *folderStr = NULL;
-  struct RKADK_STR_FILE *tmp = pstFolder.pstFileListFirst;
-
-  folder = cJSON_CreateObject();
-  cJSON_AddStringToObject(folder, JSON_KEY_FOLDER_NAME,
-                          pstFolderAttr.cFolderPath);
-  cJSON_AddNumberToObject(folder, JSON_KEY_FILE_NUMBER, pstFolder.s32FileNum);
-  cJSON_AddNumberToObject(folder, JSON_KEY_TOTAL_SIZE, pstFolder.totalSize);
-  cJSON_AddNumberToObject(folder, JSON_KEY_TOTAL_SPACE, pstFolder.totalSpace);
-  cJSON_AddItemToObject(folder, JSON_KEY_FILE_ARRAY,
-                        fileArray = cJSON_CreateArray());
-  for (i = 0; i < pstFolder.s32FileNum && tmp != NULL; i++) {
-    cJSON_AddItemToArray(fileArray, info = cJSON_CreateObject());
-    cJSON_AddStringToObject(info, JSON_KEY_FILE_NAME, tmp->filename);
-    cJSON_AddNumberToObject(info, JSON_KEY_MODIFY_TIME, tmp->stTime);
-    cJSON_AddNumberToObject(info, JSON_KEY_FILE_SIZE, tmp->stSize);
-    cJSON_AddNumberToObject(info, JSON_KEY_FILE_SPACE, tmp->stSpace);
-    tmp = tmp->next;
-  }
-  folderStr = cJSON_Print(folder);
-  cJSON_Delete(folder);
-
-  len = strlen(pstFolderAttr.cFolderPath) - 2;
-  strncpy(dataFileName, pstFolderAttr.cFolderPath + 1, len);
-  dataFileName[len] = '\0';
-  sprintf(jsonFileName, "%s/.%s.json", cMountPath, dataFileName);
-  RKADK_LOGD("Save fileList data in %s", jsonFileName);
-
-  if ((fp = fopen(jsonFileName, "w+")) == NULL) {
-    RKADK_LOGE("Open %s error!", jsonFileName);
-    free(folderStr);
-    return -1;
-  }
+// s32DelayMs < 0 disarms
+static RKADK_VOID RKADK_STORAGE_SpaceCheckAfter(RKADK_STORAGE_HANDLE *pHandle,
+                                                RKADK_S32 s32DelayMs) {
+  struct itimerspec its;
 
-  if (fwrite(folderStr, strlen(folderStr), 1, fp) != 1) {
-    RKADK_LOGE("Write file error!");
-    fclose(fp);
-    free(folderStr);
-    return -1;
+  memset(&its, 0, sizeof(its));
+  if (s32DelayMs > 0) {
+    its.it_value.tv_sec = s32DelayMs / 1000;
+    its.it_value.tv_nsec = (s32DelayMs % 1000) * 1000000;
+  } else if (s32DelayMs == 0) {
+    its.it_value.tv_nsec = 1;
   }
 
-  fclose(fp);
-  sync();
-  free(folderStr);
-  return 0;
+  if (timerfd_settime(pHandle->stLoop.s32TimerFd, 0, &its, NULL))
+    RKADK_LOGE("timerfd_settime failed: %s", strerror(errno));
 }
 
-static RKADK_S32 RKADK_STORAGE_FileListLoad(RKADK_STR_FOLDER *pstFolder,
-                                            RKADK_STR_FOLDER_ATTR pstFolderAttr,
-                                            RKADK_CHAR *cMountPath) {
-  RKADK_S32 i, len;
-  RKADK_S64 lenStr;
-  RKADK_CHAR *str;
-  RKADK_CHAR dataFileName[RKADK_MAX_FILE_PATH_LEN];
-  RKADK_CHAR jsonFileName[2 * RKADK_MAX_FILE_PATH_LEN];
-  FILE *fp;
-  cJSON *value = NULL;
-  cJSON *folder = NULL;
-  cJSON *fileArray = NULL;
-  cJSON *info = NULL;
-  struct RKADK_STR_FILE *tmp = NULL;
-
-  RKADK_CHECK_POINTER(pstFolder, RKADK_FAILURE);
-
-  len = strlen(pstFolderAttr.cFolderPath) - 2;
-  strncpy(dataFileName, pstFolderAttr.cFolderPath + 1, len);
-  dataFileName[len] = '\0';
-  sprintf(jsonFileName, "%s/.%s.json", cMountPath, dataFileName);
-  RKADK_LOGD("Load fileList data from %s", jsonFileName);
-
-  if ((fp = fopen(jsonFileName, "r")) == NULL) {
-    RKADK_LOGE("Open %s error!", jsonFileName);
-    return -1;
+// KB/s, the registered streams or the measured rate if higher
+static RKADK_S32 RKADK_STORAGE_WriteRate(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_S32 i;
+  long long rate = 0;
+
+  for (i = 0; i < RKADK_STORAGE_MAX_STREAM; i++)
+    rate += pHandle->u32StreamBitrate[i];
+  rate = (rate / 8 + 1023) / 1024;
+
+  if (rate < pHandle->stDevSta.s32WriteRate)
+    rate = pHandle->stDevSta.s32WriteRate;
+  return rate;
+}
+
+static RKADK_VOID RKADK_STORAGE_DeletePost(RKADK_STORAGE_HANDLE *pHandle,
+                                           off_t target) {
+  RKADK_STR_DELETER *pstDeleter = &pHandle->stDeleter;
+
+  pthread_mutex_lock(&pstDeleter->mutex);
+  if (!pstDeleter->bPending || target > pstDeleter->target)
+    pstDeleter->target = target;
+  pstDeleter->bPending = RKADK_TRUE;
+  pthread_cond_signal(&pstDeleter->cond);
+  pthread_mutex_unlock(&pstDeleter->mutex);
+}
+
+// called with folderMutex held
+static RKADK_VOID RKADK_STORAGE_CompactPost(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_S32 i;
+  RKADK_BOOL bCompact = RKADK_FALSE;
+  RKADK_STR_DELETER *pstDeleter = &pHandle->stDeleter;
+
+  for (i = 0; i < pHandle->stDevSta.s32FolderNum && !bCompact; i++) {
+    pthread_mutex_lock(&pHandle->stDevSta.pstFolder[i].mutex);
+    bCompact = RKADK_JOURNAL_CompactDue(&pHandle->stDevSta.pstFolder[i].stJournal);
+    pthread_mutex_unlock(&pHandle->stDevSta.pstFolder[i].mutex);
   }
 
-  fseek(fp, 0, SEEK_END);
-  lenStr = ftell(fp);
-  str = (RKADK_CHAR *)malloc(lenStr + 1);
-  if (str == NULL) {
-    RKADK_LOGE("malloc str failed!");
-    fclose(fp);
-    return -1;
+  if (!bCompact)
+    return;
+
+  pthread_mutex_lock(&pstDeleter->mutex);
+  pstDeleter->bCompact = RKADK_TRUE;
+  pthread_cond_signal(&pstDeleter->cond);
+  pthread_mutex_unlock(&pstDeleter->mutex);
+}
+
+/*
+ * Oldest files first: the folders over their file count limit, then the
+ * folder whose space is the largest multiple of its s32Limit percent, until
+ * target bytes are found. Called with folderMutex held.
+ */
+static RKADK_S32 RKADK_STORAGE_SelectVictims(RKADK_STORAGE_HANDLE *pHandle,
+                                             off_t target,
+                                             RKADK_STR_VICTIM *pstVictim) {
+  RKADK_STR_DEV_STA *pstDevSta = &pHandle->stDevSta;
+  RKADK_STR_FOLDER_ATTR *pstFolderAttr = pHandle->stDevAttr.pstFolderAttr;
+  RKADK_CATALOG_FILE_S *cursor[pstDevSta->s32FolderNum];
+  off_t space[pstDevSta->s32FolderNum];
+  RKADK_S32 i, j, num = 0, count;
+  off_t freed = 0;
+
+  for (i = 0; i < pstDevSta->s32FolderNum; i++) {
+    RKADK_CATALOG_S *catalog = &pstDevSta->pstFolder[i].stCatalog;
+
+    pthread_mutex_lock(&pstDevSta->pstFolder[i].mutex);
+    cursor[i] = RKADK_CATALOG_Last(catalog);
+    space[i] = catalog->totalSpace;
+    if (pstFolderAttr[i].bNumLimit != RKADK_TRUE)
+      continue;
+
+    count = catalog->s32FileNum - pstFolderAttr[i].s32Limit;
+    for (; count > 0 && cursor[i] && num < DELETE_BATCH_MAX; count--) {
+      pstVictim[num].s32Folder = i;
+      snprintf(pstVictim[num++].filename, RKADK_MAX_FILE_PATH_LEN, "%s",
+               cursor[i]->filename);
+      cursor[i] = RKADK_CATALOG_Prev(cursor[i]);
+    }
+    cursor[i] = NULL;
   }
 
-  fseek(fp, 0, SEEK_SET);
-  if (fread(str, lenStr, 1, fp) != 1) {
-    RKADK_LOGE("Read file error!");
-    fclose(fp);
-    free(str);
-    return -1;
+  while (freed < target && num < DELETE_BATCH_MAX) {
+    RKADK_S32 limit;
+    long long weight, best = -1;
+
+    for (i = 0, j = -1; i < pstDevSta->s32FolderNum; i++) {
+      if (!cursor[i])
+        continue;
+
+      limit = pstFolderAttr[i].s32Limit > 0 ? pstFolderAttr[i].s32Limit : 1;
+      weight = space[i] / limit;
+      if (j < 0 || weight > best ||
+          (weight == best && cursor[i]->stTime < cursor[j]->stTime)) {
+        best = weight;
+        j = i;
+      }
+    }
+    if (j < 0)
+      break;
+
+    pstVictim[num].s32Folder = j;
+    snprintf(pstVictim[num++].filename, RKADK_MAX_FILE_PATH_LEN, "%s",
+             cursor[j]->filename);
+    space[j] -= cursor[j]->stSpace;
+    freed += cursor[j]->stSpace;
+    cursor[j] = RKADK_CATALOG_Prev(cursor[j]);
   }
-  str[lenStr] = '\0';
-  fclose(fp);
 
-  if ((folder = cJSON_Parse(str)) == NULL) {
-    RKADK_LOGE("Parse error!");
-    free(str);
-    return -1;
+  for (i = 0; i < pstDevSta->s32FolderNum; i++)
+    pthread_mutex_unlock(&pstDevSta->pstFolder[i].mutex);
+
+  return num;
+}
+
+static RKADK_VOID RKADK_STORAGE_DeleteBatch(RKADK_STORAGE_HANDLE *pHandle,
+                                            off_t target) {
+  RKADK_STR_VICTIM stVictim[DELETE_BATCH_MAX];
+  RKADK_S32 *dirfd;
+  RKADK_S32 i, num, folderNum, deleted;
+  RKADK_U32 u32Gen;
+
+  pthread_mutex_lock(&pHandle->folderMutex);
+  if (pHandle->stDevSta.s32MountStatus != DISK_MOUNTED ||
+      !pHandle->stDevSta.pstFolder) {
+    pthread_mutex_unlock(&pHandle->folderMutex);
+    return;
   }
-  free(str);
-
-  pthread_mutex_lock(&pstFolder->mutex);
-  value = cJSON_GetObjectItem(folder, JSON_KEY_FILE_NUMBER);
-  pstFolder->s32FileNum = value->valuedouble;
-  value = cJSON_GetObjectItem(folder, JSON_KEY_TOTAL_SIZE);
-  pstFolder->totalSize = value->valuedouble;
-  value = cJSON_GetObjectItem(folder, JSON_KEY_TOTAL_SPACE);
-  pstFolder->totalSpace = value->valuedouble;
-  if ((fileArray = cJSON_GetObjectItem(folder, JSON_KEY_FILE_ARRAY)) == NULL) {
-    RKADK_LOGE("Get fileArray object item error!");
-    cJSON_Delete(folder);
-    pthread_mutex_unlock(&pstFolder->mutex);
-    return -1;
+  u32Gen = pHandle->stDevSta.u32MountGen;
+  folderNum = pHandle->stDevSta.s32FolderNum;
+  dirfd = (RKADK_S32 *)malloc(sizeof(RKADK_S32) * folderNum);
+  if (!dirfd) {
+    RKADK_LOGE("dirfd malloc failed.");
+    pthread_mutex_unlock(&pHandle->folderMutex);
+    return;
   }
+  for (i = 0; i < folderNum; i++)
+    dirfd[i] = open(pHandle->stDevSta.pstFolder[i].cpath,
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  num = RKADK_STORAGE_SelectVictims(pHandle, target, stVictim);
+  pthread_mutex_unlock(&pHandle->folderMutex);
 
-  for (i = 0; i < pstFolder->s32FileNum; i++) {
-    tmp = (struct RKADK_STR_FILE *)malloc(sizeof(struct RKADK_STR_FILE));
-    if (!tmp) {
-      RKADK_LOGE("tmp malloc failed.");
-      cJSON_Delete(folder);
-      pthread_mutex_unlock(&pstFolder->mutex);
-      return -1;
+  // unlinking a large file walks its FAT chain, keep the loop running
+  for (i = 0, deleted = 0; i < num; i++) {
+    if (dirfd[stVictim[i].s32Folder] < 0) {
+      stVictim[i].s32Folder = -1;
+      continue;
     }
 
-    memset(tmp, 0, sizeof(struct RKADK_STR_FILE));
-    info = cJSON_GetArrayItem(fileArray, i);
-    value = cJSON_GetObjectItem(info, JSON_KEY_FILE_NAME);
-    sprintf(tmp->filename, "%s", value->valuestring);
-    value = cJSON_GetObjectItem(info, JSON_KEY_FILE_SIZE);
-    tmp->stSize = value->valuedouble;
-    value = cJSON_GetObjectItem(info, JSON_KEY_FILE_SPACE);
-    tmp->stSpace = value->valuedouble;
-    value = cJSON_GetObjectItem(info, JSON_KEY_MODIFY_TIME);
-    tmp->stTime = value->valuedouble;
-    tmp->next = NULL;
-
-    if (pstFolder->pstFileListFirst) {
-      pstFolder->pstFileListLast->next = tmp;
-      pstFolder->pstFileListLast = tmp;
-    } else {
-      pstFolder->pstFileListFirst = tmp;
-      pstFolder->pstFileListLast = tmp;
+    RKADK_LOGI("Delete file:%s", stVictim[i].filename);
+    if (unlinkat(dirfd[stVictim[i].s32Folder], stVictim[i].filename, 0) &&
+        errno != ENOENT) {
+      RKADK_LOGE("Delete %s file error.", stVictim[i].filename);
+      stVictim[i].s32Folder = -1;
+      continue;
     }
+    deleted++;
+  }
+
+  for (i = 0; i < folderNum; i++)
+    if (dirfd[i] >= 0)
+      close(dirfd[i]);
+  free(dirfd);
+
+  // inotify reports the deletions too, drop them before the next check
+  pthread_mutex_lock(&pHandle->folderMutex);
+  if (u32Gen == pHandle->stDevSta.u32MountGen) {
+    for (i = 0; i < num; i++)
+      if (stVictim[i].s32Folder >= 0)
+        RKADK_STORAGE_FileListDel(
+            &pHandle->stDevSta.pstFolder[stVictim[i].s32Folder],
+            stVictim[i].filename);
+    pHandle->stDevSta.bDeleted = RKADK_TRUE;
+  }
+  pthread_mutex_unlock(&pHandle->folderMutex);
+
+  RKADK_LOGD("Deleted %d/%d files for %lld KB", deleted, num,
+             (long long)(target >> 10));
+  // unlinkat has returned the space and the list is current, check again now
+  if (deleted)
+    RKADK_STORAGE_SpaceCheckAfter(pHandle, 0);
+}
+
+/*
+ * Journals that outgrew their snapshot are compacted here rather than on the
+ * appending thread. The snapshot is written without the folder locks, the
+ * records appended meanwhile are copied after it when it is renamed in.
+ */
+static RKADK_VOID RKADK_STORAGE_CompactJournals(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_S32 i, ret;
+  RKADK_U32 u32Gen;
+  RKADK_STR_FOLDER *folder;
+  RKADK_JOURNAL_SNAPSHOT_S stSnap;
+
+  for (i = 0;; i++) {
+    pthread_mutex_lock(&pHandle->folderMutex);
+    if (!pHandle->stDevSta.pstFolder || i >= pHandle->stDevSta.s32FolderNum) {
+      pthread_mutex_unlock(&pHandle->folderMutex);
+      break;
+    }
+    u32Gen = pHandle->stDevSta.u32MountGen;
+    folder = &pHandle->stDevSta.pstFolder[i];
+    pthread_mutex_lock(&folder->mutex);
+    ret = -1;
+    if (RKADK_JOURNAL_CompactDue(&folder->stJournal))
+      ret = RKADK_JOURNAL_SnapshotTake(&folder->stJournal, &folder->stCatalog,
+                                       &stSnap);
+    pthread_mutex_unlock(&folder->mutex);
+    pthread_mutex_unlock(&pHandle->folderMutex);
+    if (ret)
+      continue;
+
+    RKADK_JOURNAL_SnapshotWrite(&stSnap);
+
+    pthread_mutex_lock(&pHandle->folderMutex);
+    if (u32Gen == pHandle->stDevSta.u32MountGen) {
+      folder = &pHandle->stDevSta.pstFolder[i];
+      pthread_mutex_lock(&folder->mutex);
+      RKADK_JOURNAL_SnapshotCommit(&folder->stJournal, &stSnap);
+      pthread_mutex_unlock(&folder->mutex);
+    }
+    pthread_mutex_unlock(&pHandle->folderMutex);
+    RKADK_JOURNAL_SnapshotFree(&stSnap);
   }
+}
 
-  cJSON_Delete(folder);
-  pthread_mutex_unlock(&pstFolder->mutex);
-  return 0;
+static RKADK_MW_PTR RKADK_STORAGE_DeleteThread(RKADK_MW_PTR arg) {
+  RKADK_STORAGE_HANDLE *pHandle = (RKADK_STORAGE_HANDLE *)arg;
+  RKADK_STR_DELETER *pstDeleter = &pHandle->stDeleter;
+  RKADK_BOOL bDelete;
+  off_t target;
+
+  prctl(PR_SET_NAME, "storage_delete", 0, 0, 0);
+  while (1) {
+    pthread_mutex_lock(&pstDeleter->mutex);
+    while (pstDeleter->s32Run && !pstDeleter->bPending && !pstDeleter->bCompact)
+      pthread_cond_wait(&pstDeleter->cond, &pstDeleter->mutex);
+    target = pstDeleter->target;
+    bDelete = pstDeleter->bPending;
+    pstDeleter->bPending = RKADK_FALSE;
+    pstDeleter->bCompact = RKADK_FALSE;
+    pthread_mutex_unlock(&pstDeleter->mutex);
+
+    if (!pstDeleter->s32Run)
+      break;
+
+    if (bDelete)
+      RKADK_STORAGE_DeleteBatch(pHandle, target);
+
+    // the deletions are journaled too
+    RKADK_STORAGE_CompactJournals(pHandle);
+  }
+
+  RKADK_LOGD("out");
+  return NULL;
 }
 
-static RKADK_S32 RKADK_STORAGE_Repair(RKADK_STORAGE_HANDLE *pHandle, RKADK_STR_DEV_ATTR *pdevAttr)
-{
-  int i;
-  int j;
-  RKADK_S32 ret = 0;
-  RKADK_CHAR file[3 * RKADK_MAX_FILE_PATH_LEN];
+/*
+ * Auto delete, run on file events and on the timer with folderMutex held.
+ * The space the current write rate uses until the next check is reserved on
+ * top of s32FreeSizeDelMin and s32FreeSizeDelMax, and the files to free it
+ * are handed to the delete thread, which checks again when done.
+ * Otherwise the timer is set for when half of the space left above the
+ * reserve will have been written, and stays off while nothing is written.
+ */
+static RKADK_VOID RKADK_STORAGE_SpaceCheck(RKADK_STORAGE_HANDLE *pHandle,
+                                           RKADK_BOOL bActive) {
+  RKADK_STR_DEV_STA *pstDevSta = &pHandle->stDevSta;
+  RKADK_STR_DEV_ATTR *pstDevAttr = &pHandle->stDevAttr;
+  RKADK_S32 i, delay = -1, rate;
+  RKADK_BOOL bDelete = RKADK_FALSE;
+  struct timespec now;
+  long long elapsed, used, low, high;
+  off_t target = 0;
+
+  if (pstDevSta->s32MountStatus != DISK_MOUNTED || !pstDevSta->pstFolder)
+    return;
 
-  for (i = 0; i < pdevAttr->s32FolderNum; i++) {
-    RKADK_STR_FOLDER *folder = &pHandle->stDevSta.pstFolder[i];
-    struct RKADK_STR_FILE *current = NULL;
-    struct RKADK_STR_FILE *next = NULL;
+  if (RKADK_STORAGE_GetDiskSize(pstDevAttr->cMountPath,
+                                &pstDevSta->s32TotalSize,
+                                &pstDevSta->s32FreeSize)) {
+    RKADK_LOGE("GetDiskSize failed");
+    return;
+  }
 
-    pthread_mutex_lock(&folder->mutex);
-    j = 0;
-again:
-    current = folder->pstFileListFirst;
-    if ((current) && (j < REPAIR_FILE_NUM)) {
-      j++;
-      snprintf(file, 3 * RKADK_MAX_FILE_PATH_LEN, "%s%s%s", pdevAttr->cMountPath,
-              pdevAttr->pstFolderAttr[i].cFolderPath,
-              current->filename);
-      if ((current->stSize == 0) || (repair_mp4(file) == REPA_FAIL)) {
-        RKADK_LOGE("Delete %s file. %lld", file, current->stSize);
-        if (remove(file))
-          RKADK_LOGE("Delete %s file error.", file);
-        folder->pstFileListFirst = current->next;
-        free(current);
-        if (folder->pstFileListFirst == NULL)
-          folder->pstFileListLast = NULL;
-        else if (folder->pstFileListFirst->next == NULL)
-          folder->pstFileListLast = folder->pstFileListFirst;
-        folder->s32FileNum--;
-        goto again;
-      }
-    }
-    current = folder->pstFileListFirst;
-
-    for (; j < REPAIR_FILE_NUM && current && current->next; j++) {
-      snprintf(file, 3 * RKADK_MAX_FILE_PATH_LEN, "%s%s%s", pdevAttr->cMountPath,
-              pdevAttr->pstFolderAttr[i].cFolderPath,
-              current->next->filename);
-      if ((current->next->stSize == 0) || (repair_mp4(file) == REPA_FAIL)) {
-        RKADK_LOGE("Delete %s file. %lld", file, current->next->stSize);
-        if (remove(file))
-          RKADK_LOGE("Delete %s file error.", file);
-        next = current->next;
-        current->next = next->next;
-        free(next);
-        if (current->next == NULL)
-          folder->pstFileListLast = current;
-        folder->s32FileNum--;
-      }
-      current = current->next;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - pstDevSta->checkTime.tv_sec) * 1000LL +
+            (now.tv_nsec - pstDevSta->checkTime.tv_nsec) / 1000000;
+  used = pstDevSta->s32CheckFreeSize - pstDevSta->s32FreeSize;
+  if (pstDevSta->checkTime.tv_sec && elapsed < SPACE_RATE_MIN_MS) {
+    // too close to the last check to measure, keep its reference point
+  } else {
+    if (pstDevSta->checkTime.tv_sec && !pstDevSta->bDeleted)
+      pstDevSta->s32WriteRate = used > 0 ? used * 1000 / elapsed : 0;
+    pstDevSta->s32CheckFreeSize = pstDevSta->s32FreeSize;
+    pstDevSta->checkTime = now;
+    pstDevSta->bDeleted = RKADK_FALSE;
+  }
+
+  rate = RKADK_STORAGE_WriteRate(pHandle);
+  low = pstDevAttr->s32FreeSizeDelMin * 1024LL + rate * SPACE_FORECAST_SEC;
+  high = pstDevAttr->s32FreeSizeDelMax * 1024LL + rate * SPACE_FORECAST_SEC;
+
+  if (pstDevSta->s32FreeSize <= low)
+    pstDevSta->s32AutoDel = 1;
+
+  if (pstDevSta->s32FreeSize >= high)
+    pstDevSta->s32AutoDel = 0;
+
+  for (i = 0; i < pstDevSta->s32FolderNum; i++) {
+    if (pstDevAttr->pstFolderAttr[i].bNumLimit == RKADK_TRUE) {
+      pthread_mutex_lock(&pstDevSta->pstFolder[i].mutex);
+      if (pstDevSta->pstFolder[i].stCatalog.s32FileNum >
+          pstDevAttr->pstFolderAttr[i].s32Limit)
+        bDelete = RKADK_TRUE;
+      pthread_mutex_unlock(&pstDevSta->pstFolder[i].mutex);
     }
-    pthread_mutex_unlock(&folder->mutex);
   }
-  sync();
 
-  return ret;
-}
+  if (pstDevSta->s32AutoDel) {
+    target = (off_t)(high - pstDevSta->s32FreeSize) << 10;
+    bDelete = RKADK_TRUE;
+  }
 
-static RKADK_MW_PTR RKADK_STORAGE_FileMonitorThread(RKADK_MW_PTR arg) {
-  RKADK_STORAGE_HANDLE *pHandle = (RKADK_STORAGE_HANDLE *)arg;
-  RKADK_S32 fd;
-  RKADK_S32 len;
-  RKADK_S32 nread;
-  RKADK_CHAR buf[BUFSIZ];
-  struct inotify_event *event;
-  RKADK_S32 j;
+  if (bDelete) {
+    RKADK_STORAGE_DeletePost(pHandle, target);
+    return;
+  }
 
-  if (!pHandle) {
-    RKADK_LOGE("invalid pHandle");
-    return NULL;
+  if (rate > 0) {
+    delay = (pstDevSta->s32FreeSize - low) * 1000 / rate / 2;
+    if (delay < SPACE_CHECK_MIN_MS)
+      delay = SPACE_CHECK_MIN_MS;
+    if (delay > SPACE_CHECK_MAX_MS)
+      delay = SPACE_CHECK_MAX_MS;
+  } else if (bActive) {
+    // a file was opened, measure the rate
+    delay = SPACE_CHECK_MAX_MS;
   }
 
-  prctl(PR_SET_NAME, "RKADK_STORAGE_FileMonitorThread", 0, 0, 0);
-  fd = inotify_init();
-  if (fd < 0) {
-    RKADK_LOGE("inotify_init failed");
-    return NULL;
+  RKADK_STORAGE_SpaceCheckAfter(pHandle, delay);
+}
+
+static RKADK_VOID RKADK_STORAGE_ScanProgress(RKADK_STR_SCAN_CTX *pstCtx,
+                                             RKADK_S32 s32FolderDone,
+                                             RKADK_S32 s32FileNum) {
+  RKADK_STORAGE_HANDLE *pHandle = pstCtx->pHandle;
+  RKADK_S32 totalSize, freeSize;
+  RKADK_SCAN_PROGRESS_CALLBACK_FN pfnCallback =
+      pstCtx->pstDevAttr->pfnScanProgressCallback;
+
+  pthread_mutex_lock(&pstCtx->mutex);
+  pstCtx->stProgress.s32FolderDone += s32FolderDone;
+  pstCtx->stProgress.s32FileNum += s32FileNum;
+
+  // no auto delete until mounted, stop writing before the card fills up
+  if ((s32FolderDone || !s32FileNum) &&
+      !RKADK_STORAGE_GetDiskSize(pstCtx->pstDevAttr->cMountPath, &totalSize,
+                                 &freeSize)) {
+    pHandle->stDevSta.s32TotalSize = totalSize;
+    pHandle->stDevSta.s32FreeSize = freeSize;
+    if (!pHandle->stDevSta.bWritable && freeSize >= pstCtx->s32ReserveSize) {
+      pHandle->stDevSta.bWritable = RKADK_TRUE;
+      RKADK_LOGI("Writable, s32FreeSize = %d", freeSize);
+    } else if (pHandle->stDevSta.bWritable &&
+               freeSize <= pstCtx->pstDevAttr->s32FreeSizeDelMin * 1024) {
+      pHandle->stDevSta.bWritable = RKADK_FALSE;
+      RKADK_LOGW("Not writable until mounted, s32FreeSize = %d", freeSize);
+    }
   }
+  pstCtx->stProgress.bWritable = pHandle->stDevSta.bWritable;
 
-  for (j = 0; j < pHandle->stDevSta.s32FolderNum; j++) {
-    pHandle->stDevSta.pstFolder[j].wd =
-        inotify_add_watch(fd, pHandle->stDevSta.pstFolder[j].cpath,
-                          IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM |
-                              IN_CLOSE_WRITE | IN_UNMOUNT);
+  if (pfnCallback)
+    pfnCallback(pHandle, &pstCtx->stProgress);
+  pthread_mutex_unlock(&pstCtx->mutex);
+}
+
+static RKADK_S32 RKADK_STORAGE_ScanFolder(RKADK_STR_SCAN_CTX *pstCtx,
+                                          RKADK_STR_FOLDER *folder) {
+  RKADK_STORAGE_HANDLE *pHandle = pstCtx->pHandle;
+  DIR *dir;
+  struct dirent *entry;
+  struct stat statbuf;
+  RKADK_S32 cnt = 0, add = 0, del;
+
+  dir = opendir(folder->cpath);
+  if (!dir) {
+    RKADK_LOGE("opendir[%s] failed", folder->cpath);
+    return -1;
   }
 
-  memset(buf, 0, BUFSIZ);
-  while (pHandle->stDevSta.s32MountStatus == DISK_MOUNTED) {
-    if (RKADK_STORAGE_ReadTimeout(fd, 10))
+  while ((entry = readdir(dir)) != NULL) {
+    if (pHandle->stDevSta.s32MountStatus == DISK_UNMOUNTED ||
+        pHandle->stDevSta.s32FsckQuit) {
+      closedir(dir);
+      return -1;
+    }
+
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
       continue;
 
-    len = read(fd, buf, BUFSIZ - 1);
-    nread = 0;
-    while (len > 0) {
-      event = (struct inotify_event *)&buf[nread];
-      if (event->mask & IN_UNMOUNT) {
-        pHandle->stDevSta.s32MountStatus = DISK_UNMOUNTED;
-        //RKADK_STORAGE_ProcessStatus(pHandle, pHandle->stDevSta.s32MountStatus);
-      }
+    if (fstatat(dirfd(dir), entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) ||
+        !S_ISREG(statbuf.st_mode))
+      continue;
 
-      if (event->len > 0) {
-        for (j = 0; j < pHandle->stDevSta.s32FolderNum; j++) {
-          if (event->wd == pHandle->stDevSta.pstFolder[j].wd) {
-            if (event->mask & IN_MOVED_TO) {
-              RKADK_CHAR d_name[RKADK_MAX_FILE_PATH_LEN];
-              struct stat statbuf;
-              sprintf(d_name, "%s%s", pHandle->stDevSta.pstFolder[j].cpath,
-                      event->name);
-              if (lstat(d_name, &statbuf)) {
-                RKADK_LOGE("lstat[%s](IN_MOVED_TO) failed", d_name);
-              } else {
-                if ((RKADK_STORAGE_FileListCheck(&pHandle->stDevSta.pstFolder[j],
-                                              event->name, &statbuf) == 0) &&
-                    RKADK_STORAGE_FileListAdd(&pHandle->stDevSta.pstFolder[j],
-                                                event->name, &statbuf))
-                  RKADK_LOGE("FileListAdd failed");
-              }
-            }
-
-            if ((event->mask & IN_DELETE) || (event->mask & IN_MOVED_FROM))
-              if (RKADK_STORAGE_FileListDel(&pHandle->stDevSta.pstFolder[j],
-                                            event->name))
-                RKADK_LOGE("FileListDel failed");
-
-            if (event->mask & IN_CLOSE_WRITE) {
-              RKADK_CHAR d_name[RKADK_MAX_FILE_PATH_LEN];
-              struct stat statbuf;
-              sprintf(d_name, "%s%s", pHandle->stDevSta.pstFolder[j].cpath,
-                      event->name);
-              if (lstat(d_name, &statbuf)) {
-                RKADK_LOGE("lstat[%s](IN_CLOSE_WRITE) failed", d_name);
-              } else {
-                if (statbuf.st_size == 0) {
-                  if (remove(d_name))
-                    RKADK_LOGE("Delete %s file error.", d_name);
-                } else if ((RKADK_STORAGE_FileListCheck(&pHandle->stDevSta.pstFolder[j],
-                                              event->name, &statbuf) == 0) &&
-                            RKADK_STORAGE_FileListAdd(&pHandle->stDevSta.pstFolder[j],
-                                              event->name, &statbuf)) {
-                  RKADK_LOGE("FileListAdd failed");
-                }
-              }
-            }
-          }
-        }
-      }
+    if (RKADK_STORAGE_FileListScan(folder, entry->d_name, &statbuf) > 0)
+      add++;
 
-      nread = nread + sizeof(struct inotify_event) + event->len;
-      len = len - sizeof(struct inotify_event) - event->len;
-    }
+    if (++cnt % SCAN_PROGRESS_FILE_NUM == 0)
+      RKADK_STORAGE_ScanProgress(pstCtx, 0, SCAN_PROGRESS_FILE_NUM);
+  }
+  closedir(dir);
+
+  del = RKADK_STORAGE_FileListSweep(folder);
+  RKADK_LOGI("%s: %d files, %d new or changed, %d gone", folder->cpath, cnt,
+             add, del);
+
+  RKADK_STORAGE_Repair(folder, pstCtx->startTime);
+  RKADK_STORAGE_ScanProgress(pstCtx, 1, cnt % SCAN_PROGRESS_FILE_NUM);
+  return 0;
+}
+
+static RKADK_MW_PTR RKADK_STORAGE_ScanWorker(RKADK_MW_PTR arg) {
+  RKADK_STR_SCAN_CTX *pstCtx = (RKADK_STR_SCAN_CTX *)arg;
+  RKADK_STORAGE_HANDLE *pHandle = pstCtx->pHandle;
+  RKADK_S32 i;
+
+  while (pHandle->stDevSta.s32MountStatus != DISK_UNMOUNTED &&
+         !pHandle->stDevSta.s32FsckQuit) {
+    pthread_mutex_lock(&pstCtx->mutex);
+    i = pstCtx->s32FolderNext++;
+    pthread_mutex_unlock(&pstCtx->mutex);
+
+    if (i >= pHandle->stDevSta.s32FolderNum)
+      break;
+
+    RKADK_STORAGE_ScanFolder(pstCtx, &pHandle->stDevSta.pstFolder[i]);
   }
 
-  RKADK_LOGD("Exit!");
-  close(fd);
   return NULL;
 }
 
+/*
+ * The card is writable before the folders are scanned. Each worker takes the
+ * next folder, reconciles its catalog with the directory and repairs the
+ * files left open by a power loss.
+ */
+static RKADK_VOID RKADK_STORAGE_ScanFolders(RKADK_STORAGE_HANDLE *pHandle,
+                                            RKADK_STR_DEV_ATTR *pdevAttr) {
+  RKADK_S32 i, num;
+  pthread_t tid[SCAN_THREAD_MAX];
+  RKADK_STR_SCAN_CTX stCtx;
+  struct timespec start, end;
+
+  memset(&stCtx, 0, sizeof(stCtx));
+  memset(tid, 0, sizeof(tid));
+  stCtx.pHandle = pHandle;
+  stCtx.pstDevAttr = pdevAttr;
+  stCtx.s32ReserveSize = (pdevAttr->s32ScanReserveSize > 0
+                              ? pdevAttr->s32ScanReserveSize
+                              : pdevAttr->s32FreeSizeDelMax) * 1024;
+  stCtx.startTime = time(NULL);
+  stCtx.stProgress.s32FolderNum = pHandle->stDevSta.s32FolderNum;
+  pthread_mutex_init(&stCtx.mutex, NULL);
+
+  num = pdevAttr->s32ScanThreadNum > 0 ? pdevAttr->s32ScanThreadNum
+                                       : SCAN_THREAD_NUM;
+  if (num > SCAN_THREAD_MAX)
+    num = SCAN_THREAD_MAX;
+  if (num > pHandle->stDevSta.s32FolderNum)
+    num = pHandle->stDevSta.s32FolderNum;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  RKADK_STORAGE_ScanProgress(&stCtx, 0, 0);
+
+  // this thread is worker 0
+  for (i = 1; i < num; i++) {
+    if (pthread_create(&tid[i], NULL, RKADK_STORAGE_ScanWorker,
+                       (RKADK_MW_PTR)&stCtx)) {
+      RKADK_LOGE("ScanWorker create failed.");
+      tid[i] = 0;
+    }
+  }
+  RKADK_STORAGE_ScanWorker(&stCtx);
+
+  for (i = 1; i < num; i++)
+    if (tid[i] && pthread_join(tid[i], NULL))
+      RKADK_LOGE("ScanWorker join failed.");
+
+  pthread_mutex_destroy(&stCtx.mutex);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  RKADK_LOGI("Scanned %d files in %d/%d folders, %d threads, %ld ms",
+             stCtx.stProgress.s32FileNum, stCtx.stProgress.s32FolderDone,
+             stCtx.stProgress.s32FolderNum, num,
+             (end.tv_sec - start.tv_sec) * 1000 +
+                 (end.tv_nsec - start.tv_nsec) / 1000000);
+}
+
 static RKADK_MW_PTR RKADK_STORAGE_FileScanThread(RKADK_MW_PTR arg) {
   RKADK_STORAGE_HANDLE *pHandle = (RKADK_STORAGE_HANDLE *)arg;
-  RKADK_S32 cnt = 0;
   RKADK_S32 i;
-  pthread_t fileMonitorTid = 0;
+  RKADK_STR_FOLDER *pstFolder;
   RKADK_STR_DEV_ATTR devAttr;
   RKFSCK_RET_TYPE fsck_ret;
+  RKADK_CHAR journal[2 * RKADK_MAX_FILE_PATH_LEN];
 
   if (!pHandle) {
     RKADK_LOGE("invalid pHandle");
@@ -811,27 +1071,47 @@ static RKADK_MW_PTR RKADK_STORAGE_FileScanThread(RKADK_MW_PTR arg) {
              pHandle->stDevSta.cDevType, pHandle->stDevSta.cDevAttr1);
 
   RKADK_LOGI("devAttr.s32FolderNum = %d", devAttr.s32FolderNum);
-  pHandle->stDevSta.s32FolderNum = devAttr.s32FolderNum;
-  pHandle->stDevSta.pstFolder = (RKADK_STR_FOLDER *)malloc(
+  pstFolder = (RKADK_STR_FOLDER *)malloc(
       sizeof(RKADK_STR_FOLDER) * devAttr.s32FolderNum);
 
-  if (!pHandle->stDevSta.pstFolder) {
+  if (!pstFolder) {
     RKADK_LOGE("pHandle->stDevSta.pstFolder malloc failed.");
     return NULL;
   }
-  memset(pHandle->stDevSta.pstFolder, 0,
-          sizeof(RKADK_STR_FOLDER) * devAttr.s32FolderNum);
+  memset(pstFolder, 0, sizeof(RKADK_STR_FOLDER) * devAttr.s32FolderNum);
+  for (i = 0; i < devAttr.s32FolderNum; i++) {
+    pstFolder[i].wd = -1;
+    RKADK_STORAGE_JournalPath(devAttr.cMountPath,
+                              devAttr.pstFolderAttr[i].cFolderPath, journal,
+                              sizeof(journal));
+    RKADK_JOURNAL_Init(&pstFolder[i].stJournal, journal);
+  }
+
+  // freed by RKADK_STORAGE_FolderDeinit after this thread is joined
+  pthread_mutex_lock(&pHandle->folderMutex);
+  pHandle->stDevSta.pstFolder = pstFolder;
+  pHandle->stDevSta.s32FolderNum = devAttr.s32FolderNum;
+  pthread_mutex_unlock(&pHandle->folderMutex);
+
   for (i = 0; i < pHandle->stDevSta.s32FolderNum; i++) {
     sprintf(pHandle->stDevSta.pstFolder[i].cpath, "%s%s", devAttr.cMountPath,
             devAttr.pstFolderAttr[i].cFolderPath);
     RKADK_LOGI("%s", pHandle->stDevSta.pstFolder[i].cpath);
 
     pthread_mutex_init(&(pHandle->stDevSta.pstFolder[i].mutex), NULL);
+    if (RKADK_CATALOG_Init(&pHandle->stDevSta.pstFolder[i].stCatalog)) {
+      RKADK_LOGE("Catalog init failed");
+      goto file_scan_out;
+    }
     if (pHandle->stDevSta.s32MountStatus != DISK_UNMOUNTED) {
       if (RKADK_STORAGE_CreateFolder(pHandle->stDevSta.pstFolder[i].cpath)) {
         RKADK_LOGE("CreateFolder failed");
         goto file_scan_out;
       }
+
+      // read before the fsck unmounts the card
+      RKADK_JOURNAL_Load(&pHandle->stDevSta.pstFolder[i].stJournal,
+                         &pHandle->stDevSta.pstFolder[i].stCatalog);
     }
   }
 
@@ -844,176 +1124,105 @@ static RKADK_MW_PTR RKADK_STORAGE_FileScanThread(RKADK_MW_PTR arg) {
     goto file_scan_out;
   }
 
-  RKADK_STORAGE_Repair(pHandle, &devAttr);
-
-  if (pHandle->stDevSta.s32MountStatus == DISK_UNMOUNTED) {
+  if (pHandle->stDevSta.s32MountStatus == DISK_UNMOUNTED)
     goto file_scan_out;
-  } else {
-    pHandle->stDevSta.s32MountStatus = DISK_MOUNTED;
-    RKADK_STORAGE_ProcessStatus(pHandle, pHandle->stDevSta.s32MountStatus);
-  }
 
+  for (i = 0; i < pHandle->stDevSta.s32FolderNum; i++) {
+    RKADK_STR_FOLDER *folder = &pHandle->stDevSta.pstFolder[i];
 
-  if (pHandle->stDevSta.s32MountStatus != DISK_UNMOUNTED) {
-    if (RKADK_STORAGE_GetDiskSize(devAttr.cMountPath,
-                                  &pHandle->stDevSta.s32TotalSize,
-                                  &pHandle->stDevSta.s32FreeSize)) {
-      RKADK_LOGE("GetDiskSize failed");
-      return NULL;
-    }
-  } else {
-    pHandle->stDevSta.s32TotalSize = 0;
-    pHandle->stDevSta.s32FreeSize = 0;
+    pthread_mutex_lock(&folder->mutex);
+    if (RKADK_JOURNAL_Open(&folder->stJournal, &folder->stCatalog) < 0)
+      RKADK_LOGW("%s: catalog is not persisted", folder->cpath);
+    pthread_mutex_unlock(&folder->mutex);
   }
-  RKADK_LOGI("s32TotalSize = %d, s32FreeSize = %d",
-             pHandle->stDevSta.s32TotalSize, pHandle->stDevSta.s32FreeSize);
 
-  if (pthread_create(&fileMonitorTid, NULL, RKADK_STORAGE_FileMonitorThread,
-                     (RKADK_MW_PTR)pHandle)) {
-    RKADK_LOGE("FileMonitorThread create failed.");
-    goto file_scan_out;
+  // files recorded while scanning are caught by the event loop
+  pthread_mutex_lock(&pHandle->folderMutex);
+  for (i = 0; i < pHandle->stDevSta.s32FolderNum; i++) {
+    pHandle->stDevSta.pstFolder[i].wd =
+        inotify_add_watch(pHandle->stLoop.s32InotifyFd,
+                          pHandle->stDevSta.pstFolder[i].cpath, INOTIFY_MASK);
+    if (pHandle->stDevSta.pstFolder[i].wd < 0)
+      RKADK_LOGE("inotify_add_watch[%s] failed",
+                 pHandle->stDevSta.pstFolder[i].cpath);
   }
+  pthread_mutex_unlock(&pHandle->folderMutex);
 
-  while (pHandle->stDevSta.s32MountStatus == DISK_MOUNTED) {
-    if (cnt++ > 50) {
-      RKADK_S32 limit;
-      off_t totalSpace = 0;
-      cnt = 0;
-      for (i = 0; i < devAttr.s32FolderNum; i++) {
-        if (devAttr.pstFolderAttr[i].bNumLimit == RKADK_TRUE) {
-          RKADK_CHAR file[3 * RKADK_MAX_FILE_PATH_LEN];
-
-          pthread_mutex_lock(&pHandle->stDevSta.pstFolder[i].mutex);
-          limit = pHandle->stDevSta.pstFolder[i].s32FileNum;
-          if (limit > devAttr.pstFolderAttr[i].s32Limit) {
-            if (pHandle->stDevSta.pstFolder[i].pstFileListLast) {
-              sprintf(
-                  file, "%s%s%s", devAttr.cMountPath,
-                  devAttr.pstFolderAttr[i].cFolderPath,
-                  pHandle->stDevSta.pstFolder[i].pstFileListLast->filename);
-              RKADK_LOGI("Delete file:%s", file);
-              pthread_mutex_unlock(&pHandle->stDevSta.pstFolder[i].mutex);
-
-              if (remove(file)) {
-                RKADK_CHAR filename[RKADK_MAX_FILE_PATH_LEN];
-                snprintf(filename, RKADK_MAX_FILE_PATH_LEN, "%s",
-                    pHandle->stDevSta.pstFolder[i].pstFileListLast->filename);
-                RKADK_STORAGE_FileListDel(&pHandle->stDevSta.pstFolder[i],
-                                            filename);
-                RKADK_LOGE("Delete %s file error.", file);
-              }
-              usleep(100);
-              cnt = 51;
-              continue;
-            }
-          }
-          pthread_mutex_unlock(&pHandle->stDevSta.pstFolder[i].mutex);
-        }
-      }
-
-      if (RKADK_STORAGE_GetDiskSize(devAttr.cMountPath,
-                                    &pHandle->stDevSta.s32TotalSize,
-                                    &pHandle->stDevSta.s32FreeSize)) {
-        RKADK_LOGE("GetDiskSize failed");
-        goto file_scan_out;
-      }
+  RKADK_STORAGE_ScanFolders(pHandle, &devAttr);
 
-      if (pHandle->stDevSta.s32FreeSize <= (devAttr.s32FreeSizeDelMin * 1024))
-        devAttr.s32AutoDel = 1;
+  if (pHandle->stDevSta.s32MountStatus == DISK_UNMOUNTED ||
+      pHandle->stDevSta.s32FsckQuit)
+    goto file_scan_out;
 
-      if (pHandle->stDevSta.s32FreeSize >= (devAttr.s32FreeSizeDelMax * 1024))
-        devAttr.s32AutoDel = 0;
+  pHandle->stDevSta.s32AutoDel = devAttr.s32AutoDel;
+  memset(&pHandle->stDevSta.checkTime, 0, sizeof(struct timespec));
+  pHandle->stDevSta.bWritable = RKADK_TRUE;
+  pHandle->stDevSta.s32MountStatus = DISK_MOUNTED;
+  RKADK_STORAGE_ProcessStatus(pHandle, pHandle->stDevSta.s32MountStatus);
+  RKADK_LOGI("s32TotalSize = %d, s32FreeSize = %d",
+             pHandle->stDevSta.s32TotalSize, pHandle->stDevSta.s32FreeSize);
 
-      if (devAttr.s32AutoDel) {
-        for (i = 0; i < devAttr.s32FolderNum; i++) {
-          pthread_mutex_lock(&pHandle->stDevSta.pstFolder[i].mutex);
-          if (devAttr.pstFolderAttr[i].bNumLimit == RKADK_FALSE)
-            totalSpace += pHandle->stDevSta.pstFolder[i].totalSpace;
-          pthread_mutex_unlock(&pHandle->stDevSta.pstFolder[i].mutex);
-        }
-        if (totalSpace) {
-          for (i = 0; i < devAttr.s32FolderNum; i++) {
-            if (devAttr.pstFolderAttr[i].bNumLimit == RKADK_FALSE) {
-              RKADK_CHAR file[3 * RKADK_MAX_FILE_PATH_LEN];
-              pthread_mutex_lock(&pHandle->stDevSta.pstFolder[i].mutex);
-              limit =
-                  pHandle->stDevSta.pstFolder[i].totalSpace * 100 / totalSpace;
-              if (limit > devAttr.pstFolderAttr[i].s32Limit) {
-                if (pHandle->stDevSta.pstFolder[i].pstFileListLast) {
-                  sprintf(
-                      file, "%s%s%s", devAttr.cMountPath,
-                      devAttr.pstFolderAttr[i].cFolderPath,
-                      pHandle->stDevSta.pstFolder[i].pstFileListLast->filename);
-                  RKADK_LOGI("Delete file:%s", file);
-                  pthread_mutex_unlock(&pHandle->stDevSta.pstFolder[i].mutex);
-
-                  if (remove(file)) {
-                    RKADK_CHAR filename[RKADK_MAX_FILE_PATH_LEN];
-                    snprintf(filename, RKADK_MAX_FILE_PATH_LEN, "%s",
-                        pHandle->stDevSta.pstFolder[i].pstFileListLast->filename);
-                    RKADK_STORAGE_FileListDel(&pHandle->stDevSta.pstFolder[i],
-                                            filename);
-                    RKADK_LOGE("Delete %s file error.", file);
-                  }
-                  usleep(100);
-                  cnt = 51;
-                  continue;
-                }
-              }
-              pthread_mutex_unlock(&pHandle->stDevSta.pstFolder[i].mutex);
-            }
-          }
-        }
-      }
-    }
-    usleep(10000);
-  }
+  // a scan can leave a journal to compact
+  pthread_mutex_lock(&pHandle->folderMutex);
+  RKADK_STORAGE_CompactPost(pHandle);
+  pthread_mutex_unlock(&pHandle->folderMutex);
+
+  // auto delete runs on the event loop from now on
+  RKADK_STORAGE_SpaceCheckAfter(pHandle, 0);
+  return NULL;
 
 file_scan_out:
-  if (fileMonitorTid)
-    if (pthread_join(fileMonitorTid, NULL))
-      RKADK_LOGE("FileMonitorThread join failed.");
+  pHandle->stDevSta.bWritable = RKADK_FALSE;
   RKADK_LOGD("out");
+  return NULL;
+}
+
+// called with mountMutex held
+static RKADK_VOID RKADK_STORAGE_FolderDeinit(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_S32 i;
+
+  if (pHandle->stDevSta.fileScanTid) {
+    pHandle->stDevSta.s32FsckQuit = 1;
+    if (pthread_join(pHandle->stDevSta.fileScanTid, NULL))
+      RKADK_LOGE("FileScanThread join failed.");
+    pHandle->stDevSta.fileScanTid = 0;
+  }
 
+  pthread_mutex_lock(&pHandle->folderMutex);
   if (pHandle->stDevSta.pstFolder) {
+    for (i = 0; i < pHandle->stDevSta.s32FolderNum; i++) {
+      RKADK_STR_FOLDER *folder = &pHandle->stDevSta.pstFolder[i];
+
+      if (folder->wd >= 0)
+        inotify_rm_watch(pHandle->stLoop.s32InotifyFd, folder->wd);
+      pthread_mutex_lock(&folder->mutex);
+      RKADK_JOURNAL_Close(&folder->stJournal);
+      RKADK_CATALOG_Deinit(&folder->stCatalog);
+      pthread_mutex_unlock(&folder->mutex);
+    }
     free(pHandle->stDevSta.pstFolder);
     pHandle->stDevSta.pstFolder = NULL;
   }
   pHandle->stDevSta.s32FolderNum = 0;
-
-  return NULL;
-}
-
-static void cb(void *userdata, char *filename, int dir, struct stat *statbuf)
-{
-    if (dir == 0) {
-        RKADK_STR_FOLDER *pstFolder = (RKADK_STR_FOLDER *)userdata;
-        RKADK_STORAGE_FileListAdd(pstFolder, filename, statbuf);
-    }
+  pHandle->stDevSta.bWritable = RKADK_FALSE;
+  pHandle->stDevSta.s32WriteRate = 0;
+  pHandle->stDevSta.u32MountGen++;
+  pthread_mutex_unlock(&pHandle->folderMutex);
+  RKADK_STORAGE_SpaceCheckAfter(pHandle, -1);
 }
 
 static RKADK_S32 RKADK_STORAGE_RKFSCK(RKADK_STORAGE_HANDLE *pHandle, RKADK_STR_DEV_ATTR *pdevAttr)
 {
-  int i;
   RKADK_S32 ret = 0;
   struct reg_para para;
 
-  para.folder_num = 4;
-  para.folder = (struct folder_para *)malloc(sizeof(struct folder_para) * para.folder_num);
-  if (para.folder == NULL) {
-    RKADK_LOGE("malloc para.folder failed!");
-    return -1;
-  }
-
+  memset(&para, 0, sizeof(para));
+  para.folder_num = 0;
+  para.folder = NULL;
   memcpy(para.format_id, pdevAttr->cFormatId, RKADK_MAX_FORMAT_ID_LEN);
   para.check_format_id = pdevAttr->s32CheckFormatId;
   para.quit = &pHandle->stDevSta.s32FsckQuit;
   pHandle->stDevSta.s32FsckQuit = 0;
-  for (i = 0; i < para.folder_num; i ++) {
-    para.folder[i].path = pdevAttr->pstFolderAttr[i].cFolderPath;
-    para.folder[i].userdata = &pHandle->stDevSta.pstFolder[i];
-    para.folder[i].cb = &cb;
-  }
 
   umount2(pHandle->stDevAttr.cMountPath, MNT_DETACH);
   ret = rkfsmk_fat_check(pHandle->stDevSta.cDevPath, &para);
@@ -1023,8 +1232,9 @@ static RKADK_S32 RKADK_STORAGE_RKFSCK(RKADK_STORAGE_HANDLE *pHandle, RKADK_STR_D
   return ret;
 }
 
-static RKADK_S32 RKADK_STORAGE_DevAdd(RKADK_CHAR *dev,
-                                      RKADK_STORAGE_HANDLE *pHandle) {
+// called with mountMutex held
+static RKADK_S32 RKADK_STORAGE_DevMount(RKADK_CHAR *dev,
+                                        RKADK_STORAGE_HANDLE *pHandle) {
   RKADK_S32 ret;
   RKADK_STR_DEV_ATTR stDevAttr;
   RKADK_CHAR mountPath[RKADK_MAX_FILE_PATH_LEN];
@@ -1075,234 +1285,53 @@ static RKADK_S32 RKADK_STORAGE_DevAdd(RKADK_CHAR *dev,
   pHandle->stDevSta.s32MountStatus = DISK_SCANNING;
   RKADK_STORAGE_ProcessStatus(pHandle, pHandle->stDevSta.s32MountStatus);
   if (pthread_create(&pHandle->stDevSta.fileScanTid, NULL,
-                     RKADK_STORAGE_FileScanThread, (RKADK_MW_PTR)pHandle))
+                     RKADK_STORAGE_FileScanThread, (RKADK_MW_PTR)pHandle)) {
     RKADK_LOGE("FileScanThread create failed.");
+    pHandle->stDevSta.fileScanTid = 0;
+  }
 
   return 0;
 }
 
+static RKADK_S32 RKADK_STORAGE_DevAdd(RKADK_CHAR *dev,
+                                      RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_S32 ret = 0;
+
+  RKADK_CHECK_POINTER(dev, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+
+  pthread_mutex_lock(&pHandle->mountMutex);
+  if (pHandle->stDevSta.fileScanTid &&
+      (pHandle->stDevSta.s32MountStatus == DISK_SCANNING ||
+       pHandle->stDevSta.s32MountStatus == DISK_MOUNTED)) {
+    RKADK_LOGI("%s is already mounted", dev);
+  } else {
+    RKADK_STORAGE_FolderDeinit(pHandle);
+    ret = RKADK_STORAGE_DevMount(dev, pHandle);
+  }
+  pthread_mutex_unlock(&pHandle->mountMutex);
+
+  return ret;
+}
+
 static RKADK_S32 RKADK_STORAGE_DevRemove(RKADK_CHAR *dev,
                                          RKADK_STORAGE_HANDLE *pHandle) {
   RKADK_CHECK_POINTER(dev, RKADK_FAILURE);
   RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
 
+  pthread_mutex_lock(&pHandle->mountMutex);
   if (!strcmp(pHandle->stDevSta.cDevPath, dev)) {
     pHandle->stDevSta.s32MountStatus = DISK_UNMOUNTED;
+    pHandle->stDevSta.bWritable = RKADK_FALSE;
     RKADK_STORAGE_ProcessStatus(pHandle, pHandle->stDevSta.s32MountStatus);
     pHandle->stDevSta.s32TotalSize = 0;
     pHandle->stDevSta.s32FreeSize = 0;
     pHandle->stDevSta.s32FsckQuit = 1;
 
-    if (pHandle->stDevSta.fileScanTid) {
-      if (pthread_join(pHandle->stDevSta.fileScanTid, NULL))
-        RKADK_LOGE("FileScanThread join failed.");
-      pHandle->stDevSta.fileScanTid = 0;
-    }
+    RKADK_STORAGE_FolderDeinit(pHandle);
     umount2(pHandle->stDevAttr.cMountPath, MNT_DETACH);
   }
-
-  return 0;
-}
-
-static RKADK_S32 RKADK_STORAGE_MsgPutMsgToBuffer(RKADK_TMSG_BUFFER *buf,
-                                                 struct RKADK_TMSG_ELEMENT *elm) {
-  RKADK_CHECK_POINTER(buf, RKADK_FAILURE);
-  RKADK_CHECK_POINTER(elm, RKADK_FAILURE);
-
-  if (NULL != elm->next)
-    elm->next = NULL;
-
-  pthread_mutex_lock(&buf->mutex);
-  if (buf->first) {
-    struct RKADK_TMSG_ELEMENT *tmp = buf->first;
-    while (tmp->next != NULL) {
-      tmp = tmp->next;
-    }
-    tmp->next = elm;
-  } else {
-    buf->first = elm;
-  }
-  buf->num++;
-
-  pthread_cond_signal(&buf->notEmpty);
-  pthread_mutex_unlock(&buf->mutex);
-  return 0;
-}
-
-static struct RKADK_TMSG_ELEMENT *
-RKADK_STORAGE_MsgGetMsgFromBufferTimeout(RKADK_TMSG_BUFFER *buf,
-                                         RKADK_S32 s32TimeoutMs) {
-  struct RKADK_TMSG_ELEMENT *elm = NULL;
-  struct timeval timeNow;
-  struct timespec timeout;
-
-  if (!buf) {
-    return NULL;
-  }
-
-  pthread_mutex_lock(&buf->mutex);
-  if (0 == buf->num) {
-    gettimeofday(&timeNow, NULL);
-    timeout.tv_sec = timeNow.tv_sec + s32TimeoutMs / 1000;
-    timeout.tv_nsec = (timeNow.tv_usec + (s32TimeoutMs % 1000) * 1000) * 1000;
-    pthread_cond_timedwait(&buf->notEmpty, &buf->mutex, &timeout);
-  }
-
-  if (buf->num > 0) {
-    elm = buf->first;
-    if (1 == buf->num) {
-      buf->first = buf->last = NULL;
-      buf->num = 0;
-    } else {
-      buf->first = buf->first->next;
-      buf->num--;
-    }
-  }
-
-  pthread_mutex_unlock(&buf->mutex);
-  return elm;
-}
-
-static RKADK_S32 RKADK_STORAGE_MsgFreeMsg(struct RKADK_TMSG_ELEMENT *elm) {
-  RKADK_CHECK_POINTER(elm, RKADK_FAILURE);
-
-  if (elm->data != NULL) {
-    free(elm->data);
-    elm->data = NULL;
-  }
-  free(elm);
-  elm = NULL;
-
-  return 0;
-}
-
-static RKADK_MW_PTR RKADK_STORAGE_MsgRecMsgThread(RKADK_MW_PTR arg) {
-  RKADK_TMSG_BUFFER *msgBuffer = (RKADK_TMSG_BUFFER *)arg;
-
-  if (!msgBuffer) {
-    RKADK_LOGE("invalid msgBuffer");
-    return NULL;
-  }
-
-  prctl(PR_SET_NAME, "RKADK_STORAGE_MsgRecMsgThread", 0, 0, 0);
-  while (msgBuffer->quit == 0) {
-    struct RKADK_TMSG_ELEMENT *elm =
-        RKADK_STORAGE_MsgGetMsgFromBufferTimeout(msgBuffer, 50);
-
-    if (elm) {
-      if (msgBuffer->recMsgCb)
-        msgBuffer->recMsgCb(msgBuffer, elm->msg, elm->data, elm->s32DataLen,
-                            msgBuffer->pHandlePath);
-      if (RKADK_STORAGE_MsgFreeMsg(elm))
-        RKADK_LOGE("Free msg failed.");
-    }
-  }
-
-  RKADK_LOGD("out");
-  return NULL;
-}
-
-static RKADK_S32 RKADK_STORAGE_MsgRecCb(RKADK_MW_PTR hd, RKADK_S32 msg,
-                                        RKADK_MW_PTR data, RKADK_S32 s32DataLen,
-                                        RKADK_MW_PTR pHandle) {
-  RKADK_LOGI("msg = %d", msg);
-  switch (msg) {
-  case MSG_DEV_ADD:
-    if (RKADK_STORAGE_DevAdd((RKADK_CHAR *)data,
-                             (RKADK_STORAGE_HANDLE *)pHandle)) {
-      RKADK_LOGE("DevAdd failed");
-      return -1;
-    }
-    break;
-  case MSG_DEV_REMOVE:
-    if (RKADK_STORAGE_DevRemove((RKADK_CHAR *)data,
-                                (RKADK_STORAGE_HANDLE *)pHandle)) {
-      RKADK_LOGE("DevRemove failed");
-      return -1;
-    }
-    break;
-  case MSG_DEV_CHANGED:
-    break;
-  }
-
-  return 0;
-}
-
-static RKADK_S32 RKADK_STORAGE_MsgCreate(RKADK_REC_MSG_CB recMsgCb,
-                                         RKADK_STORAGE_HANDLE *pHandle) {
-  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
-
-  pHandle->stMsgHd.first = NULL;
-  pHandle->stMsgHd.last = NULL;
-  pHandle->stMsgHd.num = 0;
-  pHandle->stMsgHd.quit = 0;
-  pHandle->stMsgHd.recMsgCb = recMsgCb;
-  pHandle->stMsgHd.pHandlePath = (RKADK_MW_PTR)pHandle;
-
-  pthread_mutex_init(&(pHandle->stMsgHd.mutex), NULL);
-  pthread_cond_init(&(pHandle->stMsgHd.notEmpty), NULL);
-  if (pthread_create(&(pHandle->stMsgHd.recTid), NULL,
-                     RKADK_STORAGE_MsgRecMsgThread,
-                     (RKADK_MW_PTR)(&pHandle->stMsgHd))) {
-    RKADK_LOGE("RecMsgThread create failed!");
-    return -1;
-  }
-
-  return 0;
-}
-
-static RKADK_S32 RKADK_STORAGE_MsgDestroy(RKADK_STORAGE_HANDLE *pHandle) {
-  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
-
-  pHandle->stMsgHd.quit = 1;
-  if (pHandle->stMsgHd.recTid)
-    if (pthread_join(pHandle->stMsgHd.recTid, NULL)) {
-      RKADK_LOGE("RecMsgThread join failed!");
-      return -1;
-    }
-
-  return 0;
-}
-
-static RKADK_S32 RKADK_STORAGE_MsgSendMsg(RKADK_S32 msg, RKADK_CHAR *data,
-                                          RKADK_S32 s32DataLen,
-                                          RKADK_TMSG_BUFFER *buf) {
-  struct RKADK_TMSG_ELEMENT *elm = NULL;
-
-  RKADK_CHECK_POINTER(buf, RKADK_FAILURE);
-  RKADK_CHECK_POINTER(data, RKADK_FAILURE);
-
-  elm = (struct RKADK_TMSG_ELEMENT *)malloc(sizeof(struct RKADK_TMSG_ELEMENT));
-  if (!elm) {
-    RKADK_LOGE("elm malloc failed.");
-    return -1;
-  }
-
-  memset(elm, 0, sizeof(struct RKADK_TMSG_ELEMENT));
-  elm->msg = msg;
-  elm->data = NULL;
-  elm->s32DataLen = s32DataLen;
-
-  if (data && s32DataLen > 0) {
-    elm->data = (RKADK_CHAR *)malloc(s32DataLen);
-    if (!elm->data) {
-      RKADK_LOGE("elm->data malloc failed.");
-      free(elm);
-      return -1;
-    }
-    memset(elm->data, 0, s32DataLen);
-    memcpy(elm->data, data, s32DataLen);
-  }
-
-  elm->next = NULL;
-
-  if (RKADK_STORAGE_MsgPutMsgToBuffer(buf, elm)) {
-    if (!elm->data)
-      free(elm->data);
-    free(elm);
-    RKADK_LOGE("Put msg to buffer failed.");
-    return -1;
-  }
+  pthread_mutex_unlock(&pHandle->mountMutex);
 
   return 0;
 }
@@ -1335,86 +1364,118 @@ static RKADK_CHAR *RKADK_STORAGE_Getparameters(RKADK_CHAR *buf, RKADK_S32 len,
   return ret;
 }
 
-static RKADK_MW_PTR RKADK_STORAGE_EventListenerThread(RKADK_MW_PTR arg) {
-  RKADK_STORAGE_HANDLE *pHandle = (RKADK_STORAGE_HANDLE *)arg;
-  RKADK_S32 sockfd;
+static RKADK_VOID RKADK_STORAGE_UeventRead(RKADK_STORAGE_HANDLE *pHandle) {
   RKADK_S32 len;
-  RKADK_S32 bufLen = 2000;
-  RKADK_CHAR buf[bufLen];
-  struct iovec iov;
-  struct msghdr msg;
-  struct sockaddr_nl sa;
-  struct timeval timeout;
+  RKADK_CHAR buf[UEVENT_BUF_LEN];
 
-  if (!pHandle) {
-    RKADK_LOGE("invalid pHandle");
-    return NULL;
+  while ((len = recv(pHandle->stLoop.s32UeventFd, buf, UEVENT_BUF_LEN - 1,
+                     MSG_DONTWAIT)) >= 0) {
+    if (len < MAX_TYPE_NMSG_LEN) {
+      RKADK_LOGW("invalid message");
+      continue;
+    }
+    buf[len] = '\0';
+
+    RKADK_CHAR *p = strstr(buf, "libudev");
+
+    if (p == buf) {
+      if (RKADK_STORAGE_Search(buf, len, "DEVTYPE=partition") ||
+          RKADK_STORAGE_Search(buf, len, "DEVTYPE=disk")) {
+        RKADK_CHAR *dev = RKADK_STORAGE_Getparameters(buf, len, "DEVNAME");
+
+        if (!dev)
+          continue;
+
+        if (RKADK_STORAGE_Search(buf, len, "ACTION=add")) {
+          if (RKADK_STORAGE_DevAdd(dev, pHandle))
+            RKADK_LOGE("DevAdd failed");
+        } else if (RKADK_STORAGE_Search(buf, len, "ACTION=remove")) {
+          RKADK_LOGI("%s remove", dev);
+          if (RKADK_STORAGE_DevRemove(dev, pHandle))
+            RKADK_LOGE("DevRemove failed");
+        } else if (RKADK_STORAGE_Search(buf, len, "ACTION=change")) {
+          RKADK_LOGI("%s change", dev);
+        }
+      }
+    }
   }
 
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 100000;
-  prctl(PR_SET_NAME, "event_monitor", 0, 0, 0);
+  if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    RKADK_LOGE("recv uevent failed: %s", strerror(errno));
+}
+
+static RKADK_VOID RKADK_STORAGE_InotifyRead(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_S32 len;
+  RKADK_CHAR *p;
+  RKADK_CHAR buf[BUFSIZ]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *event;
+  RKADK_BOOL bCheck = RKADK_FALSE, bUnmount = RKADK_FALSE;
 
-  sa.nl_family = AF_NETLINK;
-  sa.nl_groups = NETLINK_KOBJECT_UEVENT;
-  sa.nl_pid = 0;
-  iov.iov_base = (RKADK_MW_PTR)buf;
-  iov.iov_len = bufLen;
-  memset(&msg, 0, sizeof(msg));
-  msg.msg_name = (RKADK_MW_PTR)&sa;
-  msg.msg_namelen = sizeof(sa);
-  msg.msg_iov = &iov;
-  msg.msg_iovlen = 1;
-  sockfd = socket(AF_NETLINK, SOCK_RAW, NETLINK_KOBJECT_UEVENT);
-  if (sockfd == -1) {
-    RKADK_LOGE("socket creating failed:%s", strerror(errno));
-    return NULL;
+  pthread_mutex_lock(&pHandle->folderMutex);
+  while ((len = read(pHandle->stLoop.s32InotifyFd, buf, BUFSIZ)) > 0) {
+    for (p = buf; p < buf + len;
+         p += sizeof(struct inotify_event) + event->len) {
+      event = (struct inotify_event *)p;
+      if (event->mask & IN_UNMOUNT)
+        bUnmount = RKADK_TRUE;
+
+      if (event->mask & IN_Q_OVERFLOW)
+        RKADK_LOGW("inotify queue overflow, file lists may be stale");
+
+      if (event->len > 0 && RKADK_STORAGE_FileEvent(pHandle, event))
+        bCheck = RKADK_TRUE;
+    }
   }
 
-  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (RKADK_MW_PTR)&timeout,
-             (socklen_t)sizeof(struct timeval));
+  if (bCheck && !bUnmount)
+    RKADK_STORAGE_SpaceCheck(pHandle, RKADK_TRUE);
+  if (!bUnmount)
+    RKADK_STORAGE_CompactPost(pHandle);
+  pthread_mutex_unlock(&pHandle->folderMutex);
 
-  if (bind(sockfd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
-    RKADK_LOGE("bind error:%s", strerror(errno));
-    goto err_event_listener;
+  if (bUnmount) {
+    pthread_mutex_lock(&pHandle->mountMutex);
+    pHandle->stDevSta.s32MountStatus = DISK_UNMOUNTED;
+    RKADK_STORAGE_FolderDeinit(pHandle);
+    pthread_mutex_unlock(&pHandle->mountMutex);
   }
+}
 
-  while (pHandle->eventListenerRun) {
-    len = recvmsg(sockfd, &msg, 0);
-    if (len < 0) {
-      // RKADK_LOGW("receive time out");
-    } else if (len < MAX_TYPE_NMSG_LEN || len > bufLen) {
-      RKADK_LOGW("invalid message");
-    } else {
-      RKADK_CHAR *p = strstr(buf, "libudev");
-
-      if (p == buf) {
-        if (RKADK_STORAGE_Search(buf, len, "DEVTYPE=partition") ||
-            RKADK_STORAGE_Search(buf, len, "DEVTYPE=disk")) {
-          RKADK_CHAR *dev = RKADK_STORAGE_Getparameters(buf, len, "DEVNAME");
-
-          if (RKADK_STORAGE_Search(buf, len, "ACTION=add")) {
-            if (RKADK_STORAGE_MsgSendMsg(MSG_DEV_ADD, dev, strlen(dev) + 1,
-                                         &(pHandle->stMsgHd)))
-              RKADK_LOGE("Send msg: MSG_DEV_ADD failed.");
-          } else if (RKADK_STORAGE_Search(buf, len, "ACTION=remove")) {
-            RKADK_LOGI("%s remove", dev);
-            if (RKADK_STORAGE_MsgSendMsg(MSG_DEV_REMOVE, dev, strlen(dev) + 1,
-                                         &(pHandle->stMsgHd)))
-              RKADK_LOGE("Send msg: MSG_DEV_REMOVE failed.");
-          } else if (RKADK_STORAGE_Search(buf, len, "ACTION=change")) {
-            RKADK_LOGI("%s change", dev);
-            if (RKADK_STORAGE_MsgSendMsg(MSG_DEV_CHANGED, dev, strlen(dev) + 1,
-                                         &(pHandle->stMsgHd)))
-              RKADK_LOGE("Send msg: MSG_DEV_CHANGED failed.");
-          }
+static RKADK_MW_PTR RKADK_STORAGE_EventLoopThread(RKADK_MW_PTR arg) {
+  RKADK_STORAGE_HANDLE *pHandle = (RKADK_STORAGE_HANDLE *)arg;
+  RKADK_STR_EVENT_LOOP *pstLoop = &pHandle->stLoop;
+  struct epoll_event events[4];
+  uint64_t u64Count;
+  RKADK_S32 i, num;
+
+  prctl(PR_SET_NAME, "storage_event", 0, 0, 0);
+  while (pstLoop->s32Run) {
+    num = epoll_wait(pstLoop->s32EpollFd, events, 4, -1);
+    if (num < 0) {
+      if (errno == EINTR)
+        continue;
+      RKADK_LOGE("epoll_wait failed: %s", strerror(errno));
+      break;
+    }
+
+    for (i = 0; i < num; i++) {
+      if (events[i].data.fd == pstLoop->s32InotifyFd) {
+        RKADK_STORAGE_InotifyRead(pHandle);
+      } else if (events[i].data.fd == pstLoop->s32UeventFd) {
+        RKADK_STORAGE_UeventRead(pHandle);
+      } else if (events[i].data.fd == pstLoop->s32TimerFd) {
+        if (read(pstLoop->s32TimerFd, &u64Count, sizeof(u64Count)) > 0) {
+          pthread_mutex_lock(&pHandle->folderMutex);
+          RKADK_STORAGE_SpaceCheck(pHandle, RKADK_FALSE);
+          pthread_mutex_unlock(&pHandle->folderMutex);
         }
+      } else if (events[i].data.fd == pstLoop->s32WakeFd) {
+        if (read(pstLoop->s32WakeFd, &u64Count, sizeof(u64Count)) < 0)
+          RKADK_LOGW("read wake fd failed");
       }
     }
   }
-err_event_listener:
-  if (close(sockfd))
-    RKADK_LOGE("Close sockfd failed.\n");
 
   RKADK_LOGD("out");
   return NULL;
@@ -1435,6 +1496,10 @@ static RKADK_S32 RKADK_STORAGE_ParameterInit(RKADK_STORAGE_HANDLE *pstHandle,
       pstHandle->stDevAttr.s32FreeSizeDelMax = pstDevAttr->s32FreeSizeDelMax;
       pstHandle->stDevAttr.s32FolderNum = pstDevAttr->s32FolderNum;
       pstHandle->stDevAttr.s32CheckFormatId = pstDevAttr->s32CheckFormatId;
+      pstHandle->stDevAttr.s32ScanReserveSize = pstDevAttr->s32ScanReserveSize;
+      pstHandle->stDevAttr.s32ScanThreadNum = pstDevAttr->s32ScanThreadNum;
+      pstHandle->stDevAttr.pfnScanProgressCallback =
+          pstDevAttr->pfnScanProgressCallback;
       memcpy(pstHandle->stDevAttr.cFormatId, pstDevAttr->cFormatId, RKADK_MAX_FORMAT_ID_LEN);
       memcpy(pstHandle->stDevAttr.cVolume, pstDevAttr->cVolume, RKADK_MAX_VOLUME_LEN);
 
@@ -1551,12 +1616,16 @@ static RKADK_S32 RKADK_STORAGE_AutoDeleteInit(RKADK_STORAGE_HANDLE *pstHandle) {
       return -1;
     }
 
+    pthread_mutex_lock(&pstHandle->mountMutex);
     if (pthread_create(&(pstHandle->stDevSta.fileScanTid), NULL,
                        RKADK_STORAGE_FileScanThread,
                        (RKADK_MW_PTR)(pstHandle))) {
       RKADK_LOGE("FileScanThread create failed.");
+      pstHandle->stDevSta.fileScanTid = 0;
+      pthread_mutex_unlock(&pstHandle->mountMutex);
       return -1;
     }
+    pthread_mutex_unlock(&pstHandle->mountMutex);
 
   return 0;
 }
@@ -1564,33 +1633,152 @@ static RKADK_S32 RKADK_STORAGE_AutoDeleteInit(RKADK_STORAGE_HANDLE *pstHandle) {
 static RKADK_S32 RKADK_STORAGE_AutoDeleteDeinit(RKADK_STORAGE_HANDLE *pHandle) {
   RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
 
+  pthread_mutex_lock(&pHandle->mountMutex);
   pHandle->stDevSta.s32MountStatus = DISK_UNMOUNTED;
-
-  if (pHandle->stDevSta.fileScanTid)
-    if (pthread_join(pHandle->stDevSta.fileScanTid, NULL))
-      RKADK_LOGE("FileScanThread join failed.");
+  RKADK_STORAGE_FolderDeinit(pHandle);
+  pthread_mutex_unlock(&pHandle->mountMutex);
 
   return 0;
 }
 
-static RKADK_S32 RKADK_STORAGE_ListenMsgInit(RKADK_STORAGE_HANDLE *pstHandle) {
-  RKADK_CHECK_POINTER(pstHandle, RKADK_FAILURE);
+static RKADK_S32 RKADK_STORAGE_DeleterInit(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_STR_DELETER *pstDeleter = &pHandle->stDeleter;
 
-  pstHandle->eventListenerRun = 1;
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
 
-  if (RKADK_STORAGE_MsgCreate(&RKADK_STORAGE_MsgRecCb, pstHandle)) {
-    RKADK_LOGE("Msg create failed.");
+  pthread_mutex_init(&pstDeleter->mutex, NULL);
+  pthread_cond_init(&pstDeleter->cond, NULL);
+  pstDeleter->s32Run = 1;
+  if (pthread_create(&pstDeleter->tid, NULL, RKADK_STORAGE_DeleteThread,
+                     (RKADK_MW_PTR)pHandle)) {
+    RKADK_LOGE("DeleteThread create failed.");
+    pstDeleter->tid = 0;
     return -1;
   }
 
-  if (pthread_create(&pstHandle->eventListenerTid, NULL,
-                     RKADK_STORAGE_EventListenerThread,
-                     (RKADK_MW_PTR)pstHandle)) {
-    RKADK_LOGE("EventListenerThread create failed.");
-    return -1;
+  return 0;
+}
+
+static RKADK_S32 RKADK_STORAGE_DeleterDeinit(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_STR_DELETER *pstDeleter = &pHandle->stDeleter;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+
+  pthread_mutex_lock(&pstDeleter->mutex);
+  pstDeleter->s32Run = 0;
+  pthread_cond_signal(&pstDeleter->cond);
+  pthread_mutex_unlock(&pstDeleter->mutex);
+
+  if (pstDeleter->tid) {
+    if (pthread_join(pstDeleter->tid, NULL))
+      RKADK_LOGE("DeleteThread join failed.");
+    pstDeleter->tid = 0;
+  }
+  pthread_mutex_destroy(&pstDeleter->mutex);
+  pthread_cond_destroy(&pstDeleter->cond);
+
+  return 0;
+}
+
+static RKADK_S32 RKADK_STORAGE_EventLoopAdd(RKADK_STR_EVENT_LOOP *pstLoop,
+                                            RKADK_S32 fd) {
+  struct epoll_event event;
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  return epoll_ctl(pstLoop->s32EpollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static RKADK_VOID RKADK_STORAGE_EventLoopStop(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_STR_EVENT_LOOP *pstLoop = &pHandle->stLoop;
+  uint64_t u64Wake = 1;
+
+  pstLoop->s32Run = 0;
+  if (!pstLoop->tid)
+    return;
+
+  if (write(pstLoop->s32WakeFd, &u64Wake, sizeof(u64Wake)) < 0)
+    RKADK_LOGE("Wake event loop failed.");
+  if (pthread_join(pstLoop->tid, NULL))
+    RKADK_LOGE("EventLoopThread join failed.");
+  pstLoop->tid = 0;
+}
+
+static RKADK_S32 RKADK_STORAGE_EventLoopDeinit(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_STR_EVENT_LOOP *pstLoop = &pHandle->stLoop;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+
+  RKADK_STORAGE_EventLoopStop(pHandle);
+
+  if (pstLoop->s32WakeFd >= 0)
+    close(pstLoop->s32WakeFd);
+  if (pstLoop->s32TimerFd >= 0)
+    close(pstLoop->s32TimerFd);
+  if (pstLoop->s32UeventFd >= 0)
+    close(pstLoop->s32UeventFd);
+  if (pstLoop->s32InotifyFd >= 0)
+    close(pstLoop->s32InotifyFd);
+  if (pstLoop->s32EpollFd >= 0)
+    close(pstLoop->s32EpollFd);
+  pstLoop->s32WakeFd = pstLoop->s32TimerFd = pstLoop->s32UeventFd = -1;
+  pstLoop->s32InotifyFd = pstLoop->s32EpollFd = -1;
+
+  return 0;
+}
+
+static RKADK_S32 RKADK_STORAGE_EventLoopInit(RKADK_STORAGE_HANDLE *pHandle) {
+  RKADK_STR_EVENT_LOOP *pstLoop = &pHandle->stLoop;
+  struct sockaddr_nl sa;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+
+  pstLoop->s32InotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  pstLoop->s32UeventFd = socket(AF_NETLINK,
+                                SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                NETLINK_KOBJECT_UEVENT);
+  pstLoop->s32TimerFd =
+      timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  pstLoop->s32WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pstLoop->s32EpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (pstLoop->s32InotifyFd < 0 || pstLoop->s32UeventFd < 0 ||
+      pstLoop->s32TimerFd < 0 || pstLoop->s32WakeFd < 0 ||
+      pstLoop->s32EpollFd < 0) {
+    RKADK_LOGE("Create event fds failed: %s", strerror(errno));
+    goto failed;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.nl_family = AF_NETLINK;
+  sa.nl_groups = NETLINK_KOBJECT_UEVENT;
+  sa.nl_pid = 0;
+  if (bind(pstLoop->s32UeventFd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    RKADK_LOGE("bind error:%s", strerror(errno));
+    goto failed;
+  }
+
+  if (RKADK_STORAGE_EventLoopAdd(pstLoop, pstLoop->s32InotifyFd) ||
+      RKADK_STORAGE_EventLoopAdd(pstLoop, pstLoop->s32UeventFd) ||
+      RKADK_STORAGE_EventLoopAdd(pstLoop, pstLoop->s32TimerFd) ||
+      RKADK_STORAGE_EventLoopAdd(pstLoop, pstLoop->s32WakeFd)) {
+    RKADK_LOGE("epoll_ctl failed: %s", strerror(errno));
+    goto failed;
+  }
+
+  pstLoop->s32Run = 1;
+  if (pthread_create(&pstLoop->tid, NULL, RKADK_STORAGE_EventLoopThread,
+                     (RKADK_MW_PTR)pHandle)) {
+    RKADK_LOGE("EventLoopThread create failed.");
+    pstLoop->tid = 0;
+    goto failed;
   }
 
   return 0;
+
+failed:
+  RKADK_STORAGE_EventLoopDeinit(pHandle);
+  return -1;
 }
 
 RKADK_S32 RKADK_STORAGE_Init(RKADK_MW_PTR *ppHandle,
@@ -1611,20 +1799,31 @@ RKADK_S32 RKADK_STORAGE_Init(RKADK_MW_PTR *ppHandle,
   }
   memset(pstHandle, 0, sizeof(RKADK_STORAGE_HANDLE));
   pstHandle->pfnStatusCallback = pstDevAttr->pfnStatusCallback;
+  pthread_mutex_init(&pstHandle->mountMutex, NULL);
+  pthread_mutex_init(&pstHandle->folderMutex, NULL);
 
   if (RKADK_STORAGE_ParameterInit(pstHandle, pstDevAttr)) {
     RKADK_LOGE("Parameter init failed.");
     goto failed;
   }
 
-  if (RKADK_STORAGE_AutoDeleteInit(pstHandle))
-    RKADK_LOGE("AutoDelete init failed.");
+  if (RKADK_STORAGE_DeleterInit(pstHandle)) {
+    RKADK_LOGE("Deleter init failed.");
+    RKADK_STORAGE_ParameterDeinit(pstHandle);
+    goto failed;
+  }
 
-  if (RKADK_STORAGE_ListenMsgInit(pstHandle)) {
-    RKADK_LOGE("Listener and Msg init failed.");
+  // the scan thread watches the folders with the loop's inotify fd
+  if (RKADK_STORAGE_EventLoopInit(pstHandle)) {
+    RKADK_LOGE("Event loop init failed.");
+    RKADK_STORAGE_DeleterDeinit(pstHandle);
+    RKADK_STORAGE_ParameterDeinit(pstHandle);
     goto failed;
   }
 
+  if (RKADK_STORAGE_AutoDeleteInit(pstHandle))
+    RKADK_LOGE("AutoDelete init failed.");
+
   *ppHandle = (RKADK_MW_PTR)pstHandle;
   return 0;
 
@@ -1640,22 +1839,25 @@ RKADK_S32 RKADK_STORAGE_Deinit(RKADK_MW_PTR pHandle) {
 
   RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
   pstHandle = (RKADK_STORAGE_HANDLE *)pHandle;
-  pstHandle->eventListenerRun = 0;
   pstHandle->stDevSta.s32FsckQuit = 1;
 
-  if (pstHandle->eventListenerTid)
-    if (pthread_join(pstHandle->eventListenerTid, NULL))
-      RKADK_LOGE("EventListenerThread join failed.");
+  // stop the loop first, it would remount on a uevent
+  RKADK_STORAGE_EventLoopStop(pstHandle);
 
-  if (RKADK_STORAGE_MsgDestroy(pstHandle))
-    RKADK_LOGE("Msg destroy failed.");
+  if (RKADK_STORAGE_DeleterDeinit(pstHandle))
+    RKADK_LOGE("Deleter deinit failed.");
 
   if (RKADK_STORAGE_AutoDeleteDeinit(pstHandle))
     RKADK_LOGE("AutoDelete deinit failed.");
 
+  if (RKADK_STORAGE_EventLoopDeinit(pstHandle))
+    RKADK_LOGE("Event loop deinit failed.");
+
   if (RKADK_STORAGE_ParameterDeinit(pstHandle))
     RKADK_LOGE("Paramete deinit failed.");
 
+  pthread_mutex_destroy(&pstHandle->mountMutex);
+  pthread_mutex_destroy(&pstHandle->folderMutex);
   free(pstHandle);
   pstHandle = NULL;
 
@@ -1670,6 +1872,14 @@ RKADK_MOUNT_STATUS RKADK_STORAGE_GetMountStatus(RKADK_MW_PTR pHandle) {
   return pstHandle->stDevSta.s32MountStatus;
 }
 
+RKADK_BOOL RKADK_STORAGE_IsWritable(RKADK_MW_PTR pHandle) {
+  RKADK_STORAGE_HANDLE *pstHandle;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FALSE);
+  pstHandle = (RKADK_STORAGE_HANDLE *)pHandle;
+  return pstHandle->stDevSta.bWritable;
+}
+
 RKADK_S32 RKADK_STORAGE_GetCapacity(RKADK_MW_PTR *ppHandle,
                                       RKADK_S32 *totalSize,
                                       RKADK_S32 *freeSize) {
@@ -1719,8 +1929,9 @@ RKADK_S32 RKADK_STORAGE_GetFileList(RKADK_FILE_LIST *list, RKADK_MW_PTR pHandle,
 
   pthread_mutex_lock(&pstHandle->stDevSta.pstFolder[i].mutex);
 
-  struct RKADK_STR_FILE *tmp = pstHandle->stDevSta.pstFolder[i].pstFileListFirst;
-  list->s32FileNum = pstHandle->stDevSta.pstFolder[i].s32FileNum;
+  RKADK_CATALOG_FILE_S *tmp =
+      RKADK_CATALOG_First(&pstHandle->stDevSta.pstFolder[i].stCatalog);
+  list->s32FileNum = pstHandle->stDevSta.pstFolder[i].stCatalog.s32FileNum;
   list->file =
       (RKADK_FILE_INFO *)malloc(sizeof(RKADK_FILE_INFO) * list->s32FileNum);
   if (!list->file) {
@@ -1738,7 +1949,7 @@ RKADK_S32 RKADK_STORAGE_GetFileList(RKADK_FILE_LIST *list, RKADK_MW_PTR pHandle,
       list->file[j].filename[len] = '\0';
       list->file[j].stSize = tmp->stSize;
       list->file[j].stTime = tmp->stTime;
-      tmp = tmp->next;
+      tmp = RKADK_CATALOG_Next(tmp);
     }
   } else {
     for (j = list->s32FileNum - 1; j >= 0 && tmp != NULL; j--) {
@@ -1749,7 +1960,7 @@ RKADK_S32 RKADK_STORAGE_GetFileList(RKADK_FILE_LIST *list, RKADK_MW_PTR pHandle,
       list->file[j].filename[len] = '\0';
       list->file[j].stSize = tmp->stSize;
       list->file[j].stTime = tmp->stTime;
-      tmp = tmp->next;
+      tmp = RKADK_CATALOG_Next(tmp);
     }
   }
 
@@ -1782,7 +1993,7 @@ RKADK_S32 RKADK_STORAGE_GetFileNum(RKADK_CHAR *fileListPath,
   if (i == pstHandle->stDevSta.s32FolderNum)
     return 0;
 
-  return pstHandle->stDevSta.pstFolder[i].s32FileNum;
+  return pstHandle->stDevSta.pstFolder[i].stCatalog.s32FileNum;
 }
 
 RKADK_CHAR *RKADK_STORAGE_GetDevPath(RKADK_MW_PTR pHandle) {
@@ -1836,4 +2047,50 @@ RKADK_S32 RKADK_STORAGE_Format(RKADK_MW_PTR pHandle, RKADK_CHAR* cFormat)
 
   RKADK_LOGD("Format %s[%d]", pDevPath, err);
   return err;
+}
+
+RKADK_S32 RKADK_STORAGE_SetStreamBitrate(RKADK_MW_PTR pHandle,
+                                         RKADK_U32 u32StreamId,
+                                         RKADK_U32 u32Bitrate) {
+  RKADK_STORAGE_HANDLE *pstHandle;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+  pstHandle = (RKADK_STORAGE_HANDLE *)pHandle;
+
+  if (u32StreamId >= RKADK_STORAGE_MAX_STREAM) {
+    RKADK_LOGE("Invalid u32StreamId[%d]", u32StreamId);
+    return -1;
+  }
+
+  pstHandle->u32StreamBitrate[u32StreamId] = u32Bitrate;
+
+  // the reserve changes with the rate
+  if (pstHandle->stDevSta.s32MountStatus == DISK_MOUNTED)
+    RKADK_STORAGE_SpaceCheckAfter(pstHandle, 0);
+
+  return 0;
+}
+
+RKADK_S32 RKADK_STORAGE_GetRecordTimeLeft(RKADK_MW_PTR pHandle) {
+  RKADK_STORAGE_HANDLE *pstHandle;
+  RKADK_S32 rate;
+  long long left;
+
+  RKADK_CHECK_POINTER(pHandle, RKADK_FAILURE);
+  pstHandle = (RKADK_STORAGE_HANDLE *)pHandle;
+
+  if (pstHandle->stDevSta.s32MountStatus != DISK_MOUNTED)
+    return 0;
+
+  rate = RKADK_STORAGE_WriteRate(pstHandle);
+  if (rate <= 0)
+    return RKADK_STORAGE_TIME_LEFT_UNKNOWN;
+
+  // recording stops being possible at s32FreeSizeDelMin, not at a full card
+  left = pstHandle->stDevSta.s32FreeSize -
+         pstHandle->stDevAttr.s32FreeSizeDelMin * 1024LL;
+  if (left <= 0)
+    return 0;
+
+  return left / rate;
 }
\ No newline at end of file
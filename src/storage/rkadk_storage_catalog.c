@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "rkadk_storage_catalog.h"
+#include "rkadk_log.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RKADK_CATALOG_BUCKET_NUM 256
+
+static RKADK_U32 RKADK_CATALOG_Hash(const RKADK_CHAR *filename) {
+  RKADK_U32 u32Hash = 2166136261u;
+
+  while (*filename) {
+    u32Hash ^= (RKADK_U8)*filename++;
+    u32Hash *= 16777619u;
+  }
+
+  return u32Hash;
+}
+
+// p = 1/4, xorshift32 so that folders do not contend on rand()
+static RKADK_S32 RKADK_CATALOG_RandomLevel(RKADK_CATALOG_S *pstCatalog) {
+  RKADK_S32 s32Level = 1;
+  RKADK_U32 x = pstCatalog->u32Seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  pstCatalog->u32Seed = x;
+
+  while (s32Level < RKADK_CATALOG_MAX_LEVEL && !(x & 3)) {
+    s32Level++;
+    x >>= 2;
+  }
+
+  return s32Level;
+}
+
+// < 0 if pstA comes first: newer mtime, then greater filename
+static int RKADK_CATALOG_Compare(RKADK_CATALOG_FILE_S *pstA,
+                                 RKADK_CATALOG_FILE_S *pstB) {
+  if (pstA->stTime != pstB->stTime)
+    return pstA->stTime > pstB->stTime ? -1 : 1;
+
+  return strcmp(pstB->filename, pstA->filename);
+}
+
+static RKADK_CATALOG_FILE_S **
+RKADK_CATALOG_Link(RKADK_CATALOG_S *pstCatalog, RKADK_CATALOG_FILE_S *pstNode,
+                   RKADK_S32 s32Level) {
+  return pstNode ? &pstNode->pstNext[s32Level] : &pstCatalog->pstHead[s32Level];
+}
+
+static void RKADK_CATALOG_Search(RKADK_CATALOG_S *pstCatalog,
+                                 RKADK_CATALOG_FILE_S *pstFile,
+                                 RKADK_CATALOG_FILE_S **pstUpdate) {
+  RKADK_S32 i;
+  RKADK_CATALOG_FILE_S *pstNode = NULL, *pstNext;
+
+  for (i = pstCatalog->s32Level - 1; i >= 0; i--) {
+    pstNext = *RKADK_CATALOG_Link(pstCatalog, pstNode, i);
+    while (pstNext && RKADK_CATALOG_Compare(pstNext, pstFile) < 0) {
+      pstNode = pstNext;
+      pstNext = pstNode->pstNext[i];
+    }
+    pstUpdate[i] = pstNode;
+  }
+}
+
+static void RKADK_CATALOG_Insert(RKADK_CATALOG_S *pstCatalog,
+                                 RKADK_CATALOG_FILE_S *pstFile) {
+  RKADK_S32 i;
+  RKADK_CATALOG_FILE_S **ppstLink;
+  RKADK_CATALOG_FILE_S *pstUpdate[RKADK_CATALOG_MAX_LEVEL];
+
+  RKADK_CATALOG_Search(pstCatalog, pstFile, pstUpdate);
+  for (i = pstCatalog->s32Level; i < pstFile->s32Level; i++)
+    pstUpdate[i] = NULL;
+  if (pstFile->s32Level > pstCatalog->s32Level)
+    pstCatalog->s32Level = pstFile->s32Level;
+
+  for (i = 0; i < pstFile->s32Level; i++) {
+    ppstLink = RKADK_CATALOG_Link(pstCatalog, pstUpdate[i], i);
+    pstFile->pstNext[i] = *ppstLink;
+    *ppstLink = pstFile;
+  }
+
+  pstFile->pstPrev = pstUpdate[0];
+  if (pstFile->pstNext[0])
+    pstFile->pstNext[0]->pstPrev = pstFile;
+  else
+    pstCatalog->pstLast = pstFile;
+}
+
+static void RKADK_CATALOG_Remove(RKADK_CATALOG_S *pstCatalog,
+                                 RKADK_CATALOG_FILE_S *pstFile) {
+  RKADK_S32 i;
+  RKADK_CATALOG_FILE_S **ppstLink;
+  RKADK_CATALOG_FILE_S *pstUpdate[RKADK_CATALOG_MAX_LEVEL];
+
+  RKADK_CATALOG_Search(pstCatalog, pstFile, pstUpdate);
+  for (i = 0; i < pstFile->s32Level; i++) {
+    ppstLink = RKADK_CATALOG_Link(pstCatalog, pstUpdate[i], i);
+    if (*ppstLink == pstFile)
+      *ppstLink = pstFile->pstNext[i];
+  }
+
+  if (pstFile->pstNext[0])
+    pstFile->pstNext[0]->pstPrev = pstFile->pstPrev;
+  else
+    pstCatalog->pstLast = pstFile->pstPrev;
+
+  while (pstCatalog->s32Level > 1 &&
+         !pstCatalog->pstHead[pstCatalog->s32Level - 1])
+    pstCatalog->s32Level--;
+}
+
+static RKADK_S32 RKADK_CATALOG_Rehash(RKADK_CATALOG_S *pstCatalog,
+                                      RKADK_U32 u32BucketNum) {
+  RKADK_U32 i;
+  RKADK_CATALOG_FILE_S *pstFile, *pstNext;
+  RKADK_CATALOG_FILE_S **pstBucket;
+
+  pstBucket = (RKADK_CATALOG_FILE_S **)calloc(u32BucketNum, sizeof(*pstBucket));
+  if (!pstBucket) {
+    RKADK_LOGE("malloc %d buckets failed", u32BucketNum);
+    return -1;
+  }
+
+  for (i = 0; i < pstCatalog->u32BucketNum; i++) {
+    for (pstFile = pstCatalog->pstBucket[i]; pstFile; pstFile = pstNext) {
+      pstNext = pstFile->pstHashNext;
+      pstFile->pstHashNext = pstBucket[pstFile->u32Hash & (u32BucketNum - 1)];
+      pstBucket[pstFile->u32Hash & (u32BucketNum - 1)] = pstFile;
+    }
+  }
+
+  if (pstCatalog->pstBucket)
+    free(pstCatalog->pstBucket);
+  pstCatalog->pstBucket = pstBucket;
+  pstCatalog->u32BucketNum = u32BucketNum;
+  return 0;
+}
+
+RKADK_S32 RKADK_CATALOG_Init(RKADK_CATALOG_S *pstCatalog) {
+  RKADK_CHECK_POINTER(pstCatalog, RKADK_FAILURE);
+
+  memset(pstCatalog, 0, sizeof(RKADK_CATALOG_S));
+  pstCatalog->s32Level = 1;
+  pstCatalog->u32Seed = 0x9E3779B9u ^ (RKADK_U32)(uintptr_t)pstCatalog;
+  if (!pstCatalog->u32Seed)
+    pstCatalog->u32Seed = 1;
+
+  return RKADK_CATALOG_Rehash(pstCatalog, RKADK_CATALOG_BUCKET_NUM);
+}
+
+RKADK_VOID RKADK_CATALOG_Deinit(RKADK_CATALOG_S *pstCatalog) {
+  RKADK_CATALOG_FILE_S *pstFile, *pstNext;
+
+  if (!pstCatalog)
+    return;
+
+  for (pstFile = pstCatalog->pstHead[0]; pstFile; pstFile = pstNext) {
+    pstNext = pstFile->pstNext[0];
+    free(pstFile);
+  }
+
+  if (pstCatalog->pstBucket)
+    free(pstCatalog->pstBucket);
+  memset(pstCatalog, 0, sizeof(RKADK_CATALOG_S));
+}
+
+RKADK_CATALOG_FILE_S *RKADK_CATALOG_Find(RKADK_CATALOG_S *pstCatalog,
+                                         const RKADK_CHAR *filename) {
+  RKADK_U32 u32Hash;
+  RKADK_CATALOG_FILE_S *pstFile;
+
+  RKADK_CHECK_POINTER(pstCatalog, NULL);
+  RKADK_CHECK_POINTER(filename, NULL);
+
+  if (!pstCatalog->pstBucket)
+    return NULL;
+
+  u32Hash = RKADK_CATALOG_Hash(filename);
+  pstFile = pstCatalog->pstBucket[u32Hash & (pstCatalog->u32BucketNum - 1)];
+  for (; pstFile; pstFile = pstFile->pstHashNext) {
+    if (pstFile->u32Hash == u32Hash && !strcmp(pstFile->filename, filename))
+      return pstFile;
+  }
+
+  return NULL;
+}
+
+RKADK_S32 RKADK_CATALOG_Add(RKADK_CATALOG_S *pstCatalog,
+                            const RKADK_CHAR *filename, time_t stTime,
+                            off_t stSize, off_t stSpace) {
+  RKADK_S32 s32Level;
+  RKADK_U32 u32Index;
+  RKADK_CATALOG_FILE_S *pstFile;
+
+  RKADK_CHECK_POINTER(pstCatalog, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(filename, RKADK_FAILURE);
+
+  if (!pstCatalog->pstBucket) {
+    RKADK_LOGE("catalog is not inited");
+    return -1;
+  }
+
+  pstFile = RKADK_CATALOG_Find(pstCatalog, filename);
+  if (pstFile) {
+    if (pstFile->stTime != stTime) {
+      RKADK_CATALOG_Remove(pstCatalog, pstFile);
+      pstFile->stTime = stTime;
+      RKADK_CATALOG_Insert(pstCatalog, pstFile);
+    }
+
+    pstCatalog->totalSize += stSize - pstFile->stSize;
+    pstCatalog->totalSpace += stSpace - pstFile->stSpace;
+    pstFile->stSize = stSize;
+    pstFile->stSpace = stSpace;
+    return 0;
+  }
+
+  if ((RKADK_U32)pstCatalog->s32FileNum >= pstCatalog->u32BucketNum)
+    RKADK_CATALOG_Rehash(pstCatalog, pstCatalog->u32BucketNum * 2);
+
+  s32Level = RKADK_CATALOG_RandomLevel(pstCatalog);
+  pstFile = (RKADK_CATALOG_FILE_S *)malloc(
+      sizeof(RKADK_CATALOG_FILE_S) + s32Level * sizeof(RKADK_CATALOG_FILE_S *));
+  if (!pstFile) {
+    RKADK_LOGE("malloc file node failed");
+    return -1;
+  }
+
+  memset(pstFile, 0, sizeof(RKADK_CATALOG_FILE_S));
+  snprintf(pstFile->filename, RKADK_MAX_FILE_PATH_LEN, "%s", filename);
+  pstFile->u32Hash = RKADK_CATALOG_Hash(pstFile->filename);
+  pstFile->s32Level = s32Level;
+  pstFile->stTime = stTime;
+  pstFile->stSize = stSize;
+  pstFile->stSpace = stSpace;
+
+  u32Index = pstFile->u32Hash & (pstCatalog->u32BucketNum - 1);
+  pstFile->pstHashNext = pstCatalog->pstBucket[u32Index];
+  pstCatalog->pstBucket[u32Index] = pstFile;
+  RKADK_CATALOG_Insert(pstCatalog, pstFile);
+
+  pstCatalog->totalSize += stSize;
+  pstCatalog->totalSpace += stSpace;
+  pstCatalog->s32FileNum++;
+  return 0;
+}
+
+RKADK_S32 RKADK_CATALOG_Del(RKADK_CATALOG_S *pstCatalog,
+                            const RKADK_CHAR *filename) {
+  RKADK_CATALOG_FILE_S *pstFile, **ppstLink;
+
+  RKADK_CHECK_POINTER(pstCatalog, RKADK_FAILURE);
+
+  pstFile = RKADK_CATALOG_Find(pstCatalog, filename);
+  if (!pstFile)
+    return -1;
+
+  ppstLink = &pstCatalog->pstBucket[pstFile->u32Hash &
+                                    (pstCatalog->u32BucketNum - 1)];
+  while (*ppstLink != pstFile)
+    ppstLink = &(*ppstLink)->pstHashNext;
+  *ppstLink = pstFile->pstHashNext;
+
+  RKADK_CATALOG_Remove(pstCatalog, pstFile);
+  pstCatalog->totalSize -= pstFile->stSize;
+  pstCatalog->totalSpace -= pstFile->stSpace;
+  pstCatalog->s32FileNum--;
+  free(pstFile);
+  return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef __RKADK_STORAGE_CATALOG_H__
+#define __RKADK_STORAGE_CATALOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rkadk_common.h"
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * File catalog of one storage folder: a skip list ordered from the newest to
+ * the oldest file (mtime, then filename), indexed by a filename hash table.
+ * Add, delete and lookup are O(log n), the oldest file is O(1) and the totals
+ * are kept up to date on every change.
+ * The catalog is not locked, callers serialize with the folder mutex.
+ */
+
+#define RKADK_CATALOG_MAX_LEVEL 12
+
+typedef struct RKADK_CATALOG_FILE {
+  struct RKADK_CATALOG_FILE *pstHashNext;
+  struct RKADK_CATALOG_FILE *pstPrev;
+  RKADK_U32 u32Hash;
+  RKADK_S32 s32Level;
+  RKADK_U32 u32ScanFlag; /* owned by the mount scan, 0 on add */
+  RKADK_CHAR filename[RKADK_MAX_FILE_PATH_LEN];
+  time_t stTime;
+  off_t stSize;
+  off_t stSpace;
+  struct RKADK_CATALOG_FILE *pstNext[]; /* s32Level forward pointers */
+} RKADK_CATALOG_FILE_S;
+
+typedef struct {
+  RKADK_S32 s32FileNum;
+  off_t totalSize;
+  off_t totalSpace;
+  RKADK_S32 s32Level;
+  RKADK_U32 u32Seed;
+  RKADK_U32 u32BucketNum;
+  RKADK_CATALOG_FILE_S **pstBucket;
+  RKADK_CATALOG_FILE_S *pstLast;
+  RKADK_CATALOG_FILE_S *pstHead[RKADK_CATALOG_MAX_LEVEL];
+} RKADK_CATALOG_S;
+
+RKADK_S32 RKADK_CATALOG_Init(RKADK_CATALOG_S *pstCatalog);
+
+RKADK_VOID RKADK_CATALOG_Deinit(RKADK_CATALOG_S *pstCatalog);
+
+/**
+ * @brief add a file, or update its time and size if it is already listed
+ */
+RKADK_S32 RKADK_CATALOG_Add(RKADK_CATALOG_S *pstCatalog,
+                            const RKADK_CHAR *filename, time_t stTime,
+                            off_t stSize, off_t stSpace);
+
+/**
+ * @brief remove a file
+ *
+ * @return 0 on success, -1 if the file is not listed
+ */
+RKADK_S32 RKADK_CATALOG_Del(RKADK_CATALOG_S *pstCatalog,
+                            const RKADK_CHAR *filename);
+
+RKADK_CATALOG_FILE_S *RKADK_CATALOG_Find(RKADK_CATALOG_S *pstCatalog,
+                                         const RKADK_CHAR *filename);
+
+/* newest file, NULL if the catalog is empty */
+static inline RKADK_CATALOG_FILE_S *
+RKADK_CATALOG_First(RKADK_CATALOG_S *pstCatalog) {
+  return pstCatalog->pstHead[0];
+}
+
+/* oldest file, NULL if the catalog is empty */
+static inline RKADK_CATALOG_FILE_S *
+RKADK_CATALOG_Last(RKADK_CATALOG_S *pstCatalog) {
+  return pstCatalog->pstLast;
+}
+
+/* next older file */
+static inline RKADK_CATALOG_FILE_S *
+RKADK_CATALOG_Next(RKADK_CATALOG_FILE_S *pstFile) {
+  return pstFile->pstNext[0];
+}
+
+/* next newer file */
+static inline RKADK_CATALOG_FILE_S *
+RKADK_CATALOG_Prev(RKADK_CATALOG_FILE_S *pstFile) {
+  return pstFile->pstPrev;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,458 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "rkadk_storage_journal.h"
+#include "rkadk_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define RKADK_JOURNAL_MAGIC 0x54434B52 /* "RKCT" */
+
+/* little endian, as written by the device */
+typedef struct {
+  RKADK_U32 u32Magic;
+  RKADK_U16 u16Version;
+  RKADK_U16 u16RecordSize;
+  RKADK_U32 u32SnapshotNum;
+  RKADK_U32 u32Crc; /* of the fields above */
+} RKADK_JOURNAL_HEADER_S;
+
+typedef struct {
+  RKADK_U32 u32Crc; /* of the fields below */
+  RKADK_U8 u8Op;
+  RKADK_U8 u8Reserved[3];
+  RKADK_S64 s64Time;
+  RKADK_S64 s64Size;
+  RKADK_S64 s64Space;
+  RKADK_CHAR filename[RKADK_JOURNAL_NAME_LEN];
+} RKADK_JOURNAL_RECORD_S;
+
+static RKADK_U32 RKADK_JOURNAL_RecordCrc(const RKADK_JOURNAL_RECORD_S *pstRecord) {
+  return crc32(0, (const Bytef *)&pstRecord->u8Op,
+               sizeof(RKADK_JOURNAL_RECORD_S) -
+                   offsetof(RKADK_JOURNAL_RECORD_S, u8Op));
+}
+
+static RKADK_U32 RKADK_JOURNAL_HeaderCrc(const RKADK_JOURNAL_HEADER_S *pstHeader) {
+  return crc32(0, (const Bytef *)pstHeader,
+               offsetof(RKADK_JOURNAL_HEADER_S, u32Crc));
+}
+
+static RKADK_S32 RKADK_JOURNAL_FillRecord(RKADK_JOURNAL_RECORD_S *pstRecord,
+                                          RKADK_JOURNAL_OP_E enOp,
+                                          const RKADK_CHAR *filename,
+                                          RKADK_CATALOG_FILE_S *pstFile) {
+  if (strlen(filename) >= RKADK_JOURNAL_NAME_LEN) {
+    RKADK_LOGW("%s is too long to be journaled", filename);
+    return -1;
+  }
+
+  memset(pstRecord, 0, sizeof(RKADK_JOURNAL_RECORD_S));
+  pstRecord->u8Op = enOp;
+  strcpy(pstRecord->filename, filename);
+  if (pstFile) {
+    pstRecord->s64Time = pstFile->stTime;
+    pstRecord->s64Size = pstFile->stSize;
+    pstRecord->s64Space = pstFile->stSpace;
+  }
+  pstRecord->u32Crc = RKADK_JOURNAL_RecordCrc(pstRecord);
+  return 0;
+}
+
+static bool RKADK_JOURNAL_CheckRecord(const RKADK_JOURNAL_RECORD_S *pstRecord) {
+  if (pstRecord->u8Op != RKADK_JOURNAL_OP_ADD &&
+      pstRecord->u8Op != RKADK_JOURNAL_OP_DEL)
+    return false;
+
+  if (!memchr(pstRecord->filename, 0, RKADK_JOURNAL_NAME_LEN))
+    return false;
+
+  return pstRecord->u32Crc == RKADK_JOURNAL_RecordCrc(pstRecord);
+}
+
+static RKADK_S32 RKADK_JOURNAL_Write(RKADK_S32 fd, const RKADK_VOID *pData,
+                                     size_t len) {
+  ssize_t ret;
+  const RKADK_U8 *pu8Data = (const RKADK_U8 *)pData;
+
+  while (len > 0) {
+    ret = write(fd, pu8Data, len);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    pu8Data += ret;
+    len -= ret;
+  }
+
+  return 0;
+}
+
+RKADK_VOID RKADK_JOURNAL_Init(RKADK_JOURNAL_S *pstJournal,
+                              const RKADK_CHAR *path) {
+  memset(pstJournal, 0, sizeof(RKADK_JOURNAL_S));
+  snprintf(pstJournal->path, sizeof(pstJournal->path), "%s", path);
+  pstJournal->s32Fd = -1;
+}
+
+RKADK_S32 RKADK_JOURNAL_Load(RKADK_JOURNAL_S *pstJournal,
+                             RKADK_CATALOG_S *pstCatalog) {
+  RKADK_S32 fd, ret = -1;
+  RKADK_U32 i, u32Num;
+  RKADK_U8 *pu8Map;
+  struct stat statbuf;
+  RKADK_JOURNAL_HEADER_S *pstHeader;
+  RKADK_JOURNAL_RECORD_S *pstRecord;
+
+  RKADK_CHECK_POINTER(pstJournal, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstCatalog, RKADK_FAILURE);
+
+  pstJournal->validLen = 0;
+  fd = open(pstJournal->path, O_RDONLY);
+  if (fd < 0) {
+    RKADK_LOGI("No catalog %s", pstJournal->path);
+    return -1;
+  }
+
+  if (fstat(fd, &statbuf) ||
+      statbuf.st_size < (off_t)sizeof(RKADK_JOURNAL_HEADER_S)) {
+    RKADK_LOGW("Invalid catalog %s", pstJournal->path);
+    close(fd);
+    return -1;
+  }
+
+  pu8Map = (RKADK_U8 *)mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (pu8Map == MAP_FAILED) {
+    RKADK_LOGE("mmap %s failed: %s", pstJournal->path, strerror(errno));
+    return -1;
+  }
+
+  pstHeader = (RKADK_JOURNAL_HEADER_S *)pu8Map;
+  u32Num = (statbuf.st_size - sizeof(RKADK_JOURNAL_HEADER_S)) /
+           sizeof(RKADK_JOURNAL_RECORD_S);
+  if (pstHeader->u32Magic != RKADK_JOURNAL_MAGIC ||
+      pstHeader->u16Version != RKADK_JOURNAL_VERSION ||
+      pstHeader->u16RecordSize != sizeof(RKADK_JOURNAL_RECORD_S) ||
+      pstHeader->u32Crc != RKADK_JOURNAL_HeaderCrc(pstHeader) ||
+      pstHeader->u32SnapshotNum > u32Num) {
+    RKADK_LOGW("Invalid catalog header %s", pstJournal->path);
+    goto exit;
+  }
+
+  pstRecord = (RKADK_JOURNAL_RECORD_S *)(pu8Map + sizeof(RKADK_JOURNAL_HEADER_S));
+  for (i = 0; i < u32Num; i++, pstRecord++) {
+    if (!RKADK_JOURNAL_CheckRecord(pstRecord)) {
+      // a broken snapshot is not trusted, a broken journal tail is a torn append
+      if (i < pstHeader->u32SnapshotNum) {
+        RKADK_LOGW("Invalid snapshot record[%d] in %s", i, pstJournal->path);
+        RKADK_CATALOG_Deinit(pstCatalog);
+        RKADK_CATALOG_Init(pstCatalog);
+        goto exit;
+      }
+
+      RKADK_LOGW("Drop %d journal records from %s", u32Num - i, pstJournal->path);
+      break;
+    }
+
+    if (pstRecord->u8Op == RKADK_JOURNAL_OP_ADD)
+      RKADK_CATALOG_Add(pstCatalog, pstRecord->filename, pstRecord->s64Time,
+                        pstRecord->s64Size, pstRecord->s64Space);
+    else
+      RKADK_CATALOG_Del(pstCatalog, pstRecord->filename);
+  }
+
+  pstJournal->u32SnapshotNum = pstHeader->u32SnapshotNum;
+  pstJournal->u32RecordNum = i - pstHeader->u32SnapshotNum;
+  pstJournal->validLen =
+      sizeof(RKADK_JOURNAL_HEADER_S) + (off_t)i * sizeof(RKADK_JOURNAL_RECORD_S);
+  ret = pstCatalog->s32FileNum;
+  RKADK_LOGI("Load %d files from %s, %d journal records", ret,
+             pstJournal->path, pstJournal->u32RecordNum);
+
+exit:
+  munmap(pu8Map, statbuf.st_size);
+  return ret;
+}
+
+RKADK_S32 RKADK_JOURNAL_SnapshotTake(RKADK_JOURNAL_S *pstJournal,
+                                     RKADK_CATALOG_S *pstCatalog,
+                                     RKADK_JOURNAL_SNAPSHOT_S *pstSnap) {
+  RKADK_CATALOG_FILE_S *pstFile;
+  RKADK_JOURNAL_RECORD_S *pstRecord;
+
+  RKADK_CHECK_POINTER(pstJournal, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstCatalog, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstSnap, RKADK_FAILURE);
+
+  memset(pstSnap, 0, sizeof(RKADK_JOURNAL_SNAPSHOT_S));
+  pstSnap->s32Fd = -1;
+  snprintf(pstSnap->path, sizeof(pstSnap->path), "%s", pstJournal->path);
+  pstSnap->markLen = pstJournal->validLen;
+
+  if (pstCatalog->s32FileNum > 0) {
+    pstRecord = (RKADK_JOURNAL_RECORD_S *)malloc(pstCatalog->s32FileNum *
+                                                 sizeof(RKADK_JOURNAL_RECORD_S));
+    if (!pstRecord) {
+      RKADK_LOGE("malloc %d records failed", pstCatalog->s32FileNum);
+      return -1;
+    }
+    pstSnap->pRecord = pstRecord;
+  }
+
+  pstRecord = (RKADK_JOURNAL_RECORD_S *)pstSnap->pRecord;
+  for (pstFile = RKADK_CATALOG_First(pstCatalog); pstFile;
+       pstFile = RKADK_CATALOG_Next(pstFile)) {
+    if (RKADK_JOURNAL_FillRecord(&pstRecord[pstSnap->u32Num],
+                                 RKADK_JOURNAL_OP_ADD, pstFile->filename,
+                                 pstFile))
+      continue;
+
+    pstSnap->u32Num++;
+  }
+
+  return 0;
+}
+
+RKADK_S32 RKADK_JOURNAL_SnapshotWrite(RKADK_JOURNAL_SNAPSHOT_S *pstSnap) {
+  RKADK_CHAR tmpPath[2 * RKADK_MAX_FILE_PATH_LEN + 8];
+  RKADK_JOURNAL_HEADER_S stHeader;
+
+  RKADK_CHECK_POINTER(pstSnap, RKADK_FAILURE);
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", pstSnap->path);
+  pstSnap->s32Fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (pstSnap->s32Fd < 0) {
+    RKADK_LOGE("open %s failed: %s", tmpPath, strerror(errno));
+    return -1;
+  }
+
+  memset(&stHeader, 0, sizeof(stHeader));
+  stHeader.u32Magic = RKADK_JOURNAL_MAGIC;
+  stHeader.u16Version = RKADK_JOURNAL_VERSION;
+  stHeader.u16RecordSize = sizeof(RKADK_JOURNAL_RECORD_S);
+  stHeader.u32SnapshotNum = pstSnap->u32Num;
+  stHeader.u32Crc = RKADK_JOURNAL_HeaderCrc(&stHeader);
+  if (RKADK_JOURNAL_Write(pstSnap->s32Fd, &stHeader, sizeof(stHeader)) ||
+      RKADK_JOURNAL_Write(pstSnap->s32Fd, pstSnap->pRecord,
+                          pstSnap->u32Num * sizeof(RKADK_JOURNAL_RECORD_S))) {
+    RKADK_LOGE("write %s failed: %s", tmpPath, strerror(errno));
+    close(pstSnap->s32Fd);
+    pstSnap->s32Fd = -1;
+    unlink(tmpPath);
+    return -1;
+  }
+
+  return 0;
+}
+
+RKADK_S32 RKADK_JOURNAL_SnapshotCommit(RKADK_JOURNAL_S *pstJournal,
+                                       RKADK_JOURNAL_SNAPSHOT_S *pstSnap) {
+  RKADK_S32 fd = -1, ret = -1;
+  RKADK_U32 u32TailNum = 0;
+  off_t tailLen = 0;
+  RKADK_U8 *pu8Tail = NULL;
+  RKADK_CHAR tmpPath[2 * RKADK_MAX_FILE_PATH_LEN + 8];
+
+  RKADK_CHECK_POINTER(pstJournal, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstSnap, RKADK_FAILURE);
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", pstSnap->path);
+  if (pstSnap->s32Fd < 0)
+    goto exit;
+
+  // the records appended while the snapshot was written belong after it
+  if (pstJournal->validLen > pstSnap->markLen) {
+    if (pstSnap->markLen < (off_t)sizeof(RKADK_JOURNAL_HEADER_S)) {
+      RKADK_LOGE("%s was replaced while compacting", pstJournal->path);
+      goto exit;
+    }
+
+    tailLen = pstJournal->validLen - pstSnap->markLen;
+    u32TailNum = tailLen / sizeof(RKADK_JOURNAL_RECORD_S);
+    pu8Tail = (RKADK_U8 *)malloc(tailLen);
+    fd = open(pstJournal->path, O_RDONLY);
+    if (!pu8Tail || fd < 0 ||
+        pread(fd, pu8Tail, tailLen, pstSnap->markLen) != tailLen ||
+        RKADK_JOURNAL_Write(pstSnap->s32Fd, pu8Tail, tailLen))
+      goto exit;
+  } else if (pstJournal->validLen < pstSnap->markLen) {
+    RKADK_LOGE("%s was replaced while compacting", pstJournal->path);
+    goto exit;
+  }
+
+  // only this file is flushed, the rename publishes it
+  if (fdatasync(pstSnap->s32Fd) || rename(tmpPath, pstJournal->path))
+    goto exit;
+
+  if (pstJournal->s32Fd >= 0)
+    close(pstJournal->s32Fd);
+  pstJournal->s32Fd = pstSnap->s32Fd;
+  pstSnap->s32Fd = -1;
+  if (lseek(pstJournal->s32Fd, 0, SEEK_END) < 0) {
+    close(pstJournal->s32Fd);
+    pstJournal->s32Fd = -1;
+    goto exit;
+  }
+
+  pstJournal->u32SnapshotNum = pstSnap->u32Num;
+  pstJournal->u32RecordNum = u32TailNum;
+  pstJournal->validLen = sizeof(RKADK_JOURNAL_HEADER_S) +
+                         (off_t)(pstSnap->u32Num + u32TailNum) *
+                             sizeof(RKADK_JOURNAL_RECORD_S);
+  RKADK_LOGD("Compact %s, %d files, %d journal records", pstJournal->path,
+             pstSnap->u32Num, u32TailNum);
+  ret = 0;
+
+exit:
+  if (ret) {
+    RKADK_LOGE("Compact %s failed: %s", pstJournal->path, strerror(errno));
+    // retry after another RKADK_JOURNAL_COMPACT_MIN appends
+    pstJournal->u32RecordNum = 0;
+  }
+
+  if (fd >= 0)
+    close(fd);
+  if (pu8Tail)
+    free(pu8Tail);
+  return ret;
+}
+
+RKADK_VOID RKADK_JOURNAL_SnapshotFree(RKADK_JOURNAL_SNAPSHOT_S *pstSnap) {
+  RKADK_CHAR tmpPath[2 * RKADK_MAX_FILE_PATH_LEN + 8];
+
+  if (!pstSnap)
+    return;
+
+  // not committed
+  if (pstSnap->s32Fd >= 0) {
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", pstSnap->path);
+    close(pstSnap->s32Fd);
+    unlink(tmpPath);
+    pstSnap->s32Fd = -1;
+  }
+
+  if (pstSnap->pRecord)
+    free(pstSnap->pRecord);
+  pstSnap->pRecord = NULL;
+  pstSnap->u32Num = 0;
+}
+
+RKADK_S32 RKADK_JOURNAL_Compact(RKADK_JOURNAL_S *pstJournal,
+                                RKADK_CATALOG_S *pstCatalog) {
+  RKADK_S32 ret;
+  RKADK_JOURNAL_SNAPSHOT_S stSnap;
+
+  RKADK_CHECK_POINTER(pstJournal, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstCatalog, RKADK_FAILURE);
+
+  if (RKADK_JOURNAL_SnapshotTake(pstJournal, pstCatalog, &stSnap)) {
+    pstJournal->u32RecordNum = 0;
+    return -1;
+  }
+
+  // nothing can be appended meanwhile, a failed write is seen by the commit
+  RKADK_JOURNAL_SnapshotWrite(&stSnap);
+  ret = RKADK_JOURNAL_SnapshotCommit(pstJournal, &stSnap);
+  RKADK_JOURNAL_SnapshotFree(&stSnap);
+  return ret;
+}
+
+RKADK_S32 RKADK_JOURNAL_Open(RKADK_JOURNAL_S *pstJournal,
+                             RKADK_CATALOG_S *pstCatalog) {
+  RKADK_CHECK_POINTER(pstJournal, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstCatalog, RKADK_FAILURE);
+
+  if (pstJournal->s32Fd >= 0)
+    return 0;
+
+  if (!pstJournal->validLen)
+    return RKADK_JOURNAL_Compact(pstJournal, pstCatalog) ? -1 : 1;
+
+  pstJournal->s32Fd = open(pstJournal->path, O_WRONLY | O_APPEND);
+  if (pstJournal->s32Fd < 0) {
+    RKADK_LOGE("open %s failed: %s", pstJournal->path, strerror(errno));
+    return -1;
+  }
+
+  // drop a torn tail so that appends stay aligned to records
+  if (ftruncate(pstJournal->s32Fd, pstJournal->validLen))
+    RKADK_LOGW("truncate %s failed: %s", pstJournal->path, strerror(errno));
+
+  return 0;
+}
+
+RKADK_VOID RKADK_JOURNAL_Close(RKADK_JOURNAL_S *pstJournal) {
+  if (!pstJournal || pstJournal->s32Fd < 0)
+    return;
+
+  close(pstJournal->s32Fd);
+  pstJournal->s32Fd = -1;
+}
+
+RKADK_S32 RKADK_JOURNAL_Append(RKADK_JOURNAL_S *pstJournal,
+                               RKADK_CATALOG_S *pstCatalog,
+                               RKADK_JOURNAL_OP_E enOp,
+                               const RKADK_CHAR *filename) {
+  RKADK_CATALOG_FILE_S *pstFile = NULL;
+  RKADK_JOURNAL_RECORD_S stRecord;
+
+  RKADK_CHECK_POINTER(pstJournal, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(pstCatalog, RKADK_FAILURE);
+  RKADK_CHECK_POINTER(filename, RKADK_FAILURE);
+
+  if (pstJournal->s32Fd < 0)
+    return 0;
+
+  if (enOp == RKADK_JOURNAL_OP_ADD) {
+    pstFile = RKADK_CATALOG_Find(pstCatalog, filename);
+    if (!pstFile)
+      return -1;
+  }
+
+  if (RKADK_JOURNAL_FillRecord(&stRecord, enOp, filename, pstFile))
+    return -1;
+
+  if (RKADK_JOURNAL_Write(pstJournal->s32Fd, &stRecord, sizeof(stRecord))) {
+    RKADK_LOGE("append %s failed: %s", pstJournal->path, strerror(errno));
+    // a partial record would hide every later one from the next load
+    if (ftruncate(pstJournal->s32Fd, pstJournal->validLen))
+      RKADK_LOGE("truncate %s failed", pstJournal->path);
+    return -1;
+  }
+
+  pstJournal->u32RecordNum++;
+  pstJournal->validLen += sizeof(stRecord);
+  return 0;
+}
+
+RKADK_BOOL RKADK_JOURNAL_CompactDue(RKADK_JOURNAL_S *pstJournal) {
+  if (!pstJournal || pstJournal->s32Fd < 0)
+    return RKADK_FALSE;
+
+  return pstJournal->u32RecordNum >= RKADK_JOURNAL_COMPACT_MIN &&
+         pstJournal->u32RecordNum >= pstJournal->u32SnapshotNum;
+}
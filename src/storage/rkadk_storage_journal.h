@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2022 Rockchip, Inc. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef __RKADK_STORAGE_JOURNAL_H__
+#define __RKADK_STORAGE_JOURNAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rkadk_common.h"
+#include "rkadk_storage_catalog.h"
+#include <stdbool.h>
+
+/*
+ * On-card copy of a folder catalog: a snapshot of fixed-size records followed
+ * by an append-only journal of add/delete records, each with a crc32.
+ * A torn record at the end is dropped on load. When the journal outgrows the
+ * snapshot it is compacted into a new snapshot, written aside and renamed.
+ * Callers serialize with the folder mutex, like the catalog, except for
+ * RKADK_JOURNAL_SnapshotWrite, which runs without it.
+ */
+
+#define RKADK_JOURNAL_VERSION 1
+
+/* longest filename that can be journaled, longer ones are only found by scans */
+#define RKADK_JOURNAL_NAME_LEN 96
+
+/* journal records before a compaction is considered */
+#define RKADK_JOURNAL_COMPACT_MIN 1024
+
+typedef enum {
+  RKADK_JOURNAL_OP_ADD = 1,
+  RKADK_JOURNAL_OP_DEL,
+} RKADK_JOURNAL_OP_E;
+
+typedef struct {
+  RKADK_CHAR path[2 * RKADK_MAX_FILE_PATH_LEN];
+  RKADK_S32 s32Fd;         /* append fd, -1 until opened */
+  RKADK_U32 u32SnapshotNum;
+  RKADK_U32 u32RecordNum;  /* journal records after the snapshot */
+  off_t validLen;          /* length that loaded cleanly, 0 if none */
+} RKADK_JOURNAL_S;
+
+/* a compaction in three steps, only the write is done without the lock */
+typedef struct {
+  RKADK_CHAR path[2 * RKADK_MAX_FILE_PATH_LEN];
+  RKADK_S32 s32Fd;         /* the new file, written aside */
+  RKADK_U32 u32Num;        /* snapshot records */
+  RKADK_VOID *pRecord;
+  off_t markLen;           /* journal length the snapshot covers */
+} RKADK_JOURNAL_SNAPSHOT_S;
+
+RKADK_VOID RKADK_JOURNAL_Init(RKADK_JOURNAL_S *pstJournal,
+                              const RKADK_CHAR *path);
+
+/**
+ * @brief replay the snapshot and the journal into an empty catalog
+ *
+ * @return number of files loaded, -1 if the file is missing or invalid
+ */
+RKADK_S32 RKADK_JOURNAL_Load(RKADK_JOURNAL_S *pstJournal,
+                             RKADK_CATALOG_S *pstCatalog);
+
+/**
+ * @brief open for appending, the catalog is written as a new snapshot
+ * when nothing valid was loaded
+ *
+ * @return 0: appending to the loaded file, 1: compacted, -1: failure
+ */
+RKADK_S32 RKADK_JOURNAL_Open(RKADK_JOURNAL_S *pstJournal,
+                             RKADK_CATALOG_S *pstCatalog);
+
+RKADK_VOID RKADK_JOURNAL_Close(RKADK_JOURNAL_S *pstJournal);
+
+/**
+ * @brief record that a file was added (or updated) or deleted
+ *
+ * An add record is taken from the catalog entry of the file. Does nothing
+ * until the journal is opened. Never compacts, see RKADK_JOURNAL_CompactDue.
+ */
+RKADK_S32 RKADK_JOURNAL_Append(RKADK_JOURNAL_S *pstJournal,
+                               RKADK_CATALOG_S *pstCatalog,
+                               RKADK_JOURNAL_OP_E enOp,
+                               const RKADK_CHAR *filename);
+
+/* the journal has outgrown its snapshot */
+RKADK_BOOL RKADK_JOURNAL_CompactDue(RKADK_JOURNAL_S *pstJournal);
+
+/* compact in place, the three steps below with the lock held throughout */
+RKADK_S32 RKADK_JOURNAL_Compact(RKADK_JOURNAL_S *pstJournal,
+                                RKADK_CATALOG_S *pstCatalog);
+
+/**
+ * @brief copy the catalog into memory as the records of a new snapshot
+ *
+ * @return 0 on success, pstSnap is released with RKADK_JOURNAL_SnapshotFree
+ */
+RKADK_S32 RKADK_JOURNAL_SnapshotTake(RKADK_JOURNAL_S *pstJournal,
+                                     RKADK_CATALOG_S *pstCatalog,
+                                     RKADK_JOURNAL_SNAPSHOT_S *pstSnap);
+
+/* write the snapshot aside, without the folder mutex */
+RKADK_S32 RKADK_JOURNAL_SnapshotWrite(RKADK_JOURNAL_SNAPSHOT_S *pstSnap);
+
+/**
+ * @brief copy the records appended since the take, then replace the journal
+ *
+ * A failed take-to-commit is retried after another RKADK_JOURNAL_COMPACT_MIN
+ * appends.
+ */
+RKADK_S32 RKADK_JOURNAL_SnapshotCommit(RKADK_JOURNAL_S *pstJournal,
+                                       RKADK_JOURNAL_SNAPSHOT_S *pstSnap);
+
+RKADK_VOID RKADK_JOURNAL_SnapshotFree(RKADK_JOURNAL_SNAPSHOT_S *pstSnap);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -250,7 +250,8 @@ static int RKADK_STREAM_SetVencAttr(RKADK_U32 u32CamId,
   pstVencAttr->stVencAttr.u32VirWidth = pstStreamCfg->attribute.width;
   pstVencAttr->stVencAttr.u32VirHeight = pstStreamCfg->attribute.height;
   pstVencAttr->stVencAttr.u32Profile = pstStreamCfg->attribute.profile;
-  pstVencAttr->stVencAttr.u32StreamBufCnt = RKADK_PARAM_GetStreamBufCnt(u32CamId, false);
+  pstVencAttr->stVencAttr.u32StreamBufCnt =
+      RKADK_PARAM_GetVencStreamBufCnt(u32CamId, pstStreamCfg->attribute.venc_chn);
   pstVencAttr->stVencAttr.u32BufSize = pstStreamCfg->attribute.bufsize;
 
   return 0;
@@ -260,6 +261,7 @@ static RKADK_S32 RKADK_STREAM_VencGetData(RKADK_U32 u32CamId,
                                           MPP_CHN_S *pstVencChn,
                                           STREAM_VIDEO_HANDLE_S *pHandle) {
   int ret = 0;
+  RKADK_MEDIA_QUEUE_ATTR_S stQueueAttr;
 
   VENC_RECV_PIC_PARAM_S stRecvParam;
   stRecvParam.s32RecvPicNum = -1;
@@ -269,9 +271,15 @@ static RKADK_S32 RKADK_STREAM_VencGetData(RKADK_U32 u32CamId,
     return ret;
   }
 
-  ret = RKADK_MEDIA_GetVencBuffer(pstVencChn, RKADK_STREAM_VencOutCb, pHandle);
+  // a muxed venc keeps its gop cached, VencStart replays it
+  memset(&stQueueAttr, 0, sizeof(RKADK_MEDIA_QUEUE_ATTR_S));
+  stQueueAttr.enOverflow = RKADK_MEDIA_QUEUE_DROP_TO_IDR;
+  stQueueAttr.bGopCache = pHandle->bVencChnMux;
+  stQueueAttr.bNoRequestIDR = pHandle->bVencChnMux;
+  ret = RKADK_MEDIA_GetVencBufferEx(pstVencChn, RKADK_STREAM_VencOutCb, pHandle,
+                                    &stQueueAttr);
   if (ret) {
-    RKADK_LOGE("RKADK_MEDIA_GetVencBuffer failed[%x]", ret);
+    RKADK_LOGE("RKADK_MEDIA_GetVencBufferEx failed[%x]", ret);
     return ret;
   }
 
@@ -570,12 +578,21 @@ RKADK_S32 RKADK_STREAM_VencStart(RKADK_MW_PTR pHandle, RKADK_S32 s32FrameCnt) {
   }
 
   pstHandle->start = true;
-  pstHandle->bRequestIDR = false;
+  // a muxed venc starts from the cached gop instead of a forced IDR
+  pstHandle->bRequestIDR = pstHandle->bVencChnMux;
   pstHandle->bWaitIDR = false;
 
   // multiplex venc chn, thread get mediabuffer
-  if (pstHandle->bVencChnMux)
+  if (pstHandle->bVencChnMux) {
+    MPP_CHN_S stVencChn;
+
+    stVencChn.enModId = RK_ID_VENC;
+    stVencChn.s32DevId = 0;
+    stVencChn.s32ChnId = pstStreamCfg->attribute.venc_chn;
+    if (RKADK_MEDIA_ReplayVencGop(&stVencChn, RKADK_STREAM_VencOutCb, pstHandle))
+      pstHandle->bRequestIDR = false;
     return 0;
+  }
 
   VENC_RECV_PIC_PARAM_S stRecvParam;
   stRecvParam.s32RecvPicNum = s32FrameCnt;